@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
 #include <math.h>
 
 #include "chipmunk.h"
@@ -49,6 +51,15 @@ static void add_box(int i, cpFloat size){
 	shape->e = 0.0f; shape->u = 0.9f;
 }
 
+static void add_pooled_box(int i, cpFloat size){
+	cpFloat mass = size*size/100.0f;
+	cpBody *body = cpSpaceAddBody(space, cpSpaceNewBody(space, mass, cpMomentForBox(mass, size, size)));
+	body->p = cpvmult(frand_unit_circle(), 180.0f);
+	
+	cpShape *shape = cpSpaceAddShape(space, cpSpaceNewBoxShape(space, body, size, size));
+	shape->e = 0.0f; shape->u = 0.9f;
+}
+
 static void add_hexagon(int i, cpFloat radius){
 	cpVect hexagon[6] = {};
 	for(int i=0; i<6; i++){
@@ -122,6 +133,33 @@ static cpSpace *init_SimpleTerrainBoxes_100(){
 	return space;
 }
 
+// Same as SimpleTerrainBoxes_1000, but with half the iterations using the block solver.
+static cpSpace *init_SimpleTerrainBoxesBlock_1000(){
+	setupSpace_simpleTerrain();
+	space->iterations = 5;
+	space->enableBlockSolver = cpTrue;
+	for(int i=0; i<1000; i++) add_box(i, 10.0f);
+	
+	return space;
+}
+
+// Same as SimpleTerrainBoxes_1000, but reusing the contacts of resting boxes.
+static cpSpace *init_SimpleTerrainBoxesReuse_1000(){
+	setupSpace_simpleTerrain();
+	space->contactReuseTolerance = 0.05f;
+	for(int i=0; i<1000; i++) add_box(i, 10.0f);
+	
+	return space;
+}
+
+// Same as SimpleTerrainBoxes_1000, but with the bodies and shapes allocated from the space's pools.
+static cpSpace *init_SimpleTerrainBoxesPooled_1000(){
+	setupSpace_simpleTerrain();
+	for(int i=0; i<1000; i++) add_pooled_box(i, 10.0f);
+	
+	return space;
+}
+
 static cpSpace *init_SimpleTerrainHexagons_1000(){
 	setupSpace_simpleTerrain();
 	for(int i=0; i<1000; i++) add_hexagon(i, 5.0f);
@@ -171,6 +209,84 @@ static cpSpace *init_SimpleTerrainVHexagons_200(){
 }
 
 
+// SimpleTerrain as a single mesh shape
+static void setupSpace_simpleTerrainMesh(){
+	space = cpSpaceNew();
+	space->iterations = 10;
+	space->gravity = cpv(0, -100);
+	space->collisionSlop = 0.5f;
+	
+	cpVect offset = cpv(-320, -240);
+	cpVect verts[simple_terrain_count];
+	for(int i=0; i<simple_terrain_count; i++) verts[i] = cpvadd(simple_terrain_verts[i], offset);
+	
+	cpSpaceAddShape(space, cpMeshShapeNewPolyline(space->staticBody, simple_terrain_count, verts, 0.0f));
+}
+
+static cpSpace *init_SimpleTerrainMeshCircles_1000(){
+	setupSpace_simpleTerrainMesh();
+	for(int i=0; i<1000; i++) add_circle(i, 5.0f);
+	
+	return space;
+}
+
+static cpSpace *init_SimpleTerrainMeshBoxes_1000(){
+	setupSpace_simpleTerrainMesh();
+	for(int i=0; i<1000; i++) add_box(i, 10.0f);
+	
+	return space;
+}
+
+static cpSpace *init_SimpleTerrainMeshHexagons_1000(){
+	setupSpace_simpleTerrainMesh();
+	for(int i=0; i<1000; i++) add_hexagon(i, 5.0f);
+	
+	return space;
+}
+
+
+// TileMap
+static void setupSpace_tileMap(){
+	space = cpSpaceNew();
+	space->iterations = 10;
+	space->gravity = cpv(0, -100);
+	space->collisionSlop = 0.5f;
+	
+	// A 40x30 grid of 16x16 tiles with walls, a floor and a few steps.
+	int width = 40, height = 30;
+	unsigned char tiles[40*30] = {};
+	for(int y=0; y<height; y++){
+		for(int x=0; x<width; x++){
+			int steps = abs(x - width/2)/4;
+			tiles[x + y*width] = (x < 2 || x >= width - 2 || y < 2 + steps);
+		}
+	}
+	
+	cpSpaceAddShape(space, cpTileMapShapeNew(space->staticBody, width, height, 16.0f, cpv(-320, -240), tiles));
+}
+
+static cpSpace *init_TileMapCircles_1000(){
+	setupSpace_tileMap();
+	for(int i=0; i<1000; i++) add_circle(i, 5.0f);
+	
+	return space;
+}
+
+static cpSpace *init_TileMapBoxes_1000(){
+	setupSpace_tileMap();
+	for(int i=0; i<1000; i++) add_box(i, 10.0f);
+	
+	return space;
+}
+
+static cpSpace *init_TileMapHexagons_1000(){
+	setupSpace_tileMap();
+	for(int i=0; i<1000; i++) add_hexagon(i, 5.0f);
+	
+	return space;
+}
+
+
 // ComplexTerrain
 static cpVect complex_terrain_verts[] = {
 	{ 46.78, 479.00}, { 35.00, 475.63}, { 27.52, 469.00}, { 23.52, 455.00}, { 23.78, 441.00}, { 28.41, 428.00}, { 49.61, 394.00}, { 59.00, 381.56}, { 80.00, 366.03}, { 81.46, 358.00}, { 86.31, 350.00}, { 77.74, 320.00},
@@ -414,6 +530,228 @@ static cpSpace *init_NoCollide(){
 }
 
 
+// Bullets
+
+static void setupSpace_bullets(cpBool ccd){
+	space = cpSpaceNew();
+	space->iterations = 10;
+	space->gravity = cpv(0, -100);
+	
+	// Thin walls that fast bullets would normally tunnel through.
+	cpSpaceAddShape(space, cpSegmentShapeNew(space->staticBody, cpv(-320, -240), cpv( 320, -240), 0.0f))->u = 0.9f;
+	cpSpaceAddShape(space, cpSegmentShapeNew(space->staticBody, cpv( 320, -240), cpv( 320,  240), 0.0f))->e = 0.5f;
+	cpSpaceAddShape(space, cpSegmentShapeNew(space->staticBody, cpv( 320,  240), cpv(-320,  240), 0.0f))->e = 0.5f;
+	cpSpaceAddShape(space, cpSegmentShapeNew(space->staticBody, cpv(-320,  240), cpv(-320, -240), 0.0f))->e = 0.5f;
+	
+	for(int i=0; i<200; i++) add_box(i, 10.0f);
+	
+	for(int i=0; i<100; i++){
+		cpFloat radius = 2.0f;
+		cpFloat mass = 0.1f;
+		cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForCircle(mass, 0.0f, radius, cpvzero)));
+		body->p = cpv(-300.0f + 6.0f*i, 220.0f);
+		body->v = cpvmult(frand_unit_circle(), 3000.0f);
+		body->enableCCD = ccd;
+		
+		cpShape *shape = cpSpaceAddShape(space, cpCircleShapeNew(body, radius, cpvzero));
+		shape->e = 0.5f; shape->u = 0.5f;
+	}
+}
+
+static cpSpace *init_BulletsCCD_100(){
+	setupSpace_bullets(cpTrue);
+	return space;
+}
+
+static cpSpace *init_BulletsSubstep_100(){
+	setupSpace_bullets(cpFalse);
+	return space;
+}
+
+// Global substepping to keep most of the bullets from tunneling without CCD.
+static void update_substep(int ticks){
+	int steps = 16;
+	for(int i=0; i<steps; i++) cpSpaceStep(space, 1.0f/60.0f/steps);
+}
+
+
+// Constraints
+
+// Hanging chains of pivot joints braced with damped springs, added in an interleaved order.
+static cpSpace *init_PivotSpringChains_4000(){
+	space = cpSpaceNew();
+	space->iterations = 10;
+	space->gravity = cpv(0, -100);
+	
+	for(int i=0; i<40; i++){
+		cpBody *prev = space->staticBody;
+		cpVect anchor = cpv(-312.0f + 16.0f*i, 240.0f);
+		
+		for(int j=0; j<50; j++){
+			cpFloat mass = 1.0f;
+			cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForCircle(mass, 0.0f, 2.0f, cpvzero)));
+			body->p = cpvadd(anchor, cpv(8.0f, -8.0f*(j + 1)));
+			
+			cpSpaceAddConstraint(space, cpPivotJointNew(prev, body, cpvadd(anchor, cpv(0.0f, -8.0f*j))));
+			cpSpaceAddConstraint(space, cpDampedSpringNew(prev, body, cpvzero, cpvzero, 8.0f, 100.0f, 1.0f));
+			
+			prev = body;
+		}
+	}
+	
+	return space;
+}
+
+
+// Hanging pivot joint chains with heavy weights at the ends.
+static void setupSpace_heavyChains(){
+	space = cpSpaceNew();
+	space->gravity = cpv(0, -100);
+	
+	for(int i=0; i<40; i++){
+		cpBody *prev = space->staticBody;
+		cpVect anchor = cpv(-312.0f + 16.0f*i, 240.0f);
+		
+		for(int j=0; j<50; j++){
+			cpFloat mass = (j == 49 ? 10.0f : 1.0f);
+			cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForCircle(mass, 0.0f, 2.0f, cpvzero)));
+			body->p = cpvadd(anchor, cpv(4.0f*(j + 1), -8.0f*(j + 1)));
+			
+			cpSpaceAddConstraint(space, cpPivotJointNew2(prev, body, (j == 0 ? anchor : cpvzero), cpv(-4.0f, 8.0f)));
+			prev = body;
+		}
+	}
+}
+
+static cpSpace *init_HeavyChains_2000(){
+	setupSpace_heavyChains();
+	space->iterations = 10;
+	
+	return space;
+}
+
+static cpSpace *init_HeavyChainsDirect_2000(){
+	setupSpace_heavyChains();
+	space->iterations = 2;
+	space->enableDirectSolver = cpTrue;
+	
+	return space;
+}
+
+
+// Replication
+
+// Streams the bodies of the benchmark space to a clone of it as if it was a client that acknowledges every stream.
+// The bytes per tick and the time spent encoding are printed when the benchmark ends.
+static struct {
+	cpSpace *client;
+	cpReplicationEncoder *encoder;
+	cpReplicationDecoder *decoder;
+	cpTimestamp baseline;
+	
+	size_t bytes;
+	clock_t encodeTime;
+	int ticks;
+	
+	unsigned char buffer[512*1024];
+} replication;
+
+// Boxes spread along the floor that the sleeping benchmark kicks.
+static cpBody *kickedBoxes[5];
+
+static void add_replicated_body(cpBody *body, unsigned int *id){
+	cpReplicationEncoderAddBody(replication.encoder, body, *id);
+	cpReplicationDecoderAddBody(replication.decoder, cpSpaceGetClonedBody(replication.client, body), *id);
+	(*id)++;
+}
+
+static void setup_replication(){
+	replication.client = cpSpaceClone(space);
+	replication.encoder = cpReplicationEncoderNew(space, 1.0f/64.0f, 1.0f/64.0f);
+	replication.decoder = cpReplicationDecoderNew(replication.client);
+	replication.baseline = 0;
+	
+	replication.bytes = 0;
+	replication.encodeTime = 0;
+	replication.ticks = 0;
+	
+	unsigned int id = 0;
+	cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)add_replicated_body, &id);
+}
+
+// 10000 boxes spread out in rows over a wide floor so they settle without forming one big pile.
+static void setupSpace_replication(cpFloat gravity, cpBool sleeping){
+	space = cpSpaceNew();
+	space->iterations = 5;
+	space->gravity = cpv(0, gravity);
+	space->sleepTimeThreshold = 0.5f;
+	
+	cpSpaceAddShape(space, cpSegmentShapeNew(space->staticBody, cpv(-70000, 0), cpv(70000, 0), 0.0f))->u = 1.0f;
+	
+	for(int i=0; i<10000; i++){
+		cpFloat mass = 1.0f;
+		cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForBox(mass, 10.0f, 10.0f)));
+		
+		if(sleeping){
+			// Resting on the floor, far enough apart that each box sleeps on its own.
+			body->p = cpv(-60000.0f + 12.0f*i, 5.0f);
+		} else {
+			body->p = cpv(-60000.0f + 120.0f*(i%1000) + 3.0f*(i/1000%2), 10.0f + 12.0f*(i/1000));
+			if(gravity == 0.0f) body->v = cpvmult(frand_unit_circle(), 20.0f);
+		}
+		
+		cpShape *shape = cpSpaceAddShape(space, cpBoxShapeNew(body, 10.0f, 10.0f));
+		shape->e = 0.0f; shape->u = 0.7f;
+		
+		if(sleeping){
+			cpBodySleep(body);
+			if(i%2000 == 0) kickedBoxes[i/2000] = body;
+		}
+	}
+}
+
+// Rows of boxes falling onto the floor and going to sleep as they settle.
+static cpSpace *init_ReplicationSettling_10000(){
+	setupSpace_replication(-100.0f, cpFalse);
+	setup_replication();
+	return space;
+}
+
+// Boxes drifting in zero gravity, every body changes on every tick.
+static cpSpace *init_ReplicationMoving_10000(){
+	setupSpace_replication(0.0f, cpFalse);
+	setup_replication();
+	return space;
+}
+
+// Every box is asleep except for a few that are kicked once a second.
+static cpSpace *init_ReplicationSleeping_10000(){
+	setupSpace_replication(-100.0f, cpTrue);
+	setup_replication();
+	return space;
+}
+
+static void update_replication(int ticks){
+	cpSpaceStep(space, 1.0f/60.0f);
+	
+	clock_t start = clock();
+	size_t bytes = cpReplicationEncode(replication.encoder, replication.baseline, replication.buffer, sizeof(replication.buffer));
+	replication.encodeTime += clock() - start;
+	
+	replication.bytes += bytes;
+	replication.ticks++;
+	
+	if(bytes <= sizeof(replication.buffer)) replication.baseline = cpReplicationDecode(replication.decoder, replication.buffer, bytes);
+}
+
+static void update_replicationSleeping(int ticks){
+	if(ticks%60 == 0){
+		for(int i=0; i<5; i++) cpBodyApplyImpulse(kickedBoxes[i], cpv(0.0f, 200.0f), cpvzero);
+	}
+	
+	update_replication(ticks);
+}
+
 // TODO ideas:
 // addition/removal
 // Memory usage? (too small to matter?)
@@ -430,6 +768,18 @@ static void destroy(void){
 	cpSpaceFree(space);
 }
 
+static void destroy_replication(void){
+	printf("%8.0f bytes/tick, %6.3f ms/tick encoding\n",
+		(double)replication.bytes/replication.ticks, 1000.0*replication.encodeTime/CLOCKS_PER_SEC/replication.ticks
+	);
+	
+	cpReplicationEncoderFree(replication.encoder);
+	cpReplicationDecoderFree(replication.decoder);
+	cpSpaceFree(replication.client);
+	
+	destroy();
+}
+
 // Make a second demo declaration for this demo to use in the regular demo set.
 ChipmunkDemo BouncyHexagons = {
 	"Bouncy Hexagons",
@@ -447,17 +797,34 @@ ChipmunkDemo bench_list[] = {
 	BENCH(SimpleTerrainBoxes_1000),
 	BENCH(SimpleTerrainBoxes_500),
 	BENCH(SimpleTerrainBoxes_100),
+	BENCH(SimpleTerrainBoxesBlock_1000),
+	BENCH(SimpleTerrainBoxesReuse_1000),
+	BENCH(SimpleTerrainBoxesPooled_1000),
 	BENCH(SimpleTerrainHexagons_1000),
 	BENCH(SimpleTerrainHexagons_500),
 	BENCH(SimpleTerrainHexagons_100),
 	BENCH(SimpleTerrainVCircles_200),
 	BENCH(SimpleTerrainVBoxes_200),
 	BENCH(SimpleTerrainVHexagons_200),
+	BENCH(SimpleTerrainMeshCircles_1000),
+	BENCH(SimpleTerrainMeshBoxes_1000),
+	BENCH(SimpleTerrainMeshHexagons_1000),
+	BENCH(TileMapCircles_1000),
+	BENCH(TileMapBoxes_1000),
+	BENCH(TileMapHexagons_1000),
 	BENCH(ComplexTerrainCircles_1000),
 	BENCH(ComplexTerrainHexagons_1000),
 	BENCH(BouncyTerrainCircles_500),
 	BENCH(BouncyTerrainHexagons_500),
 	BENCH(NoCollide),
+	BENCH(PivotSpringChains_4000),
+	BENCH(HeavyChains_2000),
+	BENCH(HeavyChainsDirect_2000),
+	BENCH(BulletsCCD_100),
+	{"benchmark - BulletsSubstep_100", init_BulletsSubstep_100, update_substep, ChipmunkDemoDefaultDrawImpl, destroy},
+	{"benchmark - ReplicationSettling_10000", init_ReplicationSettling_10000, update_replication, ChipmunkDemoDefaultDrawImpl, destroy_replication},
+	{"benchmark - ReplicationMoving_10000", init_ReplicationMoving_10000, update_replication, ChipmunkDemoDefaultDrawImpl, destroy_replication},
+	{"benchmark - ReplicationSleeping_10000", init_ReplicationSleeping_10000, update_replicationSleeping, ChipmunkDemoDefaultDrawImpl, destroy_replication},
 };
 
 int bench_count = sizeof(bench_list)/sizeof(ChipmunkDemo);
@@ -76,7 +76,7 @@ waterPreSolve(cpArbiter *arb, cpSpace *space, void *ptr)
 		}
 	}
 	
-	cpFloat area = cpfabs(cpAreaForPoly(count, ((cpPolyShape *)poly)->tVerts));
+	cpFloat area = cpfabs(cpAreaForPoly(count, ((cpPolyShape *)poly)->verts));
 	cpFloat clippedArea = cpfabs(cpAreaForPoly(clippedCount, clipped));
 	cpVect r = cpvsub(cpCentroidForPoly(clippedCount, clipped), body->p);
 	
@@ -29,8 +29,6 @@ static cpSpace *space;
 
 #define CHAIN_COUNT 8
 #define LINK_COUNT 10
-#define JOINT_COUNT (CHAIN_COUNT*LINK_COUNT)
-cpConstraint *breakableJoints[JOINT_COUNT] = {};
 
 static void
 update(int ticks)
@@ -41,21 +39,10 @@ update(int ticks)
 	for(int i=0; i<steps; i++){
 		cpSpaceStep(space, dt);
 		
-		for(int i=0; i<JOINT_COUNT; i++){
-			cpConstraint *joint = breakableJoints[i];
-			if(joint == NULL) continue;
-			
-			// Convert the impulse to a force by dividing it by the timestep.
-			cpFloat force = cpConstraintGetImpulse(joint)/dt;
-			cpFloat maxForce = cpConstraintGetMaxForce(joint);
-
-			// If the force is almost as big as the joint's max force, break it.
-			if(force > 0.9*maxForce){
-				cpSpaceRemoveConstraint(space, joint);
-				cpConstraintFree(joint);
-				breakableJoints[i] = NULL;
-			}
-		}
+		// Free the joints that broke during the step.
+		// The space has already removed them.
+		cpConstraint *joint;
+		while((joint = cpSpacePopBrokenConstraint(space))) cpConstraintFree(joint);
 	}
 }
 
@@ -120,7 +107,10 @@ init(void)
 			}
 			
 			cpConstraintSetMaxForce(constraint, breakingForce);
-			breakableJoints[i + j*CHAIN_COUNT] = constraint;
+			
+			// If the force is almost as big as the joint's max force, break it.
+			// Convert the force to an impulse by multiplying it by the timestep used in update().
+			cpConstraintSetBreakImpulse(constraint, 0.9f*breakingForce/180.0f);
 			
 			prev = body;
 		}
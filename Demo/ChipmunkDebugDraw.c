@@ -281,10 +281,9 @@ void ChipmunkDebugDrawBB(cpBB bb, Color color)
 }
 
 static void
-drawShape(cpShape *shape, void *unused)
+drawShapeWithColor(cpShape *shape, Color color)
 {
 	cpBody *body = shape->body;
-	Color color = ColorForShape(shape);
 	
 	switch(shape->klass->type){
 		case CP_CIRCLE_SHAPE: {
@@ -299,13 +298,40 @@ drawShape(cpShape *shape, void *unused)
 		}
 		case CP_POLY_SHAPE: {
 			cpPolyShape *poly = (cpPolyShape *)shape;
+			cpPolyShapeCacheTransform(poly);
 			ChipmunkDebugDrawPolygon(poly->numVerts, poly->tVerts, LINE_COLOR, color);
 			break;
 		}
+		case CP_MESH_SHAPE: {
+			for(int i=0, count=cpMeshShapeGetNumChildren(shape); i<count; i++){
+				drawShapeWithColor(cpMeshShapeGetChild(shape, i), color);
+			}
+			break;
+		}
+		case CP_TILEMAP_SHAPE: {
+			for(int y=0, height=cpTileMapShapeGetHeight(shape); y<height; y++){
+				for(int x=0, width=cpTileMapShapeGetWidth(shape); x<width; x++){
+					if(!cpTileMapShapeGetTile(shape, x, y)) continue;
+					
+					cpBB bb = cpTileMapShapeGetTileBB(shape, x, y);
+					cpVect verts[] = {cpv(bb.l, bb.b), cpv(bb.l, bb.t), cpv(bb.r, bb.t), cpv(bb.r, bb.b)};
+					for(int i=0; i<4; i++) verts[i] = cpBodyLocal2World(body, verts[i]);
+					
+					ChipmunkDebugDrawPolygon(4, verts, LINE_COLOR, color);
+				}
+			}
+			break;
+		}
 		default: break;
 	}
 }
 
+static void
+drawShape(cpShape *shape, void *unused)
+{
+	drawShapeWithColor(shape, ColorForShape(shape));
+}
+
 void ChipmunkDebugDrawShapes(cpSpace *space)
 {
 	cpSpaceEachShape(space, drawShape, NULL);
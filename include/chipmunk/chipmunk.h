@@ -63,6 +63,11 @@ void cpMessage(const char *message, const char *condition, const char *file, int
 	#define CP_BUFFER_BYTES (32*1024)
 #endif
 
+// Collision handlers are looked up in a dense table when all of their collision types are less than this.
+#ifndef CP_HANDLER_TABLE_TYPES
+	#define CP_HANDLER_TABLE_TYPES 64
+#endif
+
 // Chipmunk memory function aliases.
 #ifndef cpcalloc
 	#define cpcalloc calloc
@@ -76,8 +81,46 @@ void cpMessage(const char *message, const char *condition, const char *file, int
 	#define cpfree free
 #endif
 
+/// Memory allocation callbacks.
+/// A space created with cpSpaceNewWithAllocator() requests all of the memory it owns through its allocator.
+/// This includes its arrays, hash sets, spatial indexes, contact buffers and pools.
+typedef struct cpAllocator {
+	/// Allocate @c count zeroed elements of @c size bytes each like calloc().
+	void *(*allocFunc)(void *data, size_t count, size_t size);
+	/// Resize a block of memory like realloc(). @c ptr may be NULL.
+	void *(*reallocFunc)(void *data, void *ptr, size_t size);
+	/// Release a block of memory like free(). @c ptr may be NULL.
+	void (*freeFunc)(void *data, void *ptr);
+	/// User data passed to each of the callbacks.
+	void *data;
+} cpAllocator;
+
+/// Allocator that forwards to cpcalloc(), cprealloc() and cpfree().
+extern const cpAllocator cpDefaultAllocator;
+
+/// Memory held by a pool of equally sized blocks.
+typedef struct cpPoolStats {
+	/// Bytes allocated for the pool.
+	size_t bytes;
+	/// Bytes of the pool that are not in use.
+	/// cpSpaceTrimMemory() can release them once a whole buffer of the pool is unused.
+	size_t unusedBytes;
+} cpPoolStats;
+
+/// Memory used by one kind of object.
+typedef struct cpMemoryStats {
+	/// Bytes allocated for the objects, including the unused pooled ones.
+	size_t bytes;
+	/// Number of objects in use.
+	int count;
+	/// Number of allocated objects waiting in a pool to be reused.
+	int pooled;
+} cpMemoryStats;
+
 typedef struct cpArray cpArray;
 typedef struct cpHashSet cpHashSet;
+typedef struct cpSnapshotCursor cpSnapshotCursor;
+typedef struct cpRelocation cpRelocation;
 
 typedef struct cpBody cpBody;
 typedef struct cpShape cpShape;
@@ -95,11 +138,14 @@ typedef struct cpSpace cpSpace;
 #include "cpBody.h"
 #include "cpShape.h"
 #include "cpPolyShape.h"
+#include "cpMeshShape.h"
+#include "cpTileMapShape.h"
 
 #include "cpArbiter.h"	
 #include "constraints/cpConstraint.h"
 
 #include "cpSpace.h"
+#include "cpReplication.h"
 
 #define CP_VERSION_MAJOR 6
 #define CP_VERSION_MINOR 0
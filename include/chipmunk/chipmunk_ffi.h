@@ -96,6 +96,7 @@ MAKE_REF(cpConstraintGetB);
 MAKE_PROPERTIES_REF(cpConstraint, MaxForce);
 MAKE_PROPERTIES_REF(cpConstraint, ErrorBias);
 MAKE_PROPERTIES_REF(cpConstraint, MaxBias);
+MAKE_PROPERTIES_REF(cpConstraint, BreakImpulse);
 MAKE_PROPERTIES_REF(cpConstraint, UserData);
 MAKE_REF(cpConstraintGetImpulse);
 
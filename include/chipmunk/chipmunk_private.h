@@ -19,20 +19,94 @@
  * SOFTWARE.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #define CP_ALLOW_PRIVATE_ACCESS 1
 #include "chipmunk.h"
 
 #define CP_HASH_COEF (3344921057ul)
 #define CP_HASH_PAIR(A, B) ((cpHashValue)(A)*CP_HASH_COEF ^ (cpHashValue)(B)*CP_HASH_COEF)
 
+#pragma mark cpAllocator
+
+// A NULL allocator stands for cpDefaultAllocator.
+static inline void *
+cpAllocatorCalloc(const cpAllocator *allocator, size_t count, size_t size)
+{
+	return (allocator ? allocator->allocFunc(allocator->data, count, size) : cpcalloc(count, size));
+}
+
+static inline void *
+cpAllocatorRealloc(const cpAllocator *allocator, void *ptr, size_t size)
+{
+	return (allocator ? allocator->reallocFunc(allocator->data, ptr, size) : cprealloc(ptr, size));
+}
+
+static inline void
+cpAllocatorFree(const cpAllocator *allocator, void *ptr)
+{
+	if(allocator) allocator->freeFunc(allocator->data, ptr); else cpfree(ptr);
+}
+
+#pragma mark Snapshots
+
+// Snapshots are saved and restored by the same functions, the cursor decides which way the bytes are copied.
+// Bytes that don't fit in the buffer while saving are only counted.
+struct cpSnapshotCursor {
+	char *buffer;
+	size_t offset, size;
+	cpBool restore;
+};
+
+static inline void
+cpSnapshotTransfer(cpSnapshotCursor *cursor, void *ptr, size_t bytes)
+{
+	size_t offset = cursor->offset;
+	cursor->offset += bytes;
+	
+	if(cursor->restore){
+		cpAssertHard(cursor->offset <= cursor->size, "The snapshot is truncated.");
+		memcpy(ptr, cursor->buffer + offset, bytes);
+	} else if(cursor->offset <= cursor->size){
+		memcpy(cursor->buffer + offset, ptr, bytes);
+	}
+}
+
+// Snapshots are only restored into the objects they were taken from.
+// Save a pointer, or check that it still matches when restoring.
+static inline void
+cpSnapshotCheckPointer(cpSnapshotCursor *cursor, void *ptr)
+{
+	void *saved = ptr;
+	cpSnapshotTransfer(cursor, &saved, sizeof(void *));
+	cpAssertHard(saved == ptr, "The snapshot was taken from different objects or memory was trimmed since.");
+}
+
+// Save or restore the links of a free list of blocks of the given size. Each block links to the next through the pointer at linkOffset.
+// The head of the list must be restored first. The contents of the blocks aren't saved.
+void cpSnapshotFreeList(cpSnapshotCursor *cursor, void *head, size_t blockSize, size_t linkOffset);
+
+#pragma mark Cloning
+
+// Maps addresses inside of copied objects and buffers to the same offsets in their copies.
+// Addresses outside of all of them are returned as they are, they point to memory the copy shares with the original.
+cpRelocation *cpRelocationNew(const cpAllocator *allocator);
+void cpRelocationFree(cpRelocation *rel);
+void cpRelocationAdd(cpRelocation *rel, void *from, void *to, size_t size);
+void *cpRelocate(cpRelocation *rel, void *ptr);
+
 #pragma mark cpArray
 
 struct cpArray {
 	int num, max;
 	void **arr;
+	
+	const cpAllocator *allocator;
 };
 
 cpArray *cpArrayNew(int size);
+cpArray *cpArrayNewWithAllocator(int size, const cpAllocator *allocator);
 
 void cpArrayFree(cpArray *arr);
 
@@ -42,6 +116,31 @@ void cpArrayDeleteObj(cpArray *arr, void *obj);
 cpBool cpArrayContains(cpArray *arr, void *ptr);
 
 void cpArrayFreeEach(cpArray *arr, void (freeFunc)(void*));
+// Free each element with the array's allocator.
+void cpArrayFreeEachBlock(cpArray *arr);
+// Bytes used by the array itself, not counting its elements.
+size_t cpArrayGetBytes(cpArray *arr);
+// Free the buffers of bufferSize bytes whose blockSize sized blocks are all in the blocks array.
+// Their blocks are removed from blocks. Buffers of other pools may share the buffers array.
+// Returns the number of bytes freed.
+size_t cpArrayTrimBuffers(cpArray *buffers, size_t bufferSize, cpArray *blocks, size_t blockSize);
+
+// Compacting a pool moves its highest live blocks into its lowest unused blocks.
+// Sorts both arrays, drops duplicates from live and returns the number of blocks to move:
+// live->arr[live->num - 1 - i] moves to unused->arr[i] for i < count.
+int cpArrayPlanCompaction(cpArray *live, cpArray *unused);
+// Where a block is moved to by the plan, or NULL if it stays put.
+void *cpArrayCompactionDest(cpArray *live, cpArray *unused, int count, void *block);
+// Once the blocks are moved, swap their old addresses into unused.
+void cpArrayFinishCompaction(cpArray *live, cpArray *unused, int count);
+
+// Save or restore the elements of the array.
+void cpArraySnapshot(cpArray *arr, cpSnapshotCursor *cursor);
+// Save or check a list of buffers. Their owner saves whatever is in use in them.
+// Buffers allocated since the snapshot was taken are freed when restoring it.
+void cpArraySnapshotBuffers(cpArray *buffers, cpSnapshotCursor *cursor);
+// Copy a list of bufferSize byte buffers along with their contents and add them to rel.
+cpArray *cpArrayCloneBuffers(cpArray *buffers, size_t bufferSize, cpRelocation *rel);
 
 #pragma mark Foreach loops
 
@@ -75,6 +174,7 @@ typedef cpBool (*cpHashSetEqlFunc)(void *ptr, void *elt);
 typedef void *(*cpHashSetTransFunc)(void *ptr, void *data);
 
 cpHashSet *cpHashSetNew(int size, cpHashSetEqlFunc eqlFunc);
+cpHashSet *cpHashSetNewWithAllocator(int size, cpHashSetEqlFunc eqlFunc, const cpAllocator *allocator);
 void cpHashSetSetDefaultValue(cpHashSet *set, void *default_value);
 
 void cpHashSetFree(cpHashSet *set);
@@ -90,24 +190,88 @@ void cpHashSetEach(cpHashSet *set, cpHashSetIteratorFunc func, void *data);
 typedef cpBool (*cpHashSetFilterFunc)(void *elt, void *data);
 void cpHashSetFilter(cpHashSet *set, cpHashSetFilterFunc func, void *data);
 
+// Replace each element with func's return value, which must be equal to the element.
+void cpHashSetRemap(cpHashSet *set, cpHashSetTransFunc func, void *data);
+
+// Shrink the table and release the unused bins. Returns the number of bytes released.
+size_t cpHashSetTrim(cpHashSet *set);
+void cpHashSetGetStats(cpHashSet *set, cpPoolStats *stats);
+// Add the memory used by the set itself to stats. Entries count as objects and unused bins as pooled.
+void cpHashSetGetMemoryStats(cpHashSet *set, cpMemoryStats *stats);
+// Save or restore the table and bins of the set. The elements themselves are left to the caller.
+void cpHashSetSnapshot(cpHashSet *set, cpSnapshotCursor *cursor);
+// Copy the set with its table and bins in the same order. Each element and a non-NULL default value are replaced with func's return value.
+cpHashSet *cpHashSetClone(cpHashSet *set, cpHashSetTransFunc func, void *data);
+
 #pragma mark Body Functions
 
+// Bodies that use the default integration functions are integrated in batches of this size.
+#define CP_BODY_BATCH_SIZE 64
+void cpBodyUpdateVelocityBatch(cpBody **bodies, int count, cpVect gravity, cpFloat damping, cpFloat dt);
+void cpBodyUpdatePositionBatch(cpBody **bodies, int count, cpFloat dt);
+
 void cpBodyAddShape(cpBody *body, cpShape *shape);
 void cpBodyRemoveShape(cpBody *body, cpShape *shape);
 void cpBodyRemoveConstraint(cpBody *body, cpConstraint *constraint);
+void cpBodyPushArbiter(cpBody *body, cpArbiter *arb);
 
 
 #pragma mark Shape/Collision Functions
 
 cpShape* cpShapeInit(cpShape *shape, const cpShapeClass *klass, cpBody *body);
 
+// Save or restore the state of a shape for cpSpaceSnapshot() and cpSpaceRestore().
+static inline void
+cpShapeSnapshot(cpShape *shape, cpSnapshotCursor *cursor)
+{
+	shape->klass->snapshot(shape, cursor);
+}
+
+// Copy a shape for cpSpaceClone(), attaching the copy to body. Circles, segments and polys are copied into the space's pools.
+// The copy isn't linked into the body or the space yet.
+static inline cpShape *
+cpShapeClone(cpShape *shape, cpBody *body, cpSpace *space)
+{
+	cpAssertHard(shape->klass->clone, "This shape does not support cloning.");
+	return shape->klass->clone(shape, body, space);
+}
+
+// Active shapes are updated in batches of this size, grouped by shape type.
+#define CP_SHAPE_BATCH_SIZE 64
+void cpCircleShapeUpdateBatch(cpCircleShape **circles, int count);
+void cpSegmentShapeUpdateBatch(cpSegmentShape **segs, int count);
+void cpPolyShapeUpdateBatch(cpPolyShape **polys, int count);
+
+// Bytes needed for the vertex and axis arrays of a polygon.
+size_t cpPolyShapeStorageSize(int numVerts);
+// Initialize a polygon that keeps its arrays in the given block of cpPolyShapeStorageSize() bytes.
+cpPolyShape *cpPolyShapeInitWithStorage(cpPolyShape *poly, cpBody *body, int numVerts, cpVect *verts, cpVect offset, void *storage);
+
+// Keep the space from reusing contacts that were generated before the shape's geometry changed.
+static inline void
+cpShapeMarkModified(cpShape *shape)
+{
+	if(shape->space) shape->modified = shape->space->stamp;
+}
+
 static inline cpBool
 cpShapeActive(cpShape *shape)
 {
 	return shape->prev || shape->body->shapeList == shape;
 }
 
-int cpCollideShapes(const cpShape *a, const cpShape *b, cpContact *arr);
+// Contacts separated by less than margin are returned with positive distances as speculative contacts.
+int cpCollideShapes(const cpShape *a, const cpShape *b, cpFloat margin, cpContact *arr);
+
+void cpPolyShapeTransform(cpPolyShape *poly);
+
+// Polys transform their vertexes and axes only when something needs them.
+// Call this before reading tVerts or tAxes.
+static inline void
+cpPolyShapeCacheTransform(cpPolyShape *poly)
+{
+	if(poly->tStamp != poly->stamp) cpPolyShapeTransform(poly);
+}
 
 static inline cpFloat
 cpPolyShapeValueOnAxis(const cpPolyShape *poly, const cpVect n, const cpFloat d)
@@ -123,32 +287,47 @@ cpPolyShapeValueOnAxis(const cpPolyShape *poly, const cpVect n, const cpFloat d)
 }
 
 static inline cpBool
-cpPolyShapeContainsVert(const cpPolyShape *poly, const cpVect v)
+cpPolyShapeContainsVert(const cpPolyShape *poly, const cpVect v, const cpFloat tolerance)
 {
 	cpPolyShapeAxis *axes = poly->tAxes;
 	
 	for(int i=0; i<poly->numVerts; i++){
 		cpFloat dist = cpvdot(axes[i].n, v) - axes[i].d;
-		if(dist > 0.0f) return cpFalse;
+		if(dist > tolerance) return cpFalse;
 	}
 	
 	return cpTrue;
 }
 
 static inline cpBool
-cpPolyShapeContainsVertPartial(const cpPolyShape *poly, const cpVect v, const cpVect n)
+cpPolyShapeContainsVertPartial(const cpPolyShape *poly, const cpVect v, const cpVect n, const cpFloat tolerance)
 {
 	cpPolyShapeAxis *axes = poly->tAxes;
 	
 	for(int i=0; i<poly->numVerts; i++){
 		if(cpvdot(axes[i].n, n) < 0.0f) continue;
 		cpFloat dist = cpvdot(axes[i].n, v) - axes[i].d;
-		if(dist > 0.0f) return cpFalse;
+		if(dist > tolerance) return cpFalse;
 	}
 	
 	return cpTrue;
 }
 
+static inline cpBool
+cpTileMapShapeTileIsSolid(const cpTileMapShape *tilemap, int x, int y)
+{
+	if(x < 0 || tilemap->width <= x || y < 0 || tilemap->height <= y) return cpFalse;
+	return (tilemap->tiles[x + y*tilemap->width] != 0);
+}
+
+#pragma mark Constraint Functions
+
+// Solve a run of pivot joints without calling through their class.
+// When measuring, the impulse batch returns the largest change of any joint's accumulated impulse.
+void cpPivotJointPreStepBatch(cpPivotJoint **joints, int count, cpFloat dt);
+void cpPivotJointApplyCachedImpulseBatch(cpPivotJoint **joints, int count, cpFloat dt_coef);
+cpFloat cpPivotJointApplyImpulseBatch(cpPivotJoint **joints, int count, cpBool measure);
+
 #pragma mark Spatial Index Functions
 
 cpSpatialIndex *cpSpatialIndexInit(cpSpatialIndex *index, cpSpatialIndexClass *klass, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
@@ -160,20 +339,102 @@ void cpSpaceProcessComponents(cpSpace *space, cpFloat dt);
 
 cpContact *cpContactBufferGetArray(cpSpace *space);
 void cpSpacePushContacts(cpSpace *space, int count);
+size_t cpSpaceTrimContactBuffers(cpSpace *space);
+void cpSpaceGetContactBufferStats(cpSpace *space, cpPoolStats *stats);
+void cpSpaceGetContactBufferMemoryStats(cpSpace *space, cpMemoryStats *stats);
+// Save or restore the contact buffer ring. The contacts themselves are saved along with their arbiters.
+void cpSpaceSnapshotContactBuffers(cpSpace *space, cpSnapshotCursor *cursor);
+// Copy the contact buffer ring into a cloned space. The buffers are added to rel so the arbiters can find their contacts.
+void cpSpaceCloneContactBuffers(cpSpace *space, cpSpace *clone, cpRelocation *rel);
 
 void *cpSpaceGetPostStepData(cpSpace *space, void *obj);
 
 void cpSpaceFilterArbiters(cpSpace *space, cpBody *body, cpShape *filter);
+// Add or remove a constraint from both the constraints array and the class groups the solver runs.
+void cpSpacePushConstraint(cpSpace *space, cpConstraint *constraint);
+void cpSpaceDeleteConstraint(cpSpace *space, cpConstraint *constraint);
+void cpSpacePushCollisionEvent(cpSpace *space, cpCollisionEventType type, cpArbiter *arb, cpVect impulse);
+// Called when the group or layers of a shape in the space change so the spatial index updates its copy of the filter.
+void cpSpaceRefilterShape(cpSpace *space, cpShape *shape);
+
+// Returns true when the spatial indexes have already rejected shapes by their body, group and layers.
+static inline cpBool
+cpSpaceIndexesFilterShapes(cpSpace *space)
+{
+	return (space->filteredIndexes && !space->staleFilters);
+}
+
+// Clones share the static shapes and bodies of the space they were copied from until they change them.
+// Meanwhile arbiters and constraints aren't linked into any static bodies, cpSpaceUnshareStatic() links them once it copies the bodies.
+void cpSpaceUnshareStatic(cpSpace *space);
+void cpSpaceDestroyClone(cpSpace *space);
+void cpSpaceCloneHandlers(cpSpace *space, cpSpace *clone);
+
+static inline cpBool
+cpSpaceLinksToBody(cpSpace *space, cpBody *body)
+{
+	return !(space->sharedStaticBody && cpBodyIsStatic(body));
+}
+
+// Give a clone its own static shapes before changing them and find its copy of a shape it shared.
+static inline cpShape *
+cpSpaceUnshareShape(cpSpace *space, cpShape *shape)
+{
+	if(space->sharedStaticBody) cpSpaceUnshareStatic(space);
+	return (space->clonedObjects && shape->space != space ? (cpShape *)cpRelocate(space->clonedObjects, shape) : shape);
+}
 
 void cpSpaceActivateBody(cpSpace *space, cpBody *body);
+void cpSpaceSweepBody(cpSpace *space, cpBody *body, cpVect p0, cpFloat a0);
+
+typedef struct cpJointTreeSolver cpJointTreeSolver;
+void cpJointTreeSolverFree(cpJointTreeSolver *solver);
+cpArray *cpSpaceBuildJointTrees(cpSpace *space);
+cpFloat cpSpaceSolveJointTrees(cpSpace *space);
 void cpSpaceLock(cpSpace *space);
 void cpSpaceUnlock(cpSpace *space, cpBool runPostStep);
 
+// Slab pool of equally sized blocks carved out of CP_BUFFER_BYTES buffers.
+typedef struct cpSpacePool {
+	size_t size;
+	// Unused blocks.
+	cpArray *blocks;
+	// Buffers the blocks are carved out of.
+	cpArray *buffers;
+	
+	const cpAllocator *allocator;
+} cpSpacePool;
+
+cpSpacePool *cpSpacePoolNew(size_t size, const cpAllocator *allocator);
+void cpSpacePoolFree(cpSpacePool *pool);
+
+void *cpSpacePoolAlloc(cpSpacePool *pool);
+void cpSpacePoolRecycle(cpSpacePool *pool, void *block);
+
+size_t cpSpacePoolTrim(cpSpacePool *pool);
+void cpSpacePoolGetStats(cpSpacePool *pool, cpPoolStats *stats);
+void cpSpacePoolGetMemoryStats(cpSpacePool *pool, cpMemoryStats *stats);
+// Save or restore which blocks are unused. The live blocks are left to their owners.
+void cpSpacePoolSnapshot(cpSpacePool *pool, cpSnapshotCursor *cursor);
+// Copy the pool with all of its blocks in use or not. The buffers are added to rel so the copies of the blocks in use can be found.
+cpSpacePool *cpSpacePoolClone(cpSpacePool *pool, cpRelocation *rel);
+
+// Get the space's pool for bodies, shapes and constraints of the given size.
+cpSpacePool *cpSpaceGetPool(cpSpace *space, size_t size);
+
 static inline cpCollisionHandler *
 cpSpaceLookupHandler(cpSpace *space, cpCollisionType a, cpCollisionType b)
 {
-	cpCollisionType types[] = {a, b};
-	return (cpCollisionHandler *)cpHashSetFind(space->collisionHandlers, CP_HASH_PAIR(a, b), types);
+	size_t size = space->handlerTableSize;
+	if(size){
+		// Types without handlers are clamped to the last row and column of the table.
+		size_t i = ((size_t)a < size ? (size_t)a : size - 1);
+		size_t j = ((size_t)b < size ? (size_t)b : size - 1);
+		return space->handlerTable[i*size + j];
+	} else {
+		cpCollisionType types[] = {a, b};
+		return (cpCollisionHandler *)cpHashSetFind(space->collisionHandlers, CP_HASH_PAIR(a, b), types);
+	}
 }
 
 static inline void
@@ -181,7 +442,7 @@ cpSpaceUncacheArbiter(cpSpace *space, cpArbiter *arb)
 {
 	cpShape *a = arb->a, *b = arb->b;
 	cpShape *shape_pair[] = {a, b};
-	cpHashValue arbHashID = CP_HASH_PAIR((size_t)a, (size_t)b);
+	cpHashValue arbHashID = CP_HASH_PAIR(a->hashid, b->hashid);
 	cpHashSetRemove(space->cachedArbiters, arbHashID, shape_pair);
 	cpArrayDeleteObj(space->arbiters, arb);
 }
@@ -221,6 +482,10 @@ cpArbiterThreadForBody(cpArbiter *arb, cpBody *body)
 void cpArbiterUnthread(cpArbiter *arb);
 
 void cpArbiterUpdate(cpArbiter *arb, cpContact *contacts, int numContacts, struct cpCollisionHandler *handler, cpShape *a, cpShape *b);
-void cpArbiterPreStep(cpArbiter *arb, cpFloat dt, cpFloat bias, cpFloat slop);
+void cpArbiterPreStep(cpArbiter *arb, cpFloat dt, cpFloat slop, cpFloat bias, cpBool block);
+// Contacts are reused for at most this many steps in a row before the collision detection runs again.
+#define CP_CONTACT_REUSE_STEPS 8
+int cpArbiterReuseContacts(cpArbiter *arb, cpFloat tolerance, cpTimestamp stamp, cpContact *contacts);
+void cpArbiterSetReferenceTransform(cpArbiter *arb, cpTimestamp stamp);
 void cpArbiterApplyCachedImpulse(cpArbiter *arb, cpFloat dt_coef);
-void cpArbiterApplyImpulse(cpArbiter *arb);
+cpFloat cpArbiterApplyImpulse(cpArbiter *arb);
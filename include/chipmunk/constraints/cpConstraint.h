@@ -35,6 +35,9 @@ struct cpConstraintClass {
 	cpConstraintApplyCachedImpulseImpl applyCachedImpulse;
 	cpConstraintApplyImpulseImpl applyImpulse;
 	cpConstraintGetImpulseImpl getImpulse;
+	
+	// Size of the constraint struct, it's saved whole by cpSpaceSnapshot().
+	size_t size;
 };
 
 
@@ -52,6 +55,9 @@ struct cpConstraint {
 	CP_PRIVATE(cpConstraint *next_a);
 	CP_PRIVATE(cpConstraint *next_b);
 	
+	// Space pool the constraint was allocated from or NULL.
+	CP_PRIVATE(struct cpSpacePool *pool);
+	
 	/// The maximum force that this constraint is allowed to use.
 	/// Defaults to infinity.
 	cpFloat maxForce;
@@ -62,6 +68,10 @@ struct cpConstraint {
 	/// The maximum rate at which joint error is corrected.
 	/// Defaults to infinity.
 	cpFloat maxBias;
+	/// The impulse at which the constraint breaks and is removed from the space.
+	/// Broken constraints can be collected using cpSpacePopBrokenConstraint() after each step.
+	/// Defaults to infinity.
+	cpFloat breakImpulse;
 	
 	/// User definable data pointer.
 	/// Generally this points to your the game object class so you can access it
@@ -99,6 +109,7 @@ CP_DefineConstraintStructGetter(cpBody *, b, B);
 CP_DefineConstraintStructProperty(cpFloat, maxForce, MaxForce);
 CP_DefineConstraintStructProperty(cpFloat, errorBias, ErrorBias);
 CP_DefineConstraintStructProperty(cpFloat, maxBias, MaxBias);
+CP_DefineConstraintStructProperty(cpFloat, breakImpulse, BreakImpulse);
 CP_DefineConstraintStructProperty(cpDataPointer, data, UserData);
 
 /// Get the last impulse applied by this constraint.
@@ -37,6 +37,31 @@ typedef void (*cpCollisionPostSolveFunc)(cpArbiter *arb, cpSpace *space, void *d
 /// Collision separate event function callback type.
 typedef void (*cpCollisionSeparateFunc)(cpArbiter *arb, cpSpace *space, void *data);
 
+/// Type of a recorded collision event.
+typedef enum cpCollisionEventType {
+	/// The shapes started touching during the step.
+	cpCollisionEventBegin,
+	/// The collision was solved during the step.
+	cpCollisionEventPostSolve,
+	/// The shapes stopped touching during the step.
+	cpCollisionEventSeparate,
+} cpCollisionEventType;
+
+/// Compact record of a collision event.
+/// Recorded by a space when cpSpace.enableCollisionEvents is set.
+typedef struct cpCollisionEvent {
+	/// Type of the event.
+	cpCollisionEventType type;
+	/// The colliding shapes, in the same order a collision handler would see them.
+	cpShape *a, *b;
+	/// Normal of the first contact point. Zero for separate events.
+	cpVect n;
+	/// Position of the first contact point. Zero for separate events.
+	cpVect point;
+	/// Total impulse, including friction, applied to resolve the collision. Only set for post-solve events.
+	cpVect impulse;
+} cpCollisionEvent;
+
 /// @private
 struct cpCollisionHandler {
 	cpCollisionType a;
@@ -94,6 +119,24 @@ struct cpArbiter {
 	CP_PRIVATE(int numContacts);
 	CP_PRIVATE(cpContact *contacts);
 	
+	// Normal mass matrix used to solve two contacts together.
+	// kDetInv is zero when the contacts are solved one at a time.
+	CP_PRIVATE(cpFloat k11);
+	CP_PRIVATE(cpFloat k12);
+	CP_PRIVATE(cpFloat k22);
+	CP_PRIVATE(cpFloat kDetInv);
+	
+	// Relative transform of the bodies when cpCollideShapes() last generated the contacts,
+	// and the transforms of the bodies when the contacts were last updated.
+	CP_PRIVATE(cpVect refPos);
+	CP_PRIVATE(cpFloat refAngle);
+	CP_PRIVATE(cpVect posA);
+	CP_PRIVATE(cpVect rotA);
+	CP_PRIVATE(cpVect posB);
+	CP_PRIVATE(cpVect rotB);
+	// Space timestamp of the step that generated the contacts.
+	CP_PRIVATE(cpTimestamp refStamp);
+	
 	CP_PRIVATE(cpTimestamp stamp);
 	CP_PRIVATE(cpCollisionHandler *handler);
 	CP_PRIVATE(cpBool swappedColl);
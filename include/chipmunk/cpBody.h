@@ -87,6 +87,11 @@ struct cpBody {
 	/// Maximum rotational rate (in radians/second) allowed when updating the angular velocity.
 	cpFloat w_limit;
 	
+	/// Sweep the body's shapes each step and stop it at the first time of impact instead of letting it tunnel.
+	/// Useful for small fast moving objects like bullets. Defaults to false.
+	/// Shapes with a begin or preSolve collision handler are not swept against, since those handlers may reject the collision.
+	cpBool enableCCD;
+	
 	CP_PRIVATE(cpVect v_bias);
 	CP_PRIVATE(cpFloat w_bias);
 	
@@ -97,6 +102,10 @@ struct cpBody {
 	CP_PRIVATE(cpConstraint *constraintList);
 	
 	CP_PRIVATE(cpComponentNode node);
+	CP_PRIVATE(int treeIndex);
+	
+	// Space pool the body was allocated from by cpSpaceNewBody() or NULL.
+	CP_PRIVATE(struct cpSpacePool *pool);
 };
 
 /// Allocate a cpBody.
@@ -189,6 +198,7 @@ CP_DefineBodyStructProperty(cpFloat, t, Torque);
 CP_DefineBodyStructGetter(cpVect, rot, Rot);
 CP_DefineBodyStructProperty(cpFloat, v_limit, VelLimit);
 CP_DefineBodyStructProperty(cpFloat, w_limit, AngVelLimit);
+CP_DefineBodyStructProperty(cpBool, enableCCD, EnableCCD);
 CP_DefineBodyStructProperty(cpDataPointer, data, UserData);
 
 /// Default Integration functions.
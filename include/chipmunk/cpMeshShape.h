@@ -0,0 +1,62 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/// @defgroup cpMeshShape cpMeshShape
+/// Mesh shapes are collections of segments or triangles that collide as a single shape.
+/// They are meant for large pieces of static level geometry such as terrain.
+/// The mesh only takes up a single entry in the space's spatial index and keeps
+/// it's own bounding box tree to find the parts touching another shape.
+/// A collision with a mesh produces a single arbiter holding the deepest contacts.
+/// Mesh shapes don't collide with other mesh shapes.
+/// @note Every child is transformed and reindexed whenever the mesh is updated,
+/// so you should attach meshes to static bodies or bodies that rarely move.
+/// @{
+
+/// @private
+typedef struct cpMeshShape {
+	cpShape shape;
+	
+	int numChildren;
+	cpShape **children;
+	
+	cpSpatialIndex *index;
+} cpMeshShape;
+
+/// Allocate a mesh shape.
+cpMeshShape *cpMeshShapeAlloc(void);
+/// Initialize a mesh shape from a polyline.
+/// A segment with the given radius is created between each consecutive pair of vertexes.
+cpMeshShape *cpMeshShapeInitPolyline(cpMeshShape *mesh, cpBody *body, int numVerts, const cpVect *verts, cpFloat radius);
+/// Initialize a mesh shape from a triangle soup.
+/// @c indexes holds three vertex indexes for each triangle. Either winding is accepted.
+cpMeshShape *cpMeshShapeInitTriangles(cpMeshShape *mesh, cpBody *body, int numVerts, const cpVect *verts, int numTriangles, const int *indexes);
+/// Allocate and initialize a mesh shape from a polyline.
+cpShape *cpMeshShapeNewPolyline(cpBody *body, int numVerts, const cpVect *verts, cpFloat radius);
+/// Allocate and initialize a mesh shape from a triangle soup.
+cpShape *cpMeshShapeNewTriangles(cpBody *body, int numVerts, const cpVect *verts, int numTriangles, const int *indexes);
+
+/// Get the number of segments or triangles in a mesh shape.
+int cpMeshShapeGetNumChildren(cpShape *shape);
+/// Get the @c ith segment or triangle of a mesh shape.
+/// The child shape is owned by the mesh and is not added to any space.
+cpShape *cpMeshShapeGetChild(cpShape *shape, int idx);
+
+/// @}
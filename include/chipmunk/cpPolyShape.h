@@ -35,6 +35,16 @@ typedef struct cpPolyShape {
 	int numVerts;
 	cpVect *verts, *tVerts;
 	cpPolyShapeAxis *axes, *tAxes;
+	
+	// Center and half size of the untransformed vertexes' bounding box.
+	// When the poly is a rectangle, the rotated extents are it's exact bounding box.
+	cpVect center, extents;
+	cpBool rect;
+	
+	// tAxes, and tVerts for rectangles, are only transformed when needed.
+	// They are current when tStamp == stamp.
+	cpVect tPos, tRot;
+	cpTimestamp stamp, tStamp;
 } cpPolyShape;
 
 /// Allocate a polygon shape.
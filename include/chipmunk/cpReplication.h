@@ -0,0 +1,71 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/// @defgroup cpReplication cpReplication
+/// Encode the state of the bodies of a space into a compact stream of bytes that is sent to clients over the network
+/// and applied to the matching bodies of a space on each client.
+/// Each body is registered with the same id on both ends. The position, angle, velocities and sleep state of a body
+/// are quantized and only the ones that changed since the baseline stream a client last acknowledged are sent.
+/// Bodies in sleeping components are never visited by the encoder, so resting piles cost nothing each tick.
+/// Adding, removing and creating the bodies on the clients is left to the game.
+/// @{
+
+/// Encodes the state of the bodies of a space.
+typedef struct cpReplicationEncoder cpReplicationEncoder;
+/// Applies encoded streams to the bodies of a space.
+typedef struct cpReplicationDecoder cpReplicationDecoder;
+
+/// Create an encoder for the bodies of @c space.
+/// Positions are rounded to multiples of @c positionQuantum and velocities to multiples of @c velocityQuantum.
+/// Angles are rounded to 1/65536th of a turn.
+cpReplicationEncoder *cpReplicationEncoderNew(cpSpace *space, cpFloat positionQuantum, cpFloat velocityQuantum);
+/// Destroy and free an encoder. The registered bodies are left alone.
+void cpReplicationEncoderFree(cpReplicationEncoder *encoder);
+
+/// Register a body to be encoded under @c id. Bodies that are removed from the space are sent as sleeping.
+void cpReplicationEncoderAddBody(cpReplicationEncoder *encoder, cpBody *body, unsigned int id);
+/// Unregister a body. This must be done before the body is freed.
+void cpReplicationEncoderRemoveBody(cpReplicationEncoder *encoder, cpBody *body);
+
+/// Encode the state of the registered bodies that changed since the stream with the stamp @c baseline into @c buffer.
+/// @c baseline is the last stamp returned by cpReplicationDecode() on the client that the stream is for, or 0 for a client that has nothing yet.
+/// Each call gives the stream a new stamp, so streams for several clients with different baselines can be encoded after the same step.
+/// Returns the number of bytes the stream needs. When that is more than @c capacity the stream is incomplete, encode it again with a larger buffer.
+size_t cpReplicationEncode(cpReplicationEncoder *encoder, cpTimestamp baseline, void *buffer, size_t capacity);
+
+/// Create a decoder that applies streams to the bodies of @c space.
+cpReplicationDecoder *cpReplicationDecoderNew(cpSpace *space);
+/// Destroy and free a decoder. The registered bodies are left alone.
+void cpReplicationDecoderFree(cpReplicationDecoder *decoder);
+
+/// Register the body that the state encoded under @c id is applied to.
+void cpReplicationDecoderAddBody(cpReplicationDecoder *decoder, cpBody *body, unsigned int id);
+/// Unregister the body with the given id. This must be done before the body is freed.
+void cpReplicationDecoderRemoveBody(cpReplicationDecoder *decoder, unsigned int id);
+
+/// Apply a stream made by cpReplicationEncode() to the registered bodies. State for unregistered ids is skipped.
+/// Bodies are woken up to match the server. Bodies that sleep on the server are marked as idle and fall asleep
+/// along with the bodies they touch the next time the client's space is stepped, if they haven't started moving again.
+/// Streams older than the last one applied, streams encoded against a baseline newer than it, and malformed streams are ignored.
+/// Returns the stamp of the last stream applied, which is the baseline the server should use for the next stream it sends.
+cpTimestamp cpReplicationDecode(cpReplicationDecoder *decoder, const void *buffer, size_t size);
+
+/// @}
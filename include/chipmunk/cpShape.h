@@ -40,6 +40,8 @@ typedef enum cpShapeType{
 	CP_CIRCLE_SHAPE,
 	CP_SEGMENT_SHAPE,
 	CP_POLY_SHAPE,
+	CP_MESH_SHAPE,
+	CP_TILEMAP_SHAPE,
 	CP_NUM_SHAPES
 } cpShapeType;
 
@@ -47,6 +49,8 @@ typedef cpBB (*cpShapeCacheDataImpl)(cpShape *shape, cpVect p, cpVect rot);
 typedef void (*cpShapeDestroyImpl)(cpShape *shape);
 typedef cpBool (*cpShapePointQueryImpl)(cpShape *shape, cpVect p);
 typedef void (*cpShapeSegmentQueryImpl)(cpShape *shape, cpVect a, cpVect b, cpSegmentQueryInfo *info);
+typedef void (*cpShapeSnapshotImpl)(cpShape *shape, cpSnapshotCursor *cursor);
+typedef cpShape *(*cpShapeCloneImpl)(cpShape *shape, cpBody *body, cpSpace *space);
 
 /// @private
 struct cpShapeClass {
@@ -56,6 +60,8 @@ struct cpShapeClass {
 	cpShapeDestroyImpl destroy;
 	cpShapePointQueryImpl pointQuery;
 	cpShapeSegmentQueryImpl segmentQuery;
+	cpShapeSnapshotImpl snapshot;
+	cpShapeCloneImpl clone;
 };
 
 /// Opaque collision shape struct.
@@ -87,8 +93,10 @@ struct cpShape {
 	/// Collision type of this shape used when picking collision handlers.
 	cpCollisionType collision_type;
 	/// Group of this shape. Shapes in the same group don't collide.
+	/// Change it with cpShapeSetGroup() once the shape is in a space so that the spatial index sees the change.
 	cpGroup group;
 	// Layer bitmask for this shape. Shapes only collide if the bitwise and of their layers is non-zero.
+	// Change it with cpShapeSetLayers() once the shape is in a space so that the spatial index sees the change.
 	cpLayers layers;
 	
 	CP_PRIVATE(cpSpace *space);
@@ -97,6 +105,12 @@ struct cpShape {
 	CP_PRIVATE(cpShape *prev);
 	
 	CP_PRIVATE(cpHashValue hashid);
+	
+	// Space timestamp of the last change to the shape's geometry. Contacts generated before it can't be reused.
+	CP_PRIVATE(cpTimestamp modified);
+	
+	// Space pool the shape was allocated from or NULL.
+	CP_PRIVATE(struct cpSpacePool *pool);
 };
 
 /// Destroy a shape.
@@ -135,8 +149,12 @@ CP_DefineShapeStructProperty(cpFloat, u, Friction, cpTrue);
 CP_DefineShapeStructProperty(cpVect, surface_v, SurfaceVelocity, cpTrue);
 CP_DefineShapeStructProperty(cpDataPointer, data, UserData, cpFalse);
 CP_DefineShapeStructProperty(cpCollisionType, collision_type, CollisionType, cpTrue);
-CP_DefineShapeStructProperty(cpGroup, group, Group, cpTrue);
-CP_DefineShapeStructProperty(cpLayers, layers, Layers, cpTrue);
+CP_DefineShapeStructGetter(cpGroup, group, Group);
+/// Set the group of a shape. The shape is reindexed so that the space's spatial index sees the change.
+void cpShapeSetGroup(cpShape *shape, cpGroup group);
+CP_DefineShapeStructGetter(cpLayers, layers, Layers);
+/// Set the layers of a shape. The shape is reindexed so that the space's spatial index sees the change.
+void cpShapeSetLayers(cpShape *shape, cpLayers layers);
 
 /// When initializing a shape, it's hash value comes from a counter.
 /// Because the hash value may affect iteration order, you can reset the shape ID counter
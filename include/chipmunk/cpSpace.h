@@ -29,6 +29,11 @@ struct cpSpace {
 	/// Number of iterations to use in the impulse solver to solve contacts.
 	int iterations;
 	
+	/// Stop solving early once no accumulated impulse changes by more than this amount during an iteration.
+	/// cpSpace.iterations is still the maximum number of iterations run.
+	/// The default value of 0 always runs every iteration.
+	cpFloat solverTolerance;
+	
 	/// Gravity to pass to rigid bodies when integrating velocity.
 	cpVect gravity;
 	
@@ -62,10 +67,47 @@ struct cpSpace {
 	/// Defaults to 3. There is probably never a reason to change this value.
 	cpTimestamp collisionPersistence;
 	
+	/// Reuse the contacts of a colliding pair from the previous step instead of running the collision detection again
+	/// while the bodies have moved less than this distance relative to each other since the contacts were last generated.
+	/// Reused contacts are moved along with the bodies. Useful for large piles of resting objects.
+	/// The collision detection still runs every few steps, and immediately after a shape's geometry is changed
+	/// with cpTileMapShapeSetTile() or one of the functions in chipmunk_unsafe.h.
+	/// The default value of 0 disables contact reuse.
+	cpFloat contactReuseTolerance;
+	
 	/// Rebuild the contact graph during each step. Must be enabled to use the cpBodyEachArbiter() function.
 	/// Disabled by default for a small performance boost. Enabled implicitly when the sleeping feature is enabled.
 	cpBool enableContactGraph;
 	
+	/// Generate speculative contacts for shapes that are close enough to touch during the next step.
+	/// Speculative contacts stop fast moving objects at the surface they would hit instead of letting them
+	/// pass through it, allowing larger timesteps without tunneling. Shapes are considered close enough when
+	/// they are separated by less than their relative velocity times the timestep.
+	/// Speculative contacts have a positive depth and are passed to collision callbacks like any other contact.
+	/// Sensor shapes never generate speculative contacts.
+	/// Objects are stopped at the surface before the bounce is calculated, so fast objects lose some of their elasticity.
+	/// Disabled by default.
+	/// @note Only the linear velocities of the bodies are considered, so long objects spinning fast enough can still tunnel.
+	cpBool enableSpeculativeContacts;
+	
+	/// Solve the normal impulses of collisions with exactly two contact points together instead of one at a time.
+	/// Resting boxes and other flat contacts converge much faster, so stacks need fewer iterations to stop jittering.
+	/// Arbiters with a poorly conditioned pair of contacts are still solved one contact at a time.
+	/// Disabled by default.
+	cpBool enableBlockSolver;
+	
+	/// Solve groups of pivot, pin and groove joints that form a tree with a direct solver instead of iteratively.
+	/// Chains, ragdolls and other articulated structures then satisfy their joints exactly on every iteration,
+	/// so they need far fewer iterations. A tree may only be attached to static or infinite mass bodies once.
+	/// Joints with a finite max force, joints that form loops, and all other constraints are still solved iteratively.
+	/// Disabled by default.
+	cpBool enableDirectSolver;
+	
+	/// Record begin, post-solve and separate collision events into a buffer that can be read
+	/// using cpSpaceGetCollisionEvents() after each step. Collision handlers are still called.
+	/// Disabled by default.
+	cpBool enableCollisionEvents;
+	
 	/// User definable data pointer.
 	/// Generally this points to your game's controller or game state
 	/// class so you can access it when given a cpSpace reference in a callback.
@@ -78,6 +120,7 @@ struct cpSpace {
 	
 	CP_PRIVATE(cpTimestamp stamp);
 	CP_PRIVATE(cpFloat curr_dt);
+	CP_PRIVATE(int iterationsUsed);
 
 	CP_PRIVATE(cpArray *bodies);
 	CP_PRIVATE(cpArray *rousedBodies);
@@ -85,19 +128,48 @@ struct cpSpace {
 	
 	CP_PRIVATE(cpSpatialIndex *staticShapes);
 	CP_PRIVATE(cpSpatialIndex *activeShapes);
+	// Set when the spatial indexes already reject pairs of shapes by body, group and layers.
+	CP_PRIVATE(cpBool filteredIndexes);
+	// Set when the filter of a shape changed while the space was locked and the indexes haven't caught up yet.
+	CP_PRIVATE(cpBool staleFilters);
 	
 	CP_PRIVATE(cpArray *arbiters);
 	CP_PRIVATE(cpContactBufferHeader *contactBuffersHead);
 	CP_PRIVATE(cpHashSet *cachedArbiters);
-	CP_PRIVATE(cpArray *pooledArbiters);
+	CP_PRIVATE(struct cpSpacePool *arbiterPool);
 	CP_PRIVATE(cpArray *constraints);
+	// The same constraints grouped by class in the order the solver runs them.
+	CP_PRIVATE(cpArray *classConstraints);
+	// Where each run of constraints of the same class ends, found once per step for the solver iterations.
+	CP_PRIVATE(int *constraintRunEnds);
+	CP_PRIVATE(int constraintRunCapacity);
+	CP_PRIVATE(struct cpJointTreeSolver *jointTrees);
+	CP_PRIVATE(cpArray *brokenConstraints);
 	
+	CP_PRIVATE(cpCollisionEvent *collisionEvents);
+	CP_PRIVATE(int collisionEventCount);
+	CP_PRIVATE(int collisionEventCapacity);
+	CP_PRIVATE(int collisionEventStepCount);
+	
+	CP_PRIVATE(const cpAllocator *allocator);
 	CP_PRIVATE(cpArray *allocatedBuffers);
+	CP_PRIVATE(cpArray *pools);
+	
+	// Set in spaces made by cpSpaceClone(). The copies of meshes and tile maps aren't pooled and are freed with the space.
+	CP_PRIVATE(cpRelocation *clonedObjects);
+	CP_PRIVATE(cpArray *clonedShapes);
+	// Static body of the space a clone shares its static shapes with until it changes them, or NULL.
+	CP_PRIVATE(cpBody *sharedStaticBody);
 	CP_PRIVATE(int locked);
 	
 	CP_PRIVATE(cpHashSet *collisionHandlers);
+	CP_PRIVATE(cpCollisionHandler **handlerTable);
+	CP_PRIVATE(int handlerTableSize);
 	CP_PRIVATE(cpCollisionHandler defaultHandler);
 	CP_PRIVATE(cpHashSet *postStepCallbacks);
+	CP_PRIVATE(cpArray *postStepQueue);
+	CP_PRIVATE(struct cpSpacePool *postStepPool);
+	CP_PRIVATE(cpBool runningPostStepCallbacks);
 	
 	CP_PRIVATE(cpBody _staticBody);
 };
@@ -108,6 +180,11 @@ cpSpace* cpSpaceAlloc(void);
 cpSpace* cpSpaceInit(cpSpace *space);
 /// Allocate and initialize a cpSpace.
 cpSpace* cpSpaceNew(void);
+/// Allocate and initialize a cpSpace that requests all of the memory it owns from @c allocator.
+/// This covers everything but the bodies, shapes and constraints you add to it,
+/// so dropping an arena that backs the allocator after cpSpaceFree() releases the whole space.
+/// The allocator must outlive the space.
+cpSpace* cpSpaceNewWithAllocator(const cpAllocator *allocator);
 
 /// Destroy a cpSpace.
 void cpSpaceDestroy(cpSpace *space);
@@ -125,6 +202,7 @@ CP_DefineSpaceStructGetter(type, member, name) \
 CP_DefineSpaceStructSetter(type, member, name)
 
 CP_DefineSpaceStructProperty(int, iterations, Iterations);
+CP_DefineSpaceStructProperty(cpFloat, solverTolerance, SolverTolerance);
 CP_DefineSpaceStructProperty(cpVect, gravity, Gravity);
 CP_DefineSpaceStructProperty(cpFloat, damping, Damping);
 CP_DefineSpaceStructProperty(cpFloat, idleSpeedThreshold, IdleSpeedThreshold);
@@ -132,10 +210,17 @@ CP_DefineSpaceStructProperty(cpFloat, sleepTimeThreshold, SleepTimeThreshold);
 CP_DefineSpaceStructProperty(cpFloat, collisionSlop, CollisionSlop);
 CP_DefineSpaceStructProperty(cpFloat, collisionBias, CollisionBias);
 CP_DefineSpaceStructProperty(cpTimestamp, collisionPersistence, CollisionPersistence);
+CP_DefineSpaceStructProperty(cpFloat, contactReuseTolerance, ContactReuseTolerance);
 CP_DefineSpaceStructProperty(cpBool, enableContactGraph, EnableContactGraph);
+CP_DefineSpaceStructProperty(cpBool, enableSpeculativeContacts, EnableSpeculativeContacts);
+CP_DefineSpaceStructProperty(cpBool, enableBlockSolver, EnableBlockSolver);
+CP_DefineSpaceStructProperty(cpBool, enableDirectSolver, EnableDirectSolver);
+CP_DefineSpaceStructProperty(cpBool, enableCollisionEvents, EnableCollisionEvents);
 CP_DefineSpaceStructProperty(cpDataPointer, data, UserData);
 CP_DefineSpaceStructGetter(cpBody *, staticBody, StaticBody);
 CP_DefineSpaceStructGetter(cpFloat, CP_PRIVATE(curr_dt), CurrentTimeStep);
+/// Number of solver iterations run during the last call to cpSpaceStep().
+CP_DefineSpaceStructGetter(int, CP_PRIVATE(iterationsUsed), IterationsUsed);
 
 /// Set a default collision handler for this space.
 /// The default collision handler is invoked for each colliding pair of shapes
@@ -173,6 +258,7 @@ cpShape *cpSpaceAddStaticShape(cpSpace *space, cpShape *shape);
 /// Add a rigid body to the simulation.
 cpBody *cpSpaceAddBody(cpSpace *space, cpBody *body);
 /// Add a constraint to the simulation.
+/// Constraints are solved grouped by class, with the classes in the order they were first added and the constraints of a class in the order they were added.
 cpConstraint *cpSpaceAddConstraint(cpSpace *space, cpConstraint *constraint);
 
 /// Remove a collision shape from the simulation.
@@ -191,6 +277,150 @@ cpBool cpSpaceContainsBody(cpSpace *space, cpBody *body);
 /// Test if a constraint has been added to the space.
 cpBool cpSpaceContainsConstraint(cpSpace *space, cpConstraint *constraint);
 
+/// @defgroup cpSpacePools Pooled Objects
+/// The space can allocate bodies, shapes and constraints from its own pools.
+/// Objects of the same type are packed together in memory, polygons keep their vertexes
+/// inline, and all of it comes from the space's allocator. The objects are not added to the space.
+/// Free them as usual with cpBodyFree(), cpShapeFree() or cpConstraintFree() to return them to the pool.
+/// Freeing the space releases the pools, so its pooled objects must not be used afterwards.
+/// @{
+
+/// Allocate and initialize a rigid body from the space's pools.
+cpBody *cpSpaceNewBody(cpSpace *space, cpFloat m, cpFloat i);
+/// Allocate and initialize a static body from the space's pools.
+cpBody *cpSpaceNewStaticBody(cpSpace *space);
+
+/// Allocate and initialize a circle shape from the space's pools.
+cpShape *cpSpaceNewCircleShape(cpSpace *space, cpBody *body, cpFloat radius, cpVect offset);
+/// Allocate and initialize a segment shape from the space's pools.
+cpShape *cpSpaceNewSegmentShape(cpSpace *space, cpBody *body, cpVect a, cpVect b, cpFloat radius);
+/// Allocate and initialize a polygon shape from the space's pools.
+/// The vertexes must be convex and have a clockwise winding.
+cpShape *cpSpaceNewPolyShape(cpSpace *space, cpBody *body, int numVerts, cpVect *verts, cpVect offset);
+/// Allocate and initialize a box shaped polygon shape from the space's pools.
+cpShape *cpSpaceNewBoxShape(cpSpace *space, cpBody *body, cpFloat width, cpFloat height);
+
+/// Allocate and initialize a pin joint from the space's pools.
+cpConstraint *cpSpaceNewPinJoint(cpSpace *space, cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2);
+/// Allocate and initialize a slide joint from the space's pools.
+cpConstraint *cpSpaceNewSlideJoint(cpSpace *space, cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2, cpFloat min, cpFloat max);
+/// Allocate and initialize a pivot joint from the space's pools.
+cpConstraint *cpSpaceNewPivotJoint(cpSpace *space, cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2);
+/// Allocate and initialize a groove joint from the space's pools.
+cpConstraint *cpSpaceNewGrooveJoint(cpSpace *space, cpBody *a, cpBody *b, cpVect groove_a, cpVect groove_b, cpVect anchr2);
+/// Allocate and initialize a damped spring from the space's pools.
+cpConstraint *cpSpaceNewDampedSpring(cpSpace *space, cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2, cpFloat restLength, cpFloat stiffness, cpFloat damping);
+/// Allocate and initialize a damped rotary spring from the space's pools.
+cpConstraint *cpSpaceNewDampedRotarySpring(cpSpace *space, cpBody *a, cpBody *b, cpFloat restAngle, cpFloat stiffness, cpFloat damping);
+/// Allocate and initialize a rotary limit joint from the space's pools.
+cpConstraint *cpSpaceNewRotaryLimitJoint(cpSpace *space, cpBody *a, cpBody *b, cpFloat min, cpFloat max);
+/// Allocate and initialize a ratchet joint from the space's pools.
+cpConstraint *cpSpaceNewRatchetJoint(cpSpace *space, cpBody *a, cpBody *b, cpFloat phase, cpFloat ratchet);
+/// Allocate and initialize a gear joint from the space's pools.
+cpConstraint *cpSpaceNewGearJoint(cpSpace *space, cpBody *a, cpBody *b, cpFloat phase, cpFloat ratio);
+/// Allocate and initialize a simple motor from the space's pools.
+cpConstraint *cpSpaceNewSimpleMotor(cpSpace *space, cpBody *a, cpBody *b, cpFloat rate);
+
+/// @}
+
+/// Memory held by the pools of a space.
+typedef struct cpSpacePoolStats {
+	/// Arbiters and the hash set that caches them.
+	cpPoolStats arbiters;
+	/// Buffers that store the contacts of the arbiters.
+	cpPoolStats contacts;
+	/// Bodies, shapes and constraints allocated with the cpSpaceNew*() functions.
+	cpPoolStats objects;
+	/// Collision handlers and post-step callbacks.
+	cpPoolStats callbacks;
+	/// The spatial index of the static shapes.
+	cpPoolStats staticIndex;
+	/// The spatial index of the active shapes.
+	cpPoolStats activeIndex;
+} cpSpacePoolStats;
+
+/// Release the memory that the space's pools hold but aren't using, such as after a burst of short lived objects.
+/// The spatial indexes move their live nodes, pairs and bins together so that more of their buffers can be released.
+/// Arbiters and pooled objects are never moved, so only buffers that they have entirely vacated are released.
+/// Shrinking the hash tables can change the order objects are visited in, so the simulation
+/// may not match an untrimmed one exactly afterwards. Returns the number of bytes released.
+size_t cpSpaceTrimMemory(cpSpace *space);
+/// Get the number of bytes held by each of the space's pools and how many of them are unused.
+void cpSpaceGetPoolStats(cpSpace *space, cpSpacePoolStats *stats);
+
+/// Memory used by a space.
+typedef struct cpSpaceMemoryStats {
+	/// Sum of the bytes of everything below plus the cpSpace struct itself.
+	size_t bytes;
+	/// The array of active bodies.
+	cpMemoryStats bodies;
+	/// Arbiters for the colliding pairs of shapes and the array of active arbiters.
+	/// Pooled arbiters are reused by new collisions.
+	cpMemoryStats arbiters;
+	/// Contacts in the ring of contact buffers.
+	/// Pooled contacts are the slots of buffers that are old enough to be reused.
+	cpMemoryStats contacts;
+	/// The hash set of arbiters cached between steps.
+	cpMemoryStats cachedArbiters;
+	/// Collision handlers along with their hash set and lookup table.
+	cpMemoryStats collisionHandlers;
+	/// Bodies, shapes and constraints allocated with the cpSpaceNew*() functions.
+	cpMemoryStats objects;
+	/// The spatial index of the static shapes.
+	cpSpatialIndexMemoryStats staticIndex;
+	/// The spatial index of the active shapes.
+	cpSpatialIndexMemoryStats activeIndex;
+} cpSpaceMemoryStats;
+
+/// Get the memory used by the space, such as for holding it to a budget.
+/// Bodies, shapes and constraints that you allocated yourself are not included.
+void cpSpaceGetMemoryStats(cpSpace *space, cpSpaceMemoryStats *stats);
+
+/// Save the state of the space into @c buffer so that cpSpaceRestore() can rewind the space to it later, such as for rollback networking.
+/// This covers the bodies, shapes and constraints in the space, the cached arbiters with their accumulated impulses,
+/// the sleeping components and the spatial indexes, so stepping a restored space gives exactly the same results as if it was never rewound.
+/// Space settings such as the gravity and the collision handlers are not saved.
+/// Only the objects in use are saved, unused pooled memory is not. The objects are saved whole, so expect roughly 1-2KB per body
+/// in a pile of colliding boxes, mostly for the bodies, shapes, arbiters and contacts.
+/// Returns the number of bytes the snapshot needs. When that is more than @c capacity the snapshot is incomplete, take it again with a larger buffer.
+size_t cpSpaceSnapshot(cpSpace *space, void *buffer, size_t capacity);
+/// Rewind the space to a snapshot taken with cpSpaceSnapshot().
+/// The saved state is copied back into the same objects, so a snapshot can only be restored into the space it was taken from.
+/// All of the bodies, shapes and constraints that were in the space at the time must still be allocated, and every field of them is restored, including their user data.
+/// Objects that were added to the space since are no longer in it afterwards, and the memory of the space must not be trimmed in between.
+void cpSpaceRestore(cpSpace *space, const void *buffer, size_t size);
+
+/// Make a copy of the space along with all of its bodies, shapes and constraints, such as for simulating ahead speculatively and throwing the result away.
+/// The spatial indexes and cached arbiters are copied as they are instead of being rebuilt, so stepping the copy gives exactly the same results as stepping the original.
+/// The copies of the objects belong to the clone and are freed along with it, so don't free them yourself.
+/// The settings, collision handlers and user data pointers are copied. Post-step callbacks, broken constraints and collision events are not.
+/// Pooled memory is copied whether it's in use or not, cpSpaceTrimMemory() keeps the clones of a space small after a spike in the number of collisions.
+/// Shapes attached to static bodies are shared with @c space until the clone adds or removes a static shape, adds a constraint to a static body or reindexes a static shape.
+/// Until then @c space must not change or free its static shapes, and the two spaces must not be stepped at the same time from different threads.
+/// cpSpaceGetStaticBody() of the clone returns its own static body, attach new static shapes to it.
+cpSpace *cpSpaceClone(cpSpace *space);
+/// Get the copy of a body of the space that @c clone was made from.
+/// Static bodies it still shares and bodies that weren't in the space are returned as they are.
+cpBody *cpSpaceGetClonedBody(cpSpace *clone, cpBody *body);
+/// Get the copy of a shape of the space that @c clone was made from.
+/// Static shapes it still shares and shapes that weren't in the space are returned as they are.
+cpShape *cpSpaceGetClonedShape(cpSpace *clone, cpShape *shape);
+/// Get the copy of a constraint of the space that @c clone was made from.
+/// Constraints that weren't in the space are returned as they are.
+cpConstraint *cpSpaceGetClonedConstraint(cpSpace *clone, cpConstraint *constraint);
+
+/// Pop a constraint that broke during the last call to cpSpaceStep().
+/// Broken constraints have already been removed from the space and are safe to free.
+/// Returns NULL once all of them have been popped. Unpopped constraints are forgotten when the space is next stepped.
+cpConstraint *cpSpacePopBrokenConstraint(cpSpace *space);
+
+/// Get the collision events recorded during the last call to cpSpaceStep() and store their number in @c count.
+/// Events are only recorded when cpSpace.enableCollisionEvents is set.
+/// The buffer belongs to the space and is overwritten by the next step.
+/// Removing a shape or body from the space records separate events for the collisions it was part of.
+/// When it's removed between steps, the events are reported by the next step and the shapes may have been freed by then.
+cpCollisionEvent *cpSpaceGetCollisionEvents(cpSpace *space, int *count);
+
 /// Post Step callback function type.
 typedef void (*cpPostStepFunc)(cpSpace *space, void *obj, void *data);
 /// Schedule a post-step callback to be called when cpSpaceStep() finishes.
@@ -61,6 +61,8 @@ struct cpSpatialIndex {
 	cpSpatialIndexBBFunc bbfunc;
 	
 	cpSpatialIndex *staticIndex, *dynamicIndex;
+	
+	const cpAllocator *allocator;
 };
 
 
@@ -74,6 +76,8 @@ cpSpaceHash *cpSpaceHashAlloc(void);
 cpSpatialIndex *cpSpaceHashInit(cpSpaceHash *hash, cpFloat celldim, int numcells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
 /// Allocate and initialize a spatial hash.
 cpSpatialIndex *cpSpaceHashNew(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a spatial hash that requests all of its memory from @c allocator.
+cpSpatialIndex *cpSpaceHashNewWithAllocator(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator);
 
 /// Change the cell dimensions and table size of the spatial hash to tune it.
 /// The cell dimensions should roughly match the average size of your objects
@@ -91,6 +95,8 @@ cpBBTree *cpBBTreeAlloc(void);
 cpSpatialIndex *cpBBTreeInit(cpBBTree *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
 /// Allocate and initialize a bounding box tree.
 cpSpatialIndex *cpBBTreeNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a bounding box tree that requests all of its memory from @c allocator.
+cpSpatialIndex *cpBBTreeNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator);
 
 /// Perform a static top down optimization of the tree.
 void cpBBTreeOptimize(cpSpatialIndex *index);
@@ -101,6 +107,38 @@ typedef cpVect (*cpBBTreeVelocityFunc)(void *obj);
 /// Set the velocity function for the bounding box tree to enable temporal coherence.
 void cpBBTreeSetVelocityFunc(cpSpatialIndex *index, cpBBTreeVelocityFunc func);
 
+/// Collision filter stored by a bounding box tree alongside each of its leaves.
+typedef struct cpBBTreeFilter {
+	/// Objects with the same non-NULL owner are never reported as colliding pairs.
+	void *owner;
+	/// Objects sharing no layers are never reported as colliding pairs.
+	cpLayers layers;
+	/// Objects in the same non-zero group are never reported as colliding pairs.
+	cpGroup group;
+} cpBBTreeFilter;
+
+/// Bounding box tree filter callback function.
+/// This function should return the collision filter of the object.
+typedef cpBBTreeFilter (*cpBBTreeFilterFunc)(void *obj);
+/// Set the filter function for the bounding box tree.
+/// Each leaf keeps a copy of its object's filter, and the internal nodes remember the union of the layers
+/// and the owner and group shared by the objects beneath them. Collision detection and the filtered queries
+/// can then reject objects and skip whole branches that could never match without touching the objects.
+/// Changes to an object's filter are picked up the next time the object is reindexed.
+void cpBBTreeSetFilterFunc(cpSpatialIndex *index, cpBBTreeFilterFunc func);
+/// Reindex only the objects whose filter changed since they were last indexed.
+void cpBBTreeRefilter(cpSpatialIndex *index);
+
+/// Perform a point query against the spatial index skipping objects that don't share any of @c layers or are in the same non-zero @c group.
+/// Falls back on cpSpatialIndexPointQuery() if the index is not a bounding box tree.
+void cpBBTreePointQueryFiltered(cpSpatialIndex *index, cpVect point, cpLayers layers, cpGroup group, cpSpatialIndexQueryFunc func, void *data);
+/// Perform a segment query against the spatial index skipping objects that don't share any of @c layers or are in the same non-zero @c group.
+/// Falls back on cpSpatialIndexSegmentQuery() if the index is not a bounding box tree.
+void cpBBTreeSegmentQueryFiltered(cpSpatialIndex *index, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpLayers layers, cpGroup group, cpSpatialIndexSegmentQueryFunc func, void *data);
+/// Perform a rectangle query against the spatial index skipping objects that don't share any of @c layers or are in the same non-zero @c group.
+/// Falls back on cpSpatialIndexQuery() if the index is not a bounding box tree.
+void cpBBTreeQueryFiltered(cpSpatialIndex *index, void *obj, cpBB bb, cpLayers layers, cpGroup group, cpSpatialIndexQueryFunc func, void *data);
+
 #pragma mark Single Axis Sweep
 
 typedef struct cpSweep1D cpSweep1D;
@@ -111,6 +149,22 @@ cpSweep1D *cpSweep1DAlloc(void);
 cpSpatialIndex *cpSweep1DInit(cpSweep1D *sweep, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
 /// Allocate and initialize a 1D sort and sweep broadphase.
 cpSpatialIndex *cpSweep1DNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a 1D sort and sweep broadphase that requests all of its memory from @c allocator.
+cpSpatialIndex *cpSweep1DNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator);
+
+/// Memory used by a spatial index.
+typedef struct cpSpatialIndexMemoryStats {
+	/// Total bytes, including the index itself.
+	size_t bytes;
+	/// BBTree leaves and internal nodes and the hash set that finds the leaves, or the cells of a Sweep1D table.
+	cpMemoryStats nodes;
+	/// BBTree pairs of overlapping leaves. Pairs are owned by the dynamic tree.
+	cpMemoryStats pairs;
+	/// Spatial hash bins and the table of cells.
+	cpMemoryStats bins;
+	/// Spatial hash handles and the hash set that finds them.
+	cpMemoryStats handles;
+} cpSpatialIndexMemoryStats;
 
 #pragma mark Spatial Index Implementation
 
@@ -131,6 +185,12 @@ typedef void (*cpSpatialIndexPointQueryImpl)(cpSpatialIndex *index, cpVect point
 typedef void (*cpSpatialIndexSegmentQueryImpl)(cpSpatialIndex *index, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data);
 typedef void (*cpSpatialIndexQueryImpl)(cpSpatialIndex *index, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data);
 
+typedef size_t (*cpSpatialIndexTrimImpl)(cpSpatialIndex *index);
+typedef void (*cpSpatialIndexPoolStatsImpl)(cpSpatialIndex *index, cpPoolStats *stats);
+typedef void (*cpSpatialIndexMemoryStatsImpl)(cpSpatialIndex *index, cpSpatialIndexMemoryStats *stats);
+typedef void (*cpSpatialIndexSnapshotImpl)(cpSpatialIndex *index, cpSnapshotCursor *cursor);
+typedef cpSpatialIndex *(*cpSpatialIndexCloneImpl)(cpSpatialIndex *index, cpSpatialIndex *staticIndex, cpRelocation *objects);
+
 struct cpSpatialIndexClass {
 	cpSpatialIndexDestroyImpl destroy;
 	
@@ -148,6 +208,12 @@ struct cpSpatialIndexClass {
 	cpSpatialIndexPointQueryImpl pointQuery;
 	cpSpatialIndexSegmentQueryImpl segmentQuery;
 	cpSpatialIndexQueryImpl query;
+	
+	cpSpatialIndexTrimImpl trim;
+	cpSpatialIndexPoolStatsImpl poolStats;
+	cpSpatialIndexMemoryStatsImpl memoryStats;
+	cpSpatialIndexSnapshotImpl snapshot;
+	cpSpatialIndexCloneImpl clone;
 };
 
 /// Destroy and free a spatial index.
@@ -233,4 +299,42 @@ static inline void cpSpatialIndexReindexQuery(cpSpatialIndex *index, cpSpatialIn
 	index->klass->reindexQuery(index, func, data);
 }
 
+/// Release the memory that the spatial index holds but isn't using.
+/// Returns the number of bytes released.
+static inline size_t cpSpatialIndexTrim(cpSpatialIndex *index)
+{
+	return (index->klass->trim ? index->klass->trim(index) : 0);
+}
+
+/// Add the memory held by the spatial index to @c stats.
+static inline void cpSpatialIndexGetPoolStats(cpSpatialIndex *index, cpPoolStats *stats)
+{
+	if(index->klass->poolStats) index->klass->poolStats(index, stats);
+}
+
+/// Get the memory used by the spatial index.
+/// Indexes that don't track their memory report zeros.
+static inline void cpSpatialIndexGetMemoryStats(cpSpatialIndex *index, cpSpatialIndexMemoryStats *stats)
+{
+	cpSpatialIndexMemoryStats zero = {0};
+	(*stats) = zero;
+	
+	if(index->klass->memoryStats) index->klass->memoryStats(index, stats);
+}
+
+/// @private Save or restore the state of the spatial index for cpSpaceSnapshot() and cpSpaceRestore().
+static inline void cpSpatialIndexSnapshot(cpSpatialIndex *index, cpSnapshotCursor *cursor)
+{
+	cpAssertHard(index->klass->snapshot, "This spatial index does not support snapshots.");
+	index->klass->snapshot(index, cursor);
+}
+
+/// @private Copy the spatial index node for node for cpSpaceClone() instead of inserting the objects again.
+/// The objects are looked up in @c objects, and @c staticIndex must be the copy of the index's static index.
+static inline cpSpatialIndex *cpSpatialIndexClone(cpSpatialIndex *index, cpSpatialIndex *staticIndex, cpRelocation *objects)
+{
+	cpAssertHard(index->klass->clone, "This spatial index does not support cloning.");
+	return index->klass->clone(index, staticIndex, objects);
+}
+
 ///@}
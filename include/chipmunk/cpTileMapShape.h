@@ -0,0 +1,73 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/// @defgroup cpTileMapShape cpTileMapShape
+/// Tile map shapes are grids of solid square tiles that collide as a single shape.
+/// They are meant for tile based levels that would otherwise need thousands of box or segment shapes.
+/// The tile map only takes up a single entry in the space's spatial index and finds the tiles
+/// touching another shape directly from the grid, so collisions only look at the tiles under the other shape.
+/// Contacts against the sides of a tile that are covered by a neighboring solid tile are discarded
+/// so that objects sliding across a row of tiles don't catch on the seams between them.
+/// Tile maps don't collide with other tile maps or mesh shapes.
+/// @{
+
+/// @private
+typedef struct cpTileMapShape {
+	cpShape shape;
+	
+	int width, height;
+	cpFloat tileSize;
+	cpVect offset;
+	
+	unsigned char *tiles;
+	
+	// Box shape reused to collide against individual tiles.
+	cpShape *tile;
+} cpTileMapShape;
+
+/// Allocate a tile map shape.
+cpTileMapShape *cpTileMapShapeAlloc(void);
+/// Initialize a tile map shape.
+/// The grid is @c width by @c height square tiles of size @c tileSize with the lower left corner at @c offset in body local coordinates.
+/// @c tiles holds @c width*height values in rows starting from the bottom. Non-zero values are solid.
+/// Pass NULL to start with an empty tile map. The tile values are copied.
+cpTileMapShape *cpTileMapShapeInit(cpTileMapShape *tilemap, cpBody *body, int width, int height, cpFloat tileSize, cpVect offset, const unsigned char *tiles);
+/// Allocate and initialize a tile map shape.
+cpShape *cpTileMapShapeNew(cpBody *body, int width, int height, cpFloat tileSize, cpVect offset, const unsigned char *tiles);
+
+/// Get the width of a tile map in tiles.
+int cpTileMapShapeGetWidth(cpShape *shape);
+/// Get the height of a tile map in tiles.
+int cpTileMapShapeGetHeight(cpShape *shape);
+/// Get the size of the tiles in a tile map.
+cpFloat cpTileMapShapeGetTileSize(cpShape *shape);
+/// Get the body local position of the lower left corner of a tile map.
+cpVect cpTileMapShapeGetOffset(cpShape *shape);
+
+/// Get the value of a tile. Tiles outside the grid are empty.
+unsigned char cpTileMapShapeGetTile(cpShape *shape, int x, int y);
+/// Set the value of a tile. Non-zero values are solid.
+/// Bodies touching the tile map are woken up. The bounding box of the tile map doesn't change, so there is no need to reindex it.
+void cpTileMapShapeSetTile(cpShape *shape, int x, int y, unsigned char value);
+/// Get the body local bounding box of a tile.
+cpBB cpTileMapShapeGetTileBB(cpShape *shape, int x, int y);
+
+/// @}
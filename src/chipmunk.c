@@ -43,6 +43,12 @@ cpMessage(const char *message, const char *condition, const char *file, int line
 	if(isError) abort();
 }
 
+static void *defaultAlloc(void *data, size_t count, size_t size){return cpcalloc(count, size);}
+static void *defaultRealloc(void *data, void *ptr, size_t size){return cprealloc(ptr, size);}
+static void defaultFree(void *data, void *ptr){cpfree(ptr);}
+
+const cpAllocator cpDefaultAllocator = {defaultAlloc, defaultRealloc, defaultFree, NULL};
+
 #define STR(s) #s
 #define XSTR(s) STR(s)
 
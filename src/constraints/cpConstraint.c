@@ -34,7 +34,12 @@ cpConstraintFree(cpConstraint *constraint)
 {
 	if(constraint){
 		cpConstraintDestroy(constraint);
-		cpfree(constraint);
+		
+		if(constraint->pool){
+			cpSpacePoolRecycle(constraint->pool, constraint);
+		} else {
+			cpfree(constraint);
+		}
 	}
 }
 
@@ -50,8 +55,10 @@ cpConstraintInit(cpConstraint *constraint, const cpConstraintClass *klass, cpBod
 	
 	constraint->next_a = NULL;
 	constraint->next_b = NULL;
+	constraint->pool = NULL;
 	
 	constraint->maxForce = (cpFloat)INFINITY;
 	constraint->errorBias = cpfpow(1.0f - 0.1f, 60.0f);
 	constraint->maxBias = (cpFloat)INFINITY;
+	constraint->breakImpulse = (cpFloat)INFINITY;
 }
@@ -82,6 +82,7 @@ static const cpConstraintClass klass = {
 	(cpConstraintApplyCachedImpulseImpl)applyCachedImpulse,
 	(cpConstraintApplyImpulseImpl)applyImpulse,
 	(cpConstraintGetImpulseImpl)getImpulse,
+	sizeof(cpDampedRotarySpring),
 };
 CP_DefineClassGetter(cpDampedRotarySpring)
 
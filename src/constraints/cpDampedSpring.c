@@ -88,6 +88,7 @@ static const cpConstraintClass klass = {
 	(cpConstraintApplyCachedImpulseImpl)applyCachedImpulse,
 	(cpConstraintApplyImpulseImpl)applyImpulse,
 	(cpConstraintGetImpulseImpl)getImpulse,
+	sizeof(cpDampedSpring),
 };
 CP_DefineClassGetter(cpDampedSpring)
 
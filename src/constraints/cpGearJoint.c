@@ -84,6 +84,7 @@ static const cpConstraintClass klass = {
 	(cpConstraintApplyCachedImpulseImpl)applyCachedImpulse,
 	(cpConstraintApplyImpulseImpl)applyImpulse,
 	(cpConstraintGetImpulseImpl)getImpulse,
+	sizeof(cpGearJoint),
 };
 CP_DefineClassGetter(cpGearJoint)
 
@@ -115,6 +115,7 @@ static const cpConstraintClass klass = {
 	(cpConstraintApplyCachedImpulseImpl)applyCachedImpulse,
 	(cpConstraintApplyImpulseImpl)applyImpulse,
 	(cpConstraintGetImpulseImpl)getImpulse,
+	sizeof(cpGrooveJoint),
 };
 CP_DefineClassGetter(cpGrooveJoint)
 
@@ -90,6 +90,7 @@ static const cpConstraintClass klass = {
 	(cpConstraintApplyCachedImpulseImpl)applyCachedImpulse,
 	(cpConstraintApplyImpulseImpl)applyImpulse,
 	(cpConstraintGetImpulseImpl)getImpulse,
+	sizeof(cpPinJoint),
 };
 CP_DefineClassGetter(cpPinJoint);
 
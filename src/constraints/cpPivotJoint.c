@@ -82,11 +82,43 @@ getImpulse(cpConstraint *joint)
 	return cpvlength(((cpPivotJoint *)joint)->jAcc);
 }
 
+void
+cpPivotJointPreStepBatch(cpPivotJoint **joints, int count, cpFloat dt)
+{
+	for(int i=0; i<count; i++) preStep(joints[i], dt);
+}
+
+void
+cpPivotJointApplyCachedImpulseBatch(cpPivotJoint **joints, int count, cpFloat dt_coef)
+{
+	for(int i=0; i<count; i++) applyCachedImpulse(joints[i], dt_coef);
+}
+
+cpFloat
+cpPivotJointApplyImpulseBatch(cpPivotJoint **joints, int count, cpBool measure)
+{
+	cpFloat delta = 0.0f;
+	
+	if(measure){
+		for(int i=0; i<count; i++){
+			cpPivotJoint *joint = joints[i];
+			cpFloat jOld = cpvlength(joint->jAcc);
+			applyImpulse(joint);
+			delta = cpfmax(delta, cpfabs(cpvlength(joint->jAcc) - jOld));
+		}
+	} else {
+		for(int i=0; i<count; i++) applyImpulse(joints[i]);
+	}
+	
+	return delta;
+}
+
 static const cpConstraintClass klass = {
 	(cpConstraintPreStepImpl)preStep,
 	(cpConstraintApplyCachedImpulseImpl)applyCachedImpulse,
 	(cpConstraintApplyImpulseImpl)applyImpulse,
 	(cpConstraintGetImpulseImpl)getImpulse,
+	sizeof(cpPivotJoint),
 };
 CP_DefineClassGetter(cpPivotJoint)
 
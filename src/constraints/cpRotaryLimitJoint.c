@@ -101,6 +101,7 @@ static const cpConstraintClass klass = {
 	(cpConstraintApplyCachedImpulseImpl)applyCachedImpulse,
 	(cpConstraintApplyImpulseImpl)applyImpulse,
 	(cpConstraintGetImpulseImpl)getImpulse,
+	sizeof(cpRotaryLimitJoint),
 };
 CP_DefineClassGetter(cpRotaryLimitJoint)
 
@@ -49,6 +49,9 @@ unthreadHelper(cpArbiter *arb, cpBody *body)
 	cpArbiter *prev = thread->prev;
 	cpArbiter *next = thread->next;
 	
+	// Not linked into the body, such as a static body a cloned space shares.
+	if(!prev && body->arbiterList != arb) return;
+	
 	if(prev){
 		cpArbiterThreadForBody(prev, body)->next = next;
 	} else {
@@ -175,6 +178,14 @@ cpArbiterInit(cpArbiter *arb, cpShape *a, cpShape *b)
 	arb->numContacts = 0;
 	arb->contacts = NULL;
 	
+	arb->k11 = arb->k12 = arb->k22 = 0.0f;
+	arb->kDetInv = 0.0f;
+	
+	arb->refPos = cpvzero;
+	arb->refAngle = 0.0f;
+	arb->posA = arb->posB = cpvzero;
+	arb->rotA = arb->rotB = cpv(1.0f, 0.0f);
+	
 	arb->a = a; arb->body_a = a->body;
 	arb->b = b; arb->body_b = b->body;
 	
@@ -225,12 +236,65 @@ cpArbiterUpdate(cpArbiter *arb, cpContact *contacts, int numContacts, cpCollisio
 	arb->a = a; arb->body_a = a->body;
 	arb->b = b; arb->body_b = b->body;
 	
+	// Remember where the bodies were so the contacts can be moved along with them if they are reused.
+	arb->posA = a->body->p; arb->rotA = a->body->rot;
+	arb->posB = b->body->p; arb->rotB = b->body->rot;
+	
 	// mark it as new if it's been cached
 	if(arb->state == cpArbiterStateCached) arb->state = cpArbiterStateFirstColl;
 }
 
+static inline cpVect
+relativePos(cpBody *a, cpBody *b)
+{
+	return cpvunrotate(cpvsub(b->p, a->p), a->rot);
+}
+
+void
+cpArbiterSetReferenceTransform(cpArbiter *arb, cpTimestamp stamp)
+{
+	cpBody *a = arb->body_a, *b = arb->body_b;
+	arb->refPos = relativePos(a, b);
+	arb->refAngle = b->a - a->a;
+	arb->refStamp = stamp;
+}
+
+int
+cpArbiterReuseContacts(cpArbiter *arb, cpFloat tolerance, cpTimestamp stamp, cpContact *contacts)
+{
+	// Run the collision detection again every so often, and whenever either shape changed since the contacts were generated.
+	if(stamp - arb->refStamp >= CP_CONTACT_REUSE_STEPS) return 0;
+	if(arb->a->modified >= arb->refStamp || arb->b->modified >= arb->refStamp) return 0;
+	
+	cpBody *a = arb->body_a, *b = arb->body_b;
+	cpContact *old = arb->contacts;
+	int count = arb->numContacts;
+	
+	// How far the contact points could have drifted relative to the bodies since they were generated.
+	cpFloat radius = 0.0f;
+	for(int i=0; i<count; i++) radius = cpfmax(radius, cpvdist(old[i].p, arb->posB));
+	
+	cpFloat drift = cpvdist(relativePos(a, b), arb->refPos) + cpfabs(b->a - a->a - arb->refAngle)*radius;
+	if(drift > tolerance) return 0;
+	
+	for(int i=0; i<count; i++){
+		cpContact *con = &contacts[i];
+		(*con) = old[i];
+		
+		// Move the contact point along with each body and measure the change in separation.
+		cpVect pa = cpvadd(a->p, cpvrotate(cpvunrotate(cpvsub(con->p, arb->posA), arb->rotA), a->rot));
+		cpVect pb = cpvadd(b->p, cpvrotate(cpvunrotate(cpvsub(con->p, arb->posB), arb->rotB), b->rot));
+		
+		con->n = cpvrotate(cpvunrotate(con->n, arb->rotA), a->rot);
+		con->dist += cpvdot(con->n, cpvsub(pb, pa));
+		con->p = cpvlerp(pa, pb, 0.5f);
+	}
+	
+	return count;
+}
+
 void
-cpArbiterPreStep(cpArbiter *arb, cpFloat dt, cpFloat slop, cpFloat bias)
+cpArbiterPreStep(cpArbiter *arb, cpFloat dt, cpFloat slop, cpFloat bias, cpBool block)
 {
 	cpBody *a = arb->body_a;
 	cpBody *b = arb->body_b;
@@ -251,7 +315,34 @@ cpArbiterPreStep(cpArbiter *arb, cpFloat dt, cpFloat slop, cpFloat bias)
 		con->jBias = 0.0f;
 		
 		// Calculate the target bounce velocity.
-		con->bounce = normal_relative_velocity(a, b, con->r1, con->r2, con->n)*arb->e;
+		if(con->dist > 0.0f){
+			// Speculative contacts only stop the shapes from closing more than the gap between them.
+			con->bounce = con->dist/dt;
+		} else {
+			con->bounce = normal_relative_velocity(a, b, con->r1, con->r2, con->n)*arb->e;
+		}
+	}
+	
+	// Calculate the normal mass matrix for solving the two contacts together.
+	arb->kDetInv = 0.0f;
+	if(block && arb->numContacts == 2){
+		cpContact *c1 = &arb->contacts[0];
+		cpContact *c2 = &arb->contacts[1];
+		
+		cpFloat k11 = 1.0f/c1->nMass;
+		cpFloat k22 = 1.0f/c2->nMass;
+		cpFloat k12 = (a->m_inv + b->m_inv)*cpvdot(c1->n, c2->n)
+			+ a->i_inv*cpvcross(c1->r1, c1->n)*cpvcross(c2->r1, c2->n)
+			+ b->i_inv*cpvcross(c1->r2, c1->n)*cpvcross(c2->r2, c2->n);
+		cpFloat det = k11*k22 - k12*k12;
+		
+		// Nearly coincident contacts make the matrix ill-conditioned, solve those one at a time.
+		if(k11*k11 < 1000.0f*det){
+			arb->k11 = k11;
+			arb->k12 = k12;
+			arb->k22 = k22;
+			arb->kDetInv = 1.0f/det;
+		}
 	}
 }
 
@@ -270,55 +361,182 @@ cpArbiterApplyCachedImpulse(cpArbiter *arb, cpFloat dt_coef)
 	}
 }
 
+static inline void
+applyBiasImpulse(cpBody *a, cpBody *b, cpContact *con)
+{
+	cpVect n = con->n;
+	cpVect r1 = con->r1;
+	cpVect r2 = con->r2;
+	
+	// Calculate the relative bias velocities.
+	cpVect vb1 = cpvadd(a->v_bias, cpvmult(cpvperp(r1), a->w_bias));
+	cpVect vb2 = cpvadd(b->v_bias, cpvmult(cpvperp(r2), b->w_bias));
+	cpFloat vbn = cpvdot(cpvsub(vb2, vb1), n);
+	
+	// Calculate and clamp the bias impulse.
+	cpFloat jbn = (con->bias - vbn)*con->nMass;
+	cpFloat jbnOld = con->jBias;
+	con->jBias = cpfmax(jbnOld + jbn, 0.0f);
+	jbn = con->jBias - jbnOld;
+	
+	// Apply the bias impulse.
+	apply_bias_impulses(a, b, r1, r2, cpvmult(n, jbn));
+}
+
+static inline cpFloat
+applyFrictionImpulse(cpArbiter *arb, cpBody *a, cpBody *b, cpContact *con, cpVect vr)
+{
+	// Calculate the relative tangent velocity.
+	cpFloat vrt = cpvdot(cpvadd(vr, arb->surface_vr), cpvperp(con->n));
+	
+	// Calculate and clamp the friction impulse.
+	cpFloat jtMax = arb->u*con->jnAcc;
+	cpFloat jt = -vrt*con->tMass;
+	cpFloat jtOld = con->jtAcc;
+	con->jtAcc = cpfclamp(jtOld + jt, -jtMax, jtMax);
+	jt = con->jtAcc - jtOld;
+	
+	// Apply the friction impulse.
+	apply_impulses(a, b, con->r1, con->r2, cpvmult(cpvperp(con->n), jt));
+	
+	return cpfabs(jt);
+}
+
+static inline cpFloat
+applyContactImpulse(cpArbiter *arb, cpBody *a, cpBody *b, cpContact *con)
+{
+	cpVect n = con->n;
+	cpVect r1 = con->r1;
+	cpVect r2 = con->r2;
+	
+	// Calculate the relative velocity.
+	cpVect vr = relative_velocity(a, b, r1, r2);
+	cpFloat vrn = cpvdot(vr, n);
+	
+	// Calculate and clamp the normal impulse.
+	cpFloat jn = -(con->bounce + vrn)*con->nMass;
+	cpFloat jnOld = con->jnAcc;
+	con->jnAcc = cpfmax(jnOld + jn, 0.0f);
+	jn = con->jnAcc - jnOld;
+	
+	// Calculate the relative tangent velocity.
+	cpFloat vrt = cpvdot(cpvadd(vr, arb->surface_vr), cpvperp(n));
+	
+	// Calculate and clamp the friction impulse.
+	cpFloat jtMax = arb->u*con->jnAcc;
+	cpFloat jt = -vrt*con->tMass;
+	cpFloat jtOld = con->jtAcc;
+	con->jtAcc = cpfclamp(jtOld + jt, -jtMax, jtMax);
+	jt = con->jtAcc - jtOld;
+	
+	// Apply the final impulse.
+	apply_impulses(a, b, r1, r2, cpvrotate(n, cpv(jn, jt)));
+	
+	return cpfmax(cpfabs(jn), cpfabs(jt));
+}
+
+// Solve the 2x2 mixed linear complementarity problem for the accumulated normal impulses of two contacts.
+// acc holds the current accumulated impulses and vn the current normal velocities minus their targets.
+// Returns false if none of the four cases gave a feasible solution (only possible due to round off).
+static cpBool
+solveBlock(cpArbiter *arb, cpVect acc, cpVect vn, cpVect *result)
+{
+	cpFloat k11 = arb->k11, k12 = arb->k12, k22 = arb->k22;
+	cpFloat b1 = vn.x - (k11*acc.x + k12*acc.y);
+	cpFloat b2 = vn.y - (k12*acc.x + k22*acc.y);
+	
+	// Both contacts pushing.
+	cpVect x = cpvmult(cpv(k12*b2 - k22*b1, k12*b1 - k11*b2), arb->kDetInv);
+	if(x.x >= 0.0f && x.y >= 0.0f){
+		(*result) = x;
+		return cpTrue;
+	}
+	
+	// Only the first contact pushing.
+	x = cpv(-b1/k11, 0.0f);
+	if(x.x >= 0.0f && k12*x.x + b2 >= 0.0f){
+		(*result) = x;
+		return cpTrue;
+	}
+	
+	// Only the second contact pushing.
+	x = cpv(0.0f, -b2/k22);
+	if(x.y >= 0.0f && k12*x.y + b1 >= 0.0f){
+		(*result) = x;
+		return cpTrue;
+	}
+	
+	// Both contacts separating.
+	if(b1 >= 0.0f && b2 >= 0.0f){
+		(*result) = cpvzero;
+		return cpTrue;
+	}
+	
+	return cpFalse;
+}
+
+static cpFloat
+applyBlockImpulse(cpArbiter *arb, cpBody *a, cpBody *b)
+{
+	cpContact *c1 = &arb->contacts[0];
+	cpContact *c2 = &arb->contacts[1];
+	cpVect x;
+	
+	// Calculate and apply the bias impulses.
+	cpVect vb1 = cpvsub(cpvadd(b->v_bias, cpvmult(cpvperp(c1->r2), b->w_bias)), cpvadd(a->v_bias, cpvmult(cpvperp(c1->r1), a->w_bias)));
+	cpVect vb2 = cpvsub(cpvadd(b->v_bias, cpvmult(cpvperp(c2->r2), b->w_bias)), cpvadd(a->v_bias, cpvmult(cpvperp(c2->r1), a->w_bias)));
+	cpVect jbAcc = cpv(c1->jBias, c2->jBias);
+	
+	if(solveBlock(arb, jbAcc, cpv(cpvdot(vb1, c1->n) - c1->bias, cpvdot(vb2, c2->n) - c2->bias), &x)){
+		c1->jBias = x.x;
+		c2->jBias = x.y;
+		apply_bias_impulses(a, b, c1->r1, c1->r2, cpvmult(c1->n, x.x - jbAcc.x));
+		apply_bias_impulses(a, b, c2->r1, c2->r2, cpvmult(c2->n, x.y - jbAcc.y));
+	} else {
+		applyBiasImpulse(a, b, c1);
+		applyBiasImpulse(a, b, c2);
+	}
+	
+	// Calculate and apply the normal impulses, then the friction impulses.
+	cpVect vr1 = relative_velocity(a, b, c1->r1, c1->r2);
+	cpVect vr2 = relative_velocity(a, b, c2->r1, c2->r2);
+	cpVect jnAcc = cpv(c1->jnAcc, c2->jnAcc);
+	
+	if(solveBlock(arb, jnAcc, cpv(cpvdot(vr1, c1->n) + c1->bounce, cpvdot(vr2, c2->n) + c2->bounce), &x)){
+		c1->jnAcc = x.x;
+		c2->jnAcc = x.y;
+		apply_impulses(a, b, c1->r1, c1->r2, cpvmult(c1->n, x.x - jnAcc.x));
+		apply_impulses(a, b, c2->r1, c2->r2, cpvmult(c2->n, x.y - jnAcc.y));
+		
+		cpFloat jt1 = applyFrictionImpulse(arb, a, b, c1, relative_velocity(a, b, c1->r1, c1->r2));
+		cpFloat jt2 = applyFrictionImpulse(arb, a, b, c2, relative_velocity(a, b, c2->r1, c2->r2));
+		
+		cpFloat jn = cpfmax(cpfabs(x.x - jnAcc.x), cpfabs(x.y - jnAcc.y));
+		return cpfmax(jn, cpfmax(jt1, jt2));
+	} else {
+		cpFloat j1 = applyContactImpulse(arb, a, b, c1);
+		cpFloat j2 = applyContactImpulse(arb, a, b, c2);
+		return cpfmax(j1, j2);
+	}
+}
+
 // TODO is it worth splitting velocity/position correction?
 
-void
+// Returns the largest change in the accumulated normal or friction impulse of any contact.
+cpFloat
 cpArbiterApplyImpulse(cpArbiter *arb)
 {
 	cpBody *a = arb->body_a;
 	cpBody *b = arb->body_b;
-
+	
+	if(arb->kDetInv != 0.0f) return applyBlockImpulse(arb, a, b);
+	
+	cpFloat delta = 0.0f;
 	for(int i=0; i<arb->numContacts; i++){
 		cpContact *con = &arb->contacts[i];
-		cpVect n = con->n;
-		cpVect r1 = con->r1;
-		cpVect r2 = con->r2;
-		
-		// Calculate the relative bias velocities.
-		cpVect vb1 = cpvadd(a->v_bias, cpvmult(cpvperp(r1), a->w_bias));
-		cpVect vb2 = cpvadd(b->v_bias, cpvmult(cpvperp(r2), b->w_bias));
-		cpFloat vbn = cpvdot(cpvsub(vb2, vb1), n);
-		
-		// Calculate and clamp the bias impulse.
-		cpFloat jbn = (con->bias - vbn)*con->nMass;
-		cpFloat jbnOld = con->jBias;
-		con->jBias = cpfmax(jbnOld + jbn, 0.0f);
-		jbn = con->jBias - jbnOld;
-		
-		// Apply the bias impulse.
-		apply_bias_impulses(a, b, r1, r2, cpvmult(n, jbn));
-
-		// Calculate the relative velocity.
-		cpVect vr = relative_velocity(a, b, r1, r2);
-		cpFloat vrn = cpvdot(vr, n);
-		
-		// Calculate and clamp the normal impulse.
-		cpFloat jn = -(con->bounce + vrn)*con->nMass;
-		cpFloat jnOld = con->jnAcc;
-		con->jnAcc = cpfmax(jnOld + jn, 0.0f);
-		jn = con->jnAcc - jnOld;
-		
-		// Calculate the relative tangent velocity.
-		cpFloat vrt = cpvdot(cpvadd(vr, arb->surface_vr), cpvperp(n));
-		
-		// Calculate and clamp the friction impulse.
-		cpFloat jtMax = arb->u*con->jnAcc;
-		cpFloat jt = -vrt*con->tMass;
-		cpFloat jtOld = con->jtAcc;
-		con->jtAcc = cpfclamp(jtOld + jt, -jtMax, jtMax);
-		jt = con->jtAcc - jtOld;
-		
-		// Apply the final impulse.
-		apply_impulses(a, b, r1, r2, cpvrotate(n, cpv(jn, jt)));
+		applyBiasImpulse(a, b, con);
+		delta = cpfmax(delta, applyContactImpulse(arb, a, b, con));
 	}
+	
+	return delta;
 }
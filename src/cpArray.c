@@ -26,25 +26,33 @@
 
 
 cpArray *
-cpArrayNew(int size)
+cpArrayNewWithAllocator(int size, const cpAllocator *allocator)
 {
-	cpArray *arr = (cpArray *)cpcalloc(1, sizeof(cpArray));
+	cpArray *arr = (cpArray *)cpAllocatorCalloc(allocator, 1, sizeof(cpArray));
 	
 	arr->num = 0;
 	arr->max = (size ? size : 4);
-	arr->arr = (void **)cpcalloc(arr->max, sizeof(void**));
+	arr->arr = (void **)cpAllocatorCalloc(allocator, arr->max, sizeof(void**));
+	arr->allocator = allocator;
 	
 	return arr;
 }
 
+cpArray *
+cpArrayNew(int size)
+{
+	return cpArrayNewWithAllocator(size, NULL);
+}
+
 void
 cpArrayFree(cpArray *arr)
 {
 	if(arr){
-		cpfree(arr->arr);
+		const cpAllocator *allocator = arr->allocator;
+		cpAllocatorFree(allocator, arr->arr);
 		arr->arr = NULL;
 		
-		cpfree(arr);
+		cpAllocatorFree(allocator, arr);
 	}
 }
 
@@ -53,7 +61,7 @@ cpArrayPush(cpArray *arr, void *object)
 {
 	if(arr->num == arr->max){
 		arr->max *= 2;
-		arr->arr = (void **)cprealloc(arr->arr, arr->max*sizeof(void**));
+		arr->arr = (void **)cpAllocatorRealloc(arr->allocator, arr->arr, arr->max*sizeof(void**));
 	}
 	
 	arr->arr[arr->num] = object;
@@ -115,6 +123,137 @@ cpArrayFreeEach(cpArray *arr, void (freeFunc)(void*))
 	for(int i=0; i<arr->num; i++) freeFunc(arr->arr[i]);
 }
 
+void
+cpArrayFreeEachBlock(cpArray *arr)
+{
+	for(int i=0; i<arr->num; i++) cpAllocatorFree(arr->allocator, arr->arr[i]);
+}
+
+static int
+comparePointers(const void *a, const void *b)
+{
+	size_t pa = (size_t)*(void **)a, pb = (size_t)*(void **)b;
+	return (pa > pb) - (pa < pb);
+}
+
+// Index of the buffer in the sorted array that holds the block, or -1.
+static int
+findBuffer(cpArray *buffers, size_t bufferSize, char *block)
+{
+	int lo = 0, hi = buffers->num;
+	while(hi - lo > 1){
+		int mid = (lo + hi)/2;
+		if((char *)buffers->arr[mid] <= block) lo = mid; else hi = mid;
+	}
+	
+	char *buffer = (char *)buffers->arr[lo];
+	return (buffer <= block && block < buffer + bufferSize ? lo : -1);
+}
+
+size_t
+cpArrayTrimBuffers(cpArray *buffers, size_t bufferSize, cpArray *blocks, size_t blockSize)
+{
+	int count = buffers->num;
+	if(count == 0 || blocks->num == 0) return 0;
+	
+	const cpAllocator *allocator = buffers->allocator;
+	qsort(buffers->arr, count, sizeof(void *), comparePointers);
+	
+	// Count the unused blocks in each buffer.
+	// Buffers that belong to other pools hold none of the blocks and are left alone.
+	int *unused = (int *)cpAllocatorCalloc(allocator, count, sizeof(int));
+	for(int i=0; i<blocks->num; i++){
+		int idx = findBuffer(buffers, bufferSize, (char *)blocks->arr[i]);
+		if(idx >= 0) unused[idx]++;
+	}
+	
+	// Drop the blocks of the buffers that are about to be freed.
+	int capacity = (int)(bufferSize/blockSize);
+	for(int i=0; i<blocks->num;){
+		int idx = findBuffer(buffers, bufferSize, (char *)blocks->arr[i]);
+		
+		if(idx >= 0 && unused[idx] == capacity){
+			blocks->num--;
+			blocks->arr[i] = blocks->arr[blocks->num];
+			blocks->arr[blocks->num] = NULL;
+		} else {
+			i++;
+		}
+	}
+	
+	size_t freed = 0;
+	int kept = 0;
+	for(int i=0; i<count; i++){
+		if(unused[i] == capacity){
+			cpAllocatorFree(allocator, buffers->arr[i]);
+			freed += bufferSize;
+		} else {
+			buffers->arr[kept++] = buffers->arr[i];
+		}
+	}
+	
+	for(int i=kept; i<count; i++) buffers->arr[i] = NULL;
+	buffers->num = kept;
+	
+	cpAllocatorFree(allocator, unused);
+	return freed;
+}
+
+size_t
+cpArrayGetBytes(cpArray *arr)
+{
+	return sizeof(cpArray) + arr->max*sizeof(void *);
+}
+
+int
+cpArrayPlanCompaction(cpArray *live, cpArray *unused)
+{
+	qsort(live->arr, live->num, sizeof(void *), comparePointers);
+	qsort(unused->arr, unused->num, sizeof(void *), comparePointers);
+	
+	// Blocks that were pushed more than once only need to be moved once.
+	int num = 0;
+	for(int i=0; i<live->num; i++){
+		if(num == 0 || live->arr[num - 1] != live->arr[i]) live->arr[num++] = live->arr[i];
+	}
+	live->num = num;
+	
+	int count = 0;
+	while(
+		count < live->num && count < unused->num &&
+		(size_t)unused->arr[count] < (size_t)live->arr[live->num - 1 - count]
+	) count++;
+	
+	return count;
+}
+
+void *
+cpArrayCompactionDest(cpArray *live, cpArray *unused, int count, void *block)
+{
+	// The moved blocks are the last count blocks of live, in ascending order.
+	int lo = live->num - count, hi = live->num;
+	while(lo < hi){
+		int mid = (lo + hi)/2;
+		size_t addr = (size_t)live->arr[mid];
+		
+		if(addr == (size_t)block){
+			return unused->arr[live->num - 1 - mid];
+		} else if(addr < (size_t)block){
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	
+	return NULL;
+}
+
+void
+cpArrayFinishCompaction(cpArray *live, cpArray *unused, int count)
+{
+	for(int i=0; i<count; i++) unused->arr[i] = live->arr[live->num - 1 - i];
+}
+
 cpBool
 cpArrayContains(cpArray *arr, void *ptr)
 {
@@ -123,3 +262,139 @@ cpArrayContains(cpArray *arr, void *ptr)
 	
 	return cpFalse;
 }
+
+void
+cpArraySnapshot(cpArray *arr, cpSnapshotCursor *cursor)
+{
+	int num = arr->num;
+	cpSnapshotTransfer(cursor, &num, sizeof(int));
+	
+	if(num > arr->max){
+		arr->max = num;
+		arr->arr = (void **)cpAllocatorRealloc(arr->allocator, arr->arr, arr->max*sizeof(void**));
+	}
+	
+	arr->num = num;
+	
+	cpSnapshotTransfer(cursor, arr->arr, num*sizeof(void *));
+}
+
+void
+cpArraySnapshotBuffers(cpArray *buffers, cpSnapshotCursor *cursor)
+{
+	int count = buffers->num;
+	cpSnapshotTransfer(cursor, &count, sizeof(int));
+	cpAssertHard(count <= buffers->num, "The snapshot was taken from different objects or memory was trimmed since.");
+	
+	// Nothing restored below can point into the buffers allocated after the snapshot.
+	for(int i=count; i<buffers->num; i++){
+		cpAllocatorFree(buffers->allocator, buffers->arr[i]);
+		buffers->arr[i] = NULL;
+	}
+	buffers->num = count;
+	
+	for(int i=0; i<count; i++) cpSnapshotCheckPointer(cursor, buffers->arr[i]);
+}
+
+cpArray *
+cpArrayCloneBuffers(cpArray *buffers, size_t bufferSize, cpRelocation *rel)
+{
+	const cpAllocator *allocator = buffers->allocator;
+	cpArray *copy = cpArrayNewWithAllocator(buffers->num, allocator);
+	
+	for(int i=0; i<buffers->num; i++){
+		void *buffer = cpAllocatorCalloc(allocator, 1, bufferSize);
+		memcpy(buffer, buffers->arr[i], bufferSize);
+		
+		cpArrayPush(copy, buffer);
+		cpRelocationAdd(rel, buffers->arr[i], buffer, bufferSize);
+	}
+	
+	return copy;
+}
+
+typedef struct cpRelocationEntry {
+	char *from, *to;
+	size_t size;
+} cpRelocationEntry;
+
+struct cpRelocation {
+	int num, max;
+	cpRelocationEntry *entries;
+	
+	// Entries are sorted by their original address the first time they are looked up.
+	cpBool sorted;
+	// Consecutive lookups tend to land in the same buffer.
+	int last;
+	
+	const cpAllocator *allocator;
+};
+
+cpRelocation *
+cpRelocationNew(const cpAllocator *allocator)
+{
+	cpRelocation *rel = (cpRelocation *)cpAllocatorCalloc(allocator, 1, sizeof(cpRelocation));
+	rel->allocator = allocator;
+	rel->sorted = cpTrue;
+	
+	return rel;
+}
+
+void
+cpRelocationFree(cpRelocation *rel)
+{
+	if(rel){
+		cpAllocatorFree(rel->allocator, rel->entries);
+		cpAllocatorFree(rel->allocator, rel);
+	}
+}
+
+void
+cpRelocationAdd(cpRelocation *rel, void *from, void *to, size_t size)
+{
+	if(rel->num == rel->max){
+		rel->max = (rel->max ? 2*rel->max : 16);
+		rel->entries = (cpRelocationEntry *)cpAllocatorRealloc(rel->allocator, rel->entries, rel->max*sizeof(cpRelocationEntry));
+	}
+	
+	cpRelocationEntry entry = {(char *)from, (char *)to, size};
+	rel->entries[rel->num++] = entry;
+	rel->sorted = cpFalse;
+}
+
+static int
+compareEntries(const cpRelocationEntry *a, const cpRelocationEntry *b)
+{
+	return (a->from < b->from ? -1 : (a->from > b->from));
+}
+
+void *
+cpRelocate(cpRelocation *rel, void *ptr)
+{
+	if(!rel->sorted){
+		qsort(rel->entries, rel->num, sizeof(cpRelocationEntry), (int (*)(const void *, const void *))compareEntries);
+		rel->sorted = cpTrue;
+		rel->last = 0;
+	}
+	
+	char *addr = (char *)ptr;
+	if(!addr || rel->num == 0) return ptr;
+	
+	cpRelocationEntry *entry = &rel->entries[rel->last];
+	if(entry->from <= addr && addr < entry->from + entry->size) return entry->to + (addr - entry->from);
+	
+	// Find the last entry that starts at or before ptr.
+	cpRelocationEntry *base = rel->entries;
+	for(int n = rel->num; n > 1;){
+		int half = n/2;
+		base = (base[half].from <= addr ? base + half : base);
+		n -= half;
+	}
+	
+	if(base->from <= addr && addr < base->from + base->size){
+		rel->last = (int)(base - rel->entries);
+		return base->to + (addr - base->from);
+	}
+	
+	return ptr;
+}
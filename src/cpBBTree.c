@@ -20,6 +20,7 @@
  */
 
 #include "stdlib.h"
+#include "stddef.h"
 #include "stdio.h"
 
 #include "chipmunk_private.h"
@@ -32,6 +33,7 @@ typedef struct Pair Pair;
 struct cpBBTree {
 	cpSpatialIndex spatialIndex;
 	cpBBTreeVelocityFunc velocityFunc;
+	cpBBTreeFilterFunc filterFunc;
 	
 	cpHashSet *leaves;
 	Node *root;
@@ -48,6 +50,11 @@ struct Node {
 	cpBB bb;
 	Node *parent;
 	
+	// The filter of a leaf's object.
+	// Internal nodes store the union of the layers in the subtree along with
+	// the owner and group shared by all the leaves, or NULL and CP_NO_GROUP if they differ.
+	cpBBTreeFilter filter;
+	
 	union {
 		// Internal nodes
 		struct { Node *a, *b; };
@@ -94,6 +101,22 @@ GetBB(cpBBTree *tree, void *obj)
 	}
 }
 
+// Filter that accepts everything.
+static const cpBBTreeFilter NoFilter = {NULL, CP_ALL_LAYERS, CP_NO_GROUP};
+
+static inline cpBBTreeFilter
+GetFilter(cpBBTree *tree, void *obj)
+{
+	cpBBTreeFilterFunc filterFunc = tree->filterFunc;
+	return (filterFunc ? filterFunc(obj) : NoFilter);
+}
+
+static inline cpBool
+FilterEql(cpBBTreeFilter a, cpBBTreeFilter b)
+{
+	return (a.owner == b.owner && a.layers == b.layers && a.group == b.group);
+}
+
 static inline cpBBTree *
 GetTree(cpSpatialIndex *index)
 {
@@ -105,6 +128,13 @@ GetRootIfTree(cpSpatialIndex *index){
 	return (index && index->klass == Klass() ? ((cpBBTree *)index)->root : NULL);
 }
 
+static inline cpBBTree *
+GetMasterTree(cpBBTree *tree)
+{
+	cpBBTree *dynamicTree = GetTree(tree->spatialIndex.dynamicIndex);
+	return (dynamicTree ? dynamicTree : tree);
+}
+
 static inline cpTimestamp
 GetStamp(cpBBTree *tree)
 {
@@ -128,6 +158,9 @@ IncrementStamp(cpBBTree *tree)
 static void
 PairRecycle(cpBBTree *tree, Pair *pair)
 {
+	// Pairs are always allocated by the dynamic tree, so return them there.
+	tree = GetMasterTree(tree);
+	
 	pair->a.next = tree->pooledPairs;
 	tree->pooledPairs = pair;
 }
@@ -145,7 +178,7 @@ PairFromPool(cpBBTree *tree)
 		int count = CP_BUFFER_BYTES/sizeof(Pair);
 		cpAssertSoft(count, "Buffer size is too small.");
 		
-		Pair *buffer = (Pair *)cpcalloc(1, CP_BUFFER_BYTES);
+		Pair *buffer = (Pair *)cpAllocatorCalloc(tree->spatialIndex.allocator, 1, CP_BUFFER_BYTES);
 		cpArrayPush(tree->allocatedBuffers, buffer);
 		
 		// push all but the first one, return the first instead
@@ -234,7 +267,7 @@ NodeFromPool(cpBBTree *tree)
 		int count = CP_BUFFER_BYTES/sizeof(Node);
 		cpAssertSoft(count, "Buffer size is too small.");
 		
-		Node *buffer = (Node *)cpcalloc(1, CP_BUFFER_BYTES);
+		Node *buffer = (Node *)cpAllocatorCalloc(tree->spatialIndex.allocator, 1, CP_BUFFER_BYTES);
 		cpArrayPush(tree->allocatedBuffers, buffer);
 		
 		// push all but the first one, return the first instead
@@ -257,6 +290,23 @@ NodeSetB(Node *node, Node *value)
 	value->parent = node;
 }
 
+static inline void
+NodeMergeFilter(Node *node, Node *a, Node *b)
+{
+	cpBBTreeFilter fa = a->filter, fb = b->filter;
+	node->filter.owner = (fa.owner == fb.owner ? fa.owner : NULL);
+	node->filter.layers = fa.layers | fb.layers;
+	node->filter.group = (fa.group == fb.group ? fa.group : CP_NO_GROUP);
+}
+
+// Returns true if nothing in the subtree can pass the filter.
+static inline cpBool
+NodeRejectFilter(Node *node, cpBBTreeFilter filter)
+{
+	cpBBTreeFilter f = node->filter;
+	return (!(f.layers & filter.layers) || (filter.group && f.group == filter.group) || (filter.owner && f.owner == filter.owner));
+}
+
 static Node *
 NodeNew(cpBBTree *tree, Node *a, Node *b)
 {
@@ -264,6 +314,7 @@ NodeNew(cpBBTree *tree, Node *a, Node *b)
 	
 	node->obj = NULL;
 	node->bb = cpBBMerge(a->bb, b->bb);
+	NodeMergeFilter(node, a, b);
 	node->parent = NULL;
 	
 	NodeSetA(node, a);
@@ -300,6 +351,7 @@ NodeReplaceChild(Node *parent, Node *child, Node *value, cpBBTree *tree)
 	
 	for(Node *node=parent; node; node = node->parent){
 		node->bb = cpBBMerge(node->a->bb, node->b->bb);
+		NodeMergeFilter(node, node->a, node->b);
 	}
 }
 
@@ -326,19 +378,20 @@ SubtreeInsert(Node *subtree, Node *leaf, cpBBTree *tree)
 		}
 		
 		subtree->bb = cpBBMerge(subtree->bb, leaf->bb);
+		NodeMergeFilter(subtree, subtree->a, subtree->b);
 		return subtree;
 	}
 }
 
 static void
-SubtreeQuery(Node *subtree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+SubtreeQuery(Node *subtree, void *obj, cpBB bb, cpBBTreeFilter filter, cpSpatialIndexQueryFunc func, void *data)
 {
-	if(cpBBIntersects(subtree->bb, bb)){
+	if(cpBBIntersects(subtree->bb, bb) && !NodeRejectFilter(subtree, filter)){
 		if(NodeIsLeaf(subtree)){
 			func(obj, subtree->obj, data);
 		} else {
-			SubtreeQuery(subtree->a, obj, bb, func, data);
-			SubtreeQuery(subtree->b, obj, bb, func, data);
+			SubtreeQuery(subtree->a, obj, bb, filter, func, data);
+			SubtreeQuery(subtree->b, obj, bb, filter, func, data);
 		}
 	}
 }
@@ -346,14 +399,14 @@ SubtreeQuery(Node *subtree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, vo
 
 // TODO Needs early exit optimization for ray queries
 static void
-SubtreeSegmentQuery(Node *subtree, void *obj, cpVect a, cpVect b, cpSpatialIndexSegmentQueryFunc func, void *data)
+SubtreeSegmentQuery(Node *subtree, void *obj, cpVect a, cpVect b, cpBBTreeFilter filter, cpSpatialIndexSegmentQueryFunc func, void *data)
 {
-	if(cpBBIntersectsSegment(subtree->bb, a, b)){
+	if(!NodeRejectFilter(subtree, filter) && cpBBIntersectsSegment(subtree->bb, a, b)){
 		if(NodeIsLeaf(subtree)){
 			func(obj, subtree->obj, data);
 		} else {
-			SubtreeSegmentQuery(subtree->a, obj, a, b, func, data);
-			SubtreeSegmentQuery(subtree->b, obj, a, b, func, data);
+			SubtreeSegmentQuery(subtree->a, obj, a, b, filter, func, data);
+			SubtreeSegmentQuery(subtree->b, obj, a, b, filter, func, data);
 		}
 	}
 }
@@ -399,7 +452,7 @@ typedef struct MarkContext {
 static void
 MarkLeafQuery(Node *subtree, Node *leaf, cpBool left, MarkContext *context)
 {
-	if(cpBBIntersects(leaf->bb, subtree->bb)){
+	if(cpBBIntersects(leaf->bb, subtree->bb) && !NodeRejectFilter(subtree, leaf->filter)){
 		if(NodeIsLeaf(subtree)){
 			if(left){
 				PairInsert(leaf, subtree, context->tree);
@@ -461,6 +514,7 @@ LeafNew(cpBBTree *tree, void *obj, cpBB bb)
 	Node *node = NodeFromPool(tree);
 	node->obj = obj;
 	node->bb = GetBB(tree, obj);
+	node->filter = GetFilter(tree, obj);
 	
 	node->parent = NULL;
 	node->stamp = 0;
@@ -474,9 +528,12 @@ LeafUpdate(Node *leaf, cpBBTree *tree)
 {
 	Node *root = tree->root;
 	cpBB bb = tree->spatialIndex.bbfunc(leaf->obj);
+	cpBBTreeFilter filter = GetFilter(tree, leaf->obj);
 	
-	if(!cpBBContainsBB(leaf->bb, bb)){
+	// Cached pairs were filtered using the old filter, so a filter change must be treated like a move.
+	if(!cpBBContainsBB(leaf->bb, bb) || !FilterEql(filter, leaf->filter)){
 		leaf->bb = GetBB(tree, leaf->obj);
+		leaf->filter = filter;
 		
 		root = SubtreeRemove(root, leaf, tree);
 		tree->root = SubtreeInsert(root, leaf, tree);
@@ -536,12 +593,14 @@ cpBBTreeInit(cpBBTree *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *static
 	cpSpatialIndexInit((cpSpatialIndex *)tree, Klass(), bbfunc, staticIndex);
 	
 	tree->velocityFunc = NULL;
+	tree->filterFunc = NULL;
 	
-	tree->leaves = cpHashSetNew(0, (cpHashSetEqlFunc)leafSetEql);
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	tree->leaves = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)leafSetEql, allocator);
 	tree->root = NULL;
 	
 	tree->pooledNodes = NULL;
-	tree->allocatedBuffers = cpArrayNew(0);
+	tree->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
 	
 	tree->stamp = 0;
 	
@@ -559,18 +618,57 @@ cpBBTreeSetVelocityFunc(cpSpatialIndex *index, cpBBTreeVelocityFunc func)
 	((cpBBTree *)index)->velocityFunc = func;
 }
 
+void
+cpBBTreeSetFilterFunc(cpSpatialIndex *index, cpBBTreeFilterFunc func)
+{
+	if(index->klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpBBTreeSetFilterFunc() call to non-tree spatial index.");
+		return;
+	}
+	
+	((cpBBTree *)index)->filterFunc = func;
+	
+	// Refilter and rebuild the pairs for any existing leaves.
+	cpSpatialIndexReindex(index);
+}
+
+static void
+LeafRefilter(Node *leaf, cpBBTree *tree)
+{
+	if(!FilterEql(GetFilter(tree, leaf->obj), leaf->filter) && LeafUpdate(leaf, tree)) LeafAddPairs(leaf, tree);
+}
+
+void
+cpBBTreeRefilter(cpSpatialIndex *index)
+{
+	cpBBTree *tree = GetTree(index);
+	if(!tree || !tree->filterFunc) return;
+	
+	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)LeafRefilter, tree);
+	IncrementStamp(tree);
+}
+
 cpSpatialIndex *
 cpBBTreeNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
 {
 	return cpBBTreeInit(cpBBTreeAlloc(), bbfunc, staticIndex);
 }
 
+cpSpatialIndex *
+cpBBTreeNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator)
+{
+	cpBBTree *tree = (cpBBTree *)cpAllocatorCalloc(allocator, 1, sizeof(cpBBTree));
+	tree->spatialIndex.allocator = allocator;
+	
+	return cpBBTreeInit(tree, bbfunc, staticIndex);
+}
+
 static void
 cpBBTreeDestroy(cpBBTree *tree)
 {
 	cpHashSetFree(tree->leaves);
 	
-	if(tree->allocatedBuffers) cpArrayFreeEach(tree->allocatedBuffers, cpfree);
+	if(tree->allocatedBuffers) cpArrayFreeEachBlock(tree->allocatedBuffers);
 	cpArrayFree(tree->allocatedBuffers);
 }
 
@@ -647,20 +745,59 @@ static void
 cpBBTreePointQuery(cpBBTree *tree, cpVect point, cpSpatialIndexQueryFunc func, void *data)
 {
 	Node *root = tree->root;
-	if(root) SubtreeQuery(root, &point, cpBBNew(point.x, point.y, point.x, point.y), func, data);
+	if(root) SubtreeQuery(root, &point, cpBBNew(point.x, point.y, point.x, point.y), NoFilter, func, data);
 }
 
 static void
 cpBBTreeSegmentQuery(cpBBTree *tree, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
 {
 	Node *root = tree->root;
-	if(root) SubtreeSegmentQuery(root, obj, a, b, func, data);
+	if(root) SubtreeSegmentQuery(root, obj, a, b, NoFilter, func, data);
 }
 
 static void
 cpBBTreeQuery(cpBBTree *tree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
 {
-	if(tree->root) SubtreeQuery(tree->root, obj, bb, func, data);
+	if(tree->root) SubtreeQuery(tree->root, obj, bb, NoFilter, func, data);
+}
+
+void
+cpBBTreePointQueryFiltered(cpSpatialIndex *index, cpVect point, cpLayers layers, cpGroup group, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpBBTree *tree = GetTree(index);
+	if(tree){
+		Node *root = tree->root;
+		cpBBTreeFilter filter = {NULL, layers, group};
+		if(root) SubtreeQuery(root, &point, cpBBNew(point.x, point.y, point.x, point.y), filter, func, data);
+	} else {
+		cpSpatialIndexPointQuery(index, point, func, data);
+	}
+}
+
+void
+cpBBTreeSegmentQueryFiltered(cpSpatialIndex *index, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpLayers layers, cpGroup group, cpSpatialIndexSegmentQueryFunc func, void *data)
+{
+	cpBBTree *tree = GetTree(index);
+	if(tree){
+		Node *root = tree->root;
+		cpBBTreeFilter filter = {NULL, layers, group};
+		if(root) SubtreeSegmentQuery(root, obj, a, b, filter, func, data);
+	} else {
+		cpSpatialIndexSegmentQuery(index, obj, a, b, t_exit, func, data);
+	}
+}
+
+void
+cpBBTreeQueryFiltered(cpSpatialIndex *index, void *obj, cpBB bb, cpLayers layers, cpGroup group, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpBBTree *tree = GetTree(index);
+	if(tree){
+		Node *root = tree->root;
+		cpBBTreeFilter filter = {NULL, layers, group};
+		if(root) SubtreeQuery(root, obj, bb, filter, func, data);
+	} else {
+		cpSpatialIndexQuery(index, obj, bb, func, data);
+	}
 }
 
 #pragma mark Misc
@@ -685,6 +822,396 @@ cpBBTreeEach(cpBBTree *tree, cpSpatialIndexIteratorFunc func, void *data)
 	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)each_helper, &context);
 }
 
+#pragma mark Memory Trimming
+
+static void
+SubtreePushNodes(Node *subtree, cpArray *nodes)
+{
+	cpArrayPush(nodes, subtree);
+	
+	if(!NodeIsLeaf(subtree)){
+		SubtreePushNodes(subtree->a, nodes);
+		SubtreePushNodes(subtree->b, nodes);
+	}
+}
+
+static void
+NodeMove(Node *node, Node *dest, cpBBTree *tree)
+{
+	(*dest) = (*node);
+	
+	Node *parent = dest->parent;
+	if(parent){
+		if(parent->a == node) parent->a = dest; else parent->b = dest;
+	} else {
+		tree->root = dest;
+	}
+	
+	if(NodeIsLeaf(dest)){
+		for(Pair *pair = dest->pairs; pair;){
+			if(pair->a.leaf == node){
+				pair->a.leaf = dest;
+				pair = pair->a.next;
+			} else {
+				pair->b.leaf = dest;
+				pair = pair->b.next;
+			}
+		}
+	} else {
+		dest->a->parent = dest;
+		dest->b->parent = dest;
+	}
+}
+
+typedef struct CompactContext {
+	cpArray *live, *unused;
+	int count;
+} CompactContext;
+
+static void *
+leafSetRemap(Node *leaf, CompactContext *context)
+{
+	Node *dest = (Node *)cpArrayCompactionDest(context->live, context->unused, context->count, leaf);
+	return (dest ? dest : leaf);
+}
+
+static void
+PushLivePairs(Node *leaf, cpArray *pairs)
+{
+	// Every pair is pushed by its 'a' leaf only.
+	for(Pair *pair = leaf->pairs; pair;){
+		if(pair->a.leaf == leaf){
+			cpArrayPush(pairs, pair);
+			pair = pair->a.next;
+		} else {
+			pair = pair->b.next;
+		}
+	}
+}
+
+static inline void
+ThreadRelink(Thread thread, Pair *dest)
+{
+	Pair *next = thread.next;
+	Pair *prev = thread.prev;
+	
+	if(next){
+		if(next->a.leaf == thread.leaf) next->a.prev = dest; else next->b.prev = dest;
+	}
+	
+	if(prev){
+		if(prev->a.leaf == thread.leaf) prev->a.next = dest; else prev->b.next = dest;
+	} else {
+		thread.leaf->pairs = dest;
+	}
+}
+
+static void
+PairMove(Pair *pair, Pair *dest)
+{
+	(*dest) = (*pair);
+	ThreadRelink(dest->a, dest);
+	ThreadRelink(dest->b, dest);
+}
+
+static size_t
+cpBBTreeTrim(cpBBTree *tree)
+{
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	cpArray *live = cpArrayNewWithAllocator(0, allocator);
+	cpArray *unused = cpArrayNewWithAllocator(0, allocator);
+	size_t freed = 0;
+	
+	// Move the nodes into the lowest free nodes, leaving the tree's shape as it is.
+	if(tree->root) SubtreePushNodes(tree->root, live);
+	for(Node *node = tree->pooledNodes; node; node = node->parent) cpArrayPush(unused, node);
+	
+	int count = cpArrayPlanCompaction(live, unused);
+	if(count){
+		for(int i=0; i<count; i++) NodeMove((Node *)live->arr[live->num - 1 - i], (Node *)unused->arr[i], tree);
+		
+		CompactContext context = {live, unused, count};
+		cpHashSetRemap(tree->leaves, (cpHashSetTransFunc)leafSetRemap, &context);
+		cpArrayFinishCompaction(live, unused, count);
+	}
+	
+	freed += cpArrayTrimBuffers(tree->allocatedBuffers, CP_BUFFER_BYTES, unused, sizeof(Node));
+	
+	tree->pooledNodes = NULL;
+	for(int i=unused->num-1; i>=0; i--) NodeRecycle(tree, (Node *)unused->arr[i]);
+	
+	// Pairs are owned by the dynamic tree, but can reference the leaves of the static tree too.
+	if(tree == GetMasterTree(tree)){
+		live->num = unused->num = 0;
+		
+		cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)PushLivePairs, live);
+		cpBBTree *staticTree = GetTree(tree->spatialIndex.staticIndex);
+		if(staticTree) cpHashSetEach(staticTree->leaves, (cpHashSetIteratorFunc)PushLivePairs, live);
+		
+		for(Pair *pair = tree->pooledPairs; pair; pair = pair->a.next) cpArrayPush(unused, pair);
+		
+		count = cpArrayPlanCompaction(live, unused);
+		for(int i=0; i<count; i++) PairMove((Pair *)live->arr[live->num - 1 - i], (Pair *)unused->arr[i]);
+		cpArrayFinishCompaction(live, unused, count);
+		
+		freed += cpArrayTrimBuffers(tree->allocatedBuffers, CP_BUFFER_BYTES, unused, sizeof(Pair));
+		
+		tree->pooledPairs = NULL;
+		for(int i=unused->num-1; i>=0; i--) PairRecycle(tree, (Pair *)unused->arr[i]);
+	}
+	
+	cpArrayFree(live);
+	cpArrayFree(unused);
+	
+	return freed + cpHashSetTrim(tree->leaves);
+}
+
+static void
+cpBBTreeGetPoolStats(cpBBTree *tree, cpPoolStats *stats)
+{
+	int nodes = 0, pairs = 0;
+	for(Node *node = tree->pooledNodes; node; node = node->parent) nodes++;
+	for(Pair *pair = tree->pooledPairs; pair; pair = pair->a.next) pairs++;
+	
+	stats->bytes += tree->allocatedBuffers->num*CP_BUFFER_BYTES;
+	stats->unusedBytes += nodes*sizeof(Node) + pairs*sizeof(Pair);
+	
+	cpHashSetGetStats(tree->leaves, stats);
+}
+
+static void
+CountLivePairs(Node *leaf, int *count)
+{
+	for(Pair *pair = leaf->pairs; pair;){
+		if(pair->a.leaf == leaf){
+			(*count)++;
+			pair = pair->a.next;
+		} else {
+			pair = pair->b.next;
+		}
+	}
+}
+
+static void
+cpBBTreeGetMemoryStats(cpBBTree *tree, cpSpatialIndexMemoryStats *stats)
+{
+	int leaves = cpHashSetCount(tree->leaves);
+	int nodes = (leaves ? 2*leaves - 1 : 0);
+	
+	int pooledNodes = 0;
+	for(Node *node = tree->pooledNodes; node; node = node->parent) pooledNodes++;
+	
+	int pairs = 0, pooledPairs = 0;
+	if(tree == GetMasterTree(tree)){
+		cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)CountLivePairs, &pairs);
+		cpBBTree *staticTree = GetTree(tree->spatialIndex.staticIndex);
+		if(staticTree) cpHashSetEach(staticTree->leaves, (cpHashSetIteratorFunc)CountLivePairs, &pairs);
+		
+		for(Pair *pair = tree->pooledPairs; pair; pair = pair->a.next) pooledPairs++;
+	}
+	
+	// Each buffer is carved up entirely into either nodes or pairs.
+	int nodeBuffers = (nodes + pooledNodes)/(CP_BUFFER_BYTES/sizeof(Node));
+	int pairBuffers = tree->allocatedBuffers->num - nodeBuffers;
+	
+	cpMemoryStats leafSet = {0};
+	cpHashSetGetMemoryStats(tree->leaves, &leafSet);
+	
+	stats->nodes.bytes += nodeBuffers*CP_BUFFER_BYTES + leafSet.bytes;
+	stats->nodes.count += nodes;
+	stats->nodes.pooled += pooledNodes;
+	
+	stats->pairs.bytes += pairBuffers*CP_BUFFER_BYTES;
+	stats->pairs.count += pairs;
+	stats->pairs.pooled += pooledPairs;
+	
+	stats->bytes += sizeof(cpBBTree) + cpArrayGetBytes(tree->allocatedBuffers) + stats->nodes.bytes + stats->pairs.bytes;
+}
+
+#pragma mark Snapshots
+
+static void
+SubtreeSnapshot(Node *subtree, cpSnapshotCursor *cursor)
+{
+	// The node is restored before its children are followed.
+	cpSnapshotTransfer(cursor, subtree, sizeof(Node));
+	
+	if(!NodeIsLeaf(subtree)){
+		SubtreeSnapshot(subtree->a, cursor);
+		SubtreeSnapshot(subtree->b, cursor);
+	}
+}
+
+static void
+LeafSavePairs(Node *leaf, cpSnapshotCursor *cursor)
+{
+	// Every pair is saved by its 'a' leaf only.
+	for(Pair *pair = leaf->pairs; pair;){
+		if(pair->a.leaf == leaf){
+			cpSnapshotTransfer(cursor, &pair, sizeof(Pair *));
+			cpSnapshotTransfer(cursor, pair, sizeof(Pair));
+			pair = pair->a.next;
+		} else {
+			pair = pair->b.next;
+		}
+	}
+}
+
+// Pairs are threaded through the leaves of both trees, so they are saved along with a pointer to them.
+static void
+SnapshotPairs(cpBBTree *tree, cpSnapshotCursor *cursor)
+{
+	if(cursor->restore){
+		for(;;){
+			Pair *pair = NULL;
+			cpSnapshotTransfer(cursor, &pair, sizeof(Pair *));
+			if(!pair) break;
+			
+			cpSnapshotTransfer(cursor, pair, sizeof(Pair));
+		}
+	} else {
+		cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)LeafSavePairs, cursor);
+		cpBBTree *staticTree = GetTree(tree->spatialIndex.staticIndex);
+		if(staticTree) cpHashSetEach(staticTree->leaves, (cpHashSetIteratorFunc)LeafSavePairs, cursor);
+		
+		Pair *end = NULL;
+		cpSnapshotTransfer(cursor, &end, sizeof(Pair *));
+	}
+}
+
+// Only the nodes and pairs in use are saved, the pooled ones only need their links.
+static void
+cpBBTreeSnapshot(cpBBTree *tree, cpSnapshotCursor *cursor)
+{
+	cpSnapshotTransfer(cursor, &tree->root, sizeof(Node *));
+	cpSnapshotTransfer(cursor, &tree->pooledNodes, sizeof(Node *));
+	cpSnapshotTransfer(cursor, &tree->pooledPairs, sizeof(Pair *));
+	cpSnapshotTransfer(cursor, &tree->stamp, sizeof(cpTimestamp));
+	
+	cpHashSetSnapshot(tree->leaves, cursor);
+	cpArraySnapshotBuffers(tree->allocatedBuffers, cursor);
+	
+	if(tree->root) SubtreeSnapshot(tree->root, cursor);
+	cpSnapshotFreeList(cursor, tree->pooledNodes, sizeof(Node), offsetof(Node, parent));
+	
+	// Pairs are owned by the dynamic tree, but can reference the leaves of the static tree too.
+	if(tree == GetMasterTree(tree)) SnapshotPairs(tree, cursor);
+	cpSnapshotFreeList(cursor, tree->pooledPairs, sizeof(Pair), offsetof(Pair, a.next));
+}
+
+#pragma mark Cloning
+
+typedef struct CloneContext {
+	cpRelocation *rel, *objects;
+} CloneContext;
+
+static void *
+leafSetClone(Node *leaf, CloneContext *context)
+{
+	return cpRelocate(context->rel, leaf);
+}
+
+static void
+PairClone(Pair *pair, cpRelocation *rel)
+{
+	Pair *copy = (Pair *)cpRelocate(rel, pair);
+	
+	copy->a.prev = (Pair *)cpRelocate(rel, pair->a.prev);
+	copy->a.leaf = (Node *)cpRelocate(rel, pair->a.leaf);
+	copy->a.next = (Pair *)cpRelocate(rel, pair->a.next);
+	copy->b.prev = (Pair *)cpRelocate(rel, pair->b.prev);
+	copy->b.leaf = (Node *)cpRelocate(rel, pair->b.leaf);
+	copy->b.next = (Pair *)cpRelocate(rel, pair->b.next);
+}
+
+static void
+LeafClonePairs(Node *leaf, CloneContext *context)
+{
+	cpRelocation *rel = context->rel;
+	((Node *)cpRelocate(rel, leaf))->pairs = (Pair *)cpRelocate(rel, leaf->pairs);
+	
+	// Every pair is copied by its 'a' leaf only.
+	for(Pair *pair = leaf->pairs; pair;){
+		if(pair->a.leaf == leaf){
+			PairClone(pair, rel);
+			pair = pair->a.next;
+		} else {
+			pair = pair->b.next;
+		}
+	}
+}
+
+static void
+SubtreeClone(Node *subtree, CloneContext *context)
+{
+	cpRelocation *rel = context->rel;
+	Node *copy = (Node *)cpRelocate(rel, subtree);
+	
+	copy->parent = (Node *)cpRelocate(rel, subtree->parent);
+	copy->filter.owner = cpRelocate(context->objects, subtree->filter.owner);
+	
+	if(NodeIsLeaf(subtree)){
+		copy->obj = cpRelocate(context->objects, subtree->obj);
+	} else {
+		copy->a = (Node *)cpRelocate(rel, subtree->a);
+		copy->b = (Node *)cpRelocate(rel, subtree->b);
+		
+		SubtreeClone(subtree->a, context);
+		SubtreeClone(subtree->b, context);
+	}
+}
+
+// The buffers are copied whole and the pointers in them are moved over to the copies.
+static cpSpatialIndex *
+cpBBTreeClone(cpBBTree *tree, cpSpatialIndex *staticIndex, cpRelocation *objects)
+{
+	const cpAllocator *allocator = tree->spatialIndex.allocator;
+	cpBBTree *copy = (cpBBTree *)cpAllocatorCalloc(allocator, 1, sizeof(cpBBTree));
+	copy->spatialIndex.allocator = allocator;
+	cpSpatialIndexInit((cpSpatialIndex *)copy, Klass(), tree->spatialIndex.bbfunc, staticIndex);
+	
+	copy->velocityFunc = tree->velocityFunc;
+	copy->filterFunc = tree->filterFunc;
+	copy->stamp = tree->stamp;
+	
+	cpRelocation *rel = cpRelocationNew(allocator);
+	copy->allocatedBuffers = cpArrayCloneBuffers(tree->allocatedBuffers, CP_BUFFER_BYTES, rel);
+	
+	// Pairs owned by the dynamic tree can reference the leaves of the static tree too.
+	cpBBTree *staticTree = GetTree(tree->spatialIndex.staticIndex);
+	cpBBTree *staticCopy = GetTree(staticIndex);
+	cpAssertHard(!staticTree == !staticCopy, "The static index must be cloned along with the dynamic index.");
+	
+	if(staticTree){
+		cpArray *buffers = staticTree->allocatedBuffers;
+		for(int i=0; i<buffers->num; i++) cpRelocationAdd(rel, buffers->arr[i], staticCopy->allocatedBuffers->arr[i], CP_BUFFER_BYTES);
+	}
+	
+	CloneContext context = {rel, objects};
+	if(tree->root) SubtreeClone(tree->root, &context);
+	copy->root = (Node *)cpRelocate(rel, tree->root);
+	
+	copy->pooledNodes = (Node *)cpRelocate(rel, tree->pooledNodes);
+	for(Node *node = tree->pooledNodes; node; node = node->parent){
+		((Node *)cpRelocate(rel, node))->parent = (Node *)cpRelocate(rel, node->parent);
+	}
+	
+	if(tree == GetMasterTree(tree)){
+		cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)LeafClonePairs, &context);
+		if(staticTree) cpHashSetEach(staticTree->leaves, (cpHashSetIteratorFunc)LeafClonePairs, &context);
+		
+		copy->pooledPairs = (Pair *)cpRelocate(rel, tree->pooledPairs);
+		for(Pair *pair = tree->pooledPairs; pair; pair = pair->a.next){
+			((Pair *)cpRelocate(rel, pair))->a.next = (Pair *)cpRelocate(rel, pair->a.next);
+		}
+	}
+	
+	copy->leaves = cpHashSetClone(tree->leaves, (cpHashSetTransFunc)leafSetClone, &context);
+	
+	cpRelocationFree(rel);
+	return (cpSpatialIndex *)copy;
+}
+
 static cpSpatialIndexClass klass = {
 	(cpSpatialIndexDestroyImpl)cpBBTreeDestroy,
 	
@@ -702,6 +1229,12 @@ static cpSpatialIndexClass klass = {
 	(cpSpatialIndexPointQueryImpl)cpBBTreePointQuery,
 	(cpSpatialIndexSegmentQueryImpl)cpBBTreeSegmentQuery,
 	(cpSpatialIndexQueryImpl)cpBBTreeQuery,
+	
+	(cpSpatialIndexTrimImpl)cpBBTreeTrim,
+	(cpSpatialIndexPoolStatsImpl)cpBBTreeGetPoolStats,
+	(cpSpatialIndexMemoryStatsImpl)cpBBTreeGetMemoryStats,
+	(cpSpatialIndexSnapshotImpl)cpBBTreeSnapshot,
+	(cpSpatialIndexCloneImpl)cpBBTreeClone,
 };
 
 static inline cpSpatialIndexClass *Klass(){return &klass;}
@@ -737,7 +1270,7 @@ partitionNodes(cpBBTree *tree, Node **nodes, int count)
 	cpBool splitWidth = (bb.r - bb.l > bb.t - bb.b);
 	
 	// Sort the bounds and use the median as the splitting point
-	cpFloat *bounds = (cpFloat *)cpcalloc(count*2, sizeof(cpFloat));
+	cpFloat *bounds = (cpFloat *)cpAllocatorCalloc(tree->spatialIndex.allocator, count*2, sizeof(cpFloat));
 	if(splitWidth){
 		for(int i=0; i<count; i++){
 			bounds[2*i + 0] = nodes[i]->bb.l;
@@ -752,7 +1285,7 @@ partitionNodes(cpBBTree *tree, Node **nodes, int count)
 	
 	qsort(bounds, count*2, sizeof(cpFloat), (int (*)(const void *, const void *))cpfcompare);
 	cpFloat split = (bounds[count - 1] + bounds[count])*0.5f; // use the medain as the split
-	cpfree(bounds);
+	cpAllocatorFree(tree->spatialIndex.allocator, bounds);
 
 	// Generate the child BBs
 	cpBB a = bb, b = bb;
@@ -817,14 +1350,14 @@ cpBBTreeOptimize(cpSpatialIndex *index)
 	if(!root) return;
 	
 	int count = cpBBTreeCount(tree);
-	Node **nodes = (Node **)cpcalloc(count, sizeof(Node *));
+	Node **nodes = (Node **)cpAllocatorCalloc(index->allocator, count, sizeof(Node *));
 	Node **cursor = nodes;
 	
 	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)fillNodeArray, &cursor);
 	
 	SubtreeRecycle(tree, root);
 	tree->root = partitionNodes(tree, nodes, count);
-	cpfree(nodes);
+	cpAllocatorFree(index->allocator, nodes);
 }
 
 #pragma mark Debug Draw
@@ -62,6 +62,10 @@ cpBodyInit(cpBody *body, cpFloat m, cpFloat i)
 	body->v_limit = (cpFloat)INFINITY;
 	body->w_limit = (cpFloat)INFINITY;
 	
+	body->enableCCD = cpFalse;
+	body->treeIndex = -1;
+	body->pool = NULL;
+	
 	body->data = NULL;
 	
 	// Setters must be called after full initialization so the sanity checks don't assert on garbage data.
@@ -100,7 +104,12 @@ cpBodyFree(cpBody *body)
 {
 	if(body){
 		cpBodyDestroy(body);
-		cpfree(body);
+		
+		if(body->pool){
+			cpSpacePoolRecycle(body->pool, body);
+		} else {
+			cpfree(body);
+		}
 	}
 }
 
@@ -240,6 +249,77 @@ cpBodyUpdatePosition(cpBody *body, cpFloat dt)
 	cpBodySanityCheck(body);
 }
 
+// The batched versions copy the state they need into arrays so that the
+// expensive parts, the trigonometry and the clamping, run in loops the compiler can vectorize.
+// They give the same results as calling the functions above for each body.
+
+void
+cpBodyUpdateVelocityBatch(cpBody **bodies, int count, cpVect gravity, cpFloat damping, cpFloat dt)
+{
+	cpAssertSoft(count <= CP_BODY_BATCH_SIZE, "Internal Error: Body batch is too large.");
+	cpFloat vx[CP_BODY_BATCH_SIZE], vy[CP_BODY_BATCH_SIZE], v_limit[CP_BODY_BATCH_SIZE];
+	cpFloat w[CP_BODY_BATCH_SIZE], w_limit[CP_BODY_BATCH_SIZE];
+	
+	for(int i=0; i<count; i++){
+		cpBody *body = bodies[i];
+		vx[i] = body->v.x*damping + (gravity.x + body->f.x*body->m_inv)*dt;
+		vy[i] = body->v.y*damping + (gravity.y + body->f.y*body->m_inv)*dt;
+		v_limit[i] = body->v_limit;
+		
+		w[i] = body->w*damping + body->t*body->i_inv*dt;
+		w_limit[i] = body->w_limit;
+	}
+	
+	for(int i=0; i<count; i++){
+		// Same as cpvclamp(), but without a branch.
+		// Unclamped velocities are multiplied by exactly 1.0 so the result is unchanged.
+		cpFloat lenSq = vx[i]*vx[i] + vy[i]*vy[i];
+		cpFloat limit = v_limit[i];
+		cpBool clamp = (lenSq > limit*limit);
+		cpFloat coef = (clamp ? 1.0f/cpfsqrt(lenSq) : 1.0f);
+		cpFloat scale = (clamp ? limit : 1.0f);
+		vx[i] = vx[i]*coef*scale;
+		vy[i] = vy[i]*coef*scale;
+		
+		w[i] = cpfclamp(w[i], -w_limit[i], w_limit[i]);
+	}
+	
+	for(int i=0; i<count; i++){
+		cpBody *body = bodies[i];
+		body->v = cpv(vx[i], vy[i]);
+		body->w = w[i];
+		
+		cpBodySanityCheck(body);
+	}
+}
+
+void
+cpBodyUpdatePositionBatch(cpBody **bodies, int count, cpFloat dt)
+{
+	cpAssertSoft(count <= CP_BODY_BATCH_SIZE, "Internal Error: Body batch is too large.");
+	cpFloat a[CP_BODY_BATCH_SIZE], rotX[CP_BODY_BATCH_SIZE], rotY[CP_BODY_BATCH_SIZE];
+	
+	for(int i=0; i<count; i++){
+		cpBody *body = bodies[i];
+		body->p = cpvadd(body->p, cpvmult(cpvadd(body->v, body->v_bias), dt));
+		a[i] = body->a = body->a + (body->w + body->w_bias)*dt;
+		
+		body->v_bias = cpvzero;
+		body->w_bias = 0.0f;
+	}
+	
+	// Separate loops keep the compiler from fusing them into a sincos() call that it can't vectorize.
+	for(int i=0; i<count; i++) rotX[i] = cpfcos(a[i]);
+	for(int i=0; i<count; i++) rotY[i] = cpfsin(a[i]);
+	
+	for(int i=0; i<count; i++){
+		cpBody *body = bodies[i];
+		body->rot = cpv(rotX[i], rotY[i]);
+		
+		cpBodySanityCheck(body);
+	}
+}
+
 void
 cpBodyResetForces(cpBody *body)
 {
@@ -25,17 +25,21 @@
 
 #include "chipmunk_private.h"
 
-typedef int (*collisionFunc)(const cpShape *, const cpShape *, cpContact *);
+typedef int (*collisionFunc)(const cpShape *, const cpShape *, cpFloat, cpContact *);
+
+// All of the collision functions take a margin and also return contacts for features separated by less than it.
+// These speculative contacts have a positive distance. With a margin of 0 only overlapping features generate contacts.
 
 // Add contact points for circle to circle collisions.
 // Used by several collision tests.
 static int
-circle2circleQuery(const cpVect p1, const cpVect p2, const cpFloat r1, const cpFloat r2, cpContact *con)
+circle2circleQuery(const cpVect p1, const cpVect p2, const cpFloat r1, const cpFloat r2, const cpFloat margin, cpContact *con)
 {
 	cpFloat mindist = r1 + r2;
+	cpFloat maxdist = mindist + margin;
 	cpVect delta = cpvsub(p2, p1);
 	cpFloat distsq = cpvlengthsq(delta);
-	if(distsq >= mindist*mindist) return 0;
+	if(distsq >= maxdist*maxdist) return 0;
 	
 	cpFloat dist = cpfsqrt(distsq);
 
@@ -53,17 +57,17 @@ circle2circleQuery(const cpVect p1, const cpVect p2, const cpFloat r1, const cpF
 
 // Collide circle shapes.
 static int
-circle2circle(const cpShape *shape1, const cpShape *shape2, cpContact *arr)
+circle2circle(const cpShape *shape1, const cpShape *shape2, cpFloat margin, cpContact *arr)
 {
 	cpCircleShape *circ1 = (cpCircleShape *)shape1; //TODO
 	cpCircleShape *circ2 = (cpCircleShape *)shape2;
 	
-	return circle2circleQuery(circ1->tc, circ2->tc, circ1->r, circ2->r, arr);
+	return circle2circleQuery(circ1->tc, circ2->tc, circ1->r, circ2->r, margin, arr);
 }
 
 // Collide circles to segment shapes.
 static int
-circle2segment(const cpShape *circleShape, const cpShape *segmentShape, cpContact *con)
+circle2segment(const cpShape *circleShape, const cpShape *segmentShape, cpFloat margin, cpContact *con)
 {
 	cpCircleShape *circ = (cpCircleShape *)circleShape;
 	cpSegmentShape *seg = (cpSegmentShape *)segmentShape;
@@ -74,7 +78,7 @@ circle2segment(const cpShape *circleShape, const cpShape *segmentShape, cpContac
 	// Calculate normal distance from segment.
 	cpFloat dn = cpvdot(seg->tn, circ->tc) - cpvdot(seg->ta, seg->tn);
 	cpFloat dist = cpfabs(dn) - rsum;
-	if(dist > 0.0f) return 0;
+	if(dist > margin) return 0;
 	
 	// Calculate tangential distance along segment.
 	cpFloat dt = -cpvcross(seg->tn, circ->tc);
@@ -83,10 +87,10 @@ circle2segment(const cpShape *circleShape, const cpShape *segmentShape, cpContac
 	
 	// Decision tree to decide which feature of the segment to collide with.
 	if(dt < dtMin){
-		if(dt < (dtMin - rsum)){
+		if(dt < (dtMin - rsum - margin)){
 			return 0;
 		} else {
-			return circle2circleQuery(circ->tc, seg->ta, circ->r, seg->r, con);
+			return circle2circleQuery(circ->tc, seg->ta, circ->r, seg->r, margin, con);
 		}
 	} else {
 		if(dt < dtMax){
@@ -100,8 +104,8 @@ circle2segment(const cpShape *circleShape, const cpShape *segmentShape, cpContac
 			);
 			return 1;
 		} else {
-			if(dt < (dtMax + rsum)) {
-				return circle2circleQuery(circ->tc, seg->tb, circ->r, seg->r, con);
+			if(dt < (dtMax + rsum + margin)) {
+				return circle2circleQuery(circ->tc, seg->tb, circ->r, seg->r, margin, con);
 			} else {
 				return 0;
 			}
@@ -128,15 +132,15 @@ nextContactPoint(cpContact *arr, int *numPtr)
 
 // Find the minimum separating axis for the give poly and axis list.
 static inline int
-findMSA(const cpPolyShape *poly, const cpPolyShapeAxis *axes, const int num, cpFloat *min_out)
+findMSA(const cpPolyShape *poly, const cpPolyShapeAxis *axes, const int num, const cpFloat margin, cpFloat *min_out)
 {
 	int min_index = 0;
 	cpFloat min = cpPolyShapeValueOnAxis(poly, axes->n, axes->d);
-	if(min > 0.0f) return -1;
+	if(min > margin) return -1;
 	
 	for(int i=1; i<num; i++){
 		cpFloat dist = cpPolyShapeValueOnAxis(poly, axes[i].n, axes[i].d);
-		if(dist > 0.0f) {
+		if(dist > margin) {
 			return -1;
 		} else if(dist > min){
 			min = dist;
@@ -154,17 +158,18 @@ findMSA(const cpPolyShape *poly, const cpPolyShapeAxis *axes, const int num, cpF
 static inline int
 findVertsFallback(cpContact *arr, const cpPolyShape *poly1, const cpPolyShape *poly2, const cpVect n, const cpFloat dist)
 {
+	cpFloat tolerance = cpfmax(dist, 0.0f);
 	int num = 0;
 	
 	for(int i=0; i<poly1->numVerts; i++){
 		cpVect v = poly1->tVerts[i];
-		if(cpPolyShapeContainsVertPartial(poly2, v, cpvneg(n)))
+		if(cpPolyShapeContainsVertPartial(poly2, v, cpvneg(n), tolerance))
 			cpContactInit(nextContactPoint(arr, &num), v, n, dist, CP_HASH_PAIR(poly1->shape.hashid, i));
 	}
 	
 	for(int i=0; i<poly2->numVerts; i++){
 		cpVect v = poly2->tVerts[i];
-		if(cpPolyShapeContainsVertPartial(poly1, v, n))
+		if(cpPolyShapeContainsVertPartial(poly1, v, n, tolerance))
 			cpContactInit(nextContactPoint(arr, &num), v, n, dist, CP_HASH_PAIR(poly2->shape.hashid, i));
 	}
 	
@@ -172,20 +177,22 @@ findVertsFallback(cpContact *arr, const cpPolyShape *poly1, const cpPolyShape *p
 }
 
 // Add contacts for penetrating vertexes.
+// When the polys are separated, vertexes up to the separating distance away are used instead.
 static inline int
 findVerts(cpContact *arr, const cpPolyShape *poly1, const cpPolyShape *poly2, const cpVect n, const cpFloat dist)
 {
+	cpFloat tolerance = cpfmax(dist, 0.0f);
 	int num = 0;
 	
 	for(int i=0; i<poly1->numVerts; i++){
 		cpVect v = poly1->tVerts[i];
-		if(cpPolyShapeContainsVert(poly2, v))
+		if(cpPolyShapeContainsVert(poly2, v, tolerance))
 			cpContactInit(nextContactPoint(arr, &num), v, n, dist, CP_HASH_PAIR(poly1->shape.hashid, i));
 	}
 	
 	for(int i=0; i<poly2->numVerts; i++){
 		cpVect v = poly2->tVerts[i];
-		if(cpPolyShapeContainsVert(poly1, v))
+		if(cpPolyShapeContainsVert(poly1, v, tolerance))
 			cpContactInit(nextContactPoint(arr, &num), v, n, dist, CP_HASH_PAIR(poly2->shape.hashid, i));
 	}
 	
@@ -194,17 +201,17 @@ findVerts(cpContact *arr, const cpPolyShape *poly1, const cpPolyShape *poly2, co
 
 // Collide poly shapes together.
 static int
-poly2poly(const cpShape *shape1, const cpShape *shape2, cpContact *arr)
+poly2poly(const cpShape *shape1, const cpShape *shape2, cpFloat margin, cpContact *arr)
 {
 	cpPolyShape *poly1 = (cpPolyShape *)shape1;
 	cpPolyShape *poly2 = (cpPolyShape *)shape2;
 	
 	cpFloat min1;
-	int mini1 = findMSA(poly2, poly1->tAxes, poly1->numVerts, &min1);
+	int mini1 = findMSA(poly2, poly1->tAxes, poly1->numVerts, margin, &min1);
 	if(mini1 == -1) return 0;
 	
 	cpFloat min2;
-	int mini2 = findMSA(poly1, poly2->tAxes, poly2->numVerts, &min2);
+	int mini2 = findMSA(poly1, poly2->tAxes, poly2->numVerts, margin, &min2);
 	if(mini2 == -1) return 0;
 	
 	// There is overlap, find the penetrating verts
@@ -224,19 +231,23 @@ segValueOnAxis(const cpSegmentShape *seg, const cpVect n, const cpFloat d)
 }
 
 // Identify vertexes that have penetrated the segment.
+// When the shapes are separated, vertexes within the margin are used instead.
 static inline void
-findPointsBehindSeg(cpContact *arr, int *num, const cpSegmentShape *seg, const cpPolyShape *poly, const cpFloat pDist, const cpFloat coef) 
+findPointsBehindSeg(cpContact *arr, int *num, const cpSegmentShape *seg, const cpPolyShape *poly, const cpFloat pDist, const cpFloat coef, const cpFloat margin) 
 {
 	cpFloat dta = cpvcross(seg->tn, seg->ta);
 	cpFloat dtb = cpvcross(seg->tn, seg->tb);
 	cpVect n = cpvmult(seg->tn, coef);
+	cpFloat tolerance = (pDist > 0.0f ? margin : 0.0f);
 	
 	for(int i=0; i<poly->numVerts; i++){
 		cpVect v = poly->tVerts[i];
-		if(cpvdot(v, n) < cpvdot(seg->tn, seg->ta)*coef + seg->r){
+		cpFloat vDist = cpvdot(v, n) - cpvdot(seg->tn, seg->ta)*coef - seg->r;
+		if(cpvdot(v, n) < cpvdot(seg->tn, seg->ta)*coef + seg->r + tolerance){
 			cpFloat dt = cpvcross(seg->tn, v);
 			if(dta >= dt && dt >= dtb){
-				cpContactInit(nextContactPoint(arr, num), v, n, pDist, CP_HASH_PAIR(poly->shape.hashid, i));
+				cpFloat dist = (pDist > 0.0f ? cpfmax(pDist, vDist) : pDist);
+				cpContactInit(nextContactPoint(arr, num), v, n, dist, CP_HASH_PAIR(poly->shape.hashid, i));
 			}
 		}
 	}
@@ -245,7 +256,7 @@ findPointsBehindSeg(cpContact *arr, int *num, const cpSegmentShape *seg, const c
 // This one is complicated and gross. Just don't go there...
 // TODO: Comment me!
 static int
-seg2poly(const cpShape *shape1, const cpShape *shape2, cpContact *arr)
+seg2poly(const cpShape *shape1, const cpShape *shape2, cpFloat margin, cpContact *arr)
 {
 	cpSegmentShape *seg = (cpSegmentShape *)shape1;
 	cpPolyShape *poly = (cpPolyShape *)shape2;
@@ -254,14 +265,14 @@ seg2poly(const cpShape *shape1, const cpShape *shape2, cpContact *arr)
 	cpFloat segD = cpvdot(seg->tn, seg->ta);
 	cpFloat minNorm = cpPolyShapeValueOnAxis(poly, seg->tn, segD) - seg->r;
 	cpFloat minNeg = cpPolyShapeValueOnAxis(poly, cpvneg(seg->tn), -segD) - seg->r;
-	if(minNeg > 0.0f || minNorm > 0.0f) return 0;
+	if(minNeg > margin || minNorm > margin) return 0;
 	
 	int mini = 0;
 	cpFloat poly_min = segValueOnAxis(seg, axes->n, axes->d);
-	if(poly_min > 0.0f) return 0;
+	if(poly_min > margin) return 0;
 	for(int i=0; i<poly->numVerts; i++){
 		cpFloat dist = segValueOnAxis(seg, axes[i].n, axes[i].d);
-		if(dist > 0.0f){
+		if(dist > margin){
 			return 0;
 		} else if(dist > poly_min){
 			poly_min = dist;
@@ -275,9 +286,11 @@ seg2poly(const cpShape *shape1, const cpShape *shape2, cpContact *arr)
 	
 	cpVect va = cpvadd(seg->ta, cpvmult(poly_n, seg->r));
 	cpVect vb = cpvadd(seg->tb, cpvmult(poly_n, seg->r));
-	if(cpPolyShapeContainsVert(poly, va))
+	// When separated, accept endpoints within the separating distance. (padded slightly for rounding)
+	cpFloat tolerance = cpfmax(poly_min, 0.0f)*1.001f;
+	if(cpPolyShapeContainsVert(poly, va, tolerance))
 		cpContactInit(nextContactPoint(arr, &num), va, poly_n, poly_min, CP_HASH_PAIR(seg->shape.hashid, 0));
-	if(cpPolyShapeContainsVert(poly, vb))
+	if(cpPolyShapeContainsVert(poly, vb, tolerance))
 		cpContactInit(nextContactPoint(arr, &num), vb, poly_n, poly_min, CP_HASH_PAIR(seg->shape.hashid, 1));
 	
 	// Floating point precision problems here.
@@ -286,9 +299,9 @@ seg2poly(const cpShape *shape1, const cpShape *shape2, cpContact *arr)
 	
 	if(minNorm >= poly_min || minNeg >= poly_min) {
 		if(minNorm > minNeg)
-			findPointsBehindSeg(arr, &num, seg, poly, minNorm, 1.0f);
+			findPointsBehindSeg(arr, &num, seg, poly, minNorm, 1.0f, margin);
 		else
-			findPointsBehindSeg(arr, &num, seg, poly, minNeg, -1.0f);
+			findPointsBehindSeg(arr, &num, seg, poly, minNeg, -1.0f, margin);
 	}
 	
 	// If no other collision points are found, try colliding endpoints.
@@ -296,16 +309,16 @@ seg2poly(const cpShape *shape1, const cpShape *shape2, cpContact *arr)
 		cpVect poly_a = poly->tVerts[mini];
 		cpVect poly_b = poly->tVerts[(mini + 1)%poly->numVerts];
 		
-		if(circle2circleQuery(seg->ta, poly_a, seg->r, 0.0f, arr))
+		if(circle2circleQuery(seg->ta, poly_a, seg->r, 0.0f, margin, arr))
 			return 1;
 			
-		if(circle2circleQuery(seg->tb, poly_a, seg->r, 0.0f, arr))
+		if(circle2circleQuery(seg->tb, poly_a, seg->r, 0.0f, margin, arr))
 			return 1;
 			
-		if(circle2circleQuery(seg->ta, poly_b, seg->r, 0.0f, arr))
+		if(circle2circleQuery(seg->ta, poly_b, seg->r, 0.0f, margin, arr))
 			return 1;
 			
-		if(circle2circleQuery(seg->tb, poly_b, seg->r, 0.0f, arr))
+		if(circle2circleQuery(seg->tb, poly_b, seg->r, 0.0f, margin, arr))
 			return 1;
 	}
 
@@ -315,7 +328,7 @@ seg2poly(const cpShape *shape1, const cpShape *shape2, cpContact *arr)
 // This one is less gross, but still gross.
 // TODO: Comment me!
 static int
-circle2poly(const cpShape *shape1, const cpShape *shape2, cpContact *con)
+circle2poly(const cpShape *shape1, const cpShape *shape2, cpFloat margin, cpContact *con)
 {
 	cpCircleShape *circ = (cpCircleShape *)shape1;
 	cpPolyShape *poly = (cpPolyShape *)shape2;
@@ -325,7 +338,7 @@ circle2poly(const cpShape *shape1, const cpShape *shape2, cpContact *con)
 	cpFloat min = cpvdot(axes->n, circ->tc) - axes->d - circ->r;
 	for(int i=0; i<poly->numVerts; i++){
 		cpFloat dist = cpvdot(axes[i].n, circ->tc) - axes[i].d - circ->r;
-		if(dist > 0.0f){
+		if(dist > margin){
 			return 0;
 		} else if(dist > min) {
 			min = dist;
@@ -341,7 +354,7 @@ circle2poly(const cpShape *shape1, const cpShape *shape2, cpContact *con)
 	cpFloat dt = cpvcross(n, circ->tc);
 		
 	if(dt < dtb){
-		return circle2circleQuery(circ->tc, b, circ->r, 0.0f, con);
+		return circle2circleQuery(circ->tc, b, circ->r, 0.0f, margin, con);
 	} else if(dt < dta) {
 		cpContactInit(
 			con,
@@ -353,20 +366,159 @@ circle2poly(const cpShape *shape1, const cpShape *shape2, cpContact *con)
 	
 		return 1;
 	} else {
-		return circle2circleQuery(circ->tc, a, circ->r, 0.0f, con);
+		return circle2circleQuery(circ->tc, a, circ->r, 0.0f, margin, con);
+	}
+}
+
+// Add a contact to a set of contacts collected from several child shapes.
+// When the set is full, the shallowest contact is replaced if the new one is deeper.
+static void
+pushDeepestContact(cpContact *arr, int *num, const cpContact *con)
+{
+	if((*num) < CP_MAX_CONTACTS_PER_ARBITER){
+		arr[(*num)++] = (*con);
+	} else {
+		int shallowest = 0;
+		for(int j=1; j<CP_MAX_CONTACTS_PER_ARBITER; j++){
+			if(arr[j].dist > arr[shallowest].dist) shallowest = j;
+		}
+		
+		if(con->dist < arr[shallowest].dist) arr[shallowest] = (*con);
+	}
+}
+
+typedef struct meshContext {
+	cpFloat margin;
+	cpContact *arr;
+	int num;
+} meshContext;
+
+static void
+shape2meshHelper(const cpShape *shape, const cpShape *child, meshContext *context)
+{
+	cpContact contacts[CP_MAX_CONTACTS_PER_ARBITER];
+	int count = 0;
+	
+	// The child shapes can be of any type so they need to be sorted as well.
+	if(shape->klass->type <= child->klass->type){
+		count = cpCollideShapes(shape, child, context->margin, contacts);
+	} else {
+		count = cpCollideShapes(child, shape, context->margin, contacts);
+		for(int i=0; i<count; i++) contacts[i].n = cpvneg(contacts[i].n);
+	}
+	
+	for(int i=0; i<count; i++){
+		cpContact *con = &contacts[i];
+		
+		// Mix in the child's hash so contacts with different children don't share warm starting data.
+		con->hash = CP_HASH_PAIR(child->hashid, con->hash);
+		pushDeepestContact(context->arr, &context->num, con);
+	}
+}
+
+// Collide any shape with the children of a mesh that it overlaps.
+// All of the contacts are merged into a single set so only one arbiter is needed.
+static int
+shape2mesh(const cpShape *shape, const cpShape *meshShape, cpFloat margin, cpContact *arr)
+{
+	cpMeshShape *mesh = (cpMeshShape *)meshShape;
+	cpBB bb = shape->bb;
+	
+	meshContext context = {margin, arr, 0};
+	cpBB query = cpBBNew(bb.l - margin, bb.b - margin, bb.r + margin, bb.t + margin);
+	cpSpatialIndexQuery(mesh->index, (void *)shape, query, (cpSpatialIndexQueryFunc)shape2meshHelper, &context);
+	
+	return context.num;
+}
+
+// Collide a circle, segment or poly with the solid tiles under it's bounding box.
+// Contacts that push against a side of a tile covered by a neighboring solid tile are internal edges and are dropped.
+static int
+shape2tilemap(const cpShape *shape, const cpShape *tileMapShape, cpFloat margin, cpContact *arr)
+{
+	cpTileMapShape *tilemap = (cpTileMapShape *)tileMapShape;
+	cpBody *body = tilemap->shape.body;
+	cpVect p = body->p, rot = body->rot;
+	cpFloat size = tilemap->tileSize;
+	
+	// Find the range of tiles under the shape's bounding box in tile coordinates.
+	cpBB bb = cpBBNew(shape->bb.l - margin, shape->bb.b - margin, shape->bb.r + margin, shape->bb.t + margin);
+	cpVect corners[] = {cpv(bb.l, bb.b), cpv(bb.r, bb.b), cpv(bb.r, bb.t), cpv(bb.l, bb.t)};
+	cpFloat l = INFINITY, b = INFINITY, r = -INFINITY, t = -INFINITY;
+	
+	for(int i=0; i<4; i++){
+		cpVect v = cpvmult(cpvsub(cpvunrotate(cpvsub(corners[i], p), rot), tilemap->offset), 1.0f/size);
+		l = cpfmin(l, v.x); r = cpfmax(r, v.x);
+		b = cpfmin(b, v.y); t = cpfmax(t, v.y);
+	}
+	
+	if(r < 0.0f || tilemap->width <= l || t < 0.0f || tilemap->height <= b) return 0;
+	
+	int x0 = cpfmax(cpffloor(l), 0), x1 = cpfmin(cpffloor(r), tilemap->width - 1);
+	int y0 = cpfmax(cpffloor(b), 0), y1 = cpfmin(cpffloor(t), tilemap->height - 1);
+	
+	cpShape *tile = tilemap->tile;
+	int num = 0;
+	
+	for(int y=y0; y<=y1; y++){
+		for(int x=x0; x<=x1; x++){
+			if(!cpTileMapShapeTileIsSolid(tilemap, x, y)) continue;
+			
+			cpVect center = cpvadd(tilemap->offset, cpv((x + 0.5f)*size, (y + 0.5f)*size));
+			cpShapeUpdate(tile, cpvadd(p, cpvrotate(center, rot)), rot);
+			
+			cpContact contacts[CP_MAX_CONTACTS_PER_ARBITER];
+			int count = cpCollideShapes(shape, tile, margin, contacts);
+			
+			for(int i=0; i<count; i++){
+				cpContact *con = &contacts[i];
+				
+				// Find the side of the tile the contact pushes out of.
+				cpVect n = cpvunrotate(cpvneg(con->n), rot);
+				int nx = 0, ny = 0;
+				if(cpfabs(n.x) > cpfabs(n.y)){
+					nx = (n.x > 0.0f ? 1 : -1);
+				} else {
+					ny = (n.y > 0.0f ? 1 : -1);
+				}
+				
+				if(cpTileMapShapeTileIsSolid(tilemap, x + nx, y + ny)) continue;
+				
+				con->hash = CP_HASH_PAIR((cpHashValue)(x + y*tilemap->width), con->hash);
+				pushDeepestContact(arr, &num, con);
+			}
+		}
 	}
+	
+	return num;
 }
 
-static const collisionFunc builtinCollisionFuncs[9] = {
+static const collisionFunc builtinCollisionFuncs[CP_NUM_SHAPES*CP_NUM_SHAPES] = {
 	circle2circle,
 	NULL,
 	NULL,
+	NULL,
+	NULL,
 	circle2segment,
 	NULL,
 	NULL,
+	NULL,
+	NULL,
 	circle2poly,
 	seg2poly,
 	poly2poly,
+	NULL,
+	NULL,
+	shape2mesh,
+	shape2mesh,
+	shape2mesh,
+	NULL,
+	NULL,
+	shape2tilemap,
+	shape2tilemap,
+	shape2tilemap,
+	NULL,
+	NULL,
 };
 static const collisionFunc *colfuncs = builtinCollisionFuncs;
 
@@ -402,11 +554,16 @@ static const collisionFunc *colfuncs = builtinCollisionFuncs;
 //#endif
 
 int
-cpCollideShapes(const cpShape *a, const cpShape *b, cpContact *arr)
+cpCollideShapes(const cpShape *a, const cpShape *b, cpFloat margin, cpContact *arr)
 {
 	// Their shape types must be in order.
 	cpAssertSoft(a->klass->type <= b->klass->type, "Collision shapes passed to cpCollideShapes() are not sorted.");
 	
 	collisionFunc cfunc = colfuncs[a->klass->type + b->klass->type*CP_NUM_SHAPES];
-	return (cfunc) ? cfunc(a, b, arr) : 0;
+	if(!cfunc) return 0;
+	
+	if(a->klass->type == CP_POLY_SHAPE) cpPolyShapeCacheTransform((cpPolyShape *)a);
+	if(b->klass->type == CP_POLY_SHAPE) cpPolyShapeCacheTransform((cpPolyShape *)b);
+	
+	return cfunc(a, b, margin, arr);
 }
@@ -20,6 +20,7 @@
  */
  
 #include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
 
 #include "chipmunk_private.h"
@@ -41,25 +42,29 @@ struct cpHashSet {
 	cpHashSetBin *pooledBins;
 	
 	cpArray *allocatedBuffers;
+	
+	const cpAllocator *allocator;
 };
 
 void
 cpHashSetFree(cpHashSet *set)
 {
 	if(set){
-		cpfree(set->table);
+		const cpAllocator *allocator = set->allocator;
+		cpAllocatorFree(allocator, set->table);
 		
-		cpArrayFreeEach(set->allocatedBuffers, cpfree);
+		cpArrayFreeEachBlock(set->allocatedBuffers);
 		cpArrayFree(set->allocatedBuffers);
 		
-		cpfree(set);
+		cpAllocatorFree(allocator, set);
 	}
 }
 
 cpHashSet *
-cpHashSetNew(int size, cpHashSetEqlFunc eqlFunc)
+cpHashSetNewWithAllocator(int size, cpHashSetEqlFunc eqlFunc, const cpAllocator *allocator)
 {
-	cpHashSet *set = (cpHashSet *)cpcalloc(1, sizeof(cpHashSet));
+	cpHashSet *set = (cpHashSet *)cpAllocatorCalloc(allocator, 1, sizeof(cpHashSet));
+	set->allocator = allocator;
 	
 	set->size = next_prime(size);
 	set->entries = 0;
@@ -67,14 +72,20 @@ cpHashSetNew(int size, cpHashSetEqlFunc eqlFunc)
 	set->eql = eqlFunc;
 	set->default_value = NULL;
 	
-	set->table = (cpHashSetBin **)cpcalloc(set->size, sizeof(cpHashSetBin *));
+	set->table = (cpHashSetBin **)cpAllocatorCalloc(allocator, set->size, sizeof(cpHashSetBin *));
 	set->pooledBins = NULL;
 	
-	set->allocatedBuffers = cpArrayNew(0);
+	set->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
 	
 	return set;
 }
 
+cpHashSet *
+cpHashSetNew(int size, cpHashSetEqlFunc eqlFunc)
+{
+	return cpHashSetNewWithAllocator(size, eqlFunc, NULL);
+}
+
 void
 cpHashSetSetDefaultValue(cpHashSet *set, void *default_value)
 {
@@ -88,12 +99,10 @@ setIsFull(cpHashSet *set)
 }
 
 static void
-cpHashSetResize(cpHashSet *set)
+cpHashSetRehash(cpHashSet *set, int newSize)
 {
-	// Get the next approximate doubled prime.
-	int newSize = next_prime(set->size + 1);
 	// Allocate a new table.
-	cpHashSetBin **newTable = (cpHashSetBin **)cpcalloc(newSize, sizeof(cpHashSetBin *));
+	cpHashSetBin **newTable = (cpHashSetBin **)cpAllocatorCalloc(set->allocator, newSize, sizeof(cpHashSetBin *));
 	
 	// Iterate over the chains.
 	for(int i=0; i<set->size; i++){
@@ -110,12 +119,19 @@ cpHashSetResize(cpHashSet *set)
 		}
 	}
 	
-	cpfree(set->table);
+	cpAllocatorFree(set->allocator, set->table);
 	
 	set->table = newTable;
 	set->size = newSize;
 }
 
+static void
+cpHashSetResize(cpHashSet *set)
+{
+	// Get the next approximate doubled prime.
+	cpHashSetRehash(set, next_prime(set->size + 1));
+}
+
 static inline void
 recycleBin(cpHashSet *set, cpHashSetBin *bin)
 {
@@ -137,7 +153,7 @@ getUnusedBin(cpHashSet *set)
 		int count = CP_BUFFER_BYTES/sizeof(cpHashSetBin);
 		cpAssertSoft(count, "Buffer size is too small.");
 		
-		cpHashSetBin *buffer = (cpHashSetBin *)cpcalloc(1, CP_BUFFER_BYTES);
+		cpHashSetBin *buffer = (cpHashSetBin *)cpAllocatorCalloc(set->allocator, 1, CP_BUFFER_BYTES);
 		cpArrayPush(set->allocatedBuffers, buffer);
 		
 		// push all but the first one, return it instead
@@ -254,3 +270,149 @@ cpHashSetFilter(cpHashSet *set, cpHashSetFilterFunc func, void *data)
 		}
 	}
 }
+
+void
+cpHashSetRemap(cpHashSet *set, cpHashSetTransFunc func, void *data)
+{
+	for(int i=0; i<set->size; i++){
+		for(cpHashSetBin *bin = set->table[i]; bin; bin = bin->next){
+			bin->elt = func(bin->elt, data);
+		}
+	}
+}
+
+#pragma mark Memory Trimming
+
+size_t
+cpHashSetTrim(cpHashSet *set)
+{
+	size_t freed = 0;
+	
+	// Shrink a table that is less than half full back down.
+	int newSize = next_prime(set->entries*2);
+	if(newSize < set->size){
+		freed += (set->size - newSize)*sizeof(cpHashSetBin *);
+		cpHashSetRehash(set, newSize);
+	}
+	
+	cpArray *live = cpArrayNewWithAllocator(set->entries, set->allocator);
+	cpArray *unused = cpArrayNewWithAllocator(0, set->allocator);
+	
+	for(int i=0; i<set->size; i++){
+		for(cpHashSetBin *bin = set->table[i]; bin; bin = bin->next) cpArrayPush(live, bin);
+	}
+	
+	for(cpHashSetBin *bin = set->pooledBins; bin; bin = bin->next) cpArrayPush(unused, bin);
+	
+	// Move the bins that are still in use down into the unused ones.
+	// The chains are relinked in place so that iteration order is unchanged.
+	int count = cpArrayPlanCompaction(live, unused);
+	if(count){
+		for(int i=0; i<set->size; i++){
+			for(cpHashSetBin **slot = &set->table[i]; *slot; slot = &(*slot)->next){
+				cpHashSetBin *dest = (cpHashSetBin *)cpArrayCompactionDest(live, unused, count, *slot);
+				if(dest){
+					(*dest) = **slot;
+					(*slot) = dest;
+				}
+			}
+		}
+		
+		cpArrayFinishCompaction(live, unused, count);
+	}
+	
+	freed += cpArrayTrimBuffers(set->allocatedBuffers, CP_BUFFER_BYTES, unused, sizeof(cpHashSetBin));
+	
+	// Relink the pool so the lowest bins are handed out first.
+	set->pooledBins = NULL;
+	for(int i=unused->num-1; i>=0; i--) recycleBin(set, (cpHashSetBin *)unused->arr[i]);
+	
+	cpArrayFree(live);
+	cpArrayFree(unused);
+	
+	return freed;
+}
+
+void
+cpHashSetGetStats(cpHashSet *set, cpPoolStats *stats)
+{
+	int pooled = 0;
+	for(cpHashSetBin *bin = set->pooledBins; bin; bin = bin->next) pooled++;
+	
+	stats->bytes += set->size*sizeof(cpHashSetBin *) + set->allocatedBuffers->num*CP_BUFFER_BYTES;
+	stats->unusedBytes += pooled*sizeof(cpHashSetBin);
+}
+
+void
+cpHashSetGetMemoryStats(cpHashSet *set, cpMemoryStats *stats)
+{
+	int pooled = 0;
+	for(cpHashSetBin *bin = set->pooledBins; bin; bin = bin->next) pooled++;
+	
+	stats->bytes += sizeof(cpHashSet) + set->size*sizeof(cpHashSetBin *);
+	stats->bytes += set->allocatedBuffers->num*CP_BUFFER_BYTES + cpArrayGetBytes(set->allocatedBuffers);
+	stats->count += set->entries;
+	stats->pooled += pooled;
+}
+
+#pragma mark Snapshots
+
+void
+cpHashSetSnapshot(cpHashSet *set, cpSnapshotCursor *cursor)
+{
+	int size = set->size;
+	cpSnapshotTransfer(cursor, &size, sizeof(int));
+	
+	// Only a set that was resized since the snapshot was taken needs a new table.
+	if(size != set->size){
+		cpAllocatorFree(set->allocator, set->table);
+		set->table = (cpHashSetBin **)cpAllocatorCalloc(set->allocator, size, sizeof(cpHashSetBin *));
+		set->size = size;
+	}
+	
+	cpSnapshotTransfer(cursor, &set->entries, sizeof(int));
+	cpSnapshotTransfer(cursor, &set->pooledBins, sizeof(cpHashSetBin *));
+	cpSnapshotTransfer(cursor, set->table, size*sizeof(cpHashSetBin *));
+	
+	cpArraySnapshotBuffers(set->allocatedBuffers, cursor);
+	
+	// Only the bins in use are saved. Each one is restored before its next pointer is followed.
+	for(int i=0; i<size; i++){
+		for(cpHashSetBin *bin = set->table[i]; bin; bin = bin->next) cpSnapshotTransfer(cursor, bin, sizeof(cpHashSetBin));
+	}
+	
+	cpSnapshotFreeList(cursor, set->pooledBins, sizeof(cpHashSetBin), offsetof(cpHashSetBin, next));
+}
+
+#pragma mark Cloning
+
+cpHashSet *
+cpHashSetClone(cpHashSet *set, cpHashSetTransFunc func, void *data)
+{
+	const cpAllocator *allocator = set->allocator;
+	cpHashSet *copy = (cpHashSet *)cpAllocatorCalloc(allocator, 1, sizeof(cpHashSet));
+	(*copy) = (*set);
+	
+	cpRelocation *rel = cpRelocationNew(allocator);
+	copy->allocatedBuffers = cpArrayCloneBuffers(set->allocatedBuffers, CP_BUFFER_BYTES, rel);
+	
+	copy->table = (cpHashSetBin **)cpAllocatorCalloc(allocator, set->size, sizeof(cpHashSetBin *));
+	for(int i=0; i<set->size; i++){
+		copy->table[i] = (cpHashSetBin *)cpRelocate(rel, set->table[i]);
+		
+		for(cpHashSetBin *bin = copy->table[i]; bin; bin = bin->next){
+			bin->next = (cpHashSetBin *)cpRelocate(rel, bin->next);
+			bin->elt = func(bin->elt, data);
+		}
+	}
+	
+	copy->pooledBins = (cpHashSetBin *)cpRelocate(rel, set->pooledBins);
+	for(cpHashSetBin *bin = copy->pooledBins; bin; bin = bin->next){
+		bin->next = (cpHashSetBin *)cpRelocate(rel, bin->next);
+	}
+	
+	if(set->default_value) copy->default_value = func(set->default_value, data);
+	
+	cpRelocationFree(rel);
+	return copy;
+}
@@ -0,0 +1,230 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+#include <stdlib.h>
+
+#include "chipmunk_private.h"
+
+cpMeshShape *
+cpMeshShapeAlloc(void)
+{
+	return (cpMeshShape *)cpcalloc(1, sizeof(cpMeshShape));
+}
+
+static cpBB
+cpMeshShapeCacheData(cpMeshShape *mesh, cpVect p, cpVect rot)
+{
+	cpShape **children = mesh->children;
+	cpBB bb = cpShapeUpdate(children[0], p, rot);
+	
+	for(int i=1; i<mesh->numChildren; i++){
+		bb = cpBBMerge(bb, cpShapeUpdate(children[i], p, rot));
+	}
+	
+	cpSpatialIndexReindex(mesh->index);
+	return bb;
+}
+
+static void
+cpMeshShapeDestroy(cpMeshShape *mesh)
+{
+	cpSpatialIndexFree(mesh->index);
+	
+	for(int i=0; i<mesh->numChildren; i++) cpShapeFree(mesh->children[i]);
+	cpfree(mesh->children);
+}
+
+static void
+pointQueryHelper(cpVect *point, cpShape *child, cpBool *hit)
+{
+	if(!(*hit)) (*hit) = cpShapePointQuery(child, *point);
+}
+
+static cpBool
+cpMeshShapePointQuery(cpMeshShape *mesh, cpVect p){
+	if(!cpBBContainsVect(mesh->shape.bb, p)) return cpFalse;
+	
+	cpBool hit = cpFalse;
+	cpSpatialIndexPointQuery(mesh->index, p, (cpSpatialIndexQueryFunc)pointQueryHelper, &hit);
+	return hit;
+}
+
+typedef struct segQueryContext {
+	cpVect a, b;
+} segQueryContext;
+
+static cpFloat
+segQueryHelper(segQueryContext *context, cpShape *child, cpSegmentQueryInfo *out)
+{
+	cpSegmentQueryInfo info;
+	if(cpShapeSegmentQuery(child, context->a, context->b, &info) && info.t < out->t){
+		(*out) = info;
+	}
+	
+	return out->t;
+}
+
+static void
+cpMeshShapeSegmentQuery(cpMeshShape *mesh, cpVect a, cpVect b, cpSegmentQueryInfo *info)
+{
+	segQueryContext context = {a, b};
+	cpSegmentQueryInfo closest = {NULL, 1.0f, cpvzero};
+	cpSpatialIndexSegmentQuery(mesh->index, &context, a, b, 1.0f, (cpSpatialIndexSegmentQueryFunc)segQueryHelper, &closest);
+	
+	if(closest.shape){
+		info->shape = (cpShape *)mesh;
+		info->t = closest.t;
+		info->n = closest.n;
+	}
+}
+
+static void
+cpMeshShapeSnapshot(cpMeshShape *mesh, cpSnapshotCursor *cursor)
+{
+	cpSnapshotTransfer(cursor, mesh, sizeof(cpMeshShape));
+	
+	for(int i=0; i<mesh->numChildren; i++) cpShapeSnapshot(mesh->children[i], cursor);
+	cpSpatialIndexSnapshot(mesh->index, cursor);
+}
+
+static cpMeshShape *
+cpMeshShapeClone(cpMeshShape *mesh, cpBody *body, cpSpace *space)
+{
+	cpMeshShape *copy = cpMeshShapeAlloc();
+	(*copy) = (*mesh);
+	copy->shape.body = body;
+	copy->shape.pool = NULL;
+	
+	int numChildren = mesh->numChildren;
+	copy->children = (cpShape **)cpcalloc(numChildren, sizeof(cpShape *));
+	
+	cpRelocation *children = cpRelocationNew(NULL);
+	for(int i=0; i<numChildren; i++){
+		copy->children[i] = cpShapeClone(mesh->children[i], body, space);
+		cpRelocationAdd(children, mesh->children[i], copy->children[i], sizeof(cpShape));
+	}
+	
+	copy->index = cpSpatialIndexClone(mesh->index, NULL, children);
+	cpRelocationFree(children);
+	
+	return copy;
+}
+
+static const cpShapeClass meshClass = {
+	CP_MESH_SHAPE,
+	(cpShapeCacheDataImpl)cpMeshShapeCacheData,
+	(cpShapeDestroyImpl)cpMeshShapeDestroy,
+	(cpShapePointQueryImpl)cpMeshShapePointQuery,
+	(cpShapeSegmentQueryImpl)cpMeshShapeSegmentQuery,
+	(cpShapeSnapshotImpl)cpMeshShapeSnapshot,
+	(cpShapeCloneImpl)cpMeshShapeClone,
+};
+
+static cpMeshShape *
+cpMeshShapeInitChildren(cpMeshShape *mesh, cpBody *body, int numChildren, cpShape **children)
+{
+	cpAssertHard(numChildren > 0, "A mesh shape must have at least one child.");
+	
+	mesh->numChildren = numChildren;
+	mesh->children = children;
+	mesh->index = cpBBTreeNew((cpSpatialIndexBBFunc)cpShapeGetBB, NULL);
+	
+	for(int i=0; i<numChildren; i++){
+		cpShape *child = children[i];
+		cpShapeCacheBB(child);
+		cpSpatialIndexInsert(mesh->index, child, i);
+	}
+	
+	cpBBTreeOptimize(mesh->index);
+	cpShapeInit((cpShape *)mesh, &meshClass, body);
+	
+	return mesh;
+}
+
+cpMeshShape *
+cpMeshShapeInitPolyline(cpMeshShape *mesh, cpBody *body, int numVerts, const cpVect *verts, cpFloat radius)
+{
+	cpAssertHard(numVerts >= 2, "A polyline must have at least two vertexes.");
+	
+	int numChildren = numVerts - 1;
+	cpShape **children = (cpShape **)cpcalloc(numChildren, sizeof(cpShape *));
+	
+	for(int i=0; i<numChildren; i++){
+		children[i] = cpSegmentShapeNew(body, verts[i], verts[i + 1], radius);
+	}
+	
+	return cpMeshShapeInitChildren(mesh, body, numChildren, children);
+}
+
+cpMeshShape *
+cpMeshShapeInitTriangles(cpMeshShape *mesh, cpBody *body, int numVerts, const cpVect *verts, int numTriangles, const int *indexes)
+{
+	cpShape **children = (cpShape **)cpcalloc(numTriangles, sizeof(cpShape *));
+	
+	for(int i=0; i<numTriangles; i++){
+		const int *tri = indexes + 3*i;
+		cpAssertHard(
+			0 <= tri[0] && tri[0] < numVerts && 0 <= tri[1] && tri[1] < numVerts && 0 <= tri[2] && tri[2] < numVerts,
+			"Triangle index out of range."
+		);
+		
+		cpVect a = verts[tri[0]], b = verts[tri[1]], c = verts[tri[2]];
+		
+		// Poly shapes require a clockwise winding.
+		cpVect triVerts[] = {a, b, c};
+		if(cpvcross(cpvsub(b, a), cpvsub(c, b)) > 0.0f){
+			triVerts[1] = c;
+			triVerts[2] = b;
+		}
+		
+		children[i] = cpPolyShapeNew(body, 3, triVerts, cpvzero);
+	}
+	
+	return cpMeshShapeInitChildren(mesh, body, numTriangles, children);
+}
+
+cpShape *
+cpMeshShapeNewPolyline(cpBody *body, int numVerts, const cpVect *verts, cpFloat radius)
+{
+	return (cpShape *)cpMeshShapeInitPolyline(cpMeshShapeAlloc(), body, numVerts, verts, radius);
+}
+
+cpShape *
+cpMeshShapeNewTriangles(cpBody *body, int numVerts, const cpVect *verts, int numTriangles, const int *indexes)
+{
+	return (cpShape *)cpMeshShapeInitTriangles(cpMeshShapeAlloc(), body, numVerts, verts, numTriangles, indexes);
+}
+
+int
+cpMeshShapeGetNumChildren(cpShape *shape)
+{
+	cpAssertHard(shape->klass == &meshClass, "Shape is not a mesh shape.");
+	return ((cpMeshShape *)shape)->numChildren;
+}
+
+cpShape *
+cpMeshShapeGetChild(cpShape *shape, int idx)
+{
+	cpAssertHard(shape->klass == &meshClass, "Shape is not a mesh shape.");
+	cpAssertHard(0 <= idx && idx < cpMeshShapeGetNumChildren(shape), "Index out of range.");
+	
+	return ((cpMeshShape *)shape)->children[idx];
+}
@@ -20,6 +20,7 @@
  */
  
 #include <stdlib.h>
+#include <string.h>
 
 #include "chipmunk_private.h"
 #include "chipmunk_unsafe.h"
@@ -65,33 +66,108 @@ cpPolyShapeTransformAxes(cpPolyShape *poly, cpVect p, cpVect rot)
 	}
 }
 
+void
+cpPolyShapeTransform(cpPolyShape *poly)
+{
+	cpPolyShapeTransformAxes(poly, poly->tPos, poly->tRot);
+	if(poly->rect) cpPolyShapeTransformVerts(poly, poly->tPos, poly->tRot);
+	
+	poly->tStamp = poly->stamp;
+}
+
+static inline cpBB
+cpPolyShapeRectBB(cpPolyShape *poly, cpVect p, cpVect rot)
+{
+	cpVect c = cpvadd(p, cpvrotate(poly->center, rot));
+	cpVect e = poly->extents;
+	cpFloat ex = cpfabs(rot.x)*e.x + cpfabs(rot.y)*e.y;
+	cpFloat ey = cpfabs(rot.y)*e.x + cpfabs(rot.x)*e.y;
+	
+	return cpBBNew(c.x - ex, c.y - ey, c.x + ex, c.y + ey);
+}
+
+// Most polys never reach the narrowphase, so only what's needed for the bounding box is transformed here.
+// The rest is transformed by cpPolyShapeCacheTransform() when a collision or query needs it.
 static cpBB
 cpPolyShapeCacheData(cpPolyShape *poly, cpVect p, cpVect rot)
 {
-	cpPolyShapeTransformAxes(poly, p, rot);
-	cpBB bb = poly->shape.bb = cpPolyShapeTransformVerts(poly, p, rot);
+	poly->tPos = p;
+	poly->tRot = rot;
+	poly->stamp++;
+	
+	if(poly->rect){
+		return (poly->shape.bb = cpPolyShapeRectBB(poly, p, rot));
+	} else {
+		return (poly->shape.bb = cpPolyShapeTransformVerts(poly, p, rot));
+	}
+}
+
+void
+cpPolyShapeUpdateBatch(cpPolyShape **polys, int count)
+{
+	cpAssertSoft(count <= CP_SHAPE_BATCH_SIZE, "Internal Error: Shape batch is too large.");
+	cpFloat px[CP_SHAPE_BATCH_SIZE], py[CP_SHAPE_BATCH_SIZE], rx[CP_SHAPE_BATCH_SIZE], ry[CP_SHAPE_BATCH_SIZE];
+	cpFloat cx[CP_SHAPE_BATCH_SIZE], cy[CP_SHAPE_BATCH_SIZE], ex[CP_SHAPE_BATCH_SIZE], ey[CP_SHAPE_BATCH_SIZE];
 	
-	return bb;
+	for(int i=0; i<count; i++){
+		cpPolyShape *poly = polys[i];
+		cpBody *body = poly->shape.body;
+		px[i] = body->p.x; py[i] = body->p.y;
+		rx[i] = body->rot.x; ry[i] = body->rot.y;
+		cx[i] = poly->center.x; cy[i] = poly->center.y;
+		ex[i] = poly->extents.x; ey[i] = poly->extents.y;
+		
+		// The vertex loop vectorizes well enough on it's own.
+		if(!poly->rect) cpPolyShapeCacheData(poly, body->p, body->rot);
+	}
+	
+	// Same math as cpPolyShapeRectBB().
+	for(int i=0; i<count; i++){
+		cpFloat x = cx[i], y = cy[i];
+		cx[i] = px[i] + (x*rx[i] - y*ry[i]);
+		cy[i] = py[i] + (x*ry[i] + y*rx[i]);
+		
+		x = ex[i], y = ey[i];
+		ex[i] = cpfabs(rx[i])*x + cpfabs(ry[i])*y;
+		ey[i] = cpfabs(ry[i])*x + cpfabs(rx[i])*y;
+	}
+	
+	for(int i=0; i<count; i++){
+		cpPolyShape *poly = polys[i];
+		if(!poly->rect) continue;
+		
+		cpBody *body = poly->shape.body;
+		poly->tPos = body->p;
+		poly->tRot = body->rot;
+		poly->stamp++;
+		
+		poly->shape.bb = cpBBNew(cx[i] - ex[i], cy[i] - ey[i], cx[i] + ex[i], cy[i] + ey[i]);
+	}
 }
 
 static void
 cpPolyShapeDestroy(cpPolyShape *poly)
 {
-	cpfree(poly->verts);
-	cpfree(poly->tVerts);
+	// Pooled polys keep their arrays in the same block, right after the struct.
+	if(!(poly->shape.pool && poly->verts == (cpVect *)(poly + 1))) cpfree(poly->verts);
 	
-	cpfree(poly->axes);
-	cpfree(poly->tAxes);
+	poly->verts = poly->tVerts = NULL;
+	poly->axes = poly->tAxes = NULL;
 }
 
 static cpBool
 cpPolyShapePointQuery(cpPolyShape *poly, cpVect p){
-	return cpBBContainsVect(poly->shape.bb, p) && cpPolyShapeContainsVert(poly, p);
+	if(!cpBBContainsVect(poly->shape.bb, p)) return cpFalse;
+	
+	cpPolyShapeCacheTransform(poly);
+	return cpPolyShapeContainsVert(poly, p, 0.0f);
 }
 
 static void
 cpPolyShapeSegmentQuery(cpPolyShape *poly, cpVect a, cpVect b, cpSegmentQueryInfo *info)
 {
+	cpPolyShapeCacheTransform(poly);
+	
 	cpPolyShapeAxis *axes = poly->tAxes;
 	cpVect *verts = poly->tVerts;
 	int numVerts = poly->numVerts;
@@ -118,12 +194,47 @@ cpPolyShapeSegmentQuery(cpPolyShape *poly, cpVect a, cpVect b, cpSegmentQueryInf
 	}
 }
 
+// Only the vertexes that cpPolyShapeCacheData() transformed are saved.
+// The axes and rectangle vertexes are transformed again when something needs them.
+static void
+cpPolyShapeSnapshot(cpPolyShape *poly, cpSnapshotCursor *cursor)
+{
+	cpSnapshotTransfer(cursor, poly, sizeof(cpPolyShape));
+	if(!poly->rect) cpSnapshotTransfer(cursor, poly->tVerts, poly->numVerts*sizeof(cpVect));
+	
+	if(cursor->restore) poly->tStamp = poly->stamp - 1;
+}
+
+// Copies always keep their arrays right after the struct like other pooled polys.
+static cpPolyShape *
+cpPolyShapeClone(cpPolyShape *poly, cpBody *body, cpSpace *space)
+{
+	int numVerts = poly->numVerts;
+	size_t storage = cpPolyShapeStorageSize(numVerts);
+	
+	cpSpacePool *pool = cpSpaceGetPool(space, sizeof(cpPolyShape) + storage);
+	cpPolyShape *copy = (cpPolyShape *)cpSpacePoolAlloc(pool);
+	(*copy) = (*poly);
+	memcpy(copy + 1, poly->verts, storage);
+	
+	copy->verts = (cpVect *)(copy + 1);
+	copy->tVerts = copy->verts + numVerts;
+	copy->axes = (cpPolyShapeAxis *)(copy->tVerts + numVerts);
+	copy->tAxes = copy->axes + numVerts;
+	
+	copy->shape.body = body;
+	copy->shape.pool = pool;
+	return copy;
+}
+
 static const cpShapeClass polyClass = {
 	CP_POLY_SHAPE,
 	(cpShapeCacheDataImpl)cpPolyShapeCacheData,
 	(cpShapeDestroyImpl)cpPolyShapeDestroy,
 	(cpShapePointQueryImpl)cpPolyShapePointQuery,
 	(cpShapeSegmentQueryImpl)cpPolyShapeSegmentQuery,
+	(cpShapeSnapshotImpl)cpPolyShapeSnapshot,
+	(cpShapeCloneImpl)cpPolyShapeClone,
 };
 
 cpBool
@@ -158,15 +269,27 @@ cpPolyShapeGetVert(cpShape *shape, int idx)
 }
 
 
+size_t
+cpPolyShapeStorageSize(int numVerts)
+{
+	return numVerts*(2*sizeof(cpVect) + 2*sizeof(cpPolyShapeAxis));
+}
+
+// The vertex and axis arrays share a single block.
+// It's allocated when storage is NULL.
 static void
-setUpVerts(cpPolyShape *poly, int numVerts, cpVect *verts, cpVect offset)
+setUpVerts(cpPolyShape *poly, int numVerts, cpVect *verts, cpVect offset, void *storage)
 {
 	poly->numVerts = numVerts;
-
-	poly->verts = (cpVect *)cpcalloc(numVerts, sizeof(cpVect));
-	poly->tVerts = (cpVect *)cpcalloc(numVerts, sizeof(cpVect));
-	poly->axes = (cpPolyShapeAxis *)cpcalloc(numVerts, sizeof(cpPolyShapeAxis));
-	poly->tAxes = (cpPolyShapeAxis *)cpcalloc(numVerts, sizeof(cpPolyShapeAxis));
+	
+	if(!storage) storage = cpcalloc(1, cpPolyShapeStorageSize(numVerts));
+	poly->verts = (cpVect *)storage;
+	poly->tVerts = poly->verts + numVerts;
+	poly->axes = (cpPolyShapeAxis *)(poly->tVerts + numVerts);
+	poly->tAxes = poly->axes + numVerts;
+	
+	cpVect first = cpvadd(offset, verts[0]);
+	cpBB bb = cpBBNew(first.x, first.y, first.x, first.y);
 	
 	for(int i=0; i<numVerts; i++){
 		cpVect a = cpvadd(offset, verts[i]);
@@ -176,21 +299,52 @@ setUpVerts(cpPolyShape *poly, int numVerts, cpVect *verts, cpVect offset)
 		poly->verts[i] = a;
 		poly->axes[i].n = n;
 		poly->axes[i].d = cpvdot(n, a);
+		
+		bb = cpBBExpand(bb, a);
 	}
+	
+	// Measure the extents from the rounded center so every vertex is inside.
+	cpVect c = poly->center = cpvlerp(cpv(bb.l, bb.b), cpv(bb.r, bb.t), 0.5f);
+	cpVect e = cpvzero;
+	
+	// A convex quad with every vertex on a corner of it's bounding box is a rectangle.
+	poly->rect = (numVerts == 4);
+	
+	for(int i=0; i<numVerts; i++){
+		cpVect v = poly->verts[i];
+		if((v.x != bb.l && v.x != bb.r) || (v.y != bb.b && v.y != bb.t)) poly->rect = cpFalse;
+		
+		v = cpvsub(v, c);
+		e = cpv(cpfmax(e.x, cpfabs(v.x)), cpfmax(e.y, cpfabs(v.y)));
+	}
+	poly->extents = e;
+	
+	// The transformed vertexes are stale until they are transformed again.
+	poly->stamp++;
 }
 
 cpPolyShape *
-cpPolyShapeInit(cpPolyShape *poly, cpBody *body, int numVerts, cpVect *verts, cpVect offset)
+cpPolyShapeInitWithStorage(cpPolyShape *poly, cpBody *body, int numVerts, cpVect *verts, cpVect offset, void *storage)
 {
 	// Fail if the user attempts to pass a concave poly, or a bad winding.
 	cpAssertHard(cpPolyValidate(verts, numVerts), "Polygon is concave or has a reversed winding.");
 	
-	setUpVerts(poly, numVerts, verts, offset);
+	poly->tPos = cpvzero;
+	poly->tRot = cpv(1.0f, 0.0f);
+	poly->stamp = poly->tStamp = 0;
+	
+	setUpVerts(poly, numVerts, verts, offset, storage);
 	cpShapeInit((cpShape *)poly, &polyClass, body);
 
 	return poly;
 }
 
+cpPolyShape *
+cpPolyShapeInit(cpPolyShape *poly, cpBody *body, int numVerts, cpVect *verts, cpVect offset)
+{
+	return cpPolyShapeInitWithStorage(poly, body, numVerts, verts, offset, NULL);
+}
+
 cpShape *
 cpPolyShapeNew(cpBody *body, int numVerts, cpVect *verts, cpVect offset)
 {
@@ -238,5 +392,6 @@ cpPolyShapeSetVerts(cpShape *shape, int numVerts, cpVect *verts, cpVect offset)
 {
 	cpAssertHard(shape->klass == &polyClass, "Shape is not a poly shape.");
 	cpPolyShapeDestroy((cpPolyShape *)shape);
-	setUpVerts((cpPolyShape *)shape, numVerts, verts, offset);
+	setUpVerts((cpPolyShape *)shape, numVerts, verts, offset, NULL);
+	cpShapeMarkModified(shape);
 }
@@ -0,0 +1,606 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "chipmunk_private.h"
+
+// A stream starts with its stamp, its baseline and the two quanta.
+// Each body that changed since the baseline follows as the difference of its id from the previous one,
+// a byte of flags and the fields that the flags say changed, all as zigzag encoded varints except for the angle.
+
+#define FLAG_POSITION 0x01
+#define FLAG_ANGLE 0x02
+#define FLAG_VELOCITY 0x04
+#define FLAG_SLEEPING 0x08
+
+// Quantized values are kept small enough that their zigzag encoding fits in an unsigned int.
+#define QUANTIZE_LIMIT 1073741823.0
+#define ANGLE_STEPS 65536
+
+enum {
+	GROUP_POSITION,
+	GROUP_ANGLE,
+	GROUP_VELOCITY,
+	GROUP_SLEEPING,
+	GROUP_COUNT,
+};
+
+#pragma mark Byte Streams
+
+typedef struct StreamWriter {
+	unsigned char *buffer;
+	size_t capacity, size;
+} StreamWriter;
+
+static inline void
+WriteByte(StreamWriter *writer, unsigned int value)
+{
+	if(writer->size < writer->capacity) writer->buffer[writer->size] = (unsigned char)value;
+	writer->size++;
+}
+
+static inline void
+WriteVarint(StreamWriter *writer, unsigned int value)
+{
+	while(value >= 0x80){
+		WriteByte(writer, (value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	
+	WriteByte(writer, value);
+}
+
+static inline void
+WriteSigned(StreamWriter *writer, int value)
+{
+	WriteVarint(writer, ((unsigned int)value << 1) ^ (unsigned int)-(value < 0));
+}
+
+static inline void
+WriteFloat(StreamWriter *writer, cpFloat value)
+{
+	float f = (float)value;
+	unsigned int bits;
+	memcpy(&bits, &f, sizeof(bits));
+	
+	for(int i=0; i<4; i++) WriteByte(writer, (bits >> 8*i) & 0xFF);
+}
+
+// Reading past the end of the stream sets the overflow flag instead of failing right away.
+typedef struct StreamReader {
+	const unsigned char *buffer;
+	size_t size, offset;
+	cpBool overflow;
+} StreamReader;
+
+static inline unsigned int
+ReadByte(StreamReader *reader)
+{
+	if(reader->offset < reader->size){
+		return reader->buffer[reader->offset++];
+	} else {
+		reader->overflow = cpTrue;
+		return 0;
+	}
+}
+
+static inline unsigned int
+ReadVarint(StreamReader *reader)
+{
+	unsigned int value = 0;
+	
+	for(int shift=0; shift<32; shift+=7){
+		unsigned int byte = ReadByte(reader);
+		value |= (byte & 0x7F) << shift;
+		if(!(byte & 0x80)) return value;
+	}
+	
+	// Too many bytes for an unsigned int.
+	reader->overflow = cpTrue;
+	return 0;
+}
+
+static inline int
+ReadSigned(StreamReader *reader)
+{
+	unsigned int value = ReadVarint(reader);
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+static inline cpFloat
+ReadFloat(StreamReader *reader)
+{
+	unsigned int bits = 0;
+	for(int i=0; i<4; i++) bits |= ReadByte(reader) << 8*i;
+	
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+#pragma mark Encoder
+
+typedef struct EncoderEntry {
+	cpBody *body;
+	unsigned int id;
+	
+	// State of the body quantized by the last encode that saw it.
+	int p[2], a, v[2], w;
+	cpBool sleeping;
+	// Set until the body is first quantized.
+	cpBool fresh;
+	
+	// Stamp of the encode that last changed each group of fields.
+	cpTimestamp changed[GROUP_COUNT];
+	// Stamps of the last encode that found the body active or wrote it.
+	cpTimestamp seen, written;
+} EncoderEntry;
+
+// Entries that went to sleep are logged so that later encodes can find them without looking at every entry.
+typedef struct SleepRecord {
+	EncoderEntry *entry;
+	cpTimestamp stamp;
+} SleepRecord;
+
+struct cpReplicationEncoder {
+	cpSpace *space;
+	const cpAllocator *allocator;
+	
+	cpFloat positionQuantum, velocityQuantum;
+	cpTimestamp stamp;
+	
+	cpArray *entries;
+	cpHashSet *bodies;
+	
+	// Entries that were active at the last encode or registered since.
+	cpArray *awake, *scratch;
+	
+	SleepRecord *log;
+	int logCount, logCapacity;
+	// Records up to this stamp were dropped, older baselines need every entry to be checked.
+	cpTimestamp logStart;
+};
+
+static cpBool
+encoderEntryEql(cpBody *body, EncoderEntry *entry)
+{
+	return (body == entry->body);
+}
+
+cpReplicationEncoder *
+cpReplicationEncoderNew(cpSpace *space, cpFloat positionQuantum, cpFloat velocityQuantum)
+{
+	cpAssertHard(positionQuantum > 0.0f && velocityQuantum > 0.0f, "Quanta must be positive.");
+	
+	const cpAllocator *allocator = space->allocator;
+	cpReplicationEncoder *encoder = (cpReplicationEncoder *)cpAllocatorCalloc(allocator, 1, sizeof(cpReplicationEncoder));
+	encoder->space = space;
+	encoder->allocator = allocator;
+	
+	encoder->positionQuantum = positionQuantum;
+	encoder->velocityQuantum = velocityQuantum;
+	encoder->stamp = 0;
+	
+	encoder->entries = cpArrayNewWithAllocator(0, allocator);
+	encoder->bodies = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)encoderEntryEql, allocator);
+	encoder->awake = cpArrayNewWithAllocator(0, allocator);
+	encoder->scratch = cpArrayNewWithAllocator(0, allocator);
+	
+	encoder->log = NULL;
+	encoder->logCount = encoder->logCapacity = 0;
+	encoder->logStart = 0;
+	
+	return encoder;
+}
+
+void
+cpReplicationEncoderFree(cpReplicationEncoder *encoder)
+{
+	if(encoder){
+		const cpAllocator *allocator = encoder->allocator;
+		
+		cpArrayFreeEachBlock(encoder->entries);
+		cpArrayFree(encoder->entries);
+		cpHashSetFree(encoder->bodies);
+		cpArrayFree(encoder->awake);
+		cpArrayFree(encoder->scratch);
+		cpAllocatorFree(allocator, encoder->log);
+		
+		cpAllocatorFree(allocator, encoder);
+	}
+}
+
+void
+cpReplicationEncoderAddBody(cpReplicationEncoder *encoder, cpBody *body, unsigned int id)
+{
+	cpAssertHard(!cpBodyIsStatic(body), "Static bodies cannot be replicated.");
+	cpAssertHard(!cpHashSetFind(encoder->bodies, (cpHashValue)(size_t)body, body), "The body is already registered with this encoder.");
+	
+	EncoderEntry *entry = (EncoderEntry *)cpAllocatorCalloc(encoder->allocator, 1, sizeof(EncoderEntry));
+	entry->body = body;
+	entry->id = id;
+	entry->fresh = cpTrue;
+	
+	cpArrayPush(encoder->entries, entry);
+	cpHashSetInsert(encoder->bodies, (cpHashValue)(size_t)body, body, entry, NULL);
+	
+	// The next encode quantizes it whether it's active or not.
+	cpArrayPush(encoder->awake, entry);
+}
+
+void
+cpReplicationEncoderRemoveBody(cpReplicationEncoder *encoder, cpBody *body)
+{
+	EncoderEntry *entry = (EncoderEntry *)cpHashSetRemove(encoder->bodies, (cpHashValue)(size_t)body, body);
+	cpAssertHard(entry, "The body is not registered with this encoder.");
+	
+	cpArrayDeleteObj(encoder->entries, entry);
+	cpArrayDeleteObj(encoder->awake, entry);
+	
+	int count = 0;
+	for(int i=0; i<encoder->logCount; i++){
+		if(encoder->log[i].entry != entry) encoder->log[count++] = encoder->log[i];
+	}
+	encoder->logCount = count;
+	
+	cpAllocatorFree(encoder->allocator, entry);
+}
+
+static inline int
+Quantize(cpFloat value, cpFloat scale)
+{
+	return (int)cpfclamp(cpffloor(value*scale + 0.5f), -QUANTIZE_LIMIT, QUANTIZE_LIMIT);
+}
+
+static inline int
+QuantizeAngle(cpFloat angle)
+{
+	cpFloat turns = angle*(cpFloat)(0.5/M_PI);
+	return (int)cpffloor((turns - cpffloor(turns))*ANGLE_STEPS + 0.5f) & (ANGLE_STEPS - 1);
+}
+
+static void
+UpdateEntry(cpReplicationEncoder *encoder, EncoderEntry *entry, cpBool sleeping, cpTimestamp stamp)
+{
+	cpBody *body = entry->body;
+	cpFloat pscale = 1.0f/encoder->positionQuantum, vscale = 1.0f/encoder->velocityQuantum;
+	
+	int px = Quantize(body->p.x, pscale), py = Quantize(body->p.y, pscale);
+	int a = QuantizeAngle(body->a);
+	int vx = Quantize(body->v.x, vscale), vy = Quantize(body->v.y, vscale), w = Quantize(body->w, vscale);
+	cpBool fresh = entry->fresh;
+	
+	if(fresh || px != entry->p[0] || py != entry->p[1]){
+		entry->p[0] = px; entry->p[1] = py;
+		entry->changed[GROUP_POSITION] = stamp;
+	}
+	
+	if(fresh || a != entry->a){
+		entry->a = a;
+		entry->changed[GROUP_ANGLE] = stamp;
+	}
+	
+	if(fresh || vx != entry->v[0] || vy != entry->v[1] || w != entry->w){
+		entry->v[0] = vx; entry->v[1] = vy; entry->w = w;
+		entry->changed[GROUP_VELOCITY] = stamp;
+	}
+	
+	if(fresh || sleeping != entry->sleeping){
+		entry->sleeping = sleeping;
+		entry->changed[GROUP_SLEEPING] = stamp;
+	}
+	
+	entry->fresh = cpFalse;
+}
+
+static void
+LogSleep(cpReplicationEncoder *encoder, EncoderEntry *entry, cpTimestamp stamp)
+{
+	if(encoder->logCount == encoder->logCapacity){
+		encoder->logCapacity = (encoder->logCapacity ? 2*encoder->logCapacity : 64);
+		encoder->log = (SleepRecord *)cpAllocatorRealloc(encoder->allocator, encoder->log, encoder->logCapacity*sizeof(SleepRecord));
+	}
+	
+	SleepRecord record = {entry, stamp};
+	encoder->log[encoder->logCount++] = record;
+}
+
+// Drop the older half of the log once it holds more records than there are entries.
+static void
+TrimLog(cpReplicationEncoder *encoder)
+{
+	int count = encoder->logCount;
+	if(count <= 64 || count <= encoder->entries->num) return;
+	
+	int drop = count/2;
+	encoder->logStart = encoder->log[drop - 1].stamp;
+	memmove(encoder->log, encoder->log + drop, (count - drop)*sizeof(SleepRecord));
+	encoder->logCount = count - drop;
+}
+
+static void
+WriteEntry(StreamWriter *writer, EncoderEntry *entry, cpTimestamp baseline, cpTimestamp stamp, unsigned int *prevID)
+{
+	if(entry->written == stamp) return;
+	entry->written = stamp;
+	
+	cpTimestamp *changed = entry->changed;
+	if(
+		changed[GROUP_POSITION] <= baseline && changed[GROUP_ANGLE] <= baseline &&
+		changed[GROUP_VELOCITY] <= baseline && changed[GROUP_SLEEPING] <= baseline
+	) return;
+	
+	unsigned int flags = (entry->sleeping ? FLAG_SLEEPING : 0);
+	if(changed[GROUP_POSITION] > baseline) flags |= FLAG_POSITION;
+	if(changed[GROUP_ANGLE] > baseline) flags |= FLAG_ANGLE;
+	if(changed[GROUP_VELOCITY] > baseline) flags |= FLAG_VELOCITY;
+	
+	// Ids usually come in the same order every time, so their differences are small.
+	WriteSigned(writer, (int)(entry->id - *prevID));
+	*prevID = entry->id;
+	WriteByte(writer, flags);
+	
+	if(flags & FLAG_POSITION){
+		WriteSigned(writer, entry->p[0]);
+		WriteSigned(writer, entry->p[1]);
+	}
+	
+	if(flags & FLAG_ANGLE){
+		WriteByte(writer, entry->a & 0xFF);
+		WriteByte(writer, entry->a >> 8);
+	}
+	
+	if(flags & FLAG_VELOCITY){
+		WriteSigned(writer, entry->v[0]);
+		WriteSigned(writer, entry->v[1]);
+		WriteSigned(writer, entry->w);
+	}
+}
+
+size_t
+cpReplicationEncode(cpReplicationEncoder *encoder, cpTimestamp baseline, void *buffer, size_t capacity)
+{
+	cpAssertHard(baseline <= encoder->stamp, "The baseline is newer than any stream this encoder made.");
+	
+	cpTimestamp stamp = ++encoder->stamp;
+	unsigned int prevID = 0;
+	
+	StreamWriter writer = {(unsigned char *)buffer, capacity, 0};
+	WriteVarint(&writer, stamp);
+	WriteVarint(&writer, baseline);
+	WriteFloat(&writer, encoder->positionQuantum);
+	WriteFloat(&writer, encoder->velocityQuantum);
+	
+	// Only the active bodies can have moved, the sleeping components are never visited.
+	cpArray *bodies = encoder->space->bodies;
+	cpArray *awake = encoder->scratch;
+	awake->num = 0;
+	
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		EncoderEntry *entry = (EncoderEntry *)cpHashSetFind(encoder->bodies, (cpHashValue)(size_t)body, body);
+		if(!entry) continue;
+		
+		entry->seen = stamp;
+		UpdateEntry(encoder, entry, cpFalse, stamp);
+		cpArrayPush(awake, entry);
+		
+		WriteEntry(&writer, entry, baseline, stamp, &prevID);
+	}
+	
+	// Bodies that were active last time but not anymore fell asleep or were removed from the space.
+	cpArray *previous = encoder->awake;
+	for(int i=0; i<previous->num; i++){
+		EncoderEntry *entry = (EncoderEntry *)previous->arr[i];
+		if(entry->seen == stamp) continue;
+		
+		UpdateEntry(encoder, entry, cpTrue, stamp);
+		LogSleep(encoder, entry, stamp);
+	}
+	
+	encoder->awake = awake;
+	encoder->scratch = previous;
+	
+	if(baseline < encoder->logStart){
+		cpArray *entries = encoder->entries;
+		for(int i=0; i<entries->num; i++) WriteEntry(&writer, (EncoderEntry *)entries->arr[i], baseline, stamp, &prevID);
+	} else {
+		for(int i=encoder->logCount - 1; i>=0 && encoder->log[i].stamp > baseline; i--){
+			WriteEntry(&writer, encoder->log[i].entry, baseline, stamp, &prevID);
+		}
+	}
+	
+	TrimLog(encoder);
+	
+	return writer.size;
+}
+
+#pragma mark Decoder
+
+typedef struct DecoderEntry {
+	unsigned int id;
+	cpBody *body;
+} DecoderEntry;
+
+struct cpReplicationDecoder {
+	cpSpace *space;
+	const cpAllocator *allocator;
+	
+	cpHashSet *bodies;
+	cpTimestamp stamp;
+};
+
+static cpBool
+decoderEntryEql(unsigned int *id, DecoderEntry *entry)
+{
+	return (*id == entry->id);
+}
+
+cpReplicationDecoder *
+cpReplicationDecoderNew(cpSpace *space)
+{
+	const cpAllocator *allocator = space->allocator;
+	cpReplicationDecoder *decoder = (cpReplicationDecoder *)cpAllocatorCalloc(allocator, 1, sizeof(cpReplicationDecoder));
+	decoder->space = space;
+	decoder->allocator = allocator;
+	
+	decoder->bodies = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)decoderEntryEql, allocator);
+	decoder->stamp = 0;
+	
+	return decoder;
+}
+
+static void
+freeDecoderEntry(DecoderEntry *entry, cpReplicationDecoder *decoder)
+{
+	cpAllocatorFree(decoder->allocator, entry);
+}
+
+void
+cpReplicationDecoderFree(cpReplicationDecoder *decoder)
+{
+	if(decoder){
+		cpHashSetEach(decoder->bodies, (cpHashSetIteratorFunc)freeDecoderEntry, decoder);
+		cpHashSetFree(decoder->bodies);
+		
+		cpAllocatorFree(decoder->allocator, decoder);
+	}
+}
+
+void
+cpReplicationDecoderAddBody(cpReplicationDecoder *decoder, cpBody *body, unsigned int id)
+{
+	cpAssertHard(!cpHashSetFind(decoder->bodies, (cpHashValue)id, &id), "A body is already registered with this id.");
+	
+	DecoderEntry *entry = (DecoderEntry *)cpAllocatorCalloc(decoder->allocator, 1, sizeof(DecoderEntry));
+	entry->id = id;
+	entry->body = body;
+	
+	cpHashSetInsert(decoder->bodies, (cpHashValue)id, &id, entry, NULL);
+}
+
+void
+cpReplicationDecoderRemoveBody(cpReplicationDecoder *decoder, unsigned int id)
+{
+	DecoderEntry *entry = (DecoderEntry *)cpHashSetRemove(decoder->bodies, (cpHashValue)id, &id);
+	cpAssertHard(entry, "No body is registered with this id.");
+	
+	cpAllocatorFree(decoder->allocator, entry);
+}
+
+// Turn the body by the shortest way to the angle so it doesn't spin back to the first turn.
+static inline cpFloat
+UnwrapAngle(cpFloat current, int angle)
+{
+	cpFloat turn = 2.0f*(cpFloat)M_PI;
+	cpFloat delta = angle*(turn/ANGLE_STEPS) - current;
+	return current + delta - turn*cpffloor(delta/turn + 0.5f);
+}
+
+static void
+ApplyRecord(cpBody *body, unsigned int flags, const int *p, int a, const int *v, int w, cpFloat pq, cpFloat vq)
+{
+	if(flags & FLAG_POSITION) cpBodySetPos(body, cpv(p[0]*pq, p[1]*pq));
+	if(flags & FLAG_ANGLE) cpBodySetAngle(body, UnwrapAngle(body->a, a));
+	
+	if(flags & FLAG_VELOCITY){
+		cpBodySetVel(body, cpv(v[0]*vq, v[1]*vq));
+		cpBodySetAngVel(body, w*vq);
+	}
+	
+	// Rogue bodies aren't simulated, so there is nothing to wake up or put to sleep.
+	if(cpBodyIsRogue(body) || cpBodyIsStatic(body)) return;
+	
+	if(flags & FLAG_SLEEPING){
+		// Putting bodies to sleep one at a time would split up the components of the client's contact graph.
+		// Mark the body as idle instead so the client's next step puts it to sleep along with everything it touches.
+		cpFloat threshold = body->space->sleepTimeThreshold;
+		if(!cpBodyIsSleeping(body) && threshold != INFINITY) body->node.idleTime = cpfmax(body->node.idleTime, threshold);
+	} else {
+		cpBodyActivate(body);
+	}
+}
+
+// Read the records of a stream and apply them when apply is set.
+// Returns false if the stream is malformed.
+static cpBool
+DecodeRecords(cpReplicationDecoder *decoder, StreamReader *reader, cpFloat pq, cpFloat vq, cpBool apply)
+{
+	unsigned int id = 0;
+	
+	while(reader->offset < reader->size){
+		id += (unsigned int)ReadSigned(reader);
+		unsigned int flags = ReadByte(reader);
+		
+		int p[2] = {0, 0}, a = 0, v[2] = {0, 0}, w = 0;
+		
+		if(flags & FLAG_POSITION){
+			p[0] = ReadSigned(reader);
+			p[1] = ReadSigned(reader);
+		}
+		
+		if(flags & FLAG_ANGLE){
+			a = ReadByte(reader);
+			a |= ReadByte(reader) << 8;
+		}
+		
+		if(flags & FLAG_VELOCITY){
+			v[0] = ReadSigned(reader);
+			v[1] = ReadSigned(reader);
+			w = ReadSigned(reader);
+		}
+		
+		if(reader->overflow) return cpFalse;
+		if(!apply) continue;
+		
+		DecoderEntry *entry = (DecoderEntry *)cpHashSetFind(decoder->bodies, (cpHashValue)id, &id);
+		if(entry) ApplyRecord(entry->body, flags, p, a, v, w, pq, vq);
+	}
+	
+	return cpTrue;
+}
+
+cpTimestamp
+cpReplicationDecode(cpReplicationDecoder *decoder, const void *buffer, size_t size)
+{
+	cpAssertHard(!decoder->space->locked, "Streams cannot be applied during a query or a call to cpSpaceStep(). Put these calls into a post-step callback.");
+	
+	StreamReader reader = {(const unsigned char *)buffer, size, 0, cpFalse};
+	cpTimestamp stamp = ReadVarint(&reader);
+	cpTimestamp baseline = ReadVarint(&reader);
+	cpFloat pq = ReadFloat(&reader);
+	cpFloat vq = ReadFloat(&reader);
+	
+	// Streams that arrive out of order, or that are deltas against state this decoder never received, are simply dropped.
+	if(reader.overflow || stamp <= decoder->stamp || baseline > decoder->stamp) return decoder->stamp;
+	
+	// Check the whole stream first so that a malformed one isn't applied halfway.
+	size_t start = reader.offset;
+	if(!DecodeRecords(decoder, &reader, pq, vq, cpFalse)) return decoder->stamp;
+	
+	reader.offset = start;
+	DecodeRecords(decoder, &reader, pq, vq, cpTrue);
+	
+	return (decoder->stamp = stamp);
+}
@@ -63,6 +63,8 @@ cpShapeInit(cpShape *shape, const cpShapeClass *klass, cpBody *body)
 	shape->data = NULL;
 	shape->next = NULL;
 	shape->prev = NULL;
+	shape->modified = 0;
+	shape->pool = NULL;
 	
 	return shape;
 }
@@ -78,7 +80,12 @@ cpShapeFree(cpShape *shape)
 {
 	if(shape){
 		cpShapeDestroy(shape);
-		cpfree(shape);
+		
+		if(shape->pool){
+			cpSpacePoolRecycle(shape->pool, shape);
+		} else {
+			cpfree(shape);
+		}
 	}
 }
 
@@ -89,6 +96,24 @@ cpShapeSetBody(cpShape *shape, cpBody *body)
 	shape->body = body;
 }
 
+void
+cpShapeSetGroup(cpShape *shape, cpGroup group)
+{
+	cpBodyActivate(shape->body);
+	shape->group = group;
+	
+	if(shape->space) cpSpaceRefilterShape(shape->space, shape);
+}
+
+void
+cpShapeSetLayers(cpShape *shape, cpLayers layers)
+{
+	cpBodyActivate(shape->body);
+	shape->layers = layers;
+	
+	if(shape->space) cpSpaceRefilterShape(shape->space, shape);
+}
+
 cpBB
 cpShapeCacheBB(cpShape *shape)
 {
@@ -130,6 +155,36 @@ cpCircleShapeCacheData(cpCircleShape *circle, cpVect p, cpVect rot)
 	return cpBBNew(c.x-r, c.y-r, c.x+r, c.y+r);
 }
 
+void
+cpCircleShapeUpdateBatch(cpCircleShape **circles, int count)
+{
+	cpAssertSoft(count <= CP_SHAPE_BATCH_SIZE, "Internal Error: Shape batch is too large.");
+	cpFloat px[CP_SHAPE_BATCH_SIZE], py[CP_SHAPE_BATCH_SIZE], rx[CP_SHAPE_BATCH_SIZE], ry[CP_SHAPE_BATCH_SIZE];
+	cpFloat cx[CP_SHAPE_BATCH_SIZE], cy[CP_SHAPE_BATCH_SIZE];
+	
+	for(int i=0; i<count; i++){
+		cpCircleShape *circle = circles[i];
+		cpBody *body = circle->shape.body;
+		px[i] = body->p.x; py[i] = body->p.y;
+		rx[i] = body->rot.x; ry[i] = body->rot.y;
+		cx[i] = circle->c.x; cy[i] = circle->c.y;
+	}
+	
+	// Same math as cpCircleShapeCacheData().
+	for(int i=0; i<count; i++){
+		cpFloat x = cx[i], y = cy[i];
+		cx[i] = px[i] + (x*rx[i] - y*ry[i]);
+		cy[i] = py[i] + (x*ry[i] + y*rx[i]);
+	}
+	
+	for(int i=0; i<count; i++){
+		cpCircleShape *circle = circles[i];
+		cpVect c = circle->tc = cpv(cx[i], cy[i]);
+		cpFloat r = circle->r;
+		circle->shape.bb = cpBBNew(c.x-r, c.y-r, c.x+r, c.y+r);
+	}
+}
+
 static cpBool
 cpCircleShapePointQuery(cpCircleShape *circle, cpVect p){
 	return cpvnear(circle->tc, p, circle->r);
@@ -164,12 +219,32 @@ cpCircleShapeSegmentQuery(cpCircleShape *circle, cpVect a, cpVect b, cpSegmentQu
 	circleSegmentQuery((cpShape *)circle, circle->tc, circle->r, a, b, info);
 }
 
+static void
+cpCircleShapeSnapshot(cpCircleShape *circle, cpSnapshotCursor *cursor)
+{
+	cpSnapshotTransfer(cursor, circle, sizeof(cpCircleShape));
+}
+
+static cpCircleShape *
+cpCircleShapeClone(cpCircleShape *circle, cpBody *body, cpSpace *space)
+{
+	cpSpacePool *pool = cpSpaceGetPool(space, sizeof(cpCircleShape));
+	cpCircleShape *copy = (cpCircleShape *)cpSpacePoolAlloc(pool);
+	(*copy) = (*circle);
+	
+	copy->shape.body = body;
+	copy->shape.pool = pool;
+	return copy;
+}
+
 static const cpShapeClass cpCircleShapeClass = {
 	CP_CIRCLE_SHAPE,
 	(cpShapeCacheDataImpl)cpCircleShapeCacheData,
 	NULL,
 	(cpShapePointQueryImpl)cpCircleShapePointQuery,
 	(cpShapeSegmentQueryImpl)cpCircleShapeSegmentQuery,
+	(cpShapeSnapshotImpl)cpCircleShapeSnapshot,
+	(cpShapeCloneImpl)cpCircleShapeClone,
 };
 
 cpCircleShape *
@@ -227,6 +302,57 @@ cpSegmentShapeCacheData(cpSegmentShape *seg, cpVect p, cpVect rot)
 	return cpBBNew(l - rad, b - rad, r + rad, t + rad);
 }
 
+void
+cpSegmentShapeUpdateBatch(cpSegmentShape **segs, int count)
+{
+	cpAssertSoft(count <= CP_SHAPE_BATCH_SIZE, "Internal Error: Shape batch is too large.");
+	cpFloat px[CP_SHAPE_BATCH_SIZE], py[CP_SHAPE_BATCH_SIZE], rx[CP_SHAPE_BATCH_SIZE], ry[CP_SHAPE_BATCH_SIZE];
+	cpFloat ax[CP_SHAPE_BATCH_SIZE], ay[CP_SHAPE_BATCH_SIZE], bx[CP_SHAPE_BATCH_SIZE], by[CP_SHAPE_BATCH_SIZE];
+	cpFloat nx[CP_SHAPE_BATCH_SIZE], ny[CP_SHAPE_BATCH_SIZE];
+	
+	for(int i=0; i<count; i++){
+		cpSegmentShape *seg = segs[i];
+		cpBody *body = seg->shape.body;
+		px[i] = body->p.x; py[i] = body->p.y;
+		rx[i] = body->rot.x; ry[i] = body->rot.y;
+		ax[i] = seg->a.x; ay[i] = seg->a.y;
+		bx[i] = seg->b.x; by[i] = seg->b.y;
+		nx[i] = seg->n.x; ny[i] = seg->n.y;
+	}
+	
+	// Same math as cpSegmentShapeCacheData().
+	for(int i=0; i<count; i++){
+		cpFloat x, y;
+		
+		x = ax[i], y = ay[i];
+		ax[i] = px[i] + (x*rx[i] - y*ry[i]);
+		ay[i] = py[i] + (x*ry[i] + y*rx[i]);
+		
+		x = bx[i], y = by[i];
+		bx[i] = px[i] + (x*rx[i] - y*ry[i]);
+		by[i] = py[i] + (x*ry[i] + y*rx[i]);
+		
+		x = nx[i], y = ny[i];
+		nx[i] = x*rx[i] - y*ry[i];
+		ny[i] = x*ry[i] + y*rx[i];
+	}
+	
+	for(int i=0; i<count; i++){
+		cpSegmentShape *seg = segs[i];
+		seg->ta = cpv(ax[i], ay[i]);
+		seg->tb = cpv(bx[i], by[i]);
+		seg->tn = cpv(nx[i], ny[i]);
+		
+		cpFloat l = (ax[i] < bx[i] ? ax[i] : bx[i]);
+		cpFloat r = (ax[i] < bx[i] ? bx[i] : ax[i]);
+		cpFloat b = (ay[i] < by[i] ? ay[i] : by[i]);
+		cpFloat t = (ay[i] < by[i] ? by[i] : ay[i]);
+		
+		cpFloat rad = seg->r;
+		seg->shape.bb = cpBBNew(l - rad, b - rad, r + rad, t + rad);
+	}
+}
+
 static cpBool
 cpSegmentShapePointQuery(cpSegmentShape *seg, cpVect p){
 	if(!cpBBContainsVect(seg->shape.bb, p)) return cpFalse;
@@ -310,12 +436,32 @@ cpSegmentShapeSegmentQuery(cpSegmentShape *seg, cpVect a, cpVect b, cpSegmentQue
 	}
 }
 
+static void
+cpSegmentShapeSnapshot(cpSegmentShape *seg, cpSnapshotCursor *cursor)
+{
+	cpSnapshotTransfer(cursor, seg, sizeof(cpSegmentShape));
+}
+
+static cpSegmentShape *
+cpSegmentShapeClone(cpSegmentShape *seg, cpBody *body, cpSpace *space)
+{
+	cpSpacePool *pool = cpSpaceGetPool(space, sizeof(cpSegmentShape));
+	cpSegmentShape *copy = (cpSegmentShape *)cpSpacePoolAlloc(pool);
+	(*copy) = (*seg);
+	
+	copy->shape.body = body;
+	copy->shape.pool = pool;
+	return copy;
+}
+
 static const cpShapeClass cpSegmentShapeClass = {
 	CP_SEGMENT_SHAPE,
 	(cpShapeCacheDataImpl)cpSegmentShapeCacheData,
 	NULL,
 	(cpShapePointQueryImpl)cpSegmentShapePointQuery,
 	(cpShapeSegmentQueryImpl)cpSegmentShapeSegmentQuery,
+	(cpShapeSnapshotImpl)cpSegmentShapeSnapshot,
+	(cpShapeCloneImpl)cpSegmentShapeClone,
 };
 
 cpSegmentShape *
@@ -352,6 +498,7 @@ cpCircleShapeSetRadius(cpShape *shape, cpFloat radius)
 	cpCircleShape *circle = (cpCircleShape *)shape;
 	
 	circle->r = radius;
+	cpShapeMarkModified(shape);
 }
 
 void
@@ -361,6 +508,7 @@ cpCircleShapeSetOffset(cpShape *shape, cpVect offset)
 	cpCircleShape *circle = (cpCircleShape *)shape;
 	
 	circle->c = offset;
+	cpShapeMarkModified(shape);
 }
 
 void
@@ -372,6 +520,7 @@ cpSegmentShapeSetEndpoints(cpShape *shape, cpVect a, cpVect b)
 	seg->a = a;
 	seg->b = b;
 	seg->n = cpvperp(cpvnormalize(cpvsub(b, a)));
+	cpShapeMarkModified(shape);
 }
 
 void
@@ -381,4 +530,5 @@ cpSegmentShapeSetRadius(cpShape *shape, cpFloat radius)
 	cpSegmentShape *seg = (cpSegmentShape *)shape;
 	
 	seg->r = radius;
+	cpShapeMarkModified(shape);
 }
@@ -49,14 +49,49 @@ handlerSetEql(cpCollisionHandler *check, cpCollisionHandler *pair)
 
 // Transformation function for collisionHandlers.
 static void *
-handlerSetTrans(cpCollisionHandler *handler, void *unused)
+handlerSetTrans(cpCollisionHandler *handler, const cpAllocator *allocator)
 {
-	cpCollisionHandler *copy = (cpCollisionHandler *)cpcalloc(1, sizeof(cpCollisionHandler));
+	cpCollisionHandler *copy = (cpCollisionHandler *)cpAllocatorCalloc(allocator, 1, sizeof(cpCollisionHandler));
 	(*copy) = (*handler);
 	
 	return copy;
 }
 
+static void
+handlerMaxType(cpCollisionHandler *handler, size_t *maxType)
+{
+	if((size_t)handler->a > (*maxType)) (*maxType) = (size_t)handler->a;
+	if((size_t)handler->b > (*maxType)) (*maxType) = (size_t)handler->b;
+}
+
+// Rebuild the dense handler table used by cpSpaceLookupHandler() after the handlers change.
+static void
+cpSpaceUpdateHandlerTable(cpSpace *space)
+{
+	cpAllocatorFree(space->allocator, space->handlerTable);
+	space->handlerTable = NULL;
+	space->handlerTableSize = 0;
+	
+	size_t maxType = 0;
+	cpHashSetEach(space->collisionHandlers, (cpHashSetIteratorFunc)handlerMaxType, &maxType);
+	
+	// Fall back on the hash set if the types are too large for the table.
+	if(maxType >= CP_HANDLER_TABLE_TYPES) return;
+	
+	// The extra row and column are shared by all the types without handlers.
+	size_t size = maxType + 2;
+	cpCollisionHandler **table = (cpCollisionHandler **)cpAllocatorCalloc(space->allocator, size*size, sizeof(cpCollisionHandler *));
+	
+	for(size_t i=0; i<size; i++){
+		for(size_t j=0; j<size; j++){
+			table[i*size + j] = cpSpaceLookupHandler(space, (cpCollisionType)i, (cpCollisionType)j);
+		}
+	}
+	
+	space->handlerTable = table;
+	space->handlerTableSize = (int)size;
+}
+
 #pragma mark Misc Helper Funcs
 
 // Default collision functions.
@@ -66,7 +101,13 @@ static void nothing(cpArbiter *arb, cpSpace *space, void *data){}
 // function to get the estimated velocity of a shape for the cpBBTree.
 static cpVect shapeVelocityFunc(cpShape *shape){return shape->body->v;}
 
-static void freeWrap(void *ptr, void *unused){cpfree(ptr);}
+// function to get the collision filter of a shape for the cpBBTree.
+static cpBBTreeFilter shapeFilterFunc(cpShape *shape){
+	cpBBTreeFilter filter = {shape->body, shape->layers, shape->group};
+	return filter;
+}
+
+static void freeWrap(void *ptr, const cpAllocator *allocator){cpAllocatorFree(allocator, ptr);}
 
 #pragma mark Memory Management Functions
 
@@ -78,8 +119,8 @@ cpSpaceAlloc(void)
 
 cpCollisionHandler cpDefaultCollisionHandler = {0, 0, alwaysCollide, alwaysCollide, nothing, nothing, NULL};
 
-cpSpace*
-cpSpaceInit(cpSpace *space)
+static cpSpace *
+cpSpaceInitWithAllocator(cpSpace *space, const cpAllocator *allocator)
 {
 #ifndef NDEBUG
 	printf("Initializing cpSpace - Chipmunk v%s (Debug Enabled)\n", cpVersionString);
@@ -87,6 +128,8 @@ cpSpaceInit(cpSpace *space)
 #endif
 
 	space->iterations = 10;
+	space->solverTolerance = 0.0f;
+	space->iterationsUsed = 0;
 	
 	space->gravity = cpvzero;
 	space->damping = 1.0f;
@@ -94,37 +137,70 @@ cpSpaceInit(cpSpace *space)
 	space->collisionSlop = 0.1f;
 	space->collisionBias = cpfpow(1.0f - 0.1f, 60.0f);
 	space->collisionPersistence = 3;
+	space->contactReuseTolerance = 0.0f;
 	
 	space->locked = 0;
 	space->stamp = 0;
+	
+	space->allocator = allocator;
 
-	space->staticShapes = cpBBTreeNew((cpSpatialIndexBBFunc)cpShapeGetBB, NULL);
-	space->activeShapes = cpBBTreeNew((cpSpatialIndexBBFunc)cpShapeGetBB, space->staticShapes);
+	space->staticShapes = cpBBTreeNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, NULL, allocator);
+	space->activeShapes = cpBBTreeNewWithAllocator((cpSpatialIndexBBFunc)cpShapeGetBB, space->staticShapes, allocator);
 	cpBBTreeSetVelocityFunc(space->activeShapes, (cpBBTreeVelocityFunc)shapeVelocityFunc);
+	cpBBTreeSetFilterFunc(space->staticShapes, (cpBBTreeFilterFunc)shapeFilterFunc);
+	cpBBTreeSetFilterFunc(space->activeShapes, (cpBBTreeFilterFunc)shapeFilterFunc);
+	space->filteredIndexes = cpTrue;
+	space->staleFilters = cpFalse;
 	
-	space->allocatedBuffers = cpArrayNew(0);
+	space->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
+	space->pools = cpArrayNewWithAllocator(0, allocator);
 	
-	space->bodies = cpArrayNew(0);
-	space->sleepingComponents = cpArrayNew(0);
-	space->rousedBodies = cpArrayNew(0);
+	space->clonedObjects = NULL;
+	space->clonedShapes = NULL;
+	space->sharedStaticBody = NULL;
+	
+	space->bodies = cpArrayNewWithAllocator(0, allocator);
+	space->sleepingComponents = cpArrayNewWithAllocator(0, allocator);
+	space->rousedBodies = cpArrayNewWithAllocator(0, allocator);
 	
 	space->sleepTimeThreshold = INFINITY;
 	space->idleSpeedThreshold = 0.0f;
 	space->enableContactGraph = cpFalse;
+	space->enableSpeculativeContacts = cpFalse;
+	space->enableBlockSolver = cpFalse;
+	space->enableDirectSolver = cpFalse;
+	space->enableCollisionEvents = cpFalse;
 	
-	space->arbiters = cpArrayNew(0);
-	space->pooledArbiters = cpArrayNew(0);
+	space->arbiters = cpArrayNewWithAllocator(0, allocator);
+	space->arbiterPool = cpSpacePoolNew(sizeof(cpArbiter), allocator);
 	
 	space->contactBuffersHead = NULL;
-	space->cachedArbiters = cpHashSetNew(0, (cpHashSetEqlFunc)arbiterSetEql);
+	space->cachedArbiters = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)arbiterSetEql, allocator);
+	
+	space->constraints = cpArrayNewWithAllocator(0, allocator);
+	space->classConstraints = cpArrayNewWithAllocator(0, allocator);
+	space->constraintRunEnds = NULL;
+	space->constraintRunCapacity = 0;
+	space->jointTrees = NULL;
+	space->brokenConstraints = cpArrayNewWithAllocator(0, allocator);
 	
-	space->constraints = cpArrayNew(0);
+	space->collisionEvents = NULL;
+	space->collisionEventCount = 0;
+	space->collisionEventCapacity = 0;
+	space->collisionEventStepCount = 0;
 	
 	space->defaultHandler = cpDefaultCollisionHandler;
-	space->collisionHandlers = cpHashSetNew(0, (cpHashSetEqlFunc)handlerSetEql);
+	space->collisionHandlers = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)handlerSetEql, allocator);
 	cpHashSetSetDefaultValue(space->collisionHandlers, &cpDefaultCollisionHandler);
 	
+	space->handlerTable = NULL;
+	space->handlerTableSize = 0;
+	cpSpaceUpdateHandlerTable(space);
+	
 	space->postStepCallbacks = NULL;
+	space->postStepQueue = cpArrayNewWithAllocator(0, allocator);
+	space->postStepPool = NULL;
+	space->runningPostStepCallbacks = cpFalse;
 	
 	cpBodyInitStatic(&space->_staticBody);
 	space->staticBody = &space->_staticBody;
@@ -132,15 +208,31 @@ cpSpaceInit(cpSpace *space)
 	return space;
 }
 
+cpSpace*
+cpSpaceInit(cpSpace *space)
+{
+	return cpSpaceInitWithAllocator(space, NULL);
+}
+
 cpSpace*
 cpSpaceNew(void)
 {
 	return cpSpaceInit(cpSpaceAlloc());
 }
 
+cpSpace*
+cpSpaceNewWithAllocator(const cpAllocator *allocator)
+{
+	cpSpace *space = (cpSpace *)cpAllocatorCalloc(allocator, 1, sizeof(cpSpace));
+	return cpSpaceInitWithAllocator(space, allocator);
+}
+
 void
 cpSpaceDestroy(cpSpace *space)
 {
+	// The objects of a clone are in its pools, so they go first.
+	if(space->clonedObjects) cpSpaceDestroyClone(space);
+	
 	cpSpatialIndexFree(space->staticShapes);
 	cpSpatialIndexFree(space->activeShapes);
 	
@@ -149,30 +241,42 @@ cpSpaceDestroy(cpSpace *space)
 	cpArrayFree(space->rousedBodies);
 	
 	cpArrayFree(space->constraints);
+	cpArrayFree(space->classConstraints);
+	cpAllocatorFree(space->allocator, space->constraintRunEnds);
+	cpJointTreeSolverFree(space->jointTrees);
+	cpArrayFree(space->brokenConstraints);
+	cpAllocatorFree(space->allocator, space->collisionEvents);
 	
 	cpHashSetFree(space->cachedArbiters);
 	
 	cpArrayFree(space->arbiters);
-	cpArrayFree(space->pooledArbiters);
+	cpSpacePoolFree(space->arbiterPool);
+	
+	cpArrayFreeEach(space->pools, (void (*)(void*))cpSpacePoolFree);
+	cpArrayFree(space->pools);
 	
 	if(space->allocatedBuffers){
-		cpArrayFreeEach(space->allocatedBuffers, cpfree);
+		cpArrayFreeEachBlock(space->allocatedBuffers);
 		cpArrayFree(space->allocatedBuffers);
 	}
 	
-	if(space->postStepCallbacks) cpHashSetEach(space->postStepCallbacks, freeWrap, NULL);
+	// The post-step callbacks themselves live in the pool.
 	cpHashSetFree(space->postStepCallbacks);
+	cpArrayFree(space->postStepQueue);
+	cpSpacePoolFree(space->postStepPool);
 	
-	if(space->collisionHandlers) cpHashSetEach(space->collisionHandlers, freeWrap, NULL);
+	if(space->collisionHandlers) cpHashSetEach(space->collisionHandlers, (cpHashSetIteratorFunc)freeWrap, (void *)space->allocator);
 	cpHashSetFree(space->collisionHandlers);
+	cpAllocatorFree(space->allocator, space->handlerTable);
 }
 
 void
 cpSpaceFree(cpSpace *space)
 {
 	if(space){
+		const cpAllocator *allocator = space->allocator;
 		cpSpaceDestroy(space);
-		cpfree(space);
+		cpAllocatorFree(allocator, space);
 	}
 }
 
@@ -208,7 +312,8 @@ cpSpaceAddCollisionHandler(
 		data
 	};
 	
-	cpHashSetInsert(space->collisionHandlers, CP_HASH_PAIR(a, b), &handler, NULL, (cpHashSetTransFunc)handlerSetTrans);
+	cpHashSetInsert(space->collisionHandlers, CP_HASH_PAIR(a, b), &handler, (void *)space->allocator, (cpHashSetTransFunc)handlerSetTrans);
+	cpSpaceUpdateHandlerTable(space);
 }
 
 void
@@ -218,7 +323,9 @@ cpSpaceRemoveCollisionHandler(cpSpace *space, cpCollisionType a, cpCollisionType
 	
 	struct { cpCollisionType a, b; } ids = {a, b};
 	cpCollisionHandler *old_handler = (cpCollisionHandler *) cpHashSetRemove(space->collisionHandlers, CP_HASH_PAIR(a, b), &ids);
-	cpfree(old_handler);
+	cpAllocatorFree(space->allocator, old_handler);
+	
+	cpSpaceUpdateHandlerTable(space);
 }
 
 void
@@ -243,9 +350,72 @@ cpSpaceSetDefaultCollisionHandler(
 	
 	space->defaultHandler = handler;
 	cpHashSetSetDefaultValue(space->collisionHandlers, &space->defaultHandler);
+	cpSpaceUpdateHandlerTable(space);
+}
+
+static void *
+handlerSetClone(cpCollisionHandler *handler, cpSpace **spaces)
+{
+	if(handler == &spaces[0]->defaultHandler) return &spaces[1]->defaultHandler;
+	if(handler == &cpDefaultCollisionHandler) return handler;
+	
+	return handlerSetTrans(handler, spaces[1]->allocator);
+}
+
+void
+cpSpaceCloneHandlers(cpSpace *space, cpSpace *clone)
+{
+	cpSpace *spaces[] = {space, clone};
+	clone->defaultHandler = space->defaultHandler;
+	
+	if(clone->collisionHandlers) cpHashSetEach(clone->collisionHandlers, (cpHashSetIteratorFunc)freeWrap, (void *)clone->allocator);
+	cpHashSetFree(clone->collisionHandlers);
+	
+	clone->collisionHandlers = cpHashSetClone(space->collisionHandlers, (cpHashSetTransFunc)handlerSetClone, spaces);
+	cpSpaceUpdateHandlerTable(clone);
 }
 
 #pragma mark Body, Shape, and Joint Management
+
+void
+cpSpacePushConstraint(cpSpace *space, cpConstraint *constraint)
+{
+	cpArrayPush(space->constraints, constraint);
+	
+	// Insert it after the last constraint of the same class, a new class starts a group at the end.
+	cpArray *grouped = space->classConstraints;
+	cpArrayPush(grouped, constraint);
+	
+	void **arr = grouped->arr;
+	int last = grouped->num - 1;
+	int i = last;
+	while(i > 0 && ((cpConstraint *)arr[i - 1])->klass != constraint->klass) i--;
+	
+	if(i > 0 && i < last){
+		memmove(arr + i + 1, arr + i, (last - i)*sizeof(void *));
+		arr[i] = constraint;
+	}
+}
+
+void
+cpSpaceDeleteConstraint(cpSpace *space, cpConstraint *constraint)
+{
+	cpArrayDeleteObj(space->constraints, constraint);
+	
+	// Shift the rest down so the groups and the constraints in them keep their order.
+	cpArray *grouped = space->classConstraints;
+	void **arr = grouped->arr;
+	for(int i=0; i<grouped->num; i++){
+		if(arr[i] == constraint){
+			grouped->num--;
+			memmove(arr + i, arr + i + 1, (grouped->num - i)*sizeof(void *));
+			arr[grouped->num] = NULL;
+			
+			return;
+		}
+	}
+}
+
 cpShape *
 cpSpaceAddShape(cpSpace *space, cpShape *shape)
 {
@@ -272,6 +442,8 @@ cpSpaceAddStaticShape(cpSpace *space, cpShape *shape)
 	cpAssertSoft(!shape->space, "This shape is already added to a space and cannot be added to another.");
 	cpAssertSpaceUnlocked(space);
 	
+	if(space->sharedStaticBody) cpSpaceUnshareStatic(space);
+	
 	cpBody *body = shape->body;
 	cpBodyAddShape(body, shape);
 	cpShapeUpdate(shape, body->p, body->rot);
@@ -300,12 +472,14 @@ cpSpaceAddConstraint(cpSpace *space, cpConstraint *constraint)
 	cpAssertSoft(!constraint->space, "This shape is already added to a space and cannot be added to another.");
 	cpAssertSpaceUnlocked(space);
 	
-	cpBodyActivate(constraint->a);
-	cpBodyActivate(constraint->b);
-	cpArrayPush(space->constraints, constraint);
+	cpBody *a = constraint->a, *b = constraint->b;
+	if(!cpSpaceLinksToBody(space, a) || !cpSpaceLinksToBody(space, b)) cpSpaceUnshareStatic(space);
+	
+	cpBodyActivate(a);
+	cpBodyActivate(b);
+	cpSpacePushConstraint(space, constraint);
 	
 	// Push onto the heads of the bodies' constraint lists
-	cpBody *a = constraint->a, *b = constraint->b;
 	constraint->next_a = a->constraintList; a->constraintList = constraint;
 	constraint->next_b = b->constraintList; b->constraintList = constraint;
 	constraint->space = space;
@@ -316,15 +490,30 @@ cpSpaceAddConstraint(cpSpace *space, cpConstraint *constraint)
 struct arbiterFilterContext {
 	cpSpace *space;
 	cpBody *body;
+	cpShape *shape;
 };
 
 static cpBool
-contactSetFilterRemovedBody(cpArbiter *arb, struct arbiterFilterContext *context)
+cachedArbitersFilter(cpArbiter *arb, struct arbiterFilterContext *context)
 {
+	cpShape *shape = context->shape;
 	cpBody *body = context->body;
-	if(body == arb->body_a || body == arb->body_b){
-		cpArrayDeleteObj(context->space->arbiters, arb);
-		cpArrayPush(context->space->pooledArbiters, arb);
+	
+	// Match on the filter shape, or if it's NULL the filter body
+	if(
+		(body == arb->body_a && (shape == arb->a || shape == NULL)) ||
+		(body == arb->body_b && (shape == arb->b || shape == NULL))
+	){
+		cpSpace *space = context->space;
+		
+		if(arb->state != cpArbiterStateCached){
+			if(space->enableCollisionEvents) cpSpacePushCollisionEvent(space, cpCollisionEventSeparate, arb, cpvzero);
+			cpArbiterCallSeparate(arb, space);
+		}
+		
+		cpArbiterUnthread(arb);
+		cpArrayDeleteObj(space->arbiters, arb);
+		cpSpacePoolRecycle(space->arbiterPool, arb);
 		return cpFalse;
 	}
 	
@@ -334,25 +523,10 @@ contactSetFilterRemovedBody(cpArbiter *arb, struct arbiterFilterContext *context
 void
 cpSpaceFilterArbiters(cpSpace *space, cpBody *body, cpShape *filter)
 {
-	cpArbiter *arb = body->arbiterList;
-	while(arb){
-		cpArbiter *next = cpArbiterNext(arb, body);
-		if(filter == NULL || filter == arb->a || filter == arb->b){
-			if(arb->state != cpArbiterStateCached) cpArbiterCallSeparate(arb, space);
-			
-			cpArbiterUnthread(arb);
-			cpSpaceUncacheArbiter(space, arb);
-			cpArrayPush(space->pooledArbiters, arb);
-		}
-		arb = next;
-	}
-	
-	// TODO see note at cpSpaceArbiterSetFilter()
-	// When just removing the body, so we need to filter all cached arbiters to avoid dangling pointers.
-	if(filter == NULL){
-		struct arbiterFilterContext context = {space, body};
-		cpHashSetFilter(space->cachedArbiters, (cpHashSetFilterFunc)contactSetFilterRemovedBody, &context);
-	}
+	// Arbiters are only threaded onto their bodies when the contact graph is enabled,
+	// so check all the cached ones. The body was just woken up, so its arbiters are all cached.
+	struct arbiterFilterContext context = {space, body, filter};
+	cpHashSetFilter(space->cachedArbiters, (cpHashSetFilterFunc)cachedArbitersFilter, &context);
 }
 
 void
@@ -377,6 +551,8 @@ cpSpaceRemoveShape(cpSpace *space, cpShape *shape)
 void
 cpSpaceRemoveStaticShape(cpSpace *space, cpShape *shape)
 {
+	shape = cpSpaceUnshareShape(space, shape);
+	
 	cpAssertSoft(cpSpaceContainsShape(space, shape),
 		"Cannot remove a static or sleeping shape that was not added to the space. (Removed twice maybe?)");
 	cpAssertSpaceUnlocked(space);
@@ -411,13 +587,27 @@ cpSpaceRemoveConstraint(cpSpace *space, cpConstraint *constraint)
 	
 	cpBodyActivate(constraint->a);
 	cpBodyActivate(constraint->b);
-	cpArrayDeleteObj(space->constraints, constraint);
+	cpSpaceDeleteConstraint(space, constraint);
 	
-	cpBodyRemoveConstraint(constraint->a, constraint);
-	cpBodyRemoveConstraint(constraint->b, constraint);
+	if(cpSpaceLinksToBody(space, constraint->a)) cpBodyRemoveConstraint(constraint->a, constraint);
+	if(cpSpaceLinksToBody(space, constraint->b)) cpBodyRemoveConstraint(constraint->b, constraint);
 	constraint->space = NULL;
 }
 
+cpConstraint *
+cpSpacePopBrokenConstraint(cpSpace *space)
+{
+	cpArray *broken = space->brokenConstraints;
+	return (broken->num ? (cpConstraint *)cpArrayPop(broken) : NULL);
+}
+
+cpCollisionEvent *
+cpSpaceGetCollisionEvents(cpSpace *space, int *count)
+{
+	(*count) = space->collisionEventCount;
+	return space->collisionEvents;
+}
+
 cpBool cpSpaceContainsShape(cpSpace *space, cpShape *shape)
 {
 	return (shape->space == space);
@@ -499,6 +689,8 @@ updateBBCache(cpShape *shape, void *unused)
 void 
 cpSpaceReindexStatic(cpSpace *space)
 {
+	if(space->sharedStaticBody) cpSpaceUnshareStatic(space);
+	
 	cpSpatialIndexEach(space->staticShapes, (cpSpatialIndexIteratorFunc)&updateBBCache, NULL);
 	cpSpatialIndexReindex(space->staticShapes);
 }
@@ -506,6 +698,8 @@ cpSpaceReindexStatic(cpSpace *space)
 void
 cpSpaceReindexShape(cpSpace *space, cpShape *shape)
 {
+	if(cpBodyIsStatic(shape->body)) shape = cpSpaceUnshareShape(space, shape);
+	
 	cpBody *body = shape->body;
 	cpShapeUpdate(shape, body->p, body->rot);
 	
@@ -514,9 +708,31 @@ cpSpaceReindexShape(cpSpace *space, cpShape *shape)
 	cpSpatialIndexReindexObject(space->staticShapes, shape, shape->hashid);
 }
 
+void
+cpSpaceRefilterShape(cpSpace *space, cpShape *shape)
+{
+	if(!space->filteredIndexes) return;
+	
+	// Wake up anything touching a static shape like removing it would.
+	if(cpBodyIsStatic(shape->body)) cpBodyActivateStatic(shape->body, shape);
+	
+	if(space->locked){
+		// The next step refilters the indexes. Until then the shapes' own filters are checked.
+		space->staleFilters = cpTrue;
+	} else {
+		// Reindexing throws away the cached pairs that were filtered with the old filter.
+		cpSpaceReindexShape(space, shape);
+	}
+}
+
 void
 cpSpaceReindexShapesForBody(cpSpace *space, cpBody *body)
 {
+	if(cpBodyIsStatic(body) && space->clonedObjects){
+		cpSpaceUnshareStatic(space);
+		body = (cpBody *)cpRelocate(space->clonedObjects, body);
+	}
+	
 	CP_BODY_FOREACH_SHAPE(body, shape) cpSpaceReindexShape(space, shape);
 }
 
@@ -530,8 +746,8 @@ copyShapes(cpShape *shape, cpSpatialIndex *index)
 void
 cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count)
 {
-	cpSpatialIndex *staticShapes = cpSpaceHashNew(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, NULL);
-	cpSpatialIndex *activeShapes = cpSpaceHashNew(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes);
+	cpSpatialIndex *staticShapes = cpSpaceHashNewWithAllocator(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, NULL, space->allocator);
+	cpSpatialIndex *activeShapes = cpSpaceHashNewWithAllocator(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes, space->allocator);
 	
 	cpSpatialIndexEach(space->staticShapes, (cpSpatialIndexIteratorFunc)copyShapes, staticShapes);
 	cpSpatialIndexEach(space->activeShapes, (cpSpatialIndexIteratorFunc)copyShapes, activeShapes);
@@ -541,4 +757,88 @@ cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count)
 	
 	space->staticShapes = staticShapes;
 	space->activeShapes = activeShapes;
+	space->filteredIndexes = cpFalse;
+}
+
+#pragma mark Memory Trimming
+
+size_t
+cpSpaceTrimMemory(cpSpace *space)
+{
+	cpAssertHard(!space->locked, "You cannot trim the memory of a space during a call to cpSpaceStep() or during a query.");
+	
+	size_t freed = 0;
+	
+	// Live arbiters and pooled objects are referenced from outside the pools and stay where they are.
+	freed += cpSpacePoolTrim(space->arbiterPool);
+	for(int i=0; i<space->pools->num; i++) freed += cpSpacePoolTrim((cpSpacePool *)space->pools->arr[i]);
+	freed += cpSpaceTrimContactBuffers(space);
+	
+	freed += cpHashSetTrim(space->cachedArbiters);
+	freed += cpHashSetTrim(space->collisionHandlers);
+	
+	if(space->postStepCallbacks){
+		freed += cpSpacePoolTrim(space->postStepPool);
+		freed += cpHashSetTrim(space->postStepCallbacks);
+	}
+	
+	// The indexes move their own live entries to pack them into fewer buffers.
+	freed += cpSpatialIndexTrim(space->staticShapes);
+	freed += cpSpatialIndexTrim(space->activeShapes);
+	
+	return freed;
+}
+
+void
+cpSpaceGetPoolStats(cpSpace *space, cpSpacePoolStats *stats)
+{
+	cpSpacePoolStats zero = {{0}};
+	(*stats) = zero;
+	
+	cpSpacePoolGetStats(space->arbiterPool, &stats->arbiters);
+	cpHashSetGetStats(space->cachedArbiters, &stats->arbiters);
+	
+	cpSpaceGetContactBufferStats(space, &stats->contacts);
+	
+	for(int i=0; i<space->pools->num; i++) cpSpacePoolGetStats((cpSpacePool *)space->pools->arr[i], &stats->objects);
+	
+	cpHashSetGetStats(space->collisionHandlers, &stats->callbacks);
+	if(space->postStepCallbacks){
+		cpSpacePoolGetStats(space->postStepPool, &stats->callbacks);
+		cpHashSetGetStats(space->postStepCallbacks, &stats->callbacks);
+	}
+	
+	cpSpatialIndexGetPoolStats(space->staticShapes, &stats->staticIndex);
+	cpSpatialIndexGetPoolStats(space->activeShapes, &stats->activeIndex);
+}
+
+void
+cpSpaceGetMemoryStats(cpSpace *space, cpSpaceMemoryStats *stats)
+{
+	cpSpaceMemoryStats zero = {0};
+	(*stats) = zero;
+	
+	stats->bodies.bytes = cpArrayGetBytes(space->bodies);
+	stats->bodies.count = space->bodies->num;
+	
+	cpSpacePoolGetMemoryStats(space->arbiterPool, &stats->arbiters);
+	stats->arbiters.bytes += cpArrayGetBytes(space->arbiters);
+	
+	cpSpaceGetContactBufferMemoryStats(space, &stats->contacts);
+	cpHashSetGetMemoryStats(space->cachedArbiters, &stats->cachedArbiters);
+	
+	cpHashSetGetMemoryStats(space->collisionHandlers, &stats->collisionHandlers);
+	stats->collisionHandlers.bytes += cpHashSetCount(space->collisionHandlers)*sizeof(cpCollisionHandler);
+	stats->collisionHandlers.bytes += space->handlerTableSize*space->handlerTableSize*sizeof(cpCollisionHandler *);
+	
+	stats->objects.bytes = cpArrayGetBytes(space->pools);
+	for(int i=0; i<space->pools->num; i++) cpSpacePoolGetMemoryStats((cpSpacePool *)space->pools->arr[i], &stats->objects);
+	
+	cpSpatialIndexGetMemoryStats(space->staticShapes, &stats->staticIndex);
+	cpSpatialIndexGetMemoryStats(space->activeShapes, &stats->activeIndex);
+	
+	stats->bytes = sizeof(cpSpace) +
+		stats->bodies.bytes + stats->arbiters.bytes + stats->contacts.bytes +
+		stats->cachedArbiters.bytes + stats->collisionHandlers.bytes + stats->objects.bytes +
+		stats->staticIndex.bytes + stats->activeIndex.bytes;
 }
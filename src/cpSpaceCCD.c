@@ -0,0 +1,174 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+#include <stdlib.h>
+
+#include "chipmunk_private.h"
+
+// Maximum number of conservative advancement iterations per pair of shapes.
+#define MAX_CCD_ITERATIONS 16
+
+typedef struct sweepContext {
+	cpSpace *space;
+	cpShape *shape;
+	
+	// The motion of the body during the step.
+	cpVect p0, dp;
+	cpFloat a0, da;
+	
+	// Distance from the center of gravity to the farthest point on the shape.
+	cpFloat radius;
+	// Upper bound on how far any point on the shape moves during the step.
+	cpFloat motion;
+	
+	// Time of impact found so far as a fraction of the step.
+	cpFloat toi;
+} sweepContext;
+
+static inline void
+sweepShapeUpdate(sweepContext *context, cpFloat t)
+{
+	cpVect p = cpvadd(context->p0, cpvmult(context->dp, t));
+	cpShapeUpdate(context->shape, p, cpvforangle(context->a0 + context->da*t));
+}
+
+// Separation between the swept shape and another shape, or INFINITY if it's more than margin.
+// Negative when they overlap. The normal of the closest contact is returned in n.
+static cpFloat
+sweepSeparation(cpShape *a, cpShape *b, cpFloat margin, cpVect *n)
+{
+	cpContact contacts[CP_MAX_CONTACTS_PER_ARBITER];
+	int count = (a->klass->type <= b->klass->type ? cpCollideShapes(a, b, margin, contacts) : cpCollideShapes(b, a, margin, contacts));
+	
+	cpFloat dist = INFINITY;
+	for(int i=0; i<count; i++){
+		if(contacts[i].dist < dist){
+			dist = contacts[i].dist;
+			(*n) = contacts[i].n;
+		}
+	}
+	
+	return dist;
+}
+
+// Find the time of impact with a single shape using conservative advancement.
+// The swept shape is advanced by the separating distance divided by an upper bound on its approach speed
+// along the contact normal until they are touching. It never moves past the surface of the other shape.
+static void
+sweepShapeQuery(cpShape *shape, cpShape *other, sweepContext *context)
+{
+	if(
+		other->body == shape->body || other->sensor ||
+		(shape->group && shape->group == other->group) || !(shape->layers & other->layers)
+	) return;
+	
+	// A begin or preSolve callback might reject the contact, like a one way platform does.
+	// There is no arbiter to call them with during the sweep, so those shapes are left to the regular collision detection.
+	cpCollisionHandler *handler = cpSpaceLookupHandler(context->space, shape->collision_type, other->collision_type);
+	if(handler->begin != cpDefaultCollisionHandler.begin || handler->preSolve != cpDefaultCollisionHandler.preSolve) return;
+	
+	cpFloat slop = context->space->collisionSlop;
+	cpFloat motion = context->motion;
+	
+	cpVect n = cpvzero;
+	cpFloat t = 0.0f;
+	sweepShapeUpdate(context, t);
+	cpFloat dist = sweepSeparation(shape, other, motion, &n);
+	
+	// Stop with the shapes overlapping by half the slop so the contact is found by the regular collision detection.
+	// Shapes that already overlap are allowed to sink in by the slop before stopping so they don't pin the body in place.
+	cpFloat target = cpfmin(dist, 0.0f) - 0.5f*slop;
+	
+	for(int i=0; i<MAX_CCD_ITERATIONS; i++){
+		if(dist == INFINITY) return;
+		
+		if(dist <= target + 0.25f*slop){
+			context->toi = cpfmin(context->toi, t);
+			return;
+		}
+		
+		cpFloat bound = cpfabs(cpvdot(context->dp, n)) + cpfabs(context->da)*context->radius;
+		if(bound == 0.0f) return;
+		
+		t += (dist - target)/bound;
+		if(t >= context->toi) return;
+		
+		sweepShapeUpdate(context, t);
+		dist = sweepSeparation(shape, other, motion*(1.0f - t) + slop, &n);
+	}
+	
+	// Out of iterations, stop at the last time known to be safe.
+	context->toi = cpfmin(context->toi, t);
+}
+
+static void
+sweepIndexQuery(sweepContext *context, cpShape *other)
+{
+	sweepShapeQuery(context->shape, other, context);
+}
+
+void
+cpSpaceSweepBody(cpSpace *space, cpBody *body, cpVect p0, cpFloat a0)
+{
+	cpVect p1 = body->p;
+	cpFloat a1 = body->a;
+	
+	sweepContext context = {space, NULL, p0, cpvsub(p1, p0), a0, a1 - a0, 0.0f, 0.0f, 1.0f};
+	cpFloat linear = cpvlength(context.dp);
+	
+	CP_BODY_FOREACH_SHAPE(body, shape){
+		if(shape->sensor) continue;
+		
+		// The shape's bounding box is still from the start of the step.
+		cpBB bb0 = shape->bb;
+		cpBB bb1 = cpShapeUpdate(shape, p1, body->rot);
+		
+		// Skip shapes that move less than half of their size, discrete collision detection will find those.
+		cpFloat size = cpfmin(bb0.r - bb0.l, bb0.t - bb0.b);
+		if(linear < 0.5f*size && cpfabs(context.da) < 0.5f) continue;
+		
+		// Bound the speed of any point on the shape using the farthest corner of the bounding box.
+		cpFloat radius = cpfmax(
+			cpfmax(cpvlength(cpvsub(cpv(bb0.l, bb0.b), p0)), cpvlength(cpvsub(cpv(bb0.r, bb0.b), p0))),
+			cpfmax(cpvlength(cpvsub(cpv(bb0.l, bb0.t), p0)), cpvlength(cpvsub(cpv(bb0.r, bb0.t), p0)))
+		);
+		
+		context.shape = shape;
+		context.radius = radius;
+		context.motion = linear + cpfabs(context.da)*radius;
+		
+		cpBB swept = cpBBMerge(bb0, bb1);
+		cpSpatialIndexQuery(space->staticShapes, &context, swept, (cpSpatialIndexQueryFunc)sweepIndexQuery, NULL);
+		cpSpatialIndexQuery(space->activeShapes, &context, swept, (cpSpatialIndexQueryFunc)sweepIndexQuery, NULL);
+	}
+	
+	// Move the body back to where it first touched something.
+	// The contact solver takes care of the rest of the motion this step.
+	cpFloat toi = context.toi;
+	if(toi < 1.0f){
+		body->p = cpvadd(p0, cpvmult(context.dp, toi));
+		body->a = a0 + context.da*toi;
+		body->rot = cpvforangle(body->a);
+	}
+	
+	// Leave the shapes in the end of step position, the space will update them again shortly.
+	CP_BODY_FOREACH_SHAPE(body, shape) cpShapeUpdate(shape, body->p, body->rot);
+}
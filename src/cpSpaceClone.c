@@ -0,0 +1,556 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chipmunk_private.h"
+
+// A clone copies the objects of a space into its own pools, then links the copies together by relocating the pointers between them.
+// The spatial indexes, the arbiter pool and the contact buffers are copied a buffer at a time instead of being rebuilt,
+// so the copy steps exactly like the original would. Shapes attached to static bodies are shared until the clone changes them.
+
+// Same test as cpSpaceDeactivateBody() uses to decide which body stores the arbiter or constraint.
+static inline cpBool
+OwnsArbiter(cpBody *body, cpArbiter *arb)
+{
+	return (body == arb->body_a || cpBodyIsStatic(arb->body_a));
+}
+
+static inline cpBool
+OwnsConstraint(cpBody *body, cpConstraint *constraint)
+{
+	return (body == constraint->a || cpBodyIsStatic(constraint->a));
+}
+
+#pragma mark Gathering
+
+typedef struct GatherContext {
+	cpSpace *space;
+	cpArray *shapes;
+	// Bodies that the space doesn't track itself.
+	cpArray *bodies;
+	// Gather the static or the non-static objects.
+	cpBool statics;
+} GatherContext;
+
+static void
+GatherShape(cpShape *shape, GatherContext *context)
+{
+	cpBody *body = shape->body;
+	if(cpBodyIsStatic(body) != context->statics) return;
+	
+	cpArrayPush(context->shapes, shape);
+	if(body->space != context->space) cpArrayPush(context->bodies, body);
+}
+
+static void
+GatherConstraintBodies(cpConstraint *constraint, GatherContext *context)
+{
+	cpBody *a = constraint->a, *b = constraint->b;
+	if(cpBodyIsStatic(a) == context->statics && a->space != context->space) cpArrayPush(context->bodies, a);
+	if(cpBodyIsStatic(b) == context->statics && b->space != context->space) cpArrayPush(context->bodies, b);
+}
+
+// Sleeping constraints and arbiters are only linked to their bodies.
+static cpArray *
+GatherConstraints(cpSpace *space)
+{
+	cpArray *constraints = cpArrayNewWithAllocator(space->constraints->num, space->allocator);
+	for(int i=0; i<space->constraints->num; i++) cpArrayPush(constraints, space->constraints->arr[i]);
+	
+	cpArray *components = space->sleepingComponents;
+	for(int i=0; i<components->num; i++){
+		CP_BODY_FOREACH_COMPONENT((cpBody *)components->arr[i], body){
+			CP_BODY_FOREACH_CONSTRAINT(body, constraint){
+				if(OwnsConstraint(body, constraint)) cpArrayPush(constraints, constraint);
+			}
+		}
+	}
+	
+	return constraints;
+}
+
+static cpArray *
+GatherSleepingArbiters(cpSpace *space)
+{
+	cpArray *arbiters = cpArrayNewWithAllocator(0, space->allocator);
+	
+	cpArray *components = space->sleepingComponents;
+	for(int i=0; i<components->num; i++){
+		CP_BODY_FOREACH_COMPONENT((cpBody *)components->arr[i], body){
+			CP_BODY_FOREACH_ARBITER(body, arb){
+				if(OwnsArbiter(body, arb)) cpArrayPush(arbiters, arb);
+			}
+		}
+	}
+	
+	return arbiters;
+}
+
+static int
+comparePointers(const void *a, const void *b)
+{
+	size_t pa = (size_t)*(void **)a, pb = (size_t)*(void **)b;
+	return (pa > pb) - (pa < pb);
+}
+
+static void
+SortUnique(cpArray *arr)
+{
+	qsort(arr->arr, arr->num, sizeof(void *), comparePointers);
+	
+	int count = 0;
+	for(int i=0; i<arr->num; i++){
+		if(count == 0 || arr->arr[i] != arr->arr[count - 1]) arr->arr[count++] = arr->arr[i];
+	}
+	
+	arr->num = count;
+}
+
+#pragma mark Copying
+
+static void
+RelocationAdd(cpRelocation *rel, cpRelocation *objects, void *from, void *to, size_t size)
+{
+	cpRelocationAdd(rel, from, to, size);
+	if(objects) cpRelocationAdd(objects, from, to, size);
+}
+
+static cpBody *
+CopyBody(cpBody *body, cpSpacePool *pool)
+{
+	cpBody *copy = (cpBody *)cpSpacePoolAlloc(pool);
+	(*copy) = (*body);
+	copy->pool = pool;
+	
+	return copy;
+}
+
+// Replaces the shapes with their copies.
+// The copies of the bodies are all looked up first since lookups are only fast while no entries are added.
+static void
+CopyShapes(cpSpace *clone, cpArray *shapes, cpRelocation *rel, cpRelocation *objects)
+{
+	cpArray *copies = cpArrayNewWithAllocator(shapes->num, clone->allocator);
+	for(int i=0; i<shapes->num; i++){
+		cpShape *shape = (cpShape *)shapes->arr[i];
+		cpArrayPush(copies, cpShapeClone(shape, (cpBody *)cpRelocate(rel, shape->body), clone));
+	}
+	
+	for(int i=0; i<shapes->num; i++){
+		cpShape *copy = (cpShape *)copies->arr[i];
+		RelocationAdd(rel, objects, shapes->arr[i], copy, sizeof(cpShape));
+		if(!copy->pool) cpArrayPush(clone->clonedShapes, copy);
+		
+		copy->space = clone;
+		shapes->arr[i] = copy;
+	}
+	
+	cpArrayFree(copies);
+}
+
+static void
+CopyArray(cpArray *copy, cpArray *arr, cpRelocation *rel)
+{
+	copy->num = 0;
+	for(int i=0; i<arr->num; i++) cpArrayPush(copy, cpRelocate(rel, arr->arr[i]));
+}
+
+static void *
+relocateElement(void *elt, cpRelocation *rel)
+{
+	return cpRelocate(rel, elt);
+}
+
+#pragma mark Linking
+
+static void
+LinkBody(cpBody *body, cpSpace *space, cpSpace *clone, cpRelocation *rel)
+{
+	if(body->space == space) body->space = clone;
+	
+	body->shapeList = (cpShape *)cpRelocate(rel, body->shapeList);
+	body->arbiterList = (cpArbiter *)cpRelocate(rel, body->arbiterList);
+	body->constraintList = (cpConstraint *)cpRelocate(rel, body->constraintList);
+	
+	body->node.root = (cpBody *)cpRelocate(rel, body->node.root);
+	body->node.next = (cpBody *)cpRelocate(rel, body->node.next);
+}
+
+static void
+LinkShape(cpShape *shape, cpRelocation *rel)
+{
+	shape->next = (cpShape *)cpRelocate(rel, shape->next);
+	shape->prev = (cpShape *)cpRelocate(rel, shape->prev);
+}
+
+// Constraints and arbiters of a clone aren't linked into the static bodies it shares.
+static void
+LinkConstraint(cpConstraint *constraint, cpSpace *space, cpSpace *clone, cpRelocation *rel)
+{
+	cpBody *a = constraint->a = (cpBody *)cpRelocate(rel, constraint->a);
+	cpBody *b = constraint->b = (cpBody *)cpRelocate(rel, constraint->b);
+	
+	constraint->next_a = (cpBodyIsStatic(a) ? NULL : (cpConstraint *)cpRelocate(rel, constraint->next_a));
+	constraint->next_b = (cpBodyIsStatic(b) ? NULL : (cpConstraint *)cpRelocate(rel, constraint->next_b));
+	
+	if(constraint->space == space) constraint->space = clone;
+}
+
+static void
+LinkThread(struct cpArbiterThread *thread, cpBody *body, cpRelocation *rel)
+{
+	if(cpBodyIsStatic(body)){
+		thread->next = thread->prev = NULL;
+	} else {
+		thread->next = (cpArbiter *)cpRelocate(rel, thread->next);
+		thread->prev = (cpArbiter *)cpRelocate(rel, thread->prev);
+	}
+}
+
+static void
+LinkArbiter(cpArbiter *arb, cpSpace *clone)
+{
+	cpRelocation *rel = clone->clonedObjects;
+	
+	cpShape *a = arb->a = (cpShape *)cpRelocate(rel, arb->a);
+	cpShape *b = arb->b = (cpShape *)cpRelocate(rel, arb->b);
+	arb->body_a = (cpBody *)cpRelocate(rel, arb->body_a);
+	arb->body_b = (cpBody *)cpRelocate(rel, arb->body_b);
+	
+	LinkThread(&arb->thread_a, arb->body_a, rel);
+	LinkThread(&arb->thread_b, arb->body_b, rel);
+	
+	arb->contacts = (cpContact *)cpRelocate(rel, arb->contacts);
+	arb->handler = cpSpaceLookupHandler(clone, a->collision_type, b->collision_type);
+}
+
+#pragma mark Cloning
+
+cpSpace *
+cpSpaceClone(cpSpace *space)
+{
+	cpAssertHard(!space->locked,
+		"You cannot clone a space while it is locked. "
+		"Put these calls into a post-step callback.");
+	
+	const cpAllocator *allocator = space->allocator;
+	cpSpace *clone = cpSpaceNewWithAllocator(allocator);
+	
+	clone->iterations = space->iterations;
+	clone->solverTolerance = space->solverTolerance;
+	clone->gravity = space->gravity;
+	clone->damping = space->damping;
+	clone->idleSpeedThreshold = space->idleSpeedThreshold;
+	clone->sleepTimeThreshold = space->sleepTimeThreshold;
+	clone->collisionSlop = space->collisionSlop;
+	clone->collisionBias = space->collisionBias;
+	clone->collisionPersistence = space->collisionPersistence;
+	clone->contactReuseTolerance = space->contactReuseTolerance;
+	clone->enableContactGraph = space->enableContactGraph;
+	clone->enableSpeculativeContacts = space->enableSpeculativeContacts;
+	clone->enableBlockSolver = space->enableBlockSolver;
+	clone->enableDirectSolver = space->enableDirectSolver;
+	clone->enableCollisionEvents = space->enableCollisionEvents;
+	clone->data = space->data;
+	
+	clone->stamp = space->stamp;
+	clone->curr_dt = space->curr_dt;
+	clone->iterationsUsed = space->iterationsUsed;
+	clone->filteredIndexes = space->filteredIndexes;
+	clone->staleFilters = space->staleFilters;
+	
+	cpSpaceCloneHandlers(space, clone);
+	
+	// The clone starts with an empty copy of the static body, the shapes on it stay attached to the original.
+	cpBody *staticBody = clone->staticBody;
+	(*staticBody) = (*space->staticBody);
+	staticBody->space = NULL;
+	staticBody->shapeList = NULL;
+	staticBody->arbiterList = NULL;
+	staticBody->constraintList = NULL;
+	staticBody->node.root = staticBody->node.next = NULL;
+	staticBody->pool = NULL;
+	
+	cpRelocation *objects = clone->clonedObjects = cpRelocationNew(allocator);
+	clone->clonedShapes = cpArrayNewWithAllocator(0, allocator);
+	
+	// Bodies
+	cpSpacePool *bodyPool = cpSpaceGetPool(clone, sizeof(cpBody));
+	cpArray *bodies = cpArrayNewWithAllocator(space->bodies->num, allocator);
+	
+	for(int i=0; i<space->bodies->num; i++) cpArrayPush(bodies, space->bodies->arr[i]);
+	
+	cpArray *components = space->sleepingComponents;
+	for(int i=0; i<components->num; i++){
+		CP_BODY_FOREACH_COMPONENT((cpBody *)components->arr[i], body) cpArrayPush(bodies, body);
+	}
+	
+	cpArray *shapes = cpArrayNewWithAllocator(0, allocator);
+	cpArray *rogues = cpArrayNewWithAllocator(0, allocator);
+	cpArray *constraints = GatherConstraints(space);
+	
+	GatherContext context = {space, shapes, rogues, cpFalse};
+	cpSpatialIndexEach(space->staticShapes, (cpSpatialIndexIteratorFunc)GatherShape, &context);
+	cpSpatialIndexEach(space->activeShapes, (cpSpatialIndexIteratorFunc)GatherShape, &context);
+	for(int i=0; i<constraints->num; i++) GatherConstraintBodies((cpConstraint *)constraints->arr[i], &context);
+	
+	SortUnique(rogues);
+	for(int i=0; i<rogues->num; i++) cpArrayPush(bodies, rogues->arr[i]);
+	
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		cpBody *copy = CopyBody(body, bodyPool);
+		
+		cpRelocationAdd(objects, body, copy, sizeof(cpBody));
+		bodies->arr[i] = copy;
+	}
+	
+	// Shapes
+	CopyShapes(clone, shapes, objects, NULL);
+	
+	// Constraints
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		size_t size = constraint->klass->size;
+		
+		cpSpacePool *pool = cpSpaceGetPool(clone, size);
+		cpConstraint *copy = (cpConstraint *)cpSpacePoolAlloc(pool);
+		memcpy(copy, constraint, size);
+		copy->pool = pool;
+		
+		cpRelocationAdd(objects, constraint, copy, size);
+		constraints->arr[i] = copy;
+	}
+	
+	// Arbiters and the contacts they point to.
+	cpSpacePoolFree(clone->arbiterPool);
+	clone->arbiterPool = cpSpacePoolClone(space->arbiterPool, objects);
+	cpSpaceCloneContactBuffers(space, clone, objects);
+	
+	// Link everything together.
+	for(int i=0; i<bodies->num; i++) LinkBody((cpBody *)bodies->arr[i], space, clone, objects);
+	for(int i=0; i<shapes->num; i++) LinkShape((cpShape *)shapes->arr[i], objects);
+	for(int i=0; i<constraints->num; i++) LinkConstraint((cpConstraint *)constraints->arr[i], space, clone, objects);
+	
+	cpHashSetFree(clone->cachedArbiters);
+	clone->cachedArbiters = cpHashSetClone(space->cachedArbiters, (cpHashSetTransFunc)relocateElement, objects);
+	cpHashSetEach(clone->cachedArbiters, (cpHashSetIteratorFunc)LinkArbiter, clone);
+	
+	// The contacts of sleeping arbiters live in their own blocks.
+	cpArray *sleepingArbiters = GatherSleepingArbiters(space);
+	for(int i=0; i<sleepingArbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)sleepingArbiters->arr[i];
+		cpArbiter *copy = (cpArbiter *)cpRelocate(objects, arb);
+		LinkArbiter(copy, clone);
+		
+		size_t bytes = arb->numContacts*sizeof(cpContact);
+		copy->contacts = (cpContact *)cpAllocatorCalloc(allocator, 1, bytes);
+		memcpy(copy->contacts, arb->contacts, bytes);
+	}
+	
+	CopyArray(clone->bodies, space->bodies, objects);
+	CopyArray(clone->sleepingComponents, space->sleepingComponents, objects);
+	CopyArray(clone->constraints, space->constraints, objects);
+	CopyArray(clone->classConstraints, space->classConstraints, objects);
+	CopyArray(clone->arbiters, space->arbiters, objects);
+	
+	// The static index keeps pointing to the shared shapes. It's still copied since the pairs of the active index go through its leaves.
+	cpSpatialIndexFree(clone->staticShapes);
+	cpSpatialIndexFree(clone->activeShapes);
+	clone->staticShapes = cpSpatialIndexClone(space->staticShapes, NULL, objects);
+	clone->activeShapes = cpSpatialIndexClone(space->activeShapes, clone->staticShapes, objects);
+	
+	clone->sharedStaticBody = (space->sharedStaticBody ? space->sharedStaticBody : space->staticBody);
+	
+	cpArrayFree(bodies);
+	cpArrayFree(shapes);
+	cpArrayFree(rogues);
+	cpArrayFree(constraints);
+	cpArrayFree(sleepingArbiters);
+	
+	return clone;
+}
+
+#pragma mark Unsharing
+
+static inline cpBool
+ArbiterLinked(cpArbiter *arb, cpBody *body)
+{
+	return (cpArbiterThreadForBody(arb, body)->prev || body->arbiterList == arb);
+}
+
+static void
+LinkStaticArbiter(cpArbiter *arb)
+{
+	cpBody *a = arb->body_a, *b = arb->body_b;
+	
+	// Only arbiters a step linked into the other body were linked into the static body in the original.
+	if(cpBodyIsStatic(a) && ArbiterLinked(arb, b)) cpBodyPushArbiter(a, arb);
+	if(cpBodyIsStatic(b) && ArbiterLinked(arb, a)) cpBodyPushArbiter(b, arb);
+}
+
+static void
+RelocateArbiter(cpArbiter *arb, cpRelocation *rel)
+{
+	arb->a = (cpShape *)cpRelocate(rel, arb->a);
+	arb->b = (cpShape *)cpRelocate(rel, arb->b);
+	arb->body_a = (cpBody *)cpRelocate(rel, arb->body_a);
+	arb->body_b = (cpBody *)cpRelocate(rel, arb->body_b);
+}
+
+// Link the copies of the shapes into the copy of the body in the same order as the original.
+static void
+LinkStaticShapes(cpBody *body, cpBody *copy, cpRelocation *rel)
+{
+	cpShape *head = NULL, *tail = NULL;
+	CP_BODY_FOREACH_SHAPE(body, shape){
+		cpShape *shapeCopy = (cpShape *)cpRelocate(rel, shape);
+		if(shapeCopy == shape) continue;
+		
+		shapeCopy->prev = tail;
+		shapeCopy->next = NULL;
+		if(tail) tail->next = shapeCopy; else head = shapeCopy;
+		tail = shapeCopy;
+	}
+	
+	if(tail){
+		tail->next = copy->shapeList;
+		if(copy->shapeList) copy->shapeList->prev = tail;
+		copy->shapeList = head;
+	}
+}
+
+void
+cpSpaceUnshareStatic(cpSpace *space)
+{
+	cpBody *sharedStaticBody = space->sharedStaticBody;
+	if(!sharedStaticBody) return;
+	
+	const cpAllocator *allocator = space->allocator;
+	cpRelocation *objects = space->clonedObjects;
+	cpRelocation *rel = cpRelocationNew(allocator);
+	
+	cpArray *shapes = cpArrayNewWithAllocator(0, allocator);
+	cpArray *bodies = cpArrayNewWithAllocator(0, allocator);
+	cpArray *constraints = GatherConstraints(space);
+	
+	GatherContext context = {space, shapes, bodies, cpTrue};
+	cpSpatialIndexEach(space->staticShapes, (cpSpatialIndexIteratorFunc)GatherShape, &context);
+	for(int i=0; i<constraints->num; i++) GatherConstraintBodies((cpConstraint *)constraints->arr[i], &context);
+	SortUnique(bodies);
+	
+	// The shapes on the shared static body move to the space's own static body.
+	cpSpacePool *bodyPool = cpSpaceGetPool(space, sizeof(cpBody));
+	cpArray *copies = cpArrayNewWithAllocator(bodies->num, allocator);
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		cpBody *copy = space->staticBody;
+		
+		if(body != sharedStaticBody){
+			copy = CopyBody(body, bodyPool);
+			copy->shapeList = NULL;
+			copy->arbiterList = NULL;
+			copy->constraintList = NULL;
+		}
+		
+		RelocationAdd(rel, objects, body, copy, sizeof(cpBody));
+		cpArrayPush(copies, copy);
+	}
+	
+	CopyShapes(space, shapes, rel, objects);
+	for(int i=0; i<bodies->num; i++) LinkStaticShapes((cpBody *)bodies->arr[i], (cpBody *)copies->arr[i], rel);
+	
+	cpSpatialIndex *staticShapes = cpSpatialIndexClone(space->staticShapes, NULL, rel);
+	cpSpatialIndex *activeShapes = cpSpatialIndexClone(space->activeShapes, staticShapes, rel);
+	cpSpatialIndexFree(space->staticShapes);
+	cpSpatialIndexFree(space->activeShapes);
+	space->staticShapes = staticShapes;
+	space->activeShapes = activeShapes;
+	
+	// Cached arbiters are hashed by the ids of their shapes, so the set doesn't change.
+	cpHashSetEach(space->cachedArbiters, (cpHashSetIteratorFunc)RelocateArbiter, rel);
+	
+	cpArray *sleepingArbiters = GatherSleepingArbiters(space);
+	for(int i=0; i<sleepingArbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)sleepingArbiters->arr[i];
+		RelocateArbiter(arb, rel);
+		LinkStaticArbiter(arb);
+	}
+	
+	cpArray *arbiters = space->arbiters;
+	for(int i=0; i<arbiters->num; i++) LinkStaticArbiter((cpArbiter *)arbiters->arr[i]);
+	
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		cpBody *a = constraint->a = (cpBody *)cpRelocate(rel, constraint->a);
+		cpBody *b = constraint->b = (cpBody *)cpRelocate(rel, constraint->b);
+		
+		if(cpBodyIsStatic(a)){constraint->next_a = a->constraintList; a->constraintList = constraint;}
+		if(cpBodyIsStatic(b)){constraint->next_b = b->constraintList; b->constraintList = constraint;}
+	}
+	
+	space->sharedStaticBody = NULL;
+	
+	cpRelocationFree(rel);
+	cpArrayFree(shapes);
+	cpArrayFree(bodies);
+	cpArrayFree(copies);
+	cpArrayFree(constraints);
+	cpArrayFree(sleepingArbiters);
+}
+
+#pragma mark Destroying
+
+// Unlike the objects of other spaces, the copies belong to the clone. That includes the contacts of the sleeping arbiters.
+void
+cpSpaceDestroyClone(cpSpace *space)
+{
+	cpArray *sleepingArbiters = GatherSleepingArbiters(space);
+	for(int i=0; i<sleepingArbiters->num; i++) cpAllocatorFree(space->allocator, ((cpArbiter *)sleepingArbiters->arr[i])->contacts);
+	cpArrayFree(sleepingArbiters);
+	
+	// The children of copied meshes are pooled, so these go before the pools.
+	cpArrayFreeEach(space->clonedShapes, (void (*)(void*))cpShapeFree);
+	cpArrayFree(space->clonedShapes);
+	cpRelocationFree(space->clonedObjects);
+}
+
+#pragma mark Public Functions
+
+cpBody *
+cpSpaceGetClonedBody(cpSpace *clone, cpBody *body)
+{
+	return (clone->clonedObjects ? (cpBody *)cpRelocate(clone->clonedObjects, body) : body);
+}
+
+cpShape *
+cpSpaceGetClonedShape(cpSpace *clone, cpShape *shape)
+{
+	return (clone->clonedObjects ? (cpShape *)cpRelocate(clone->clonedObjects, shape) : shape);
+}
+
+cpConstraint *
+cpSpaceGetClonedConstraint(cpSpace *clone, cpConstraint *constraint)
+{
+	return (clone->clonedObjects ? (cpConstraint *)cpRelocate(clone->clonedObjects, constraint) : constraint);
+}
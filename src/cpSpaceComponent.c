@@ -57,7 +57,7 @@ cpSpaceActivateBody(cpSpace *space, cpBody *body)
 				// Reinsert the arbiter into the arbiter cache
 				cpShape *a = arb->a, *b = arb->b;
 				cpShape *shape_pair[] = {a, b};
-				cpHashValue arbHashID = CP_HASH_PAIR((size_t)a, (size_t)b);
+				cpHashValue arbHashID = CP_HASH_PAIR(a->hashid, b->hashid);
 				cpHashSetInsert(space->cachedArbiters, arbHashID, shape_pair, arb, NULL);
 				
 				// Update the arbiter's state
@@ -65,13 +65,13 @@ cpSpaceActivateBody(cpSpace *space, cpBody *body)
 				arb->handler = cpSpaceLookupHandler(space, a->collision_type, b->collision_type);
 				cpArrayPush(space->arbiters, arb);
 				
-				cpfree(contacts);
+				cpAllocatorFree(space->allocator, contacts);
 			}
 		}
 		
 		CP_BODY_FOREACH_CONSTRAINT(body, constraint){
 			cpBody *bodyA = constraint->a;
-			if(body == bodyA || cpBodyIsStatic(bodyA)) cpArrayPush(space->constraints, constraint);
+			if(body == bodyA || cpBodyIsStatic(bodyA)) cpSpacePushConstraint(space, constraint);
 		}
 	}
 }
@@ -95,7 +95,7 @@ cpSpaceDeactivateBody(cpSpace *space, cpBody *body)
 			
 			// Save contact values to a new block of memory so they won't time out
 			size_t bytes = arb->numContacts*sizeof(cpContact);
-			cpContact *contacts = (cpContact *)cpcalloc(1, bytes);
+			cpContact *contacts = (cpContact *)cpAllocatorCalloc(space->allocator, 1, bytes);
 			memcpy(contacts, arb->contacts, bytes);
 			arb->contacts = contacts;
 		}
@@ -103,7 +103,7 @@ cpSpaceDeactivateBody(cpSpace *space, cpBody *body)
 		
 	CP_BODY_FOREACH_CONSTRAINT(body, constraint){
 		cpBody *bodyA = constraint->a;
-		if(body == bodyA || cpBodyIsStatic(bodyA)) cpArrayDeleteObj(space->constraints, constraint);
+		if(body == bodyA || cpBodyIsStatic(bodyA)) cpSpaceDeleteConstraint(space, constraint);
 	}
 }
 
@@ -190,8 +190,7 @@ FloodFillComponent(cpBody *root, cpBody *body)
 	}
 }
 
-
-static inline void
+void
 cpBodyPushArbiter(cpBody *body, cpArbiter *arb)
 {
 	cpAssertSoft(cpArbiterThreadForBody(arb, body)->next == NULL, "Internal Error: Dangling contact graph pointers detected. (A)");
@@ -233,8 +232,8 @@ cpSpaceProcessComponents(cpSpace *space, cpFloat dt)
 		if((cpBodyIsRogue(b) && !cpBodyIsStatic(b)) || cpBodyIsSleeping(a)) cpBodyActivate(a);
 		if((cpBodyIsRogue(a) && !cpBodyIsStatic(a)) || cpBodyIsSleeping(b)) cpBodyActivate(b);
 		
-		cpBodyPushArbiter(a, arb);
-		cpBodyPushArbiter(b, arb);
+		if(cpSpaceLinksToBody(space, a)) cpBodyPushArbiter(a, arb);
+		if(cpSpaceLinksToBody(space, b)) cpBodyPushArbiter(b, arb);
 	}
 	
 	// Bodies should be held active if connected by a joint to a non-static rouge body.
@@ -21,6 +21,7 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #include "chipmunk_private.h"
 #include "prime.h"
@@ -82,7 +83,7 @@ handleSetTrans(void *obj, cpSpaceHash *hash)
 		int count = CP_BUFFER_BYTES/sizeof(cpHandle);
 		cpAssertSoft(count, "Buffer size is too small.");
 		
-		cpHandle *buffer = (cpHandle *)cpcalloc(1, CP_BUFFER_BYTES);
+		cpHandle *buffer = (cpHandle *)cpAllocatorCalloc(hash->spatialIndex.allocator, 1, CP_BUFFER_BYTES);
 		cpArrayPush(hash->allocatedBuffers, buffer);
 		
 		for(int i=0; i<count; i++) cpArrayPush(hash->pooledHandles, buffer + i);
@@ -144,7 +145,7 @@ getEmptyBin(cpSpaceHash *hash)
 		int count = CP_BUFFER_BYTES/sizeof(cpSpaceHashBin);
 		cpAssertSoft(count, "Buffer size is too small.");
 		
-		cpSpaceHashBin *buffer = (cpSpaceHashBin *)cpcalloc(1, CP_BUFFER_BYTES);
+		cpSpaceHashBin *buffer = (cpSpaceHashBin *)cpAllocatorCalloc(hash->spatialIndex.allocator, 1, CP_BUFFER_BYTES);
 		cpArrayPush(hash->allocatedBuffers, buffer);
 		
 		// push all but the first one, return the first instead
@@ -165,10 +166,11 @@ cpSpaceHashAlloc(void)
 static void
 cpSpaceHashAllocTable(cpSpaceHash *hash, int numcells)
 {
-	cpfree(hash->table);
+	const cpAllocator *allocator = hash->spatialIndex.allocator;
+	cpAllocatorFree(allocator, hash->table);
 	
 	hash->numcells = numcells;
-	hash->table = (cpSpaceHashBin **)cpcalloc(numcells, sizeof(cpSpaceHashBin *));
+	hash->table = (cpSpaceHashBin **)cpAllocatorCalloc(allocator, numcells, sizeof(cpSpaceHashBin *));
 }
 
 static inline cpSpatialIndexClass *Klass();
@@ -181,12 +183,13 @@ cpSpaceHashInit(cpSpaceHash *hash, cpFloat celldim, int numcells, cpSpatialIndex
 	cpSpaceHashAllocTable(hash, next_prime(numcells));
 	hash->celldim = celldim;
 	
-	hash->handleSet = cpHashSetNew(0, (cpHashSetEqlFunc)handleSetEql);
+	const cpAllocator *allocator = hash->spatialIndex.allocator;
+	hash->handleSet = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)handleSetEql, allocator);
 	
-	hash->pooledHandles = cpArrayNew(0);
+	hash->pooledHandles = cpArrayNewWithAllocator(0, allocator);
 	
 	hash->pooledBins = NULL;
-	hash->allocatedBuffers = cpArrayNew(0);
+	hash->allocatedBuffers = cpArrayNewWithAllocator(0, allocator);
 	
 	hash->stamp = 1;
 	
@@ -199,15 +202,24 @@ cpSpaceHashNew(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatia
 	return cpSpaceHashInit(cpSpaceHashAlloc(), celldim, cells, bbfunc, staticIndex);
 }
 
+cpSpatialIndex *
+cpSpaceHashNewWithAllocator(cpFloat celldim, int cells, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator)
+{
+	cpSpaceHash *hash = (cpSpaceHash *)cpAllocatorCalloc(allocator, 1, sizeof(cpSpaceHash));
+	hash->spatialIndex.allocator = allocator;
+	
+	return cpSpaceHashInit(hash, celldim, cells, bbfunc, staticIndex);
+}
+
 static void
 cpSpaceHashDestroy(cpSpaceHash *hash)
 {
 	if(hash->table) clearTable(hash);
-	cpfree(hash->table);
+	cpAllocatorFree(hash->spatialIndex.allocator, hash->table);
 	
 	cpHashSetFree(hash->handleSet);
 	
-	cpArrayFreeEach(hash->allocatedBuffers, cpfree);
+	cpArrayFreeEachBlock(hash->allocatedBuffers);
 	cpArrayFree(hash->allocatedBuffers);
 	cpArrayFree(hash->pooledHandles);
 }
@@ -583,6 +595,268 @@ cpSpaceHashContains(cpSpaceHash *hash, void *obj, cpHashValue hashid)
 	return cpHashSetFind(hash->handleSet, hashid, obj) != NULL;
 }
 
+#pragma mark Memory Trimming
+
+typedef struct CompactContext {
+	cpArray *live, *unused;
+	int count;
+} CompactContext;
+
+static void *
+handleSetRemap(cpHandle *hand, CompactContext *context)
+{
+	cpHandle *dest = (cpHandle *)cpArrayCompactionDest(context->live, context->unused, context->count, hand);
+	return (dest ? dest : hand);
+}
+
+static void pushHandle(cpHandle *hand, cpArray *handles){cpArrayPush(handles, hand);}
+
+static size_t
+cpSpaceHashTrim(cpSpaceHash *hash)
+{
+	const cpAllocator *allocator = hash->spatialIndex.allocator;
+	cpArray *live = cpArrayNewWithAllocator(0, allocator);
+	cpArray *unused = cpArrayNewWithAllocator(0, allocator);
+	size_t freed = 0;
+	
+	// Handles can still be referenced by bins after their object is removed.
+	cpHashSetEach(hash->handleSet, (cpHashSetIteratorFunc)pushHandle, live);
+	for(int i=0; i<hash->numcells; i++){
+		for(cpSpaceHashBin *bin = hash->table[i]; bin; bin = bin->next) cpArrayPush(live, bin->handle);
+	}
+	
+	int count = cpArrayPlanCompaction(live, hash->pooledHandles);
+	if(count){
+		for(int i=0; i<count; i++){
+			cpHandle *dest = (cpHandle *)hash->pooledHandles->arr[i];
+			(*dest) = *(cpHandle *)live->arr[live->num - 1 - i];
+		}
+		
+		CompactContext context = {live, hash->pooledHandles, count};
+		cpHashSetRemap(hash->handleSet, (cpHashSetTransFunc)handleSetRemap, &context);
+		
+		for(int i=0; i<hash->numcells; i++){
+			for(cpSpaceHashBin *bin = hash->table[i]; bin; bin = bin->next){
+				bin->handle = (cpHandle *)handleSetRemap(bin->handle, &context);
+			}
+		}
+		
+		cpArrayFinishCompaction(live, hash->pooledHandles, count);
+	}
+	
+	freed += cpArrayTrimBuffers(hash->allocatedBuffers, CP_BUFFER_BYTES, hash->pooledHandles, sizeof(cpHandle));
+	
+	// Move the bins, keeping the order of each cell's chain.
+	live->num = 0;
+	for(int i=0; i<hash->numcells; i++){
+		for(cpSpaceHashBin *bin = hash->table[i]; bin; bin = bin->next) cpArrayPush(live, bin);
+	}
+	
+	for(cpSpaceHashBin *bin = hash->pooledBins; bin; bin = bin->next) cpArrayPush(unused, bin);
+	
+	count = cpArrayPlanCompaction(live, unused);
+	if(count){
+		for(int i=0; i<hash->numcells; i++){
+			for(cpSpaceHashBin **slot = &hash->table[i]; *slot; slot = &(*slot)->next){
+				cpSpaceHashBin *dest = (cpSpaceHashBin *)cpArrayCompactionDest(live, unused, count, *slot);
+				if(dest){
+					(*dest) = **slot;
+					(*slot) = dest;
+				}
+			}
+		}
+		
+		cpArrayFinishCompaction(live, unused, count);
+	}
+	
+	freed += cpArrayTrimBuffers(hash->allocatedBuffers, CP_BUFFER_BYTES, unused, sizeof(cpSpaceHashBin));
+	
+	hash->pooledBins = NULL;
+	for(int i=unused->num-1; i>=0; i--) recycleBin(hash, (cpSpaceHashBin *)unused->arr[i]);
+	
+	cpArrayFree(live);
+	cpArrayFree(unused);
+	
+	return freed + cpHashSetTrim(hash->handleSet);
+}
+
+static void
+cpSpaceHashGetPoolStats(cpSpaceHash *hash, cpPoolStats *stats)
+{
+	int bins = 0;
+	for(cpSpaceHashBin *bin = hash->pooledBins; bin; bin = bin->next) bins++;
+	
+	stats->bytes += hash->numcells*sizeof(cpSpaceHashBin *) + hash->allocatedBuffers->num*CP_BUFFER_BYTES;
+	stats->unusedBytes += bins*sizeof(cpSpaceHashBin) + hash->pooledHandles->num*sizeof(cpHandle);
+	
+	cpHashSetGetStats(hash->handleSet, stats);
+}
+
+static void
+cpSpaceHashGetMemoryStats(cpSpaceHash *hash, cpSpatialIndexMemoryStats *stats)
+{
+	int bins = 0, pooledBins = 0;
+	for(int i=0; i<hash->numcells; i++){
+		for(cpSpaceHashBin *bin = hash->table[i]; bin; bin = bin->next) bins++;
+	}
+	
+	for(cpSpaceHashBin *bin = hash->pooledBins; bin; bin = bin->next) pooledBins++;
+	
+	// Each buffer is carved up entirely into either bins or handles.
+	int binBuffers = (bins + pooledBins)/(CP_BUFFER_BYTES/sizeof(cpSpaceHashBin));
+	int handleBuffers = hash->allocatedBuffers->num - binBuffers;
+	int handles = handleBuffers*(CP_BUFFER_BYTES/sizeof(cpHandle)) - hash->pooledHandles->num;
+	
+	cpMemoryStats handleSet = {0};
+	cpHashSetGetMemoryStats(hash->handleSet, &handleSet);
+	
+	stats->bins.bytes += binBuffers*CP_BUFFER_BYTES + hash->numcells*sizeof(cpSpaceHashBin *);
+	stats->bins.count += bins;
+	stats->bins.pooled += pooledBins;
+	
+	stats->handles.bytes += handleBuffers*CP_BUFFER_BYTES + handleSet.bytes + cpArrayGetBytes(hash->pooledHandles);
+	stats->handles.count += handles;
+	stats->handles.pooled += hash->pooledHandles->num;
+	
+	stats->bytes += sizeof(cpSpaceHash) + cpArrayGetBytes(hash->allocatedBuffers) + stats->bins.bytes + stats->handles.bytes;
+}
+
+#pragma mark Snapshots
+
+static int
+compareHandles(const void *a, const void *b)
+{
+	size_t pa = (size_t)*(cpHandle **)a, pb = (size_t)*(cpHandle **)b;
+	return (pa > pb) - (pa < pb);
+}
+
+static void
+PushHandle(cpHandle *hand, cpArray *arr)
+{
+	cpArrayPush(arr, hand);
+}
+
+// Handles aren't linked to each other, so the ones in use are saved along with a pointer to them.
+// Bins can still reference the handles of objects that were removed, so the bins are searched too.
+static void
+SnapshotHandles(cpSpaceHash *hash, cpSnapshotCursor *cursor)
+{
+	if(cursor->restore){
+		for(;;){
+			cpHandle *hand = NULL;
+			cpSnapshotTransfer(cursor, &hand, sizeof(cpHandle *));
+			if(!hand) break;
+			
+			cpSnapshotTransfer(cursor, hand, sizeof(cpHandle));
+		}
+	} else {
+		cpArray *handles = cpArrayNewWithAllocator(0, hash->spatialIndex.allocator);
+		cpHashSetEach(hash->handleSet, (cpHashSetIteratorFunc)PushHandle, handles);
+		
+		for(int i=0; i<hash->numcells; i++){
+			for(cpSpaceHashBin *bin = hash->table[i]; bin; bin = bin->next) cpArrayPush(handles, bin->handle);
+		}
+		
+		qsort(handles->arr, handles->num, sizeof(void *), compareHandles);
+		
+		for(int i=0; i<handles->num; i++){
+			cpHandle *hand = (cpHandle *)handles->arr[i];
+			if(i > 0 && hand == handles->arr[i - 1]) continue;
+			
+			cpSnapshotTransfer(cursor, &hand, sizeof(cpHandle *));
+			cpSnapshotTransfer(cursor, hand, sizeof(cpHandle));
+		}
+		
+		cpHandle *end = NULL;
+		cpSnapshotTransfer(cursor, &end, sizeof(cpHandle *));
+		cpArrayFree(handles);
+	}
+}
+
+// Only the bins and handles in use are saved, the pooled bins only need their links.
+static void
+cpSpaceHashSnapshot(cpSpaceHash *hash, cpSnapshotCursor *cursor)
+{
+	int numcells = hash->numcells;
+	cpSnapshotTransfer(cursor, &numcells, sizeof(int));
+	cpSnapshotTransfer(cursor, &hash->celldim, sizeof(cpFloat));
+	
+	// Only a hash that was resized since the snapshot was taken needs a new table.
+	if(numcells != hash->numcells) cpSpaceHashAllocTable(hash, numcells);
+	
+	cpSnapshotTransfer(cursor, hash->table, numcells*sizeof(cpSpaceHashBin *));
+	cpSnapshotTransfer(cursor, &hash->pooledBins, sizeof(cpSpaceHashBin *));
+	cpSnapshotTransfer(cursor, &hash->stamp, sizeof(cpTimestamp));
+	
+	cpHashSetSnapshot(hash->handleSet, cursor);
+	cpArraySnapshot(hash->pooledHandles, cursor);
+	cpArraySnapshotBuffers(hash->allocatedBuffers, cursor);
+	
+	// Each bin is restored before its next pointer is followed.
+	for(int i=0; i<numcells; i++){
+		for(cpSpaceHashBin *bin = hash->table[i]; bin; bin = bin->next) cpSnapshotTransfer(cursor, bin, sizeof(cpSpaceHashBin));
+	}
+	
+	cpSnapshotFreeList(cursor, hash->pooledBins, sizeof(cpSpaceHashBin), offsetof(cpSpaceHashBin, next));
+	SnapshotHandles(hash, cursor);
+}
+
+#pragma mark Cloning
+
+typedef struct CloneContext {
+	cpRelocation *rel, *objects;
+} CloneContext;
+
+static void *
+handleSetClone(cpHandle *hand, CloneContext *context)
+{
+	cpHandle *copy = (cpHandle *)cpRelocate(context->rel, hand);
+	copy->obj = cpRelocate(context->objects, hand->obj);
+	
+	return copy;
+}
+
+// The buffers are copied whole and the pointers in them are moved over to the copies.
+static cpSpatialIndex *
+cpSpaceHashClone(cpSpaceHash *hash, cpSpatialIndex *staticIndex, cpRelocation *objects)
+{
+	const cpAllocator *allocator = hash->spatialIndex.allocator;
+	cpSpaceHash *copy = (cpSpaceHash *)cpAllocatorCalloc(allocator, 1, sizeof(cpSpaceHash));
+	copy->spatialIndex.allocator = allocator;
+	cpSpatialIndexInit((cpSpatialIndex *)copy, Klass(), hash->spatialIndex.bbfunc, staticIndex);
+	
+	cpSpaceHashAllocTable(copy, hash->numcells);
+	copy->celldim = hash->celldim;
+	copy->stamp = hash->stamp;
+	
+	cpRelocation *rel = cpRelocationNew(allocator);
+	copy->allocatedBuffers = cpArrayCloneBuffers(hash->allocatedBuffers, CP_BUFFER_BYTES, rel);
+	
+	for(int i=0; i<hash->numcells; i++){
+		copy->table[i] = (cpSpaceHashBin *)cpRelocate(rel, hash->table[i]);
+		
+		for(cpSpaceHashBin *bin = copy->table[i]; bin; bin = bin->next){
+			bin->handle = (cpHandle *)cpRelocate(rel, bin->handle);
+			bin->next = (cpSpaceHashBin *)cpRelocate(rel, bin->next);
+		}
+	}
+	
+	copy->pooledBins = (cpSpaceHashBin *)cpRelocate(rel, hash->pooledBins);
+	for(cpSpaceHashBin *bin = copy->pooledBins; bin; bin = bin->next){
+		bin->next = (cpSpaceHashBin *)cpRelocate(rel, bin->next);
+	}
+	
+	cpArray *pooledHandles = hash->pooledHandles;
+	copy->pooledHandles = cpArrayNewWithAllocator(pooledHandles->num, allocator);
+	for(int i=0; i<pooledHandles->num; i++) cpArrayPush(copy->pooledHandles, cpRelocate(rel, pooledHandles->arr[i]));
+	
+	CloneContext context = {rel, objects};
+	copy->handleSet = cpHashSetClone(hash->handleSet, (cpHashSetTransFunc)handleSetClone, &context);
+	
+	cpRelocationFree(rel);
+	return (cpSpatialIndex *)copy;
+}
+
 static cpSpatialIndexClass klass = {
 	(cpSpatialIndexDestroyImpl)cpSpaceHashDestroy,
 	
@@ -600,6 +874,12 @@ static cpSpatialIndexClass klass = {
 	(cpSpatialIndexPointQueryImpl)cpSpaceHashPointQuery,
 	(cpSpatialIndexSegmentQueryImpl)cpSpaceHashSegmentQuery,
 	(cpSpatialIndexQueryImpl)cpSpaceHashQuery,
+	
+	(cpSpatialIndexTrimImpl)cpSpaceHashTrim,
+	(cpSpatialIndexPoolStatsImpl)cpSpaceHashGetPoolStats,
+	(cpSpatialIndexMemoryStatsImpl)cpSpaceHashGetMemoryStats,
+	(cpSpatialIndexSnapshotImpl)cpSpaceHashSnapshot,
+	(cpSpatialIndexCloneImpl)cpSpaceHashClone,
 };
 
 static inline cpSpatialIndexClass *Klass(){return &klass;}
@@ -0,0 +1,605 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "chipmunk_private.h"
+#include "constraints/util.h"
+
+// Direct solver for acyclic groups of pivot, pin and groove joints.
+// The velocity constraints of each tree are solved exactly using the sparse LDL^T factorization
+// described in "Linear-Time Dynamics using Lagrange Multipliers" by David Baraff.
+// The system is built from body nodes (velocity, 3 DOF) and joint nodes (impulse, 1 or 2 DOF)
+// connected by the joint's Jacobian blocks. Because the graph is a tree, eliminating the nodes
+// from the leaves towards the root causes no fill in and the whole solve is O(n).
+// Static and other infinite mass bodies are left out of the graph, so a tree may only touch them once.
+
+typedef enum treeJointType {
+	TREE_PIVOT,
+	TREE_PIN,
+	TREE_GROOVE,
+} treeJointType;
+
+typedef struct treeJoint {
+	cpConstraint *constraint;
+	treeJointType type;
+	int dim;
+	
+	// Body node indexes, -1 for an infinite mass body.
+	int a, b;
+	// Next joint in the adjacency lists of a and b.
+	int next_a, next_b;
+	
+	// Jacobian rows for the a and b bodies.
+	cpFloat ja[2][3], jb[2][3];
+	
+	cpBool visited;
+	cpBool direct;
+} treeJoint;
+
+typedef struct treeNode {
+	// Parent node index or -1 for a root.
+	int parent;
+	int dim;
+	
+	// Holds the diagonal block D while factoring, then its inverse.
+	cpFloat Dinv[3][3];
+	// Dinv*H(i, parent), dim x parent dim.
+	cpFloat L[3][3];
+	cpFloat x[3];
+} treeNode;
+
+struct cpJointTreeSolver {
+	int bodyCount, bodyCapacity;
+	cpBody **bodies;
+	int *bodyJoints;
+	
+	int jointCount, jointCapacity;
+	treeJoint *joints;
+	
+	int nodeCapacity;
+	treeNode *nodes;
+	// Nodes in order from the roots to the leaves.
+	int orderCount;
+	int *order;
+	
+	cpArray *constraints;
+	
+	const cpAllocator *allocator;
+};
+
+static cpJointTreeSolver *
+cpJointTreeSolverNew(const cpAllocator *allocator)
+{
+	cpJointTreeSolver *solver = (cpJointTreeSolver *)cpAllocatorCalloc(allocator, 1, sizeof(cpJointTreeSolver));
+	solver->constraints = cpArrayNewWithAllocator(0, allocator);
+	solver->allocator = allocator;
+	
+	return solver;
+}
+
+void
+cpJointTreeSolverFree(cpJointTreeSolver *solver)
+{
+	if(solver){
+		const cpAllocator *allocator = solver->allocator;
+		cpAllocatorFree(allocator, solver->bodies);
+		cpAllocatorFree(allocator, solver->bodyJoints);
+		cpAllocatorFree(allocator, solver->joints);
+		cpAllocatorFree(allocator, solver->nodes);
+		cpAllocatorFree(allocator, solver->order);
+		cpArrayFree(solver->constraints);
+		
+		cpAllocatorFree(allocator, solver);
+	}
+}
+
+static inline cpBool
+bodyIsGround(cpBody *body)
+{
+	return (body->m_inv == 0.0f && body->i_inv == 0.0f);
+}
+
+static int
+bodyIndex(cpJointTreeSolver *solver, cpBody *body)
+{
+	if(bodyIsGround(body)) return -1;
+	if(body->treeIndex >= 0) return body->treeIndex;
+	
+	if(solver->bodyCount == solver->bodyCapacity){
+		solver->bodyCapacity = (solver->bodyCapacity ? 2*solver->bodyCapacity : 64);
+		solver->bodies = (cpBody **)cpAllocatorRealloc(solver->allocator, solver->bodies, solver->bodyCapacity*sizeof(cpBody *));
+		solver->bodyJoints = (int *)cpAllocatorRealloc(solver->allocator, solver->bodyJoints, solver->bodyCapacity*sizeof(int));
+	}
+	
+	int index = solver->bodyCount++;
+	solver->bodies[index] = body;
+	solver->bodyJoints[index] = -1;
+	
+	return (body->treeIndex = index);
+}
+
+// Fill in a Jacobian row for the velocity of the point r on a body along n.
+static inline void
+jacobianRow(cpFloat row[3], cpVect n, cpVect r, cpFloat sign)
+{
+	row[0] = sign*n.x;
+	row[1] = sign*n.y;
+	row[2] = sign*cpvcross(r, n);
+}
+
+// Returns false if the constraint can't be solved directly this step.
+static cpBool
+jointInit(treeJoint *joint, cpConstraint *constraint)
+{
+	// Joints with a max force need clamped impulses.
+	if(constraint->maxForce != (cpFloat)INFINITY) return cpFalse;
+	
+	const cpConstraintClass *klass = constraint->klass;
+	if(klass == cpPivotJointGetClass()){
+		cpPivotJoint *pivot = (cpPivotJoint *)constraint;
+		
+		joint->type = TREE_PIVOT;
+		joint->dim = 2;
+		jacobianRow(joint->ja[0], cpv(1.0f, 0.0f), pivot->r1, -1.0f);
+		jacobianRow(joint->ja[1], cpv(0.0f, 1.0f), pivot->r1, -1.0f);
+		jacobianRow(joint->jb[0], cpv(1.0f, 0.0f), pivot->r2,  1.0f);
+		jacobianRow(joint->jb[1], cpv(0.0f, 1.0f), pivot->r2,  1.0f);
+	} else if(klass == cpPinJointGetClass()){
+		cpPinJoint *pin = (cpPinJoint *)constraint;
+		
+		// The direction is undefined when the anchors overlap.
+		if(cpveql(pin->n, cpvzero)) return cpFalse;
+		
+		joint->type = TREE_PIN;
+		joint->dim = 1;
+		jacobianRow(joint->ja[0], pin->n, pin->r1, -1.0f);
+		jacobianRow(joint->jb[0], pin->n, pin->r2,  1.0f);
+	} else if(klass == cpGrooveJointGetClass()){
+		cpGrooveJoint *groove = (cpGrooveJoint *)constraint;
+		
+		// At the ends of the groove the joint can only push one way.
+		if(groove->clamp != 0.0f) return cpFalse;
+		
+		joint->type = TREE_GROOVE;
+		joint->dim = 1;
+		jacobianRow(joint->ja[0], groove->grv_tn, groove->r1, -1.0f);
+		jacobianRow(joint->jb[0], groove->grv_tn, groove->r2,  1.0f);
+	} else {
+		return cpFalse;
+	}
+	
+	joint->constraint = constraint;
+	joint->visited = cpFalse;
+	joint->direct = cpFalse;
+	
+	return cpTrue;
+}
+
+// Target change in the joint's relative velocity.
+static inline void
+jointError(treeJoint *joint, cpFloat err[2])
+{
+	cpConstraint *constraint = joint->constraint;
+	cpBody *a = constraint->a;
+	cpBody *b = constraint->b;
+	
+	if(joint->type == TREE_PIVOT){
+		cpPivotJoint *pivot = (cpPivotJoint *)constraint;
+		cpVect e = cpvsub(pivot->bias, relative_velocity(a, b, pivot->r1, pivot->r2));
+		err[0] = e.x;
+		err[1] = e.y;
+	} else if(joint->type == TREE_PIN){
+		cpPinJoint *pin = (cpPinJoint *)constraint;
+		err[0] = pin->bias - normal_relative_velocity(a, b, pin->r1, pin->r2, pin->n);
+	} else {
+		cpGrooveJoint *groove = (cpGrooveJoint *)constraint;
+		err[0] = cpvdot(cpvsub(groove->bias, relative_velocity(a, b, groove->r1, groove->r2)), groove->grv_tn);
+	}
+}
+
+static inline void
+jointAccumulate(treeJoint *joint, cpFloat j[2])
+{
+	cpConstraint *constraint = joint->constraint;
+	
+	if(joint->type == TREE_PIVOT){
+		cpPivotJoint *pivot = (cpPivotJoint *)constraint;
+		pivot->jAcc = cpvadd(pivot->jAcc, cpv(j[0], j[1]));
+	} else if(joint->type == TREE_PIN){
+		((cpPinJoint *)constraint)->jnAcc += j[0];
+	} else {
+		cpGrooveJoint *groove = (cpGrooveJoint *)constraint;
+		groove->jAcc = cpvadd(groove->jAcc, cpvmult(groove->grv_tn, j[0]));
+	}
+}
+
+#pragma mark Dense Block Helpers
+
+static void
+blockInverse(int n, cpFloat m[3][3], cpFloat inv[3][3])
+{
+	if(n == 1){
+		inv[0][0] = 1.0f/m[0][0];
+	} else if(n == 2){
+		cpFloat det_inv = 1.0f/(m[0][0]*m[1][1] - m[0][1]*m[1][0]);
+		inv[0][0] =  m[1][1]*det_inv; inv[0][1] = -m[0][1]*det_inv;
+		inv[1][0] = -m[1][0]*det_inv; inv[1][1] =  m[0][0]*det_inv;
+	} else {
+		cpFloat c00 = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+		cpFloat c01 = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+		cpFloat c02 = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+		cpFloat det_inv = 1.0f/(m[0][0]*c00 + m[0][1]*c01 + m[0][2]*c02);
+		
+		inv[0][0] = c00*det_inv;
+		inv[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2])*det_inv;
+		inv[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1])*det_inv;
+		inv[1][0] = c01*det_inv;
+		inv[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0])*det_inv;
+		inv[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2])*det_inv;
+		inv[2][0] = c02*det_inv;
+		inv[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1])*det_inv;
+		inv[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0])*det_inv;
+	}
+}
+
+// H(child, parent) for the edge between a node and its parent.
+// Joint rows map body velocities to joint velocities, bodies get the transpose.
+static void
+edgeBlock(cpJointTreeSolver *solver, int child, int parent, cpFloat h[3][3])
+{
+	int bodyCount = solver->bodyCount;
+	cpBool childIsJoint = (child >= bodyCount);
+	
+	int jointIndex = (childIsJoint ? child : parent) - bodyCount;
+	int bodyIndex = (childIsJoint ? parent : child);
+	treeJoint *joint = &solver->joints[jointIndex];
+	cpFloat (*rows)[3] = (joint->a == bodyIndex ? joint->ja : joint->jb);
+	
+	for(int i=0; i<joint->dim; i++){
+		for(int j=0; j<3; j++){
+			if(childIsJoint){
+				h[i][j] = rows[i][j];
+			} else {
+				h[j][i] = rows[i][j];
+			}
+		}
+	}
+}
+
+#pragma mark Tree Building
+
+static inline int
+otherBody(treeJoint *joint, int body)
+{
+	return (joint->a == body ? joint->b : joint->a);
+}
+
+static inline int
+nextJoint(treeJoint *joint, int body)
+{
+	return (joint->a == body ? joint->next_a : joint->next_b);
+}
+
+// Walk the component containing body and check that it's a tree touching infinite mass bodies at most once.
+// Returns the root node, or -1 if the component has to be solved iteratively.
+static int
+findRoot(cpJointTreeSolver *solver, int body, int *stack)
+{
+	int bodyCount = solver->bodyCount;
+	treeNode *nodes = solver->nodes;
+	
+	int groundJoint = -1;
+	cpBool tree = cpTrue;
+	
+	int count = 0;
+	stack[count++] = body;
+	nodes[body].parent = body;
+	
+	while(count){
+		int node = stack[--count];
+		
+		for(int i=solver->bodyJoints[node]; i>=0; i=nextJoint(&solver->joints[i], node)){
+			treeJoint *joint = &solver->joints[i];
+			if(joint->visited) continue;
+			joint->visited = cpTrue;
+			
+			int other = otherBody(joint, node);
+			if(other < 0){
+				if(groundJoint >= 0) tree = cpFalse;
+				groundJoint = bodyCount + i;
+			} else if(nodes[other].parent >= 0){
+				tree = cpFalse;
+			} else {
+				nodes[other].parent = other;
+				stack[count++] = other;
+			}
+		}
+	}
+	
+	return (tree ? (groundJoint >= 0 ? groundJoint : body) : -1);
+}
+
+// Append the tree rooted at root to the elimination order, parents before children.
+static void
+orderTree(cpJointTreeSolver *solver, int root)
+{
+	int bodyCount = solver->bodyCount;
+	treeNode *nodes = solver->nodes;
+	int *order = solver->order;
+	
+	int start = solver->orderCount;
+	int end = start;
+	
+	nodes[root].parent = -1;
+	order[end++] = root;
+	
+	// Breadth first, the order array doubles as the queue.
+	for(int k=start; k<end; k++){
+		int node = order[k];
+		int parent = nodes[node].parent;
+		
+		if(node < bodyCount){
+			nodes[node].dim = 3;
+			for(int i=solver->bodyJoints[node]; i>=0; i=nextJoint(&solver->joints[i], node)){
+				int child = bodyCount + i;
+				if(child == parent) continue;
+				
+				solver->joints[i].direct = cpTrue;
+				nodes[child].parent = node;
+				order[end++] = child;
+			}
+		} else {
+			treeJoint *joint = &solver->joints[node - bodyCount];
+			nodes[node].dim = joint->dim;
+			joint->direct = cpTrue;
+			
+			int ends[] = {joint->a, joint->b};
+			for(int i=0; i<2; i++){
+				int child = ends[i];
+				if(child < 0 || child == parent) continue;
+				
+				nodes[child].parent = node;
+				order[end++] = child;
+			}
+		}
+	}
+	
+	solver->orderCount = end;
+}
+
+// Factor the tree from the leaves to the roots.
+static void
+factor(cpJointTreeSolver *solver)
+{
+	int bodyCount = solver->bodyCount;
+	treeNode *nodes = solver->nodes;
+	int *order = solver->order;
+	
+	for(int k=0; k<solver->orderCount; k++){
+		int i = order[k];
+		treeNode *node = &nodes[i];
+		memset(node->Dinv, 0, sizeof(node->Dinv));
+		
+		if(i < bodyCount){
+			cpBody *body = solver->bodies[i];
+			node->Dinv[0][0] = node->Dinv[1][1] = body->m;
+			node->Dinv[2][2] = body->i;
+		}
+	}
+	
+	for(int k=solver->orderCount-1; k>=0; k--){
+		int i = order[k];
+		treeNode *node = &nodes[i];
+		int n = node->dim;
+		
+		cpFloat D[3][3];
+		memcpy(D, node->Dinv, sizeof(D));
+		blockInverse(n, D, node->Dinv);
+		if(node->parent < 0) continue;
+		
+		treeNode *parent = &nodes[node->parent];
+		int m = parent->dim;
+		
+		cpFloat h[3][3];
+		edgeBlock(solver, i, node->parent, h);
+		
+		// L = Dinv*H
+		for(int r=0; r<n; r++){
+			for(int c=0; c<m; c++){
+				cpFloat sum = 0.0f;
+				for(int s=0; s<n; s++) sum += node->Dinv[r][s]*h[s][c];
+				node->L[r][c] = sum;
+			}
+		}
+		
+		// Dparent -= H^T*L
+		for(int r=0; r<m; r++){
+			for(int c=0; c<m; c++){
+				cpFloat sum = 0.0f;
+				for(int s=0; s<n; s++) sum += h[s][r]*node->L[s][c];
+				parent->Dinv[r][c] -= sum;
+			}
+		}
+	}
+}
+
+#pragma mark Space Functions
+
+cpArray *
+cpSpaceBuildJointTrees(cpSpace *space)
+{
+	if(!space->jointTrees) space->jointTrees = cpJointTreeSolverNew(space->allocator);
+	cpJointTreeSolver *solver = space->jointTrees;
+	
+	solver->bodyCount = 0;
+	solver->jointCount = 0;
+	solver->orderCount = 0;
+	
+	// Find the joints that can be solved directly and build the adjacency lists of their bodies.
+	cpArray *constraints = space->classConstraints;
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		if(constraint->a == constraint->b) continue;
+		
+		cpBody *bodies[] = {constraint->a, constraint->b};
+		cpBool supported = cpTrue;
+		for(int j=0; j<2; j++){
+			cpBody *body = bodies[j];
+			supported = supported && (bodyIsGround(body) || (body->m_inv != 0.0f && body->i_inv != 0.0f));
+		}
+		if(!supported || (bodyIsGround(bodies[0]) && bodyIsGround(bodies[1]))) continue;
+		
+		if(solver->jointCount == solver->jointCapacity){
+			solver->jointCapacity = (solver->jointCapacity ? 2*solver->jointCapacity : 64);
+			solver->joints = (treeJoint *)cpAllocatorRealloc(solver->allocator, solver->joints, solver->jointCapacity*sizeof(treeJoint));
+		}
+		
+		treeJoint *joint = &solver->joints[solver->jointCount];
+		if(!jointInit(joint, constraint)) continue;
+		
+		int index = solver->jointCount++;
+		joint->a = bodyIndex(solver, constraint->a);
+		joint->b = bodyIndex(solver, constraint->b);
+		
+		if(joint->a >= 0){
+			joint->next_a = solver->bodyJoints[joint->a];
+			solver->bodyJoints[joint->a] = index;
+		}
+		
+		if(joint->b >= 0){
+			joint->next_b = solver->bodyJoints[joint->b];
+			solver->bodyJoints[joint->b] = index;
+		}
+	}
+	
+	int nodeCount = solver->bodyCount + solver->jointCount;
+	if(nodeCount > solver->nodeCapacity){
+		solver->nodeCapacity = nodeCount;
+		solver->nodes = (treeNode *)cpAllocatorRealloc(solver->allocator, solver->nodes, nodeCount*sizeof(treeNode));
+		solver->order = (int *)cpAllocatorRealloc(solver->allocator, solver->order, nodeCount*sizeof(int));
+	}
+	
+	for(int i=0; i<nodeCount; i++) solver->nodes[i].parent = -1;
+	
+	// Order each tree shaped component. The order array is free to use as a stack while searching.
+	for(int i=0; i<solver->bodyCount; i++){
+		if(solver->nodes[i].parent >= 0) continue;
+		
+		int root = findRoot(solver, i, solver->order + solver->orderCount);
+		if(root >= 0) orderTree(solver, root);
+	}
+	
+	factor(solver);
+	
+	// The remaining constraints are left to the iterative solver, still grouped by class.
+	cpArray *iterative = solver->constraints;
+	iterative->num = 0;
+	
+	for(int i=0, j=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		
+		if(j < solver->jointCount && solver->joints[j].constraint == constraint){
+			if(!solver->joints[j++].direct) cpArrayPush(iterative, constraint);
+		} else {
+			cpArrayPush(iterative, constraint);
+		}
+	}
+	
+	// Reset the body indexes for the next step.
+	for(int i=0; i<solver->bodyCount; i++) solver->bodies[i]->treeIndex = -1;
+	
+	return iterative;
+}
+
+cpFloat
+cpSpaceSolveJointTrees(cpSpace *space)
+{
+	cpJointTreeSolver *solver = space->jointTrees;
+	int bodyCount = solver->bodyCount;
+	treeNode *nodes = solver->nodes;
+	int *order = solver->order;
+	int count = solver->orderCount;
+	
+	// The right hand side is zero for the bodies and the velocity error for the joints.
+	for(int k=0; k<count; k++){
+		int i = order[k];
+		treeNode *node = &nodes[i];
+		node->x[0] = node->x[1] = node->x[2] = 0.0f;
+		
+		if(i >= bodyCount) jointError(&solver->joints[i - bodyCount], node->x);
+	}
+	
+	// Forward substitution from the leaves.
+	for(int k=count-1; k>=0; k--){
+		treeNode *node = &nodes[order[k]];
+		if(node->parent < 0) continue;
+		
+		treeNode *parent = &nodes[node->parent];
+		for(int r=0; r<parent->dim; r++){
+			for(int s=0; s<node->dim; s++) parent->x[r] -= node->L[s][r]*node->x[s];
+		}
+	}
+	
+	// Back substitution from the roots.
+	for(int k=0; k<count; k++){
+		treeNode *node = &nodes[order[k]];
+		int n = node->dim;
+		
+		cpFloat y[3];
+		for(int r=0; r<n; r++){
+			y[r] = 0.0f;
+			for(int s=0; s<n; s++) y[r] += node->Dinv[r][s]*node->x[s];
+		}
+		
+		if(node->parent >= 0){
+			treeNode *parent = &nodes[node->parent];
+			for(int r=0; r<n; r++){
+				for(int s=0; s<parent->dim; s++) y[r] -= node->L[r][s]*parent->x[s];
+			}
+		}
+		
+		for(int r=0; r<n; r++) node->x[r] = y[r];
+	}
+	
+	// Bodies hold their change in velocity, joints hold their negated change in impulse.
+	cpFloat delta = 0.0f;
+	for(int k=0; k<count; k++){
+		int i = order[k];
+		cpFloat *x = nodes[i].x;
+		
+		if(i < bodyCount){
+			cpBody *body = solver->bodies[i];
+			body->v = cpvadd(body->v, cpv(x[0], x[1]));
+			body->w += x[2];
+		} else {
+			treeJoint *joint = &solver->joints[i - bodyCount];
+			cpFloat j[] = {-x[0], -x[1]};
+			jointAccumulate(joint, j);
+			
+			delta = cpfmax(delta, cpfmax(cpfabs(j[0]), joint->dim == 2 ? cpfabs(j[1]) : 0.0f));
+		}
+	}
+	
+	return delta;
+}
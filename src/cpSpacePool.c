@@ -0,0 +1,310 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+#include <stdlib.h>
+#include <string.h>
+
+#include "chipmunk_private.h"
+
+#pragma mark Pool Functions
+
+static inline size_t
+BufferSize(cpSpacePool *pool)
+{
+	return (pool->size > CP_BUFFER_BYTES ? pool->size : CP_BUFFER_BYTES);
+}
+
+cpSpacePool *
+cpSpacePoolNew(size_t size, const cpAllocator *allocator)
+{
+	cpSpacePool *pool = (cpSpacePool *)cpAllocatorCalloc(allocator, 1, sizeof(cpSpacePool));
+	
+	// Round up so that every block stays aligned.
+	pool->size = (size + 15)&~(size_t)15;
+	pool->blocks = cpArrayNewWithAllocator(0, allocator);
+	pool->buffers = cpArrayNewWithAllocator(0, allocator);
+	pool->allocator = allocator;
+	
+	return pool;
+}
+
+void
+cpSpacePoolFree(cpSpacePool *pool)
+{
+	if(pool){
+		const cpAllocator *allocator = pool->allocator;
+		
+		cpArrayFreeEachBlock(pool->buffers);
+		cpArrayFree(pool->buffers);
+		cpArrayFree(pool->blocks);
+		
+		cpAllocatorFree(allocator, pool);
+	}
+}
+
+void *
+cpSpacePoolAlloc(cpSpacePool *pool)
+{
+	size_t size = pool->size;
+	
+	if(pool->blocks->num == 0){
+		// Pool is exhausted, make more
+		size_t bytes = BufferSize(pool);
+		int count = (int)(bytes/size);
+		
+		char *buffer = (char *)cpAllocatorCalloc(pool->allocator, 1, bytes);
+		cpArrayPush(pool->buffers, buffer);
+		
+		// Push them in reverse so they are handed out in address order.
+		for(int i=count-1; i>=0; i--) cpArrayPush(pool->blocks, buffer + i*size);
+	}
+	
+	void *block = cpArrayPop(pool->blocks);
+	memset(block, 0, size);
+	
+	return block;
+}
+
+void
+cpSpacePoolRecycle(cpSpacePool *pool, void *block)
+{
+	cpArrayPush(pool->blocks, block);
+}
+
+size_t
+cpSpacePoolTrim(cpSpacePool *pool)
+{
+	return cpArrayTrimBuffers(pool->buffers, BufferSize(pool), pool->blocks, pool->size);
+}
+
+void
+cpSpacePoolGetStats(cpSpacePool *pool, cpPoolStats *stats)
+{
+	stats->bytes += pool->buffers->num*BufferSize(pool);
+	stats->unusedBytes += pool->blocks->num*pool->size;
+}
+
+void
+cpSpacePoolGetMemoryStats(cpSpacePool *pool, cpMemoryStats *stats)
+{
+	int blocks = pool->buffers->num*(int)(BufferSize(pool)/pool->size);
+	
+	stats->bytes += sizeof(cpSpacePool) + cpArrayGetBytes(pool->blocks) + cpArrayGetBytes(pool->buffers);
+	stats->bytes += pool->buffers->num*BufferSize(pool);
+	stats->count += blocks - pool->blocks->num;
+	stats->pooled += pool->blocks->num;
+}
+
+void
+cpSpacePoolSnapshot(cpSpacePool *pool, cpSnapshotCursor *cursor)
+{
+	cpArraySnapshotBuffers(pool->buffers, cursor);
+	cpArraySnapshot(pool->blocks, cursor);
+}
+
+cpSpacePool *
+cpSpacePoolClone(cpSpacePool *pool, cpRelocation *rel)
+{
+	cpSpacePool *copy = cpSpacePoolNew(pool->size, pool->allocator);
+	
+	cpArrayFree(copy->buffers);
+	copy->buffers = cpArrayCloneBuffers(pool->buffers, BufferSize(pool), rel);
+	
+	cpArray *blocks = pool->blocks;
+	for(int i=0; i<blocks->num; i++) cpArrayPush(copy->blocks, cpRelocate(rel, blocks->arr[i]));
+	
+	return copy;
+}
+
+cpSpacePool *
+cpSpaceGetPool(cpSpace *space, size_t size)
+{
+	size = (size + 15)&~(size_t)15;
+	
+	cpArray *pools = space->pools;
+	for(int i=0; i<pools->num; i++){
+		cpSpacePool *pool = (cpSpacePool *)pools->arr[i];
+		if(pool->size == size) return pool;
+	}
+	
+	cpSpacePool *pool = cpSpacePoolNew(size, space->allocator);
+	cpArrayPush(pools, pool);
+	
+	return pool;
+}
+
+#pragma mark Bodies
+
+static inline cpBody *
+PoolBody(cpBody *body, cpSpacePool *pool)
+{
+	body->pool = pool;
+	return body;
+}
+
+cpBody *
+cpSpaceNewBody(cpSpace *space, cpFloat m, cpFloat i)
+{
+	cpSpacePool *pool = cpSpaceGetPool(space, sizeof(cpBody));
+	cpBody *body = (cpBody *)cpSpacePoolAlloc(pool);
+	return PoolBody(cpBodyInit(body, m, i), pool);
+}
+
+cpBody *
+cpSpaceNewStaticBody(cpSpace *space)
+{
+	cpSpacePool *pool = cpSpaceGetPool(space, sizeof(cpBody));
+	cpBody *body = (cpBody *)cpSpacePoolAlloc(pool);
+	return PoolBody(cpBodyInitStatic(body), pool);
+}
+
+#pragma mark Shapes
+
+static inline cpShape *
+PoolShape(cpShape *shape, cpSpacePool *pool)
+{
+	shape->pool = pool;
+	return shape;
+}
+
+cpShape *
+cpSpaceNewCircleShape(cpSpace *space, cpBody *body, cpFloat radius, cpVect offset)
+{
+	cpSpacePool *pool = cpSpaceGetPool(space, sizeof(cpCircleShape));
+	cpCircleShape *circle = (cpCircleShape *)cpSpacePoolAlloc(pool);
+	return PoolShape((cpShape *)cpCircleShapeInit(circle, body, radius, offset), pool);
+}
+
+cpShape *
+cpSpaceNewSegmentShape(cpSpace *space, cpBody *body, cpVect a, cpVect b, cpFloat radius)
+{
+	cpSpacePool *pool = cpSpaceGetPool(space, sizeof(cpSegmentShape));
+	cpSegmentShape *seg = (cpSegmentShape *)cpSpacePoolAlloc(pool);
+	return PoolShape((cpShape *)cpSegmentShapeInit(seg, body, a, b, radius), pool);
+}
+
+cpShape *
+cpSpaceNewPolyShape(cpSpace *space, cpBody *body, int numVerts, cpVect *verts, cpVect offset)
+{
+	// Polygons with the same number of vertexes share a pool and keep their arrays right after the struct.
+	cpSpacePool *pool = cpSpaceGetPool(space, sizeof(cpPolyShape) + cpPolyShapeStorageSize(numVerts));
+	cpPolyShape *poly = (cpPolyShape *)cpSpacePoolAlloc(pool);
+	return PoolShape((cpShape *)cpPolyShapeInitWithStorage(poly, body, numVerts, verts, offset, poly + 1), pool);
+}
+
+cpShape *
+cpSpaceNewBoxShape(cpSpace *space, cpBody *body, cpFloat width, cpFloat height)
+{
+	cpFloat hw = width/2.0f;
+	cpFloat hh = height/2.0f;
+	
+	cpVect verts[] = {
+		cpv(-hw, -hh),
+		cpv(-hw,  hh),
+		cpv( hw,  hh),
+		cpv( hw, -hh),
+	};
+	
+	return cpSpaceNewPolyShape(space, body, 4, verts, cpvzero);
+}
+
+#pragma mark Constraints
+
+#define POOLED_CONSTRAINT(space, type, pool) \
+	cpSpacePool *pool = cpSpaceGetPool(space, sizeof(type)); \
+	type *joint = (type *)cpSpacePoolAlloc(pool)
+
+static inline cpConstraint *
+PoolConstraint(cpConstraint *constraint, cpSpacePool *pool)
+{
+	constraint->pool = pool;
+	return constraint;
+}
+
+cpConstraint *
+cpSpaceNewPinJoint(cpSpace *space, cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2)
+{
+	POOLED_CONSTRAINT(space, cpPinJoint, pool);
+	return PoolConstraint((cpConstraint *)cpPinJointInit(joint, a, b, anchr1, anchr2), pool);
+}
+
+cpConstraint *
+cpSpaceNewSlideJoint(cpSpace *space, cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2, cpFloat min, cpFloat max)
+{
+	POOLED_CONSTRAINT(space, cpSlideJoint, pool);
+	return PoolConstraint((cpConstraint *)cpSlideJointInit(joint, a, b, anchr1, anchr2, min, max), pool);
+}
+
+cpConstraint *
+cpSpaceNewPivotJoint(cpSpace *space, cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2)
+{
+	POOLED_CONSTRAINT(space, cpPivotJoint, pool);
+	return PoolConstraint((cpConstraint *)cpPivotJointInit(joint, a, b, anchr1, anchr2), pool);
+}
+
+cpConstraint *
+cpSpaceNewGrooveJoint(cpSpace *space, cpBody *a, cpBody *b, cpVect groove_a, cpVect groove_b, cpVect anchr2)
+{
+	POOLED_CONSTRAINT(space, cpGrooveJoint, pool);
+	return PoolConstraint((cpConstraint *)cpGrooveJointInit(joint, a, b, groove_a, groove_b, anchr2), pool);
+}
+
+cpConstraint *
+cpSpaceNewDampedSpring(cpSpace *space, cpBody *a, cpBody *b, cpVect anchr1, cpVect anchr2, cpFloat restLength, cpFloat stiffness, cpFloat damping)
+{
+	POOLED_CONSTRAINT(space, cpDampedSpring, pool);
+	return PoolConstraint((cpConstraint *)cpDampedSpringInit(joint, a, b, anchr1, anchr2, restLength, stiffness, damping), pool);
+}
+
+cpConstraint *
+cpSpaceNewDampedRotarySpring(cpSpace *space, cpBody *a, cpBody *b, cpFloat restAngle, cpFloat stiffness, cpFloat damping)
+{
+	POOLED_CONSTRAINT(space, cpDampedRotarySpring, pool);
+	return PoolConstraint((cpConstraint *)cpDampedRotarySpringInit(joint, a, b, restAngle, stiffness, damping), pool);
+}
+
+cpConstraint *
+cpSpaceNewRotaryLimitJoint(cpSpace *space, cpBody *a, cpBody *b, cpFloat min, cpFloat max)
+{
+	POOLED_CONSTRAINT(space, cpRotaryLimitJoint, pool);
+	return PoolConstraint((cpConstraint *)cpRotaryLimitJointInit(joint, a, b, min, max), pool);
+}
+
+cpConstraint *
+cpSpaceNewRatchetJoint(cpSpace *space, cpBody *a, cpBody *b, cpFloat phase, cpFloat ratchet)
+{
+	POOLED_CONSTRAINT(space, cpRatchetJoint, pool);
+	return PoolConstraint((cpConstraint *)cpRatchetJointInit(joint, a, b, phase, ratchet), pool);
+}
+
+cpConstraint *
+cpSpaceNewGearJoint(cpSpace *space, cpBody *a, cpBody *b, cpFloat phase, cpFloat ratio)
+{
+	POOLED_CONSTRAINT(space, cpGearJoint, pool);
+	return PoolConstraint((cpConstraint *)cpGearJointInit(joint, a, b, phase, ratio), pool);
+}
+
+cpConstraint *
+cpSpaceNewSimpleMotor(cpSpace *space, cpBody *a, cpBody *b, cpFloat rate)
+{
+	POOLED_CONSTRAINT(space, cpSimpleMotor, pool);
+	return PoolConstraint((cpConstraint *)cpSimpleMotorInit(joint, a, b, rate), pool);
+}
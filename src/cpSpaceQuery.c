@@ -23,11 +23,20 @@
 
 #include "chipmunk_private.h"
 
+// Returns true if the shape doesn't pass the layers and group of a query.
+// A filtered index already skipped those shapes, so only the spatial hash needs the check.
+static inline cpBool
+queryRejectShape(cpShape *shape, cpLayers layers, cpGroup group, cpBool filtered)
+{
+	return (!filtered && ((shape->group && group == shape->group) || !(layers&shape->layers)));
+}
+
 #pragma mark Point Query Functions
 
 typedef struct pointQueryContext {
 	cpLayers layers;
 	cpGroup group;
+	cpBool filtered;
 	cpSpacePointQueryFunc func;
 	void *data;
 } pointQueryContext;
@@ -36,7 +45,7 @@ static void
 pointQueryHelper(cpVect *point, cpShape *shape, pointQueryContext *context)
 {
 	if(
-		!(shape->group && context->group == shape->group) && (context->layers&shape->layers) &&
+		!queryRejectShape(shape, context->layers, context->group, context->filtered) &&
 		cpShapePointQuery(shape, *point)
 	){
 		context->func(shape, context->data);
@@ -46,11 +55,14 @@ pointQueryHelper(cpVect *point, cpShape *shape, pointQueryContext *context)
 void
 cpSpacePointQuery(cpSpace *space, cpVect point, cpLayers layers, cpGroup group, cpSpacePointQueryFunc func, void *data)
 {
-	pointQueryContext context = {layers, group, func, data};
+	pointQueryContext context = {layers, group, cpSpaceIndexesFilterShapes(space), func, data};
+	
+	// Only let the indexes skip shapes when their filters are up to date.
+	if(!context.filtered){layers = CP_ALL_LAYERS; group = CP_NO_GROUP;}
 	
 	cpSpaceLock(space); {
-    cpSpatialIndexPointQuery(space->activeShapes, point, (cpSpatialIndexQueryFunc)pointQueryHelper, &context);
-    cpSpatialIndexPointQuery(space->staticShapes, point, (cpSpatialIndexQueryFunc)pointQueryHelper, &context);
+    cpBBTreePointQueryFiltered(space->activeShapes, point, layers, group, (cpSpatialIndexQueryFunc)pointQueryHelper, &context);
+    cpBBTreePointQueryFiltered(space->staticShapes, point, layers, group, (cpSpatialIndexQueryFunc)pointQueryHelper, &context);
 	} cpSpaceUnlock(space, cpTrue);
 }
 
@@ -76,6 +88,7 @@ typedef struct segQueryContext {
 	cpVect start, end;
 	cpLayers layers;
 	cpGroup group;
+	cpBool filtered;
 	cpSpaceSegmentQueryFunc func;
 } segQueryContext;
 
@@ -85,7 +98,7 @@ segQueryFunc(segQueryContext *context, cpShape *shape, void *data)
 	cpSegmentQueryInfo info;
 	
 	if(
-		!(shape->group && context->group == shape->group) && (context->layers&shape->layers) &&
+		!queryRejectShape(shape, context->layers, context->group, context->filtered) &&
 		cpShapeSegmentQuery(shape, context->start, context->end, &info)
 	){
 		context->func(shape, info.t, info.n, data);
@@ -100,12 +113,16 @@ cpSpaceSegmentQuery(cpSpace *space, cpVect start, cpVect end, cpLayers layers, c
 	segQueryContext context = {
 		start, end,
 		layers, group,
+		cpSpaceIndexesFilterShapes(space),
 		func,
 	};
 	
+	// Only let the indexes skip shapes when their filters are up to date.
+	if(!context.filtered){layers = CP_ALL_LAYERS; group = CP_NO_GROUP;}
+	
 	cpSpaceLock(space); {
-    cpSpatialIndexSegmentQuery(space->staticShapes, &context, start, end, 1.0f, (cpSpatialIndexSegmentQueryFunc)segQueryFunc, data);
-    cpSpatialIndexSegmentQuery(space->activeShapes, &context, start, end, 1.0f, (cpSpatialIndexSegmentQueryFunc)segQueryFunc, data);
+    cpBBTreeSegmentQueryFiltered(space->staticShapes, &context, start, end, 1.0f, layers, group, (cpSpatialIndexSegmentQueryFunc)segQueryFunc, data);
+    cpBBTreeSegmentQueryFiltered(space->activeShapes, &context, start, end, 1.0f, layers, group, (cpSpatialIndexSegmentQueryFunc)segQueryFunc, data);
 	} cpSpaceUnlock(space, cpTrue);
 }
 
@@ -113,6 +130,7 @@ typedef struct segQueryFirstContext {
 	cpVect start, end;
 	cpLayers layers;
 	cpGroup group;
+	cpBool filtered;
 } segQueryFirstContext;
 
 static cpFloat
@@ -121,7 +139,7 @@ segQueryFirst(segQueryFirstContext *context, cpShape *shape, cpSegmentQueryInfo
 	cpSegmentQueryInfo info;
 	
 	if(
-		!(shape->group && context->group == shape->group) && (context->layers&shape->layers) &&
+		!queryRejectShape(shape, context->layers, context->group, context->filtered) &&
 		!shape->sensor &&
 		cpShapeSegmentQuery(shape, context->start, context->end, &info) &&
 		info.t < out->t
@@ -144,11 +162,15 @@ cpSpaceSegmentQueryFirst(cpSpace *space, cpVect start, cpVect end, cpLayers laye
 	
 	segQueryFirstContext context = {
 		start, end,
-		layers, group
+		layers, group,
+		cpSpaceIndexesFilterShapes(space)
 	};
 	
-	cpSpatialIndexSegmentQuery(space->staticShapes, &context, start, end, 1.0f, (cpSpatialIndexSegmentQueryFunc)segQueryFirst, out);
-	cpSpatialIndexSegmentQuery(space->activeShapes, &context, start, end, out->t, (cpSpatialIndexSegmentQueryFunc)segQueryFirst, out);
+	// Only let the indexes skip shapes when their filters are up to date.
+	if(!context.filtered){layers = CP_ALL_LAYERS; group = CP_NO_GROUP;}
+	
+	cpBBTreeSegmentQueryFiltered(space->staticShapes, &context, start, end, 1.0f, layers, group, (cpSpatialIndexSegmentQueryFunc)segQueryFirst, out);
+	cpBBTreeSegmentQueryFiltered(space->activeShapes, &context, start, end, out->t, layers, group, (cpSpatialIndexSegmentQueryFunc)segQueryFirst, out);
 	
 	return out->shape;
 }
@@ -158,6 +180,7 @@ cpSpaceSegmentQueryFirst(cpSpace *space, cpVect start, cpVect end, cpLayers laye
 typedef struct bbQueryContext {
 	cpLayers layers;
 	cpGroup group;
+	cpBool filtered;
 	cpSpaceBBQueryFunc func;
 	void *data;
 } bbQueryContext;
@@ -166,7 +189,7 @@ static void
 bbQueryHelper(cpBB *bb, cpShape *shape, bbQueryContext *context)
 {
 	if(
-		!(shape->group && context->group == shape->group) && (context->layers&shape->layers) &&
+		!queryRejectShape(shape, context->layers, context->group, context->filtered) &&
 		cpBBIntersects(*bb, shape->bb)
 	){
 		context->func(shape, context->data);
@@ -176,11 +199,14 @@ bbQueryHelper(cpBB *bb, cpShape *shape, bbQueryContext *context)
 void
 cpSpaceBBQuery(cpSpace *space, cpBB bb, cpLayers layers, cpGroup group, cpSpaceBBQueryFunc func, void *data)
 {
-	bbQueryContext context = {layers, group, func, data};
+	bbQueryContext context = {layers, group, cpSpaceIndexesFilterShapes(space), func, data};
+	
+	// Only let the indexes skip shapes when their filters are up to date.
+	if(!context.filtered){layers = CP_ALL_LAYERS; group = CP_NO_GROUP;}
 	
 	cpSpaceLock(space); {
-    cpSpatialIndexQuery(space->activeShapes, &bb, bb, (cpSpatialIndexQueryFunc)bbQueryHelper, &context);
-    cpSpatialIndexQuery(space->staticShapes, &bb, bb, (cpSpatialIndexQueryFunc)bbQueryHelper, &context);
+    cpBBTreeQueryFiltered(space->activeShapes, &bb, bb, layers, group, (cpSpatialIndexQueryFunc)bbQueryHelper, &context);
+    cpBBTreeQueryFiltered(space->staticShapes, &bb, bb, layers, group, (cpSpatialIndexQueryFunc)bbQueryHelper, &context);
 	} cpSpaceUnlock(space, cpTrue);
 }
 
@@ -189,6 +215,7 @@ cpSpaceBBQuery(cpSpace *space, cpBB bb, cpLayers layers, cpGroup group, cpSpaceB
 typedef struct shapeQueryContext {
 	cpSpaceShapeQueryFunc func;
 	void *data;
+	cpBool filtered;
 	cpBool anyCollision;
 } shapeQueryContext;
 
@@ -198,8 +225,7 @@ shapeQueryHelper(cpShape *a, cpShape *b, shapeQueryContext *context)
 {
 	// Reject any of the simple cases
 	if(
-		(a->group && a->group == b->group) ||
-		!(a->layers & b->layers) ||
+		queryRejectShape(b, a->layers, a->group, context->filtered) ||
 		a == b
 	) return;
 	
@@ -208,9 +234,9 @@ shapeQueryHelper(cpShape *a, cpShape *b, shapeQueryContext *context)
 	
 	// Shape 'a' should have the lower shape type. (required by cpCollideShapes() )
 	if(a->klass->type <= b->klass->type){
-		numContacts = cpCollideShapes(a, b, contacts);
+		numContacts = cpCollideShapes(a, b, 0.0f, contacts);
 	} else {
-		numContacts = cpCollideShapes(b, a, contacts);
+		numContacts = cpCollideShapes(b, a, 0.0f, contacts);
 		for(int i=0; i<numContacts; i++) contacts[i].n = cpvneg(contacts[i].n);
 	}
 	
@@ -235,11 +261,17 @@ cpSpaceShapeQuery(cpSpace *space, cpShape *shape, cpSpaceShapeQueryFunc func, vo
 {
 	cpBody *body = shape->body;
 	cpBB bb = (body ? cpShapeUpdate(shape, body->p, body->rot) : shape->bb);
-	shapeQueryContext context = {func, data, cpFalse};
+	shapeQueryContext context = {func, data, cpSpaceIndexesFilterShapes(space), cpFalse};
+	
+	cpLayers layers = shape->layers;
+	cpGroup group = shape->group;
+	
+	// Only let the indexes skip shapes when their filters are up to date.
+	if(!context.filtered){layers = CP_ALL_LAYERS; group = CP_NO_GROUP;}
 	
 	cpSpaceLock(space); {
-    cpSpatialIndexQuery(space->activeShapes, shape, bb, (cpSpatialIndexQueryFunc)shapeQueryHelper, &context);
-    cpSpatialIndexQuery(space->staticShapes, shape, bb, (cpSpatialIndexQueryFunc)shapeQueryHelper, &context);
+    cpBBTreeQueryFiltered(space->activeShapes, shape, bb, layers, group, (cpSpatialIndexQueryFunc)shapeQueryHelper, &context);
+    cpBBTreeQueryFiltered(space->staticShapes, shape, bb, layers, group, (cpSpatialIndexQueryFunc)shapeQueryHelper, &context);
 	} cpSpaceUnlock(space, cpTrue);
 	
 	return context.anyCollision;
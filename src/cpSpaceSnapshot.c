@@ -0,0 +1,439 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chipmunk_private.h"
+
+// A snapshot is a raw copy of the objects in use and of the containers that link them together.
+// Saving and restoring walk the space in exactly the same order using the same functions,
+// the restored containers are used to find the objects to restore next.
+
+#define CP_SNAPSHOT_MAGIC 0x63705353
+
+typedef struct cpSnapshotHeader {
+	unsigned int magic;
+	size_t size;
+	cpSpace *space;
+} cpSnapshotHeader;
+
+#pragma mark Sleeping Contacts
+
+// The contacts of sleeping arbiters live in their own blocks of memory that are freed when they wake up.
+// Restoring reuses the blocks that still exist and allocates new ones for the rest.
+typedef struct SleepingContacts {
+	cpContact *contacts;
+	int count;
+} SleepingContacts;
+
+typedef struct SleepingContactsList {
+	SleepingContacts *arr;
+	int num;
+} SleepingContactsList;
+
+// Same test as cpSpaceDeactivateBody() uses to decide which body stores the arbiter or constraint.
+static inline cpBool
+OwnsArbiter(cpBody *body, cpArbiter *arb)
+{
+	return (body == arb->body_a || cpBodyIsStatic(arb->body_a));
+}
+
+static inline cpBool
+OwnsConstraint(cpBody *body, cpConstraint *constraint)
+{
+	return (body == constraint->a || cpBodyIsStatic(constraint->a));
+}
+
+static int
+compareSleepingContacts(const void *a, const void *b)
+{
+	size_t pa = (size_t)((SleepingContacts *)a)->contacts, pb = (size_t)((SleepingContacts *)b)->contacts;
+	return (pa > pb) - (pa < pb);
+}
+
+static SleepingContactsList
+GatherSleepingContacts(cpSpace *space)
+{
+	SleepingContactsList list = {NULL, 0};
+	
+	cpArray *components = space->sleepingComponents;
+	for(int pass=0; pass<2; pass++){
+		for(int i=0; i<components->num; i++){
+			CP_BODY_FOREACH_COMPONENT((cpBody *)components->arr[i], body){
+				CP_BODY_FOREACH_ARBITER(body, arb){
+					if(!OwnsArbiter(body, arb)) continue;
+					
+					if(list.arr){
+						SleepingContacts block = {arb->contacts, arb->numContacts};
+						list.arr[list.num] = block;
+					}
+					
+					list.num++;
+				}
+			}
+		}
+		
+		// The first pass only counts the blocks.
+		if(pass == 0){
+			if(list.num == 0) break;
+			list.arr = (SleepingContacts *)cpAllocatorCalloc(space->allocator, list.num, sizeof(SleepingContacts));
+			list.num = 0;
+		}
+	}
+	
+	if(list.arr) qsort(list.arr, list.num, sizeof(SleepingContacts), compareSleepingContacts);
+	return list;
+}
+
+static cpContact *
+ReuseSleepingContacts(cpSpace *space, SleepingContactsList *list, cpContact *contacts, int count)
+{
+	SleepingContacts key = {contacts, 0};
+	SleepingContacts *block = (SleepingContacts *)(list->arr ? bsearch(&key, list->arr, list->num, sizeof(SleepingContacts), compareSleepingContacts) : NULL);
+	
+	if(block && block->contacts && block->count == count){
+		block->contacts = NULL;
+		return contacts;
+	} else {
+		// The block was freed or reused for something else since the snapshot was taken.
+		return (cpContact *)cpAllocatorCalloc(space->allocator, 1, count*sizeof(cpContact));
+	}
+}
+
+static void
+FreeSleepingContacts(cpSpace *space, SleepingContactsList *list)
+{
+	for(int i=0; i<list->num; i++) cpAllocatorFree(space->allocator, list->arr[i].contacts);
+	cpAllocatorFree(space->allocator, list->arr);
+}
+
+#pragma mark Free Lists
+
+static inline char **
+FreeListLink(char *block, size_t linkOffset)
+{
+	return (char **)(block + linkOffset);
+}
+
+// Pools push the blocks of a new buffer so they link to each other in descending order.
+// Each run of blocks linked like that is saved as its first block and its length.
+void
+cpSnapshotFreeList(cpSnapshotCursor *cursor, void *head, size_t blockSize, size_t linkOffset)
+{
+	if(cursor->restore){
+		char **link = NULL;
+		
+		for(;;){
+			char *block = NULL;
+			cpSnapshotTransfer(cursor, &block, sizeof(char *));
+			if(!block) break;
+			
+			int count = 0;
+			cpSnapshotTransfer(cursor, &count, sizeof(int));
+			cpAssertSoft(link || block == head, "Internal Error: The free list does not match its head.");
+			
+			if(link) (*link) = block;
+			for(int i=1; i<count; i++, block -= blockSize) (*FreeListLink(block, linkOffset)) = block - blockSize;
+			link = FreeListLink(block, linkOffset);
+		}
+		
+		if(link) (*link) = NULL;
+	} else {
+		for(char *block = (char *)head; block;){
+			char *last = block;
+			int count = 1;
+			while(*FreeListLink(last, linkOffset) == last - blockSize) last -= blockSize, count++;
+			
+			cpSnapshotTransfer(cursor, &block, sizeof(char *));
+			cpSnapshotTransfer(cursor, &count, sizeof(int));
+			block = *FreeListLink(last, linkOffset);
+		}
+		
+		char *end = NULL;
+		cpSnapshotTransfer(cursor, &end, sizeof(char *));
+	}
+}
+
+#pragma mark Snapshot Functions
+
+static void
+SnapshotBody(cpBody *body, cpSnapshotCursor *cursor)
+{
+	cpSnapshotTransfer(cursor, body, sizeof(cpBody));
+}
+
+static void
+SnapshotConstraint(cpConstraint *constraint, cpSnapshotCursor *cursor)
+{
+	cpSnapshotTransfer(cursor, constraint, constraint->klass->size);
+}
+
+static void
+SnapshotArbiter(cpArbiter *arb, cpSnapshotCursor *cursor)
+{
+	cpSnapshotTransfer(cursor, arb, sizeof(cpArbiter));
+}
+
+// Only the contacts referenced by an arbiter are saved, the rest of the contact buffers is left as it is.
+static void
+SnapshotCachedArbiter(cpArbiter *arb, cpSnapshotCursor *cursor)
+{
+	SnapshotArbiter(arb, cursor);
+	if(arb->numContacts) cpSnapshotTransfer(cursor, arb->contacts, arb->numContacts*sizeof(cpContact));
+}
+
+static void
+SnapshotIndex(cpSpatialIndex *index, cpSnapshotCursor *cursor)
+{
+	// Catch spaces that switched to a different kind of spatial index.
+	cpSnapshotCheckPointer(cursor, index);
+	cpSnapshotCheckPointer(cursor, index->klass);
+	
+	cpSpatialIndexSnapshot(index, cursor);
+}
+
+// Sleeping constraints and arbiters are only linked to their bodies. Following those links while restoring would
+// step through objects that aren't restored yet, so they are saved along with a pointer to them instead.
+static void
+SaveSleepingObjects(cpBody *root, cpSnapshotCursor *cursor)
+{
+	CP_BODY_FOREACH_COMPONENT(root, body){
+		CP_BODY_FOREACH_CONSTRAINT(body, constraint){
+			if(!OwnsConstraint(body, constraint)) continue;
+			
+			cpSnapshotTransfer(cursor, &constraint, sizeof(cpConstraint *));
+			SnapshotConstraint(constraint, cursor);
+		}
+	}
+	
+	cpConstraint *endConstraint = NULL;
+	cpSnapshotTransfer(cursor, &endConstraint, sizeof(cpConstraint *));
+	
+	CP_BODY_FOREACH_COMPONENT(root, body){
+		CP_BODY_FOREACH_ARBITER(body, arb){
+			if(!OwnsArbiter(body, arb)) continue;
+			
+			cpSnapshotTransfer(cursor, &arb, sizeof(cpArbiter *));
+			SnapshotArbiter(arb, cursor);
+			cpSnapshotTransfer(cursor, arb->contacts, arb->numContacts*sizeof(cpContact));
+		}
+	}
+	
+	cpArbiter *endArbiter = NULL;
+	cpSnapshotTransfer(cursor, &endArbiter, sizeof(cpArbiter *));
+}
+
+static void
+RestoreSleepingObjects(cpSpace *space, cpSnapshotCursor *cursor, SleepingContactsList *list)
+{
+	for(;;){
+		cpConstraint *constraint = NULL;
+		cpSnapshotTransfer(cursor, &constraint, sizeof(cpConstraint *));
+		if(!constraint) break;
+		
+		SnapshotConstraint(constraint, cursor);
+	}
+	
+	for(;;){
+		cpArbiter *arb = NULL;
+		cpSnapshotTransfer(cursor, &arb, sizeof(cpArbiter *));
+		if(!arb) break;
+		
+		SnapshotArbiter(arb, cursor);
+		arb->contacts = ReuseSleepingContacts(space, list, arb->contacts, arb->numContacts);
+		cpSnapshotTransfer(cursor, arb->contacts, arb->numContacts*sizeof(cpContact));
+	}
+}
+
+static void
+SnapshotSleepingComponent(cpSpace *space, cpBody *root, cpSnapshotCursor *cursor, SleepingContactsList *list)
+{
+	// The bodies are restored before their next pointers are followed.
+	CP_BODY_FOREACH_COMPONENT(root, body) SnapshotBody(body, cursor);
+	
+	if(cursor->restore){
+		RestoreSleepingObjects(space, cursor, list);
+	} else {
+		SaveSleepingObjects(root, cursor);
+	}
+}
+
+static void
+cpSpaceSnapshotState(cpSpace *space, cpSnapshotCursor *cursor, SleepingContactsList *list)
+{
+	cpSnapshotTransfer(cursor, &space->stamp, sizeof(cpTimestamp));
+	cpSnapshotTransfer(cursor, &space->curr_dt, sizeof(cpFloat));
+	cpSnapshotTransfer(cursor, &space->iterationsUsed, sizeof(int));
+	// The saved leaves may hold filters that predate a shape's group or layers change.
+	cpSnapshotTransfer(cursor, &space->staleFilters, sizeof(cpBool));
+	
+	// The containers go first so the objects can be found through them.
+	cpArraySnapshot(space->bodies, cursor);
+	cpArraySnapshot(space->sleepingComponents, cursor);
+	cpArraySnapshot(space->constraints, cursor);
+	cpArraySnapshot(space->classConstraints, cursor);
+	cpArraySnapshot(space->arbiters, cursor);
+	
+	cpHashSetSnapshot(space->cachedArbiters, cursor);
+	cpSpacePoolSnapshot(space->arbiterPool, cursor);
+	cpSpaceSnapshotContactBuffers(space, cursor);
+	
+	SnapshotIndex(space->staticShapes, cursor);
+	SnapshotIndex(space->activeShapes, cursor);
+	
+	cpArray *bodies = space->bodies;
+	for(int i=0; i<bodies->num; i++) SnapshotBody((cpBody *)bodies->arr[i], cursor);
+	
+	cpArray *constraints = space->constraints;
+	for(int i=0; i<constraints->num; i++) SnapshotConstraint((cpConstraint *)constraints->arr[i], cursor);
+	
+	cpHashSetEach(space->cachedArbiters, (cpHashSetIteratorFunc)SnapshotCachedArbiter, cursor);
+	
+	cpSpatialIndexEach(space->staticShapes, (cpSpatialIndexIteratorFunc)cpShapeSnapshot, cursor);
+	cpSpatialIndexEach(space->activeShapes, (cpSpatialIndexIteratorFunc)cpShapeSnapshot, cursor);
+	
+	cpArray *components = space->sleepingComponents;
+	for(int i=0; i<components->num; i++) SnapshotSleepingComponent(space, (cpBody *)components->arr[i], cursor, list);
+}
+
+#pragma mark Rogue Bodies
+
+// Static and rogue bodies aren't tracked by the space, so they are saved along with a pointer to them.
+// They are found through the first of their shapes, or through their constraints if they have no shapes.
+
+static void
+SaveRogueBody(cpBody *body, cpSnapshotCursor *cursor)
+{
+	cpSnapshotTransfer(cursor, &body, sizeof(cpBody *));
+	SnapshotBody(body, cursor);
+}
+
+static void
+SaveShapeBody(cpShape *shape, cpSnapshotCursor *cursor)
+{
+	cpBody *body = shape->body;
+	if(shape->prev == NULL && (cpBodyIsRogue(body) || cpBodyIsStatic(body))) SaveRogueBody(body, cursor);
+}
+
+static void
+SaveConstraintBodies(cpConstraint *constraint, cpSnapshotCursor *cursor)
+{
+	cpBody *a = constraint->a, *b = constraint->b;
+	if(a->shapeList == NULL && (cpBodyIsRogue(a) || cpBodyIsStatic(a))) SaveRogueBody(a, cursor);
+	if(b->shapeList == NULL && (cpBodyIsRogue(b) || cpBodyIsStatic(b))) SaveRogueBody(b, cursor);
+}
+
+static void
+SaveRogueBodies(cpSpace *space, cpSnapshotCursor *cursor)
+{
+	cpSpatialIndexEach(space->staticShapes, (cpSpatialIndexIteratorFunc)SaveShapeBody, cursor);
+	cpSpatialIndexEach(space->activeShapes, (cpSpatialIndexIteratorFunc)SaveShapeBody, cursor);
+	
+	cpArray *constraints = space->constraints;
+	for(int i=0; i<constraints->num; i++) SaveConstraintBodies((cpConstraint *)constraints->arr[i], cursor);
+	
+	cpArray *components = space->sleepingComponents;
+	for(int i=0; i<components->num; i++){
+		CP_BODY_FOREACH_COMPONENT((cpBody *)components->arr[i], body){
+			CP_BODY_FOREACH_CONSTRAINT(body, constraint){
+				if(OwnsConstraint(body, constraint)) SaveConstraintBodies(constraint, cursor);
+			}
+		}
+	}
+	
+	cpBody *end = NULL;
+	cpSnapshotTransfer(cursor, &end, sizeof(cpBody *));
+}
+
+static void
+RestoreRogueBodies(cpSnapshotCursor *cursor)
+{
+	for(;;){
+		cpBody *body = NULL;
+		cpSnapshotTransfer(cursor, &body, sizeof(cpBody *));
+		if(!body) break;
+		
+		SnapshotBody(body, cursor);
+	}
+}
+
+#pragma mark Public Functions
+
+size_t
+cpSpaceSnapshot(cpSpace *space, void *buffer, size_t capacity)
+{
+	cpAssertHard(!space->locked,
+		"You cannot take a snapshot of a space while it is locked. "
+		"Put these calls into a post-step callback.");
+	
+	// Restoring writes to the static bodies, so a clone can't share them.
+	if(space->sharedStaticBody) cpSpaceUnshareStatic(space);
+	
+	cpSnapshotCursor cursor = {(char *)buffer, 0, capacity, cpFalse};
+	
+	cpSnapshotHeader header = {CP_SNAPSHOT_MAGIC, 0, space};
+	cpSnapshotTransfer(&cursor, &header, sizeof(cpSnapshotHeader));
+	
+	cpSpaceSnapshotState(space, &cursor, NULL);
+	SaveRogueBodies(space, &cursor);
+	
+	// The size is only filled in once the whole snapshot fits.
+	if(cursor.offset <= capacity){
+		header.size = cursor.offset;
+		memcpy(buffer, &header, sizeof(cpSnapshotHeader));
+	}
+	
+	return cursor.offset;
+}
+
+void
+cpSpaceRestore(cpSpace *space, const void *buffer, size_t size)
+{
+	cpAssertHard(!space->locked,
+		"You cannot restore a snapshot of a space while it is locked. "
+		"Put these calls into a post-step callback.");
+	
+	if(space->sharedStaticBody) cpSpaceUnshareStatic(space);
+	
+	cpSnapshotHeader header;
+	cpAssertHard(size >= sizeof(cpSnapshotHeader), "The buffer does not hold a complete snapshot.");
+	memcpy(&header, buffer, sizeof(cpSnapshotHeader));
+	
+	cpAssertHard(header.magic == CP_SNAPSHOT_MAGIC && header.size && header.size <= size, "The buffer does not hold a complete snapshot.");
+	cpAssertHard(header.space == space, "The snapshot was taken from a different space.");
+	
+	cpSnapshotCursor cursor = {(char *)buffer, sizeof(cpSnapshotHeader), header.size, cpTrue};
+	
+	SleepingContactsList list = GatherSleepingContacts(space);
+	cpSpaceSnapshotState(space, &cursor, &list);
+	RestoreRogueBodies(&cursor);
+	
+	// Blocks of arbiters that fell asleep after the snapshot was taken.
+	FreeSleepingContacts(space, &list);
+	
+	cpAssertSoft(cursor.offset == header.size, "Internal Error: The snapshot was not read completely.");
+	
+	// These belong to the step that was rewound.
+	space->brokenConstraints->num = 0;
+	space->collisionEventCount = 0;
+	space->collisionEventStepCount = 0;
+}
@@ -21,6 +21,7 @@
  
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include "chipmunk_private.h"
@@ -39,11 +40,14 @@ postStepFuncSetEql(cpPostStepCallback *a, cpPostStepCallback *b){
 }
 
 static void *
-postStepFuncSetTrans(cpPostStepCallback *callback, void *ignored)
+postStepFuncSetTrans(cpPostStepCallback *callback, cpSpace *space)
 {
-	cpPostStepCallback *value = (cpPostStepCallback *)cpcalloc(1, sizeof(cpPostStepCallback));
+	cpPostStepCallback *value = (cpPostStepCallback *)cpSpacePoolAlloc(space->postStepPool);
 	(*value) = (*callback);
 	
+	// Queue it so the callbacks run in the order they were added.
+	cpArrayPush(space->postStepQueue, value);
+	
 	return value;
 }
 
@@ -55,11 +59,12 @@ cpSpaceAddPostStepCallback(cpSpace *space, cpPostStepFunc func, void *obj, void
 		"Post-step callbacks will not called until the end of the next call to cpSpaceStep() or the next query.");
 	
 	if(!space->postStepCallbacks){
-		space->postStepCallbacks = cpHashSetNew(0, (cpHashSetEqlFunc)postStepFuncSetEql);
+		space->postStepCallbacks = cpHashSetNewWithAllocator(0, (cpHashSetEqlFunc)postStepFuncSetEql, space->allocator);
+		space->postStepPool = cpSpacePoolNew(sizeof(cpPostStepCallback), space->allocator);
 	}
 	
 	cpPostStepCallback callback = {func, obj, data};
-	cpHashSetInsert(space->postStepCallbacks, (cpHashValue)(size_t)obj, &callback, NULL, (cpHashSetTransFunc)postStepFuncSetTrans);
+	cpHashSetInsert(space->postStepCallbacks, (cpHashValue)(size_t)obj, &callback, space, (cpHashSetTransFunc)postStepFuncSetTrans);
 }
 
 void *
@@ -74,24 +79,39 @@ cpSpaceGetPostStepData(cpSpace *space, void *obj)
 	}
 }
 
-static void
-cpSpacePostStepCallbackSetIter(cpPostStepCallback *callback, cpSpace *space)
-{
-	callback->func(space, callback->obj, callback->data);
-	cpfree(callback);
-}
-
 static void
 cpSpaceRunPostStepCallbacks(cpSpace *space)
 {
+	// Callbacks that unlock the space again (queries for instance) leave the new callbacks to the outer loop.
+	if(space->runningPostStepCallbacks) return;
+	space->runningPostStepCallbacks = cpTrue;
+	
+	cpHashSet *callbacks = space->postStepCallbacks;
+	cpArray *queue = space->postStepQueue;
+	
 	// Loop because post step callbacks may add more post step callbacks directly or indirectly.
-	while(space->postStepCallbacks){
-		cpHashSet *callbacks = space->postStepCallbacks;
-		space->postStepCallbacks = NULL;
+	// Each batch is removed from the set before it runs so its objects can be given new callbacks.
+	for(int start=0; start<queue->num;){
+		int end = queue->num;
+		
+		for(int i=start; i<end; i++){
+			cpPostStepCallback *callback = (cpPostStepCallback *)queue->arr[i];
+			cpHashSetRemove(callbacks, (cpHashValue)(size_t)callback->obj, callback);
+		}
+		
+		for(int i=start; i<end; i++){
+			cpPostStepCallback *callback = (cpPostStepCallback *)queue->arr[i];
+			callback->func(space, callback->obj, callback->data);
+		}
 		
-		cpHashSetEach(callbacks, (cpHashSetIteratorFunc)cpSpacePostStepCallbackSetIter, space);
-		cpHashSetFree(callbacks);
+		start = end;
 	}
+	
+	// Return the callbacks to the pool.
+	for(int i=0; i<queue->num; i++) cpSpacePoolRecycle(space->postStepPool, queue->arr[i]);
+	queue->num = 0;
+	
+	space->runningPostStepCallbacks = cpFalse;
 }
 
 #pragma mark Locking Functions
@@ -134,10 +154,17 @@ typedef struct cpContactBuffer {
 	cpContact contacts[CP_CONTACTS_BUFFER_SIZE];
 } cpContactBuffer;
 
+// Buffers that are older than the persistence are not referenced by any arbiter.
+static inline cpBool
+cpContactBufferIsStale(cpSpace *space, cpContactBufferHeader *header)
+{
+	return (space->stamp - header->stamp > space->collisionPersistence);
+}
+
 static cpContactBufferHeader *
 cpSpaceAllocContactBuffer(cpSpace *space)
 {
-	cpContactBuffer *buffer = (cpContactBuffer *)cpcalloc(1, sizeof(cpContactBuffer));
+	cpContactBuffer *buffer = (cpContactBuffer *)cpAllocatorCalloc(space->allocator, 1, sizeof(cpContactBuffer));
 	cpArrayPush(space->allocatedBuffers, buffer);
 	return (cpContactBufferHeader *)buffer;
 }
@@ -162,7 +189,7 @@ cpSpacePushFreshContactBuffer(cpSpace *space)
 	if(!head){
 		// No buffers have been allocated, make one
 		space->contactBuffersHead = cpContactBufferHeaderInit(cpSpaceAllocContactBuffer(space), stamp, NULL);
-	} else if(stamp - head->next->stamp > space->collisionPersistence){
+	} else if(cpContactBufferIsStale(space, head->next)){
 		// The tail buffer is available, rotate the ring
 	cpContactBufferHeader *tail = head->next;
 		space->contactBuffersHead = cpContactBufferHeaderInit(tail, stamp, tail);
@@ -173,6 +200,102 @@ cpSpacePushFreshContactBuffer(cpSpace *space)
 	}
 }
 
+size_t
+cpSpaceTrimContactBuffers(cpSpace *space)
+{
+	cpContactBufferHeader *head = space->contactBuffersHead;
+	size_t freed = 0;
+	
+	// The oldest buffers follow the head, the head itself is always kept.
+	while(head && head->next != head && cpContactBufferIsStale(space, head->next)){
+		cpContactBufferHeader *tail = head->next;
+		head->next = tail->next;
+		
+		cpArrayDeleteObj(space->allocatedBuffers, tail);
+		cpAllocatorFree(space->allocator, tail);
+		freed += sizeof(cpContactBuffer);
+	}
+	
+	return freed;
+}
+
+void
+cpSpaceGetContactBufferStats(cpSpace *space, cpPoolStats *stats)
+{
+	stats->bytes += space->allocatedBuffers->num*sizeof(cpContactBuffer);
+	
+	cpContactBufferHeader *head = space->contactBuffersHead;
+	if(head){
+		for(cpContactBufferHeader *tail = head->next; tail != head && cpContactBufferIsStale(space, tail); tail = tail->next){
+			stats->unusedBytes += sizeof(cpContactBuffer);
+		}
+	}
+}
+
+void
+cpSpaceGetContactBufferMemoryStats(cpSpace *space, cpMemoryStats *stats)
+{
+	stats->bytes += space->allocatedBuffers->num*sizeof(cpContactBuffer) + cpArrayGetBytes(space->allocatedBuffers);
+	
+	cpContactBufferHeader *head = space->contactBuffersHead;
+	if(head){
+		cpContactBufferHeader *buffer = head;
+		do {
+			buffer = buffer->next;
+			
+			if(buffer != head && cpContactBufferIsStale(space, buffer)){
+				stats->pooled += CP_CONTACTS_BUFFER_SIZE;
+			} else {
+				stats->count += buffer->numContacts;
+			}
+		} while(buffer != head);
+	}
+}
+
+void
+cpSpaceSnapshotContactBuffers(cpSpace *space, cpSnapshotCursor *cursor)
+{
+	cpArray *buffers = space->allocatedBuffers;
+	cpArraySnapshotBuffers(buffers, cursor);
+	cpSnapshotTransfer(cursor, &space->contactBuffersHead, sizeof(cpContactBufferHeader *));
+	
+	// The contacts are saved along with the arbiters that reference them.
+	for(int i=0; i<buffers->num; i++){
+		cpContactBuffer *buffer = (cpContactBuffer *)buffers->arr[i];
+		cpSnapshotTransfer(cursor, &buffer->header, sizeof(cpContactBufferHeader));
+	}
+}
+
+void
+cpSpaceCloneContactBuffers(cpSpace *space, cpSpace *clone, cpRelocation *rel)
+{
+	cpContactBufferHeader *head = space->contactBuffersHead;
+	if(!head) return;
+	
+	// Stale buffers aren't referenced by any arbiter, so the clone starts out with a trimmed ring.
+	cpContactBufferHeader *header = head->next;
+	while(header != head && cpContactBufferIsStale(space, header)) header = header->next;
+	
+	cpContactBufferHeader *first = NULL, *last = NULL;
+	for(;;){
+		cpContactBuffer *buffer = (cpContactBuffer *)header;
+		cpContactBuffer *copy = (cpContactBuffer *)cpAllocatorCalloc(clone->allocator, 1, sizeof(cpContactBuffer));
+		copy->header = buffer->header;
+		memcpy(copy->contacts, buffer->contacts, buffer->header.numContacts*sizeof(cpContact));
+		
+		cpArrayPush(clone->allocatedBuffers, copy);
+		cpRelocationAdd(rel, buffer, copy, sizeof(cpContactBuffer));
+		
+		if(last) last->next = &copy->header; else first = &copy->header;
+		last = &copy->header;
+		
+		if(header == head) break;
+		header = header->next;
+	}
+	
+	last->next = first;
+	clone->contactBuffersHead = last;
+}
 
 cpContact *
 cpContactBufferGetArray(cpSpace *space)
@@ -198,37 +321,57 @@ cpSpacePopContacts(cpSpace *space, int count){
 	space->contactBuffersHead->numContacts -= count;
 }
 
+#pragma mark Collision Event Functions
+
+void
+cpSpacePushCollisionEvent(cpSpace *space, cpCollisionEventType type, cpArbiter *arb, cpVect impulse)
+{
+	if(space->collisionEventCount == space->collisionEventCapacity){
+		space->collisionEventCapacity = (space->collisionEventCapacity ? 2*space->collisionEventCapacity : 64);
+		space->collisionEvents = (cpCollisionEvent *)cpAllocatorRealloc(space->allocator, space->collisionEvents, space->collisionEventCapacity*sizeof(cpCollisionEvent));
+	}
+	
+	cpCollisionEvent *event = space->collisionEvents + space->collisionEventCount++;
+	event->type = type;
+	cpArbiterGetShapes(arb, &event->a, &event->b);
+	
+	// The contacts of a separating arbiter are not valid anymore.
+	if(type == cpCollisionEventSeparate){
+		event->n = cpvzero;
+		event->point = cpvzero;
+	} else {
+		event->n = cpArbiterGetNormal(arb, 0);
+		event->point = cpArbiterGetPoint(arb, 0);
+	}
+	
+	event->impulse = impulse;
+}
+
 #pragma mark Collision Detection Functions
 
 static void *
 cpSpaceArbiterSetTrans(cpShape **shapes, cpSpace *space)
 {
-	if(space->pooledArbiters->num == 0){
-		// arbiter pool is exhausted, make more
-		int count = CP_BUFFER_BYTES/sizeof(cpArbiter);
-		cpAssertSoft(count, "Buffer size too small.");
-		
-		cpArbiter *buffer = (cpArbiter *)cpcalloc(1, CP_BUFFER_BYTES);
-		cpArrayPush(space->allocatedBuffers, buffer);
-		
-		for(int i=0; i<count; i++) cpArrayPush(space->pooledArbiters, buffer + i);
-	}
-	
-	return cpArbiterInit((cpArbiter *)cpArrayPop(space->pooledArbiters), shapes[0], shapes[1]);
+	return cpArbiterInit((cpArbiter *)cpSpacePoolAlloc(space->arbiterPool), shapes[0], shapes[1]);
 }
 
 static inline cpBool
-queryReject(cpShape *a, cpShape *b)
+queryReject(cpShape *a, cpShape *b, cpFloat margin, cpBool filtered)
 {
+	cpBB bb = b->bb;
+	
 	return (
-		// BBoxes must overlap
-		!cpBBIntersects(a->bb, b->bb)
-		// Don't collide shapes attached to the same body.
-		|| a->body == b->body
-		// Don't collide objects in the same non-zero group
-		|| (a->group && a->group == b->group)
-		// Don't collide objects that don't share at least on layer.
-		|| !(a->layers & b->layers)
+		// BBoxes must overlap (or be within the speculative margin)
+		!cpBBIntersects(a->bb, cpBBNew(bb.l - margin, bb.b - margin, bb.r + margin, bb.t + margin))
+		// The filters stored with the leaves of a cpBBTree have already rejected the rest.
+		|| (!filtered && (
+			// Don't collide shapes attached to the same body.
+			a->body == b->body
+			// Don't collide objects in the same non-zero group
+			|| (a->group && a->group == b->group)
+			// Don't collide objects that don't share at least on layer.
+			|| !(a->layers & b->layers)
+		))
 	);
 }
 
@@ -236,8 +379,14 @@ queryReject(cpShape *a, cpShape *b)
 static void
 collideShapes(cpShape *a, cpShape *b, cpSpace *space)
 {
+	// Shapes within the distance they could close during the step get speculative contacts.
+	cpFloat margin = 0.0f;
+	if(space->enableSpeculativeContacts && !a->sensor && !b->sensor){
+		margin = cpvlength(cpvsub(a->body->v, b->body->v))*space->curr_dt;
+	}
+	
 	// Reject any of the simple cases
-	if(queryReject(a,b)) return;
+	if(queryReject(a, b, margin, cpSpaceIndexesFilterShapes(space))) return;
 	
 	cpCollisionHandler *handler = cpSpaceLookupHandler(space, a->collision_type, b->collision_type);
 	
@@ -251,22 +400,46 @@ collideShapes(cpShape *a, cpShape *b, cpSpace *space)
 		b = temp;
 	}
 	
-	// Narrow-phase collision detection.
+	// Arbiters are hashed by the ids of their shapes, which copies of the shapes in a cloned space keep.
+	cpShape *shape_pair[] = {a, b};
+	cpHashValue arbHashID = CP_HASH_PAIR(a->hashid, b->hashid);
 	cpContact *contacts = cpContactBufferGetArray(space);
-	int numContacts = cpCollideShapes(a, b, contacts);
+	int numContacts = 0;
+	
+	// Reuse the contacts from the last step if the shapes have barely moved relative to each other.
+	// The contact buffers from the last step are only guaranteed to be intact if contacts persist.
+	cpFloat tolerance = space->contactReuseTolerance;
+	if(tolerance > 0.0f && space->collisionPersistence > 0){
+		cpArbiter *cached = (cpArbiter *)cpHashSetFind(space->cachedArbiters, arbHashID, shape_pair);
+		
+		if(cached && cached->numContacts && cached->stamp + 1 == space->stamp){
+			numContacts = cpArbiterReuseContacts(cached, tolerance, space->stamp, contacts);
+			
+			// The reused contacts are relative to the arbiter's order of the shapes.
+			if(numContacts) a = cached->a, b = cached->b;
+		}
+	}
+	
+	cpBool reused = (numContacts > 0);
+	
+	// Narrow-phase collision detection.
+	if(!reused) numContacts = cpCollideShapes(a, b, margin, contacts);
 	if(!numContacts) return; // Shapes are not colliding.
 	cpSpacePushContacts(space, numContacts);
 	
 	// Get an arbiter from space->arbiterSet for the two shapes.
 	// This is where the persistant contact magic comes from.
-	cpShape *shape_pair[] = {a, b};
-	cpHashValue arbHashID = CP_HASH_PAIR((size_t)a, (size_t)b);
 	cpArbiter *arb = (cpArbiter *)cpHashSetInsert(space->cachedArbiters, arbHashID, shape_pair, space, (cpHashSetTransFunc)cpSpaceArbiterSetTrans);
 	cpArbiterUpdate(arb, contacts, numContacts, handler, a, b);
+	if(!reused) cpArbiterSetReferenceTransform(arb, space->stamp);
 	
 	// Call the begin function first if it's the first step
-	if(arb->state == cpArbiterStateFirstColl && !handler->begin(arb, space, handler->data)){
-		cpArbiterIgnore(arb); // permanently ignore the collision until separation
+	if(arb->state == cpArbiterStateFirstColl){
+		if(space->enableCollisionEvents) cpSpacePushCollisionEvent(space, cpCollisionEventBegin, arb, cpvzero);
+		
+		if(!handler->begin(arb, space, handler->data)){
+			cpArbiterIgnore(arb); // permanently ignore the collision until separation
+		}
 	}
 	
 	if(
@@ -312,6 +485,7 @@ cpSpaceArbiterSetFilter(cpArbiter *arb, cpSpace *space)
 	
 	// Arbiter was used last frame, but not this one
 	if(ticks >= 1 && arb->state != cpArbiterStateCached){
+		if(space->enableCollisionEvents) cpSpacePushCollisionEvent(space, cpCollisionEventSeparate, arb, cpvzero);
 		cpArbiterCallSeparate(arb, space);
 		arb->state = cpArbiterStateCached;
 	}
@@ -320,7 +494,7 @@ cpSpaceArbiterSetFilter(cpArbiter *arb, cpSpace *space)
 		arb->contacts = NULL;
 		arb->numContacts = 0;
 		
-		cpArrayPush(space->pooledArbiters, arb);
+		cpSpacePoolRecycle(space->arbiterPool, arb);
 		return cpFalse;
 	}
 	
@@ -329,11 +503,110 @@ cpSpaceArbiterSetFilter(cpArbiter *arb, cpSpace *space)
 
 #pragma mark All Important cpSpaceStep() Function
 
+// Active shapes sorted by type so each type can be updated by it's batch function.
+typedef struct cpShapeBatches {
+	cpCircleShape *circles[CP_SHAPE_BATCH_SIZE];
+	cpSegmentShape *segs[CP_SHAPE_BATCH_SIZE];
+	cpPolyShape *polys[CP_SHAPE_BATCH_SIZE];
+	int numCircles, numSegs, numPolys;
+} cpShapeBatches;
+
+static void
+cpShapeBatchesFlush(cpShapeBatches *batches)
+{
+	cpCircleShapeUpdateBatch(batches->circles, batches->numCircles);
+	cpSegmentShapeUpdateBatch(batches->segs, batches->numSegs);
+	cpPolyShapeUpdateBatch(batches->polys, batches->numPolys);
+	
+	batches->numCircles = batches->numSegs = batches->numPolys = 0;
+}
+
 static void
-cpShapeUpdateFunc(cpShape *shape, void *unused)
+cpShapeUpdateFunc(cpShape *shape, cpShapeBatches *batches)
+{
+	switch(shape->klass->type){
+		case CP_CIRCLE_SHAPE:
+			batches->circles[batches->numCircles++] = (cpCircleShape *)shape;
+			if(batches->numCircles == CP_SHAPE_BATCH_SIZE) cpShapeBatchesFlush(batches);
+			break;
+		case CP_SEGMENT_SHAPE:
+			batches->segs[batches->numSegs++] = (cpSegmentShape *)shape;
+			if(batches->numSegs == CP_SHAPE_BATCH_SIZE) cpShapeBatchesFlush(batches);
+			break;
+		case CP_POLY_SHAPE:
+			batches->polys[batches->numPolys++] = (cpPolyShape *)shape;
+			if(batches->numPolys == CP_SHAPE_BATCH_SIZE) cpShapeBatchesFlush(batches);
+			break;
+		default: {
+			cpBody *body = shape->body;
+			cpShapeUpdate(shape, body->p, body->rot);
+		}
+	}
+}
+
+// Bounding box of a shape swept along it's body's velocity for the current step.
+// Used to find speculative pairs, the padding the spatial index adds on it's own isn't enough.
+static cpBB
+cpShapeSweptBB(cpShape *shape)
+{
+	cpBB bb = shape->bb;
+	cpVect delta = cpvmult(shape->body->v, shape->space->curr_dt);
+	
+	return cpBBNew(
+		bb.l + cpfmin(delta.x, 0.0f), bb.b + cpfmin(delta.y, 0.0f),
+		bb.r + cpfmax(delta.x, 0.0f), bb.t + cpfmax(delta.y, 0.0f)
+	);
+}
+
+// End of the run of constraints sharing the class of the one at index i.
+static inline int
+cpSpaceConstraintRunEnd(cpArray *constraints, int i)
 {
-	cpBody *body = shape->body;
-	cpShapeUpdate(shape, body->p, body->rot);
+	const cpConstraintClass *klass = ((cpConstraint *)constraints->arr[i])->klass;
+	
+	int end = i + 1;
+	while(end < constraints->num && ((cpConstraint *)constraints->arr[end])->klass == klass) end++;
+	
+	return end;
+}
+
+// Find the ends of the runs of constraints of the same class, returns how many runs there are.
+static int
+cpSpaceFindConstraintRuns(cpSpace *space, cpArray *constraints)
+{
+	int count = 0;
+	
+	for(int i=0; i<constraints->num; count++){
+		if(count == space->constraintRunCapacity){
+			space->constraintRunCapacity = (space->constraintRunCapacity ? 2*space->constraintRunCapacity : 16);
+			space->constraintRunEnds = (int *)cpAllocatorRealloc(space->allocator, space->constraintRunEnds, space->constraintRunCapacity*sizeof(int));
+		}
+		
+		i = space->constraintRunEnds[count] = cpSpaceConstraintRunEnd(constraints, i);
+	}
+	
+	return count;
+}
+
+// Remove the constraints that applied at least their break impulse during the step.
+static void
+cpSpaceBreakConstraints(cpSpace *space)
+{
+	cpArray *constraints = space->constraints;
+	cpArray *broken = space->brokenConstraints;
+	
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		cpFloat breakImpulse = constraint->breakImpulse;
+		
+		if(breakImpulse != (cpFloat)INFINITY && constraint->klass->getImpulse(constraint) >= breakImpulse){
+			cpArrayPush(broken, constraint);
+		}
+	}
+	
+	for(int i=0; i<broken->num; i++){
+		cpSpaceRemoveConstraint(space, (cpConstraint *)broken->arr[i]);
+	}
 }
 
 void
@@ -343,6 +616,16 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 	
 	cpFloat prev_dt = space->curr_dt;
 	space->curr_dt = dt;
+	
+	space->brokenConstraints->num = 0;
+	
+	// Keep the separate events recorded by removing shapes or bodies since the last step.
+	int removedEvents = space->collisionEventCount - space->collisionEventStepCount;
+	if(removedEvents) memmove(space->collisionEvents, space->collisionEvents + space->collisionEventStepCount, removedEvents*sizeof(cpCollisionEvent));
+	space->collisionEventCount = removedEvents;
+	
+	// Static shapes whose group or layers changed while the space was locked.
+	if(space->staleFilters) cpBBTreeRefilter(space->staticShapes);
 		
 	// Reset and empty the arbiter list.
 	cpArray *arbiters = space->arbiters;
@@ -358,17 +641,54 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 	arbiters->num = 0;
 
 	// Integrate positions
+	// Bodies with the default function are batched, the others are called in order between the batches.
 	cpArray *bodies = space->bodies;
+	cpBody *batch[CP_BODY_BATCH_SIZE];
+	int batchCount = 0;
+	
 	for(int i=0; i<bodies->num; i++){
 		cpBody *body = (cpBody *)bodies->arr[i];
-		body->position_func(body, dt);
+		
+		if(body->position_func == cpBodyUpdatePosition && !body->enableCCD){
+			batch[batchCount++] = body;
+			if(batchCount == CP_BODY_BATCH_SIZE){
+				cpBodyUpdatePositionBatch(batch, batchCount, dt);
+				batchCount = 0;
+			}
+		} else {
+			cpBodyUpdatePositionBatch(batch, batchCount, dt);
+			batchCount = 0;
+			
+			if(body->enableCCD){
+				cpVect p = body->p;
+				cpFloat a = body->a;
+				
+				body->position_func(body, dt);
+				cpSpaceSweepBody(space, body, p, a);
+			} else {
+				body->position_func(body, dt);
+			}
+		}
 	}
 	
+	cpBodyUpdatePositionBatch(batch, batchCount, dt);
+	
 	// Find colliding pairs.
 	cpSpaceLock(space); {
 		cpSpacePushFreshContactBuffer(space);
-		cpSpatialIndexEach(space->activeShapes, (cpSpatialIndexIteratorFunc)cpShapeUpdateFunc, NULL);
-		cpSpatialIndexReindexQuery(space->activeShapes, (cpSpatialIndexQueryFunc)collideShapes, space);
+		
+		cpShapeBatches batches = {{0}};
+		cpSpatialIndexEach(space->activeShapes, (cpSpatialIndexIteratorFunc)cpShapeUpdateFunc, &batches);
+		cpShapeBatchesFlush(&batches);
+		
+		cpSpatialIndex *activeShapes = space->activeShapes;
+		cpSpatialIndexBBFunc bbfunc = activeShapes->bbfunc;
+		if(space->enableSpeculativeContacts) activeShapes->bbfunc = (cpSpatialIndexBBFunc)cpShapeSweptBB;
+		
+		// Reindexing refilters the active shapes before any pairs are reported.
+		space->staleFilters = cpFalse;
+		cpSpatialIndexReindexQuery(activeShapes, (cpSpatialIndexQueryFunc)collideShapes, space);
+		activeShapes->bbfunc = bbfunc;
 	} cpSpaceUnlock(space, cpFalse);
 	
 	// If body sleeping is enabled, do that now.
@@ -383,46 +703,124 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 	cpFloat slop = space->collisionSlop;
 	cpFloat biasCoef = 1.0f - cpfpow(space->collisionBias, dt);
 	for(int i=0; i<arbiters->num; i++){
-		cpArbiterPreStep((cpArbiter *)arbiters->arr[i], dt, slop, biasCoef);
+		cpArbiterPreStep((cpArbiter *)arbiters->arr[i], dt, slop, biasCoef, space->enableBlockSolver);
 	}
 
-	cpArray *constraints = space->constraints;
-	for(int i=0; i<constraints->num; i++){
-		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
-		constraint->klass->preStep(constraint, dt);
+	// The space keeps the constraints grouped by class, so each class is run by a single loop.
+	// Pivot joints are common enough to get loops that don't call through their class.
+	const cpConstraintClass *pivotClass = cpPivotJointGetClass();
+	cpArray *constraints = space->classConstraints;
+	for(int i=0; i<constraints->num;){
+		int end = cpSpaceConstraintRunEnd(constraints, i);
+		cpConstraint **run = (cpConstraint **)constraints->arr + i;
+		int count = end - i;
+		const cpConstraintClass *klass = run[0]->klass;
+		
+		if(klass == pivotClass){
+			cpPivotJointPreStepBatch((cpPivotJoint **)run, count, dt);
+		} else {
+			cpConstraintPreStepImpl preStep = klass->preStep;
+			for(int j=0; j<count; j++) preStep(run[j], dt);
+		}
+		
+		i = end;
 	}
 
 	// Integrate velocities.
 	cpFloat damping = cpfpow(space->damping, dt);
 	cpVect gravity = space->gravity;
+	batchCount = 0;
+	
 	for(int i=0; i<bodies->num; i++){
 		cpBody *body = (cpBody *)bodies->arr[i];
-		body->velocity_func(body, gravity, damping, dt);
+		
+		if(body->velocity_func == cpBodyUpdateVelocity){
+			batch[batchCount++] = body;
+			if(batchCount == CP_BODY_BATCH_SIZE){
+				cpBodyUpdateVelocityBatch(batch, batchCount, gravity, damping, dt);
+				batchCount = 0;
+			}
+		} else {
+			cpBodyUpdateVelocityBatch(batch, batchCount, gravity, damping, dt);
+			batchCount = 0;
+			
+			body->velocity_func(body, gravity, damping, dt);
+		}
 	}
 	
+	cpBodyUpdateVelocityBatch(batch, batchCount, gravity, damping, dt);
+	
 	// Apply cached impulses
 	cpFloat dt_coef = (space->stamp ? dt/prev_dt : 0.0f);
 	for(int i=0; i<arbiters->num; i++){
 		cpArbiterApplyCachedImpulse((cpArbiter *)arbiters->arr[i], dt_coef);
 	}
 	
-	for(int i=0; i<constraints->num; i++){
-		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
-		constraint->klass->applyCachedImpulse(constraint, dt_coef);
+	for(int i=0; i<constraints->num;){
+		int end = cpSpaceConstraintRunEnd(constraints, i);
+		cpConstraint **run = (cpConstraint **)constraints->arr + i;
+		int count = end - i;
+		const cpConstraintClass *klass = run[0]->klass;
+		
+		if(klass == pivotClass){
+			cpPivotJointApplyCachedImpulseBatch((cpPivotJoint **)run, count, dt_coef);
+		} else {
+			cpConstraintApplyCachedImpulseImpl applyCachedImpulse = klass->applyCachedImpulse;
+			for(int j=0; j<count; j++) applyCachedImpulse(run[j], dt_coef);
+		}
+		
+		i = end;
 	}
 	
+	// Joints solved directly are left out of the iterative constraints.
+	cpBool direct = space->enableDirectSolver;
+	if(direct) constraints = cpSpaceBuildJointTrees(space);
+	
 	// Run the impulse solver.
+	cpFloat tolerance = space->solverTolerance;
+	cpBool measure = (tolerance > 0.0f);
+	space->iterationsUsed = 0;
+	
+	int runCount = cpSpaceFindConstraintRuns(space, constraints);
+	int *runEnds = space->constraintRunEnds;
+	
 	for(int i=0; i<space->iterations; i++){
+		// Largest change in any accumulated impulse during this iteration.
+		cpFloat delta = 0.0f;
+		
 		for(int j=0; j<arbiters->num; j++){
-			cpArbiterApplyImpulse((cpArbiter *)arbiters->arr[j]);
+			delta = cpfmax(delta, cpArbiterApplyImpulse((cpArbiter *)arbiters->arr[j]));
 		}
 			
-		for(int j=0; j<constraints->num; j++){
-			cpConstraint *constraint = (cpConstraint *)constraints->arr[j];
-			constraint->klass->applyImpulse(constraint);
+		for(int r=0, j=0; r<runCount; j = runEnds[r++]){
+			cpConstraint **run = (cpConstraint **)constraints->arr + j;
+			int count = runEnds[r] - j;
+			const cpConstraintClass *klass = run[0]->klass;
+			cpConstraintApplyImpulseImpl applyImpulse = klass->applyImpulse;
+			
+			if(klass == pivotClass){
+				delta = cpfmax(delta, cpPivotJointApplyImpulseBatch((cpPivotJoint **)run, count, measure));
+			} else if(measure){
+				cpConstraintGetImpulseImpl getImpulse = klass->getImpulse;
+				
+				for(int k=0; k<count; k++){
+					cpFloat jOld = getImpulse(run[k]);
+					applyImpulse(run[k]);
+					delta = cpfmax(delta, cpfabs(getImpulse(run[k]) - jOld));
+				}
+			} else {
+				for(int k=0; k<count; k++) applyImpulse(run[k]);
+			}
 		}
+		
+		if(direct) delta = cpfmax(delta, cpSpaceSolveJointTrees(space));
+		
+		space->iterationsUsed = i + 1;
+		if(delta < tolerance) break;
 	}
 	
+	cpSpaceBreakConstraints(space);
+	
 	// run the post-solve callbacks
 	cpSpaceLock(space);
 	for(int i=0; i<arbiters->num; i++){
@@ -431,8 +829,19 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 		cpCollisionHandler *handler = arb->handler;
 		handler->postSolve(arb, space, handler->data);
 	}
+	
+	if(space->enableCollisionEvents){
+		for(int i=0; i<arbiters->num; i++){
+			cpArbiter *arb = (cpArbiter *) arbiters->arr[i];
+			cpVect j = cpArbiterTotalImpulseWithFriction(arb);
+			cpSpacePushCollisionEvent(space, cpCollisionEventPostSolve, arb, arb->swappedColl ? cpvneg(j) : j);
+		}
+	}
 	cpSpaceUnlock(space, cpTrue);
 	
+	// Events recorded from here until the next step are reported by that step.
+	space->collisionEventStepCount = space->collisionEventCount;
+	
 	// Increment the stamp.
 	space->stamp++;
 }
@@ -6,8 +6,9 @@ void
 cpSpatialIndexFree(cpSpatialIndex *index)
 {
 	if(index){
+		const cpAllocator *allocator = index->allocator;
 		cpSpatialIndexDestroy(index);
-		cpfree(index);
+		cpAllocatorFree(allocator, index);
 	}
 }
 
@@ -78,7 +78,7 @@ static void
 ResizeTable(cpSweep1D *sweep, int size)
 {
 	sweep->max = size;
-	sweep->table = (TableCell *)cprealloc(sweep->table, size*sizeof(TableCell));
+	sweep->table = (TableCell *)cpAllocatorRealloc(sweep->spatialIndex.allocator, sweep->table, size*sizeof(TableCell));
 }
 
 cpSpatialIndex *
@@ -98,10 +98,19 @@ cpSweep1DNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
 	return cpSweep1DInit(cpSweep1DAlloc(), bbfunc, staticIndex);
 }
 
+cpSpatialIndex *
+cpSweep1DNewWithAllocator(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex, const cpAllocator *allocator)
+{
+	cpSweep1D *sweep = (cpSweep1D *)cpAllocatorCalloc(allocator, 1, sizeof(cpSweep1D));
+	sweep->spatialIndex.allocator = allocator;
+	
+	return cpSweep1DInit(sweep, bbfunc, staticIndex);
+}
+
 static void
 cpSweep1DDestroy(cpSweep1D *sweep)
 {
-	cpfree(sweep->table);
+	cpAllocatorFree(sweep->spatialIndex.allocator, sweep->table);
 	sweep->table = NULL;
 }
 
@@ -241,6 +250,78 @@ cpSweep1DReindexQuery(cpSweep1D *sweep, cpSpatialIndexQueryFunc func, void *data
 	cpSpatialIndexCollideStatic((cpSpatialIndex *)sweep, sweep->spatialIndex.staticIndex, func, data);
 }
 
+#pragma mark Memory Trimming
+
+static size_t
+cpSweep1DTrim(cpSweep1D *sweep)
+{
+	// Shrink the table while leaving room to grow.
+	int size = 32;
+	while(size < sweep->num*2) size *= 2;
+	
+	if(size < sweep->max){
+		size_t freed = (sweep->max - size)*sizeof(TableCell);
+		ResizeTable(sweep, size);
+		return freed;
+	} else {
+		return 0;
+	}
+}
+
+static void
+cpSweep1DGetPoolStats(cpSweep1D *sweep, cpPoolStats *stats)
+{
+	stats->bytes += sweep->max*sizeof(TableCell);
+	stats->unusedBytes += (sweep->max - sweep->num)*sizeof(TableCell);
+}
+
+static void
+cpSweep1DGetMemoryStats(cpSweep1D *sweep, cpSpatialIndexMemoryStats *stats)
+{
+	stats->nodes.bytes += sweep->max*sizeof(TableCell);
+	stats->nodes.count += sweep->num;
+	stats->nodes.pooled += sweep->max - sweep->num;
+	
+	stats->bytes += sizeof(cpSweep1D) + stats->nodes.bytes;
+}
+
+#pragma mark Snapshots
+
+static void
+cpSweep1DSnapshot(cpSweep1D *sweep, cpSnapshotCursor *cursor)
+{
+	int num = sweep->num;
+	cpSnapshotTransfer(cursor, &num, sizeof(int));
+	
+	if(num > sweep->max) ResizeTable(sweep, num);
+	sweep->num = num;
+	
+	// The order of the cells is saved too since sorting them again isn't stable.
+	cpSnapshotTransfer(cursor, sweep->table, num*sizeof(TableCell));
+}
+
+#pragma mark Cloning
+
+static cpSpatialIndex *
+cpSweep1DClone(cpSweep1D *sweep, cpSpatialIndex *staticIndex, cpRelocation *objects)
+{
+	const cpAllocator *allocator = sweep->spatialIndex.allocator;
+	cpSweep1D *copy = (cpSweep1D *)cpAllocatorCalloc(allocator, 1, sizeof(cpSweep1D));
+	copy->spatialIndex.allocator = allocator;
+	cpSpatialIndexInit((cpSpatialIndex *)copy, Klass(), sweep->spatialIndex.bbfunc, staticIndex);
+	
+	ResizeTable(copy, sweep->max);
+	copy->num = sweep->num;
+	
+	// The order of the cells is kept since sorting them again isn't stable.
+	for(int i=0; i<sweep->num; i++){
+		copy->table[i] = sweep->table[i];
+		copy->table[i].obj = cpRelocate(objects, sweep->table[i].obj);
+	}
+	
+	return (cpSpatialIndex *)copy;
+}
+
 static cpSpatialIndexClass klass = {
 	(cpSpatialIndexDestroyImpl)cpSweep1DDestroy,
 	
@@ -258,6 +339,12 @@ static cpSpatialIndexClass klass = {
 	(cpSpatialIndexPointQueryImpl)cpSweep1DPointQuery,
 	(cpSpatialIndexSegmentQueryImpl)cpSweep1DSegmentQuery,
 	(cpSpatialIndexQueryImpl)cpSweep1DQuery,
+	
+	(cpSpatialIndexTrimImpl)cpSweep1DTrim,
+	(cpSpatialIndexPoolStatsImpl)cpSweep1DGetPoolStats,
+	(cpSpatialIndexMemoryStatsImpl)cpSweep1DGetMemoryStats,
+	(cpSpatialIndexSnapshotImpl)cpSweep1DSnapshot,
+	(cpSpatialIndexCloneImpl)cpSweep1DClone,
 };
 
 static inline cpSpatialIndexClass *Klass(){return &klass;}
@@ -0,0 +1,273 @@
+/* Copyright (c) 2007 Scott Lembcke
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "chipmunk_private.h"
+
+static inline int
+floor_int(cpFloat f)
+{
+	int i = (int)f;
+	return (f < 0.0f && f != i ? i - 1 : i);
+}
+
+cpTileMapShape *
+cpTileMapShapeAlloc(void)
+{
+	return (cpTileMapShape *)cpcalloc(1, sizeof(cpTileMapShape));
+}
+
+static cpBB
+cpTileMapShapeCacheData(cpTileMapShape *tilemap, cpVect p, cpVect rot)
+{
+	cpVect size = cpv(tilemap->width*tilemap->tileSize, tilemap->height*tilemap->tileSize);
+	cpVect v0 = tilemap->offset;
+	cpVect v1 = cpvadd(v0, size);
+	
+	cpVect a = cpvadd(p, cpvrotate(v0, rot));
+	cpVect b = cpvadd(p, cpvrotate(cpv(v1.x, v0.y), rot));
+	cpVect c = cpvadd(p, cpvrotate(v1, rot));
+	cpVect d = cpvadd(p, cpvrotate(cpv(v0.x, v1.y), rot));
+	
+	return cpBBNew(
+		cpfmin(cpfmin(a.x, b.x), cpfmin(c.x, d.x)),
+		cpfmin(cpfmin(a.y, b.y), cpfmin(c.y, d.y)),
+		cpfmax(cpfmax(a.x, b.x), cpfmax(c.x, d.x)),
+		cpfmax(cpfmax(a.y, b.y), cpfmax(c.y, d.y))
+	);
+}
+
+static void
+cpTileMapShapeDestroy(cpTileMapShape *tilemap)
+{
+	cpShapeFree(tilemap->tile);
+	cpfree(tilemap->tiles);
+}
+
+// Convert a world point into tile coordinates.
+static inline cpVect
+WorldToTile(const cpTileMapShape *tilemap, cpVect p)
+{
+	cpBody *body = tilemap->shape.body;
+	cpVect local = cpvunrotate(cpvsub(p, body->p), body->rot);
+	return cpvmult(cpvsub(local, tilemap->offset), 1.0f/tilemap->tileSize);
+}
+
+static cpBool
+cpTileMapShapePointQuery(cpTileMapShape *tilemap, cpVect p){
+	if(!cpBBContainsVect(tilemap->shape.bb, p)) return cpFalse;
+	
+	cpVect v = WorldToTile(tilemap, p);
+	return cpTileMapShapeTileIsSolid(tilemap, floor_int(v.x), floor_int(v.y));
+}
+
+// Walks the tiles under the segment in order using the same grid stepping as cpSpaceHashSegmentQuery().
+// The first solid tile entered is the closest hit.
+static void
+cpTileMapShapeSegmentQuery(cpTileMapShape *tilemap, cpVect a, cpVect b, cpSegmentQueryInfo *info)
+{
+	cpVect ta = WorldToTile(tilemap, a);
+	cpVect tb = WorldToTile(tilemap, b);
+	cpVect delta = cpvsub(tb, ta);
+	
+	// Clip the segment to the grid, remembering which axis it entered the grid along.
+	cpFloat t_enter = 0.0f, t_exit = 1.0f;
+	int axis = -1;
+	
+	cpFloat lo[] = {ta.x, ta.y}, d[] = {delta.x, delta.y}, hi[] = {tilemap->width, tilemap->height};
+	for(int i=0; i<2; i++){
+		if(d[i] == 0.0f){
+			if(lo[i] < 0.0f || hi[i] < lo[i]) return;
+		} else {
+			cpFloat t0 = (0.0f - lo[i])/d[i];
+			cpFloat t1 = (hi[i] - lo[i])/d[i];
+			if(t0 > t1){cpFloat temp = t0; t0 = t1; t1 = temp;}
+			
+			if(t0 > t_enter){t_enter = t0; axis = i;}
+			t_exit = cpfmin(t_exit, t1);
+		}
+	}
+	
+	if(t_enter > t_exit) return;
+	
+	cpVect start = cpvadd(ta, cpvmult(delta, t_enter));
+	int cell_x = floor_int(start.x), cell_y = floor_int(start.y);
+	int x_inc = (delta.x > 0.0f ? 1 : -1);
+	int y_inc = (delta.y > 0.0f ? 1 : -1);
+	
+	// Snap the starting tile into the grid when the segment starts on it's edge.
+	if(axis == 0) cell_x = (x_inc > 0 ? 0 : tilemap->width - 1);
+	if(axis == 1) cell_y = (y_inc > 0 ? 0 : tilemap->height - 1);
+	
+	// Division by zero is *very* slow on ARM
+	cpFloat dx = cpfabs(delta.x), dy = cpfabs(delta.y);
+	cpFloat dt_dx = (dx ? 1.0f/dx : INFINITY), dt_dy = (dy ? 1.0f/dy : INFINITY);
+	
+	cpFloat next_h = (dx ? cpfabs((cell_x + (x_inc > 0) - ta.x)/delta.x) : INFINITY);
+	cpFloat next_v = (dy ? cpfabs((cell_y + (y_inc > 0) - ta.y)/delta.y) : INFINITY);
+	
+	// Only tiles entered from an empty tile count as hits.
+	// Segments that start inside of solid tiles ignore them until they leave.
+	cpBool wasSolid = (axis < 0);
+	
+	cpFloat t = t_enter;
+	while(t <= t_exit){
+		cpBool solid = cpTileMapShapeTileIsSolid(tilemap, cell_x, cell_y);
+		if(solid && !wasSolid){
+			cpVect n = (axis == 0 ? cpv(-x_inc, 0.0f) : cpv(0.0f, -y_inc));
+			
+			info->shape = (cpShape *)tilemap;
+			info->t = t;
+			info->n = cpvrotate(n, tilemap->shape.body->rot);
+			return;
+		}
+		
+		wasSolid = solid;
+		
+		if(next_v < next_h){
+			cell_y += y_inc;
+			t = next_v;
+			next_v += dt_dy;
+			axis = 1;
+		} else {
+			cell_x += x_inc;
+			t = next_h;
+			next_h += dt_dx;
+			axis = 0;
+		}
+	}
+}
+
+// The tile shape is set up again for every tile it collides, so only the tile values are saved with the struct.
+static void
+cpTileMapShapeSnapshot(cpTileMapShape *tilemap, cpSnapshotCursor *cursor)
+{
+	cpSnapshotTransfer(cursor, tilemap, sizeof(cpTileMapShape));
+	cpSnapshotTransfer(cursor, tilemap->tiles, tilemap->width*tilemap->height*sizeof(unsigned char));
+}
+
+static cpTileMapShape *
+cpTileMapShapeClone(cpTileMapShape *tilemap, cpBody *body, cpSpace *space)
+{
+	cpTileMapShape *copy = cpTileMapShapeAlloc();
+	(*copy) = (*tilemap);
+	copy->shape.body = body;
+	copy->shape.pool = NULL;
+	
+	int count = tilemap->width*tilemap->height;
+	copy->tiles = (unsigned char *)cpcalloc(count, sizeof(unsigned char));
+	memcpy(copy->tiles, tilemap->tiles, count*sizeof(unsigned char));
+	
+	copy->tile = cpShapeClone(tilemap->tile, body, space);
+	
+	return copy;
+}
+
+static const cpShapeClass tileMapClass = {
+	CP_TILEMAP_SHAPE,
+	(cpShapeCacheDataImpl)cpTileMapShapeCacheData,
+	(cpShapeDestroyImpl)cpTileMapShapeDestroy,
+	(cpShapePointQueryImpl)cpTileMapShapePointQuery,
+	(cpShapeSegmentQueryImpl)cpTileMapShapeSegmentQuery,
+	(cpShapeSnapshotImpl)cpTileMapShapeSnapshot,
+	(cpShapeCloneImpl)cpTileMapShapeClone,
+};
+
+cpTileMapShape *
+cpTileMapShapeInit(cpTileMapShape *tilemap, cpBody *body, int width, int height, cpFloat tileSize, cpVect offset, const unsigned char *tiles)
+{
+	cpAssertHard(width > 0 && height > 0, "A tile map must have at least one tile.");
+	cpAssertHard(tileSize > 0.0f, "Tile size must be positive.");
+	
+	tilemap->width = width;
+	tilemap->height = height;
+	tilemap->tileSize = tileSize;
+	tilemap->offset = offset;
+	
+	tilemap->tiles = (unsigned char *)cpcalloc(width*height, sizeof(unsigned char));
+	if(tiles) memcpy(tilemap->tiles, tiles, width*height*sizeof(unsigned char));
+	
+	tilemap->tile = cpBoxShapeNew(body, tileSize, tileSize);
+	
+	cpShapeInit((cpShape *)tilemap, &tileMapClass, body);
+	
+	return tilemap;
+}
+
+cpShape *
+cpTileMapShapeNew(cpBody *body, int width, int height, cpFloat tileSize, cpVect offset, const unsigned char *tiles)
+{
+	return (cpShape *)cpTileMapShapeInit(cpTileMapShapeAlloc(), body, width, height, tileSize, offset, tiles);
+}
+
+static inline cpTileMapShape *
+GetTileMap(cpShape *shape)
+{
+	cpAssertHard(shape->klass == &tileMapClass, "Shape is not a tile map shape.");
+	return (cpTileMapShape *)shape;
+}
+
+int cpTileMapShapeGetWidth(cpShape *shape){return GetTileMap(shape)->width;}
+int cpTileMapShapeGetHeight(cpShape *shape){return GetTileMap(shape)->height;}
+cpFloat cpTileMapShapeGetTileSize(cpShape *shape){return GetTileMap(shape)->tileSize;}
+cpVect cpTileMapShapeGetOffset(cpShape *shape){return GetTileMap(shape)->offset;}
+
+unsigned char
+cpTileMapShapeGetTile(cpShape *shape, int x, int y)
+{
+	cpTileMapShape *tilemap = GetTileMap(shape);
+	if(x < 0 || tilemap->width <= x || y < 0 || tilemap->height <= y) return 0;
+	
+	return tilemap->tiles[x + y*tilemap->width];
+}
+
+void
+cpTileMapShapeSetTile(cpShape *shape, int x, int y, unsigned char value)
+{
+	cpTileMapShape *tilemap = GetTileMap(shape);
+	cpAssertHard(0 <= x && x < tilemap->width && 0 <= y && y < tilemap->height, "Tile index out of range.");
+	
+	tilemap->tiles[x + y*tilemap->width] = value;
+	cpShapeMarkModified(shape);
+	
+	// Wake up anything touching the tile map like cpSpaceRemoveShape() does.
+	if(shape->space){
+		cpBody *body = shape->body;
+		if(cpBodyIsStatic(body)){
+			cpBodyActivateStatic(body, shape);
+		} else {
+			cpBodyActivate(body);
+		}
+	}
+}
+
+cpBB
+cpTileMapShapeGetTileBB(cpShape *shape, int x, int y)
+{
+	cpTileMapShape *tilemap = GetTileMap(shape);
+	cpFloat size = tilemap->tileSize;
+	cpVect v = cpvadd(tilemap->offset, cpv(x*size, y*size));
+	
+	return cpBBNew(v.x, v.y, v.x + size, v.y + size);
+}